@@ -0,0 +1,36 @@
+/*
+** Copyright 2014 Guillaume Filion, Eduard Valera Zorita and Pol Cusco.
+**
+** File authors:
+**  Guillaume Filion     (guillaume.filion@gmail.com)
+**  Eduard Valera Zorita (eduardvalera@gmail.com)
+**
+** License: 
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU General Public License as published by
+**  the Free Software Foundation, either version 3 of the License, or
+**  (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU General Public License for more details.
+**
+**  You should have received a copy of the GNU General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+#ifndef _STARCODE_KERNEL_HEADER
+#define _STARCODE_KERNEL_HEADER
+
+// Kernels of the dynamic programming of the trie search (see
+// 'search()' in 'trie.c'). The type is shared by 'starcode.h'
+// and 'trie.h'.
+typedef enum {
+   BYTEWISE_KERNEL,
+   BITPARALLEL_KERNEL,
+   SIMD_KERNEL
+} kernel_t;
+
+#endif
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <unistd.h>
 #include "starcode.h"
+#include "trie.h"
 
 #define ERRM "starcode error:"
 
@@ -44,9 +45,16 @@ char *USAGE =
 "\n"
 "  general options:\n"
 "    -d --dist: maximum Levenshtein distance (default auto)\n"
+"       --hamming: substitutions only, between sequences of\n"
+"               the same length (Hamming distance)\n"
 "    -t --threads: number of concurrent threads (default 1)\n"
 "    -q --quiet: quiet output (default verbose)\n"
 "    -v --version: display version and exit\n"
+"       --bit-parallel: use the bit-parallel search kernel\n"
+"       --simd: use the SIMD search kernel\n"
+"       --seed-verify: use seed-and-verify search instead of the\n"
+"               trie (default auto)\n"
+"       --trie-search: always use the trie search\n"
 "\n"
 "  cluster options: (default algorithm: message passing)\n"
 "    -r --cluster-ratio: min size ratio for merging clusters in\n"
@@ -66,6 +74,18 @@ char *USAGE =
 "       --output1: output file1 (default input1-starcode.fastq)\n"
 "       --output2: output file2 (default input2-starcode.fastq)\n"
 "\n"
+"  index options\n"
+"       --build-index: write the index of the input to a file\n"
+"               and exit (no clustering)\n"
+"       --reference: print the nearest sequences of this file\n"
+"               or index for every input sequence (no clustering)\n"
+"\n"
+"  checkpoint options\n"
+"       --checkpoint: add the input to the sequences of this\n"
+"               checkpoint and cluster them all\n"
+"       --save-checkpoint: write the sequences and their matches\n"
+"               to this checkpoint before clustering\n"
+"\n"
 "  output format options\n"
 "       --non-redundant: remove redundant sequences from input file(s)\n"
 "       --print-clusters: outputs cluster compositions\n"
@@ -137,6 +157,10 @@ main(
    static int cl_flag = 0;
    static int id_flag = 0;
    static int cp_flag = 0;
+   static int bp_flag = 0;
+   static int sd_flag = 0;
+   static int hm_flag = 0;
+   static int en_flag = AUTO_ENGINE;
 
    // Unset flags (value -1).
    int dist = -1;
@@ -151,6 +175,10 @@ main(
    char * output  = UNSET;
    char * output1 = UNSET;
    char * output2 = UNSET;
+   char * indexpath = UNSET;
+   char * reference = UNSET;
+   char * ckptin    = UNSET;
+   char * ckptout   = UNSET;
 
 
    if (argc == 1 && isatty(0)) {
@@ -169,6 +197,11 @@ main(
          {"quiet",             no_argument,       &vb_flag,  0 },
          {"sphere",            no_argument,       &sp_flag, 's'},
          {"connected-comp",    no_argument,       &cp_flag, 'c'},
+         {"bit-parallel",      no_argument,       &bp_flag,  1 },
+         {"simd",              no_argument,       &sd_flag,  1 },
+         {"hamming",           no_argument,       &hm_flag,  1 },
+         {"seed-verify",       no_argument,       &en_flag, SEED_ENGINE},
+         {"trie-search",       no_argument,       &en_flag, TRIE_ENGINE},
          {"version",           no_argument,              0, 'v'},
          {"dist",              required_argument,        0, 'd'},
          {"cluster-ratio",     required_argument,        0, 'r'},
@@ -180,6 +213,10 @@ main(
          {"threads",           required_argument,        0, 't'},
          {"output1",           required_argument,        0, '3'},
          {"output2",           required_argument,        0, '4'},
+         {"build-index",       required_argument,        0, '5'},
+         {"reference",         required_argument,        0, '6'},
+         {"checkpoint",        required_argument,        0, '7'},
+         {"save-checkpoint",   required_argument,        0, '8'},
 
          {0, 0, 0, 0}
       };
@@ -239,6 +276,54 @@ main(
          }
          break;
 
+      case '5':
+         if (indexpath == UNSET) {
+            indexpath = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --build-index set more than once\n",
+                  ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '6':
+         if (reference == UNSET) {
+            reference = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --reference set more than once\n",
+                  ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '7':
+         if (ckptin == UNSET) {
+            ckptin = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --checkpoint set more than once\n",
+                  ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
+      case '8':
+         if (ckptout == UNSET) {
+            ckptout = optarg;
+         }
+         else {
+            fprintf(stderr, "%s --save-checkpoint set more than once\n",
+                  ERRM);
+            say_usage();
+            return EXIT_FAILURE;
+         }
+         break;
+
 
       case 'd':
          if (dist < 0) {
@@ -388,12 +473,42 @@ main(
       say_usage();
       return EXIT_FAILURE;
    }
+   if (indexpath != UNSET && (output != UNSET || output1 != UNSET ||
+            output2 != UNSET || nr_flag || td_flag || cl_flag || id_flag)) {
+      fprintf(stderr, "%s --build-index is incompatible with "
+            "output options\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if (reference != UNSET && (indexpath != UNSET || input1 != UNSET ||
+            nr_flag || td_flag || cl_flag || sp_flag || cp_flag ||
+            cluster_ratio >= 0 || en_flag != AUTO_ENGINE)) {
+      fprintf(stderr, "%s --reference is incompatible with paired-end "
+            "input, clustering, output format and engine options "
+            "(--seed-verify/--trie-search)\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   if ((ckptin != UNSET || ckptout != UNSET) && (indexpath != UNSET ||
+            reference != UNSET || input1 != UNSET || nr_flag || td_flag)) {
+      fprintf(stderr, "%s checkpoints are incompatible with paired-end "
+            "input, --build-index, --reference, --non-redundant and "
+            "--tidy\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
    if (sp_flag && cp_flag) {
       fprintf(stderr, "%s --sphere and --connected-comp are "
               "incompatible\n", ERRM);
       say_usage();
       return EXIT_FAILURE;
    }
+   if (bp_flag && sd_flag) {
+      fprintf(stderr, "%s --bit-parallel and --simd are "
+              "incompatible\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
    if (td_flag && (nr_flag || cl_flag || id_flag)) {
       fprintf(stderr,
             "%s --tidy flag is not compatible with options "
@@ -449,6 +564,15 @@ main(
       inputf1 = stdin;
    }
 
+   // Only write the index if requested. //
+   if (indexpath != UNSET) {
+      int exitcode = starcode_index(inputf1, inputf2, indexpath, dist,
+            vb_flag, threads < 0 ? 1 : threads);
+      if (inputf1 != stdin)   fclose(inputf1);
+      if (inputf2 != NULL)    fclose(inputf2);
+      return exitcode;
+   }
+
    if (output != UNSET) {
       outputf1 = fopen(output, "w");
       if (outputf1 == NULL) {
@@ -502,21 +626,45 @@ main(
 	    " may result in arbitrary cluster breaks.\n");
    }
 
+   kernel_t kernel = BYTEWISE_KERNEL;
+   if (bp_flag) kernel = BITPARALLEL_KERNEL;
+   else if (sd_flag) kernel = SIMD_KERNEL;
+
+   // Search the reference instead of clustering if requested. //
+   if (reference != UNSET) {
+      int exitcode = starcode_reference(inputf1, reference, outputf1,
+            dist, hm_flag, kernel, vb_flag, threads, id_flag);
+      if (inputf1 != stdin)   fclose(inputf1);
+      if (outputf1 != stdout) fclose(outputf1);
+      return exitcode;
+   }
+
+   starcode_t *sc = new_starcode(dist, hm_flag, threads, cluster_alg,
+         cluster_ratio);
+   if (sc == NULL) {
+      fprintf(stderr, "%s invalid clustering options\n", ERRM);
+      say_usage();
+      return EXIT_FAILURE;
+   }
+   starcode_set_engine(sc, en_flag);
+   starcode_set_kernel(sc, kernel);
+   starcode_set_checkpoints(sc,
+         ckptin == UNSET ? NULL : ckptin,
+         ckptout == UNSET ? NULL : ckptout);
+
    int exitcode =
-   starcode(
+   starcode_run_files(
+       sc,
        inputf1,
        inputf2,
        outputf1,
        outputf2,
-       dist,
        vb_flag,
-       threads,
-       cluster_alg,
-       cluster_ratio,
        cl_flag,
        id_flag,
        output_type
    );
+   destroy_starcode(sc);
 
    if (inputf1 != stdin)   fclose(inputf1);
    if (inputf2 != NULL)    fclose(inputf2);
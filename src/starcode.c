@@ -21,14 +21,22 @@
 **
 */
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #include "starcode.h"
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
 #include "trie.h"
 
 #define alert()                                                    \
@@ -37,6 +45,22 @@
 
 #define MAX_K_FOR_LOOKUP 14
 
+// Format of the index files (see 'write_index()').
+#define INDEX_MAGIC "STRCINDX"
+#define INDEX_VERSION 1
+#define INDEX_ENDIAN 0x01020304u
+#define INDEX_ALIGN(x) (((x) + 63) & ~(uint64_t)63)
+
+// Format of the checkpoint files (see 'write_checkpoint()').
+#define CKPT_MAGIC "STRCCKPT"
+#define CKPT_VERSION 1
+
+// Node of the new sequences of a batch (see 'add_batch()').
+#define NEW_NODE UINT32_MAX
+
+// Bytes of the bitmap of a lookup table of k-mers of length 'k'.
+#define LUT_BYTES(k) ((size_t)1 << max(0, (2 * (k) - 3)))
+
 #define BISECTION_START 1
 #define BISECTION_END -1
 
@@ -47,6 +71,18 @@
 #define STRATEGY_EQUAL 1
 #define STRATEGY_PREFIX 99
 
+#define STEAL_NCHUNKS 16
+#define MP_PARALLEL_WAVE 4096  // Min sequences per wave for threads.
+#define SPHERE_BATCH 16384     // Centroids claimed in parallel.
+#define PARSE_CHUNK (1 << 22)  // Min bytes of input per parsing thread.
+#define GZIP_READ (1 << 22)    // Read-ahead of compressed input.
+
+// Paired-end reads, with the separator.
+#define MAXSEQLEN (2 * M + 8)
+
+#define ARENA_BLOCK (1 << 20)
+#define ARENA_ALIGN 8
+
 #define str(a) (char*)(a)
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #define max(a, b) (((a) > (b)) ? (a) : (b))
@@ -89,28 +125,60 @@ typedef struct match_t match_t;
 typedef struct mtplan_t mtplan_t;
 typedef struct mttrie_t mttrie_t;
 typedef struct mtjob_t mtjob_t;
+typedef struct refjob_t refjob_t;
 typedef struct lookup_t lookup_t;
+typedef struct seeds_t seeds_t;
+typedef struct index_t index_t;
+typedef struct indexhdr_t indexhdr_t;
+typedef struct ckpt_t ckpt_t;
+typedef struct ckpthdr_t ckpthdr_t;
 typedef struct propt_t propt_t;
 typedef struct idstack_t idstack_t;
+typedef struct edge_t edge_t;
+typedef struct edgebuf_t edgebuf_t;
+typedef struct graph_t graph_t;
+typedef struct arena_t arena_t;
 
 typedef struct sortargs_t sortargs_t;
-
-// The field 'seqid' is either an id number for
-// the unique sequence or a pointer to a struct
-// containing information about the matches. This
-// creates some confusion in the code at times.
-// See function 'transfer_useq_ids()'.
+typedef struct spherekey_t spherekey_t;
+typedef struct mergeargs_t mergeargs_t;
+typedef struct clusterargs_t clusterargs_t;
+typedef struct mpargs_t mpargs_t;
+typedef struct sphereargs_t sphereargs_t;
+typedef struct dedupargs_t dedupargs_t;
+typedef struct radixargs_t radixargs_t;
+typedef struct scanargs_t scanargs_t;
+typedef struct gunzipargs_t gunzipargs_t;
+typedef struct gzin_t gzin_t;
+typedef struct batchargs_t batchargs_t;
+
+// The field 'seqid' points to the ids of the reads
+// of the unique sequence. When there is only one, it
+// points to the field 'id', otherwise the list is on
+// the heap. See function 'transfer_useq_ids()'.
 struct useq_t {
   ssize_t count;       // Number of sequences
   unsigned int nids;   // Number of associated sequence IDs
   ssize_t sphere_c;    // Centroid: size of the sphere.
   ssize_t sphere_d;    // Distance to current sphere centroid. / MP:
                        // Ambiguous flag.
-  char* seq;           // Sequence
+  uint8_t* pack;       // Packed sequence (see 'pack_seq()')
+  uint16_t len;        // Length of the sequence
+  uint8_t special;     // Contains 'N' or '-'
   char* info;          // Multi-function text field
-  gstack_t** matches;  // Matches stratified by distance
+  uint32_t node;       // Index in the match graph
   useq_t* canonical;   // Pointer to canonical sequence
   int* seqid;          // Unique ID / pointer (see above).
+  int id;              // First unique ID.
+};
+
+// Bump allocator for the data of the reads, which is
+// released in bulk. The blocks are chained by their
+// first word.
+struct arena_t {
+  char* block;         // Current block
+  size_t used;         // Bytes used in the current block
+  size_t size;         // Size of the current block
 };
 
 struct lookup_t {
@@ -120,6 +188,88 @@ struct lookup_t {
   unsigned char* lut[];
 };
 
+// Inverted index of the seed-and-verify engine. The sequences
+// are cut in the segments of the lookup table and each segment
+// has a hash table from the id of its k-mer to the last posting
+// of the k-mer. The postings of a k-mer are chained by 'next'
+// and the indices of the postings are 1-based (0 is the end).
+struct seeds_t {
+  int slen;            // Padded length of the sequences.
+  int kmers;           // Number of segments.
+  int* klen;           // Lengths of the segments.
+  size_t nslots;       // Slots of a hash table (power of 2).
+  int32_t* keys;       // K-mer ids of the slots (-1 if empty).
+  uint32_t* heads;     // Last posting of the k-mers.
+  size_t npost;        // Number of postings.
+  size_t postslots;    // Allocated postings.
+  useq_t** useqs;      // Sequences of the postings.
+  uint32_t* next;      // Previous posting of the same k-mer.
+};
+
+// Header of the index files. The offsets of the sequences, of
+// the lookup tables and of the image of the trie are aligned on
+// 64 bytes. The sequences are the 'nseq + 1' offsets of their
+// text, followed by the text, where they end with '\0'.
+struct indexhdr_t {
+  char magic[8];       // 'INDEX_MAGIC'.
+  uint32_t version;    // 'INDEX_VERSION'.
+  uint32_t endian;     // 'INDEX_ENDIAN' in native order.
+  int32_t tau;         // Max distance of the lookup tables.
+  int32_t height;      // Padded length of the sequences.
+  int32_t medianlen;   // Median length of the sequences.
+  int32_t kmers;       // Number of lookup tables.
+  uint64_t nseq;       // Number of sequences.
+  uint64_t seqs;       // Offset of the sequences.
+  uint64_t lut;        // Offset of the lookup tables.
+  uint64_t trie;       // Offset of the image of the trie.
+  uint64_t size;       // Size of the file.
+};
+
+// Index of a set of sequences, built by 'new_index()' or loaded
+// from a file by 'load_index()'. The data of the leaves of the
+// trie are the sequence numbers plus 1.
+struct index_t {
+  int tau;
+  int height;
+  int medianlen;
+  size_t nseq;
+  const uint64_t* offsets;   // Offsets of the sequences in 'text'.
+  const char* text;          // Text of the sequences.
+  lookup_t* lut;             // Lookup tables (in the mapping).
+  trie_t* trie;              // Trie (in the mapping).
+  void* mapping;             // Private mapping (or NULL if built).
+  size_t size;               // Size of the mapping.
+};
+
+// Clustering state saved in a checkpoint file (see
+// 'write_checkpoint()'). The matches of the graph are in both
+// directions, so they do not depend on the counts.
+struct ckpt_t {
+  int tau;
+  int hamming;
+  size_t nreads;             // Number of reads (the largest id).
+  gstack_t* useqS;           // Unique sequences in sort order.
+  graph_t* graph;            // Match graph of 'useqS'.
+};
+
+// Header of the checkpoint files. It is followed by the counts
+// (int64), the numbers of ids (uint32), the ids (int) and the
+// text of the sequences, where they end with '\0', and by the
+// offsets (size_t), the matches (uint32) and the distances
+// (uint8) of the match graph.
+struct ckpthdr_t {
+  char magic[8];       // 'CKPT_MAGIC'.
+  uint32_t version;    // 'CKPT_VERSION'.
+  uint32_t endian;     // 'INDEX_ENDIAN' in native order.
+  int32_t tau;         // Max distance of the matches.
+  int32_t hamming;     // Substitutions only.
+  uint64_t nseq;       // Number of unique sequences.
+  uint64_t nreads;     // Number of reads.
+  uint64_t nids;       // Number of ids of the sequences.
+  uint64_t textsize;   // Size of the text of the sequences.
+  uint64_t nmatches;   // Number of matches of the graph.
+};
+
 struct sortargs_t {
   useq_t** buf0;
   useq_t** buf1;
@@ -129,10 +279,167 @@ struct sortargs_t {
   ssize_t repeats;
 };
 
+// Sort key of sphere clustering. The weight is the total
+// count of the matches, or -1 if the sequence has no match.
+struct spherekey_t {
+  useq_t* useq;
+  long weight;
+};
+
+struct mergeargs_t {
+  mtplan_t* mtplan;
+  graph_t* graph;
+  int part;
+  int phase;
+};
+
+struct clusterargs_t {
+  gstack_t* clusters;
+  graph_t* graph;
+  int part;
+  int nparts;
+};
+
+// Wave of message passing clustering (see 'mp_part()').
+struct mpargs_t {
+  graph_t* graph;
+  const uint32_t* order;     // Nodes by decreasing count.
+  const uint32_t* rank;      // Position of the nodes in 'order'.
+  size_t lo;                 // First position of the wave.
+  size_t hi;                 // End of the wave (excluded).
+  int part;
+  int nparts;
+};
+
+// Batch of sphere clustering (see 'sphere_part()'). The owner
+// of a node is the key of the first centroid of the batch whose
+// sphere contains the node. The key of the centroid at position
+// 'k' of the batch is 'tag | k', the tag of a batch is lower
+// than those of the previous batches.
+struct sphereargs_t {
+  gstack_t* useqS;           // Sequences in count order.
+  graph_t* graph;
+  uint64_t* owner;           // Owners of the nodes.
+  uint64_t tag;
+  size_t lo;                 // First position of the batch.
+  size_t hi;                 // End of the batch (excluded).
+  int phase;
+  int part;
+  int nparts;
+};
+
+struct dedupargs_t {
+  useq_t** data;
+  size_t numels;
+  uint64_t* hash;
+  int part;
+  int nparts;
+  int phase;
+};
+
+struct radixargs_t {
+  useq_t** data;
+  useq_t** buf;
+  size_t* bounds;
+  size_t nbuckets;
+  int part;
+  int nparts;
+};
+
+struct scanargs_t {
+  const char* data;
+  size_t start;
+  size_t end;
+  size_t nlines;
+  gstack_t* useqS;
+  arena_t* arena;
+  format_t format;
+  int readh;                 // Keep the headers.
+  int phase;
+};
+
+// Reader of compressed input (see 'new_gzin()'). The compressed
+// bytes that are read but not consumed are 'data[start..end)'.
+struct gzin_t {
+  FILE* inputf;
+  unsigned char* data;       // Read-ahead of 'GZIP_READ' bytes.
+  size_t start;
+  size_t end;
+  int eof;                   // The input is entirely read.
+  int bgzf;                  // Inflate by BGZF blocks in parallel.
+  int member;                // Inside a gzip member (stream).
+  z_stream strm;             // State of the stream inflation.
+  size_t* blocks;            // Offsets of the BGZF blocks in 'data'.
+  size_t* offsets;           // Offsets of the BGZF blocks in the text.
+  size_t maxblocks;
+};
+
+struct gunzipargs_t {
+  const unsigned char* data;
+  const size_t* blocks;      // Offsets of the blocks in 'data'.
+  const size_t* offsets;     // Offsets of the blocks in 'text'.
+  char* text;
+  size_t start;              // First block.
+  size_t end;                // Last block (excluded).
+};
+
+// Context of a clustering (see 'new_starcode()'). It holds the
+// options of the search and of the clustering, so that several
+// clusterings can run at the same time. The sequences are added
+// with 'starcode_add()' or 'starcode_add_seqs()', and after
+// 'starcode_run()' the clusters are in 'members', where cluster
+// 'i' is between 'bounds[i]' and 'bounds[i+1]', with the centroid
+// first.
+struct starcode_t {
+  int tau;                   // Max distance (-1 for auto).
+  int hamming;               // Substitutions only.
+  int engine;                // Search engine.
+  kernel_t kernel;           // Kernel of the trie search.
+  int verbose;               // Verbose output (to stderr).
+  int thrmax;                // Max number of threads.
+  cluster_t clusteralg;      // Clustering algorithm.
+  double ratio;              // Min parent/child count ratio.
+  const char* ckptin;        // Checkpoint to add the input to.
+  const char* ckptout;       // Checkpoint to write.
+  int allpairs;              // Matches in both directions.
+  arena_t* arena;            // Memory of the sequences.
+  gstack_t* useqS;           // Unique sequences.
+  int done;                  // The clustering has run.
+  size_t nclusters;
+  useq_t** members;          // Sequences of the clusters.
+  size_t* bounds;            // Bounds of the clusters in 'members'.
+  long int* counts;          // Counts of the clusters.
+  size_t next;               // Next cluster (see 'starcode_next_cluster()').
+  char* text;                // Unpacked sequences of the cluster.
+  const char** seqs;         // Sequences of the cluster in 'text'.
+  int* ids;                  // Ids of the reads of the cluster.
+  int userids;               // Ids given (1) or automatic (-1).
+  int* idset;                // Hash set of the given ids (0 if empty).
+  size_t idslots;            // Slots of 'idset' (power of 2).
+  size_t nidset;             // Ids in 'idset'.
+};
+
 struct mtplan_t {
-  char active;
   int ntries;
+  int njobs;
   int jobsdone;
+  int qhead;                 // First trie of the ready queue.
+  int qsize;                 // Number of tries in the ready queue.
+  int* queue;                // Ring buffer of tries with a pending job.
+  int steal;                 // Work-stealing mode (see 'steal_job()').
+  int nchunks;               // Query chunks per block (work-stealing).
+  int* bounds;               // Boundaries of the query blocks.
+  int* unclaimed;            // Unclaimed pairs of blocks per trie.
+  char* claimed;             // Claimed pairs of blocks ('ntries^2').
+  int engine;                // Search engine of the jobs.
+  int nworkers;              // Number of workers started.
+  int nparts;                // Partitions of the edge buffers.
+  edgebuf_t* edges;          // Edge buffers ('nworkers x nparts').
+  uint32_t* forest;          // Connected components (or NULL).
+  int hamming;               // Substitutions only.
+  kernel_t kernel;           // Kernel of the trie search.
+  int bidir;                 // Matches in both directions.
+  double ratio;              // Min parent/child count ratio.
   struct mttrie_t* tries;
   pthread_mutex_t* mutex;
   pthread_cond_t* monitor;
@@ -142,6 +449,8 @@ struct mttrie_t {
   char flag;
   int currentjob;
   int njobs;
+  int partner;               // Block queried in this trie (or -1).
+  int nextchunk;             // Next chunk of the partner block.
   struct mtjob_t* jobs;
 };
 
@@ -149,21 +458,50 @@ struct mtjob_t {
   int start;
   int end;
   int tau;
+  int height;
   int build;
   int queryid;
   int trieid;
   gstack_t* useqS;
   trie_t* trie;
-  node_t* node_pos;
   lookup_t* lut;
-  pthread_mutex_t* mutex;
-  pthread_cond_t* monitor;
-  int* jobsdone;
-  char* trieflag;
-  char* active;
+  seeds_t* seeds;            // Index instead of the trie (or NULL).
+  int nparts;
+  edgebuf_t* edges;
+  uint32_t* forest;          // Connected components (or NULL).
+  int hamming;               // Substitutions only.
+  kernel_t kernel;           // Kernel of the trie search.
+  int bidir;                 // Matches in both directions.
+  double ratio;              // Min parent/child count ratio.
+};
+
+struct batchargs_t {
+  mtjob_t job;
+  gstack_t* useqS;           // All the sequences.
+  int* block;                // Block of the sequences (see 'add_batch()').
+  int medianlen;
+};
+
+// Job of the search of the reads against the references (see
+// 'do_reference()'). The distance to the nearest references of
+// read 'i' is 'dist[i]', or -1 if there is none, and they start
+// at 'first[i]' in 'nearest'.
+struct refjob_t {
+  const index_t* index;      // Index of the references (shared).
+  gstack_t* useqS;           // Reads.
+  size_t start;              // First read of the job.
+  size_t end;                // Last read of the job (excluded).
+  int tau;
+  int height;
+  int hamming;
+  kernel_t kernel;
+  int* dist;
+  size_t* first;
+  gstack_t* nearest;         // Nearest references of the reads.
 };
 
 struct propt_t {
+  FILE* outputf;
   char first[5];
   int pe_fastq;
   int showclusters;
@@ -176,70 +514,175 @@ struct idstack_t {
   int* elm;
 };
 
-int addmatch(useq_t*, useq_t*, int, int);
+// Matches found by the search are recorded as edges in
+// thread-local buffers, and merged in the match graph of
+// the sequences after the search (see 'merge_edges()').
+struct edge_t {
+  uint32_t to;         // Node to add the match to.
+  uint32_t from;       // Node to add as a match.
+  int dist;            // Distance between the sequences.
+};
+
+struct edgebuf_t {
+  size_t nslots;
+  size_t nitems;
+  edge_t* items;
+};
+
+// The match graph is stored in compressed sparse row format.
+// The matches of node 'i' are 'nbr[k]' at distance 'dist[k]'
+// for 'k' from 'offsets[i]' to 'offsets[i+1]' (excluded),
+// ordered by increasing distance. The nodes are indexed by
+// the 'node' member of the sequences.
+struct graph_t {
+  size_t nnodes;             // Number of nodes.
+  size_t* offsets;           // Start of the matches of each node.
+  uint32_t* nbr;             // Packed matches.
+  unsigned char* dist;       // Distance to the matches.
+  useq_t** nodes;            // Sequences by node index.
+};
+
+#define first_match(g, u) ((g)->offsets[(u)->node])
+#define end_match(g, u) ((g)->offsets[(u)->node + 1])
+#define nmatches(g, u) (end_match(g, u) - first_match(g, u))
+
+graph_t* add_batch(gstack_t*, ckpt_t*, int, int, int, int, kernel_t,
+    uint32_t*);
+void* arena_alloc(arena_t*, size_t);
+void arena_merge(arena_t*, arena_t*);
+useq_t* arena_useq(arena_t*, int, char*, char*);
 int bisection(int, int, char*, useq_t**, int, int);
+int addr_order(const void*, const void*);
 int canonical_order(const void*, const void*);
 int cluster_count(const void*, const void*);
-gstack_t* compute_clusters(gstack_t*);
-void connected_components(useq_t*, gstack_t**);
-long int count_trie_nodes(useq_t**, int, int);
+void* cluster_part(void*);
+gstack_t* compute_clusters(gstack_t*, graph_t*, uint32_t*, int);
+long int count_trie_nodes(useq_t**, int, int, int);
 int sphere_size_order(const void*, const void*);
 int count_order(const void*, const void*);
 int count_order_spheres(const void*, const void*);
+int close_gzin(void*);
+void destroy_arena(arena_t*);
+void destroy_ckpt(ckpt_t*);
+void destroy_graph(graph_t*);
+void destroy_gzin(gzin_t*);
+void destroy_index(index_t*);
 void destroy_useq(useq_t*);
 void destroy_lookup(lookup_t*);
+void destroy_seeds(seeds_t*);
+void* do_batch(void*);
 void* do_query(void*);
+void* do_reference(void*);
+size_t bgzf_block_size(const unsigned char*, size_t);
+size_t dedup_useq(useq_t**, size_t, int);
+void* dedup_part(void*);
+void* mt_worker(void*);
+void fill_gzin(gzin_t*);
+uint32_t find_root(uint32_t*, uint32_t);
+format_t guess_format(int, int);
+void* gunzip_part(void*);
+int has_id(const starcode_t*, int);
+int next_job(mtplan_t*, mtjob_t*);
+unsigned int id_capacity(unsigned int);
 void idstack_free(idstack_t*);
 idstack_t* idstack_new(size_t);
 void idstack_push(int*, size_t, idstack_t*);
+size_t inflate_bgzf(gzin_t*, char*, size_t, int);
+size_t inflate_gzin(gzin_t*, char*, size_t);
+void insert_id(starcode_t*, int);
 int int_ascending(const void*, const void*);
 void krash(void) __attribute__((__noreturn__));
-int lut_insert(lookup_t*, useq_t*);
-int lut_search(lookup_t*, useq_t*);
-void message_passing_clustering(gstack_t*);
-void mp_resolve_ambiguous(useq_t*);
+int* kmer_lengths(int, int);
+ckpt_t* load_checkpoint(const char*, arena_t*);
+index_t* load_index(const char*);
+int lut_insert(lookup_t*, const char*);
+graph_t* merge_edges(mtplan_t*, gstack_t*);
+void* merge_edges_part(void*);
+int lut_search(lookup_t*, const char*);
+void message_passing_clustering(gstack_t*, graph_t*, int);
+void* mp_part(void*);
+void mp_resolve_ambiguous(useq_t*, graph_t*);
+arena_t* new_arena(void);
+uint32_t* new_forest(size_t);
+index_t* new_index(gstack_t*, int, int, int);
 lookup_t* new_lookup(int, int, int);
+seeds_t* new_seeds(int, int, int, size_t);
 useq_t* new_useq(int, char*, char*);
+int pack_seq(useq_t*, const char*, size_t, arena_t*);
+useq_t* pack_useq(arena_t*, int, const char*, size_t, char*);
 int pad_useq(gstack_t*, int*);
-mtplan_t* plan_mt(int, int, int, int, gstack_t*);
+mtplan_t* plan_mt(int, int, int, int, int, int, gstack_t*);
 void print_tidy(long int, const gstack_t*, int);
-void sort_and_print_ids(idstack_t*);
+void orient_graph(graph_t*, double);
+void parents(graph_t*, useq_t*, size_t*, size_t*);
+void push_edge(uint32_t, uint32_t, int, int, edgebuf_t*);
+void radix_bytes(useq_t**, useq_t**, size_t, int);
+void* radix_part(void*);
+void union_nodes(uint32_t*, uint32_t, uint32_t);
+void radix_sort(useq_t**, size_t, int);
+void release_reads(gstack_t*, arena_t*);
+void release_trie(mtplan_t*, int);
+void sort_and_print_ids(idstack_t*, FILE*);
 void run_plan(mtplan_t*, int, int);
-gstack_t* read_rawseq(FILE*, gstack_t*);
-gstack_t* read_fasta(FILE*, gstack_t*);
-gstack_t* read_fastq(FILE*, gstack_t*);
-gstack_t* read_file(FILE*, FILE*, int);
-gstack_t* read_PE_fastq(FILE*, FILE*, gstack_t*);
-int seq2id(char*, int);
+graph_t* search_graph(const starcode_t*, gstack_t*, int, int, int, int,
+    int, uint32_t*);
+gstack_t* read_rawseq(FILE*, gstack_t*, arena_t*);
+gstack_t* read_fasta(FILE*, gstack_t*, arena_t*, int);
+gstack_t* read_fastq(FILE*, gstack_t*, arena_t*, int);
+gstack_t* read_file(FILE*, FILE*, int, int, arena_t*, int, format_t*);
+ssize_t read_gzin(void*, char*, size_t);
+gstack_t* read_gzip(gzin_t*, int, arena_t*, size_t, int, int, format_t*);
+gstack_t* read_mapped(FILE*, gstack_t*, int, arena_t*, format_t, int);
+gstack_t* read_PE_fastq(FILE*, FILE*, gstack_t*, arena_t*, int);
+const char* next_line(const char**, const char*, size_t*);
+gzin_t* new_gzin(FILE*);
+FILE* open_gzin(gzin_t*);
+size_t record_end(const char*, size_t, int);
+gstack_t* scan_chunks(const char*, size_t, gstack_t*, arena_t*, int,
+    format_t, int);
+gstack_t* scan_fasta(const char*, size_t, gstack_t*, arena_t*, int);
+gstack_t* scan_fastq(const char*, size_t, gstack_t*, arena_t*, int);
+void* scan_part(void*);
+gstack_t* scan_rawseq(const char*, size_t, gstack_t*, arena_t*);
+int seeds_insert(seeds_t*, const char*, useq_t*);
+int seeds_search(seeds_t*, const char*, const useq_t*, int, int,
+    gstack_t**, gstack_t**, char*);
+size_t seeds_slot(const seeds_t*, int, int32_t);
+int seq2id(const char*, int);
+char seq_at(const useq_t*, int);
+uint64_t seq_hash(const useq_t*);
+int seq_order(const void*, const void*);
+int seq_prefix(const useq_t*, const useq_t*);
+int seqcmp(const useq_t*, const useq_t*);
 gstack_t* seq2useq(gstack_t*, int);
 size_t seqsort(useq_t**, size_t, int);
+int steal_job(mtplan_t*, mtjob_t*);
 int size_order(const void* a, const void* b);
-void sphere_clustering(gstack_t*);
-void transfer_counts_and_update_canonicals(useq_t*);
+void claim_sphere(useq_t*, graph_t*);
+void sphere_clustering(gstack_t*, graph_t*, int);
+void* sphere_part(void*);
+void transfer_counts_and_update_canonicals(useq_t*, graph_t*);
+int wave_parent(graph_t*, useq_t*, const uint32_t*, size_t);
 void transfer_sorted_useq_ids(useq_t*, useq_t*);
 void transfer_useq_ids(useq_t*, useq_t*);
-void unpad_useq(gstack_t*);
+int write_checkpoint(const char*, const ckpt_t*);
+int write_index(const char*, const index_t*);
+int trie_seq_order(const void*, const void*);
+char* unpack_seq(const useq_t*, char*, int);
+int valid_seq(const char*, size_t);
 void* nukesort(void*);
 
-//    Global variables    //
-static FILE* OUTPUTF1 = NULL;              // output file 1
-static FILE* OUTPUTF2 = NULL;              // output file 2
-static format_t FORMAT = UNSET;            // input format
-static output_t OUTPUTT = DEFAULT_OUTPUT;  // output type
-static cluster_t CLUSTERALG = MP_CLUSTER;  // cluster algorithm
-static double CLUSTER_RATIO = 5.0;         // min parent/child ratio
-                                           // to link clusters
-
 void
 head_default(useq_t* u, propt_t propt) {
+  char buf[MAXSEQLEN];
   useq_t* cncal = u->canonical;
-  char* seq = propt.pe_fastq ? cncal->info : cncal->seq;
+  char* seq = propt.pe_fastq ? cncal->info : unpack_seq(cncal, buf, 0);
 
-  fprintf(OUTPUTF1, "%s%s\t%ld", propt.first, seq, cncal->count);
+  fprintf(propt.outputf, "%s%s\t%ld", propt.first, seq, cncal->count);
 
   if (propt.showclusters) {
-    char* seq = propt.pe_fastq ? u->info : u->seq;
-    fprintf(OUTPUTF1, "\t%s", seq);
+    char* seq = propt.pe_fastq ? u->info : unpack_seq(u, buf, 0);
+    fprintf(propt.outputf, "\t%s", seq);
   }
 }
 
@@ -247,86 +690,80 @@ void
 members_mp_default(useq_t* u, propt_t propt) {
   if (!propt.showclusters)
     return;
-  char* seq = propt.pe_fastq ? u->info : u->seq;
-  fprintf(OUTPUTF1, ",%s", seq);
-}
-
-void
-members_sc_default(useq_t* u, propt_t propt) {
-  // Nothing to print if clusters are not shown, or
-  // if this sequence has no match.
-  if (!propt.showclusters || u->matches == NULL)
-    return;
-
-  gstack_t* hits;
-  for (int j = 0; (hits = u->matches[j]) != TOWER_TOP; j++) {
-    for (size_t k = 0; k < hits->nitems; k++) {
-      useq_t* match = (useq_t*)hits->items[k];
-      if (match->canonical != u)
-        continue;
-      char* seq = propt.pe_fastq ? match->seq : u->seq;
-      fprintf(OUTPUTF1, ",%s", seq);
-    }
-  }
+  char buf[MAXSEQLEN];
+  char* seq = propt.pe_fastq ? u->info : unpack_seq(u, buf, 0);
+  fprintf(propt.outputf, ",%s", seq);
 }
 
 void
-sort_and_print_ids(idstack_t* stack) {
+sort_and_print_ids(idstack_t* stack, FILE* outputf) {
   // Sort sequence of integers.
   qsort(stack->elm, stack->pos, sizeof(int), int_ascending);
   // Print ids.
-  fprintf(OUTPUTF1, "\t%u", stack->elm[0]);
+  fprintf(outputf, "\t%u", stack->elm[0]);
   for (unsigned int k = 1; k < stack->pos; k++) {
-    fprintf(OUTPUTF1, ",%u", stack->elm[k]);
+    fprintf(outputf, ",%u", stack->elm[k]);
   }
 }
 
 void
 sort_and_print_ids_perread(idstack_t* stack,
     useq_t* canonical,
-    int showids) {
+    int showids,
+    FILE* outputf) {
+  char seq[MAXSEQLEN];
+  unpack_seq(canonical, seq, 0);
   // Sort sequence of integers.
   qsort(stack->elm, stack->pos, sizeof(int), int_ascending);
   for (unsigned int k = 0; k < stack->pos; k++) {
-    fprintf(OUTPUTF1, "%s", canonical->seq);
+    fprintf(outputf, "%s", seq);
     if (showids)
-      fprintf(OUTPUTF1, "\t%u", stack->elm[k]);
-    fprintf(OUTPUTF1, "\n");
+      fprintf(outputf, "\t%u", stack->elm[k]);
+    fprintf(outputf, "\n");
   }
 }
 
 void
-print_nr_raw(useq_t* u) {
-  fprintf(OUTPUTF1, "%s\n", u->seq);
+print_nr_raw(useq_t* u, FILE* outputf1, FILE* outputf2) {
+  (void)outputf2;
+  char seq[MAXSEQLEN];
+  fprintf(outputf1, "%s\n", unpack_seq(u, seq, 0));
 }
 
 void
-print_nr_fasta(useq_t* u) {
-  fprintf(OUTPUTF1, "%s\n%s\n", u->info, u->seq);
+print_nr_fasta(useq_t* u, FILE* outputf1, FILE* outputf2) {
+  (void)outputf2;
+  char seq[MAXSEQLEN];
+  fprintf(outputf1, "%s\n%s\n", u->info, unpack_seq(u, seq, 0));
 }
 
 void
-print_nr_fastq(useq_t* u) {
+print_nr_fastq(useq_t* u, FILE* outputf1, FILE* outputf2) {
+  (void)outputf2;
   char header[M] = {0};
   char quality[M] = {0};
+  char seq[MAXSEQLEN];
   sscanf(u->info, "%s\n%s", header, quality);
-  fprintf(OUTPUTF1, "%s\n%s\n+\n%s\n", header, u->seq, quality);
+  fprintf(outputf1, "%s\n%s\n+\n%s\n", header, unpack_seq(u, seq, 0),
+      quality);
 }
 
 void
-print_nr_pe_fastq(useq_t* u) {
+print_nr_pe_fastq(useq_t* u, FILE* outputf1, FILE* outputf2) {
   char head1[M] = {0};
   char head2[M] = {0};
   char qual1[M] = {0};
   char qual2[M] = {0};
   char seq1[M] = {0};
   char seq2[M] = {0};
+  char seq[MAXSEQLEN];
+  unpack_seq(u, seq, 0);
 
   // Split the sequences.
-  char* c = strrchr(u->seq, '-');
-  if (c == NULL || c - u->seq > MAXBRCDLEN)
+  char* c = strrchr(seq, '-');
+  if (c == NULL || c - seq > MAXBRCDLEN)
     return;
-  strncpy(seq1, u->seq, c - u->seq - STARCODE_MAX_TAU);
+  memcpy(seq1, seq, c - seq - STARCODE_MAX_TAU);
   strncpy(seq2, c + 1, MAXBRCDLEN);
 
   // Split the info field.
@@ -339,8 +776,8 @@ print_nr_pe_fastq(useq_t* u) {
   }
 
   // Print to separate files.
-  fprintf(OUTPUTF1, "%s\n%s\n+\n%s\n", head1, seq1, qual1);
-  fprintf(OUTPUTF2, "%s\n%s\n+\n%s\n", head2, seq2, qual2);
+  fprintf(outputf1, "%s\n%s\n+\n%s\n", head1, seq1, qual1);
+  fprintf(outputf2, "%s\n%s\n+\n%s\n", head2, seq2, qual2);
 }
 
 void
@@ -373,31 +810,32 @@ print_tidy( // Private
   char sep[STARCODE_MAX_TAU + 2] = {0};
   memset(sep, '-', STARCODE_MAX_TAU + 1);
 
+  char seq[MAXSEQLEN];
+  char can[MAXSEQLEN];
   for (long int i = 0; i < nseq; i++) {
     useq_t* u = outputseq[i];
     if (u == NULL) {
       alert();
       krash();
     }
+    unpack_seq(u, seq, 0);
+    unpack_seq(u->canonical, can, 0);
     if (is_pe_fastq) {
-      char * seq2 = strstr(u->seq, sep);
-      char * can2 = strstr(u->canonical->seq, sep);
+      char * seq2 = strstr(seq, sep);
+      char * can2 = strstr(can, sep);
       if (seq2 == NULL || can2 == NULL) {
-        fprintf(stderr, "%s\n", u->seq);
-        fprintf(stderr, "%s\n", u->canonical->seq);
+        fprintf(stderr, "%s\n", seq);
+        fprintf(stderr, "%s\n", can);
         alert();
         krash();
       }
       // Insert null byte to terminate first read.
       seq2[0] = can2[0] = '\0';
-      fprintf(stdout, "%s/%s\t%s/%s\n", u->seq, seq2 + STARCODE_MAX_TAU + 1,
-          u->canonical->seq, can2 + STARCODE_MAX_TAU + 1);
-      // Put it back as it was because the sequence may
-      // be present multiple times.
-      seq2[0] = can2[0] = '-';
+      fprintf(stdout, "%s/%s\t%s/%s\n", seq, seq2 + STARCODE_MAX_TAU + 1,
+          can, can2 + STARCODE_MAX_TAU + 1);
     }
     else {
-      fprintf(stdout, "%s\t%s\n", u->seq, u->canonical->seq);
+      fprintf(stdout, "%s\t%s\n", seq, can);
     }
   }
   free(outputseq);
@@ -419,27 +857,123 @@ starcode(                    // Public
     const int outputt        // Output type (format)
 )
 // SYNOPSIS:
-//   Performs all-pairs sequence clustering.
+//   Performs all-pairs sequence clustering with the default
+//   search (see 'starcode_run_files()'). The other options are
+//   set on a context (see 'new_starcode()').
+{
+  starcode_t sc = {
+      .tau = tau,
+      .engine = AUTO_ENGINE,
+      .kernel = BYTEWISE_KERNEL,
+      .thrmax = thrmax,
+      .clusteralg = clusteralg,
+      .ratio = parent_to_child,
+  };
+  return starcode_run_files(&sc, inputf1, inputf2, outputf1, outputf2,
+      verbose, showclusters, showids, outputt);
+}
+
+int
+starcode_run_files(          // Public
+    starcode_t* sc,          // Context of the clustering
+    FILE* inputf1,           // First input file
+    FILE* inputf2,           // Second input file (fastq)
+    FILE* outputf1,          // First output file
+    FILE* outputf2,          // Second output file (fastq)
+    const int verbose,       // Verbose output (to stderr)
+    const int showclusters,  // Print cluster members
+    const int showids,       // Print sequence ID numbers
+    const int outputt        // Output type (format)
+)
+// SYNOPSIS:
+//   Performs all-pairs sequence clustering of the input files with
+//   the options of the context and writes the clusters to the
+//   output files. The sequences are read from the input files, so
+//   none can be added to the context. If the context has an input
+//   checkpoint, the input is a new batch of reads added to the
+//   sequences of the checkpoint, and only the new sequences are
+//   searched (see 'add_batch()'). If it has an output checkpoint,
+//   the sequences and their matches are written to it before
+//   clustering (see 'starcode_set_checkpoints()').
+//
+// RETURN:
+//   0 upon success, 1 upon failure or if the context has already
+//   run or has sequences.
 {
-  OUTPUTF1 = outputf1;
-  OUTPUTF2 = outputf2;
-  OUTPUTT = outputt;
-  CLUSTERALG = clusteralg;
-  CLUSTER_RATIO = parent_to_child;
+  if (sc->done || (sc->useqS != NULL && sc->useqS->nitems > 0))
+    return 1;
+  sc->done = 1;
+  sc->verbose = verbose;
+  // The matches of the checkpoints do not depend on the counts.
+  sc->allpairs = sc->ckptin != NULL || sc->ckptout != NULL;
+
+  int tau = sc->tau;
+  int thrmax = sc->thrmax;
+  const int hamming = sc->hamming;
+  const int clusteralg = sc->clusteralg;
+  const double parent_to_child = sc->ratio;
+  const char* ckptin = sc->ckptin;
+  const char* ckptout = sc->ckptout;
+  format_t format = UNSET;
 
   if (verbose) {
     fprintf(stderr, "running %s (last revised %s) with %d thread%s\n",
         VERSION, DATE, thrmax, thrmax > 1 ? "s" : "");
     fprintf(stderr, "reading input files\n");
   }
-  gstack_t* uSQ = read_file(inputf1, inputf2, verbose);
+  // All the reads are allocated in the arena.
+  arena_t* arena = new_arena();
+  // The headers are only needed for the non-redundant output.
+  gstack_t* uSQ = read_file(inputf1, inputf2, verbose, thrmax, arena,
+      outputt == NRED_OUTPUT, &format);
   if (uSQ == NULL || uSQ->nitems < 1) {
     fprintf(stderr, "input file empty\n");
+    free(uSQ);
+    destroy_arena(arena);
     return 1;
   }
 
   const long int nseq = uSQ->nitems;
 
+  // The sequences of the checkpoint come first, so that the
+  // new reads are merged into them by 'seqsort()'. The ids of
+  // the new reads follow those of the checkpoint.
+  ckpt_t* ckpt = NULL;
+  size_t nreads = nseq;
+  if (ckptin != NULL) {
+    if (verbose)
+      fprintf(stderr, "loading checkpoint\n");
+    ckpt = load_checkpoint(ckptin, arena);
+    if (ckpt != NULL && (ckpt->hamming != hamming ||
+        (tau >= 0 && tau != ckpt->tau))) {
+      fprintf(stderr, "the distance must be that of the checkpoint "
+          "(%d%s)\n", ckpt->tau, ckpt->hamming ? ", Hamming" : "");
+      destroy_ckpt(ckpt);
+      ckpt = NULL;
+    }
+    if (ckpt == NULL) {
+      release_reads(uSQ, arena);
+      return 1;
+    }
+    tau = ckpt->tau;
+    nreads += ckpt->nreads;
+    for (size_t i = 0; i < uSQ->nitems; i++) {
+      useq_t* u = (useq_t*)uSQ->items[i];
+      u->id += ckpt->nreads;
+      u->node = NEW_NODE;
+    }
+    gstack_t* allS = ckpt->useqS;
+    for (size_t i = 0; i < uSQ->nitems; i++) {
+      if (push(uSQ->items[i], &allS)) {
+        alert();
+        krash();
+      }
+    }
+    free(uSQ);
+    uSQ = allS;
+    ckpt->useqS = NULL;
+  }
+
   // Sort/reduce.
   if (verbose)
     fprintf(stderr, "sorting\n");
@@ -452,8 +986,8 @@ starcode(                    // Public
     thrmax = 1;
   }
 
-  // Pad sequences (and return the median size).
-  // Compute 'tau' from it in "auto" mode.
+  // Get the padded length of the sequences (and the median
+  // size). Compute 'tau' from it in "auto" mode.
   int med = -1;
   int height = pad_useq(uSQ, &med);
   if (tau < 0) {
@@ -463,56 +997,79 @@ starcode(                    // Public
     }
   }
 
-  // Make multithreading plan.
-  mtplan_t* mtplan = plan_mt(tau, height, med, ntries, uSQ);
+  // The connected components are joined during the search
+  // (see 'union_nodes()').
+  uint32_t* forest = NULL;
+  if (clusteralg == COMPONENTS_CLUSTER)
+    forest = new_forest(uSQ->nitems);
 
-  // Run the query.
-  run_plan(mtplan, verbose, thrmax);
-  if (verbose)
-    fprintf(stderr, "progress: 100.00%%\n");
+  graph_t* graph = NULL;
+  if (ckpt != NULL) {
+    if (verbose)
+      fprintf(stderr, "searching the new sequences\n");
+    graph =
+        add_batch(uSQ, ckpt, tau, height, med, thrmax, sc->kernel, forest);
+    destroy_ckpt(ckpt);
+  } else {
+    graph = search_graph(sc, uSQ, tau, height, med, ntries, thrmax, forest);
+  }
 
-  // Free mtplan.
-  free(mtplan->mutex);
-  free(mtplan->monitor);
-  for (int i = 0 ; i < mtplan->ntries ; i++) {
-    free(mtplan->tries[i].jobs->node_pos);
-    free(mtplan->tries[i].jobs->lut);
-    free(mtplan->tries[i].jobs->trie);
-    free(mtplan->tries[i].jobs);
+  if (ckptout != NULL) {
+    if (verbose)
+      fprintf(stderr, "writing checkpoint\n");
+    ckpt_t state = {
+        .tau = tau,
+        .hamming = hamming,
+        .nreads = nreads,
+        .useqS = uSQ,
+        .graph = graph,
+    };
+    if (write_checkpoint(ckptout, &state)) {
+      free(forest);
+      destroy_graph(graph);
+      release_reads(uSQ, arena);
+      return 1;
+    }
   }
-  free(mtplan->tries);
-  free(mtplan);
 
-  // Remove padding characters.
-  unpad_useq(uSQ);
+  // Message passing only uses the matches of the children.
+  if (sc->allpairs && clusteralg == MP_CLUSTER)
+    orient_graph(graph, parent_to_child);
 
   //
   //  MESSAGE PASSING ALGORITHM
   //
 
   propt_t propt = {
+      .outputf = outputf1,
       .first = {0},
       .showclusters = showclusters,
       .showids = showids,
-      .pe_fastq = PE_FASTQ == FORMAT,
+      .pe_fastq = PE_FASTQ == format,
   };
 
-  if (CLUSTERALG == MP_CLUSTER) {
+  // Sequences of the non-redundant output.
+  gstack_t* nredS = uSQ;
+
+  if (clusteralg == MP_CLUSTER) {
     if (verbose)
       fprintf(stderr, "message passing clustering\n");
 
     // Cluster the pairs.
-    message_passing_clustering(uSQ);
+    message_passing_clustering(uSQ, graph, thrmax);
     // Sort in canonical order.
     qsort(uSQ->items, uSQ->nitems, sizeof(useq_t*), canonical_order);
 
-    if (OUTPUTT == DEFAULT_OUTPUT) {
+    if (outputt == DEFAULT_OUTPUT) {
       useq_t* first = (useq_t*)uSQ->items[0];
       useq_t* canonical = first->canonical;
 
       // If the first canonical is NULL, then they all are.
-      if (first->canonical == NULL)
+      if (first->canonical == NULL) {
+        destroy_graph(graph);
+        release_reads(uSQ, arena);
         return 0;
+      }
       head_default(first, propt);
 
       // Use newline separator.
@@ -534,7 +1091,7 @@ starcode(                    // Public
         if (u->canonical != canonical) {
           // Print cluster seqIDs of previous canonical.
           if (showids)
-            sort_and_print_ids(idstack);
+            sort_and_print_ids(idstack, outputf1);
           // Update canonical and print.
           canonical = u->canonical;
           head_default(u, propt);
@@ -552,44 +1109,46 @@ starcode(                    // Public
 
       // Print last cluster seqIDs.
       if (showids) {
-        sort_and_print_ids(idstack);
+        sort_and_print_ids(idstack, outputf1);
         idstack_free(idstack);
       }
-      fprintf(OUTPUTF1, "\n");
+      fprintf(outputf1, "\n");
     }
 
-    if (OUTPUTT == TIDY_OUTPUT) {
-      print_tidy(nseq, uSQ, FORMAT == PE_FASTQ);
+    if (outputt == TIDY_OUTPUT) {
+      print_tidy(nseq, uSQ, format == PE_FASTQ);
     }
 
     //
     //  SPHERES ALGORITHM
     //
 
-  } else if (CLUSTERALG == SPHERES_CLUSTER) {
+  } else if (clusteralg == SPHERES_CLUSTER) {
     if (verbose)
       fprintf(stderr, "spheres clustering\n");
     // Cluster the pairs.
-    sphere_clustering(uSQ);
+    sphere_clustering(uSQ, graph, thrmax);
     // Sort in count order.
     qsort(uSQ->items, uSQ->nitems, sizeof(useq_t*), sphere_size_order);
 
     // Default output.
-    if (OUTPUTT == DEFAULT_OUTPUT) {
+    if (outputt == DEFAULT_OUTPUT) {
       // Sequence id stack.
       idstack_t* idstack = NULL;
       if (showids)
         idstack = idstack_new(64);
+      char seq[MAXSEQLEN];
       for (size_t i = 0; i < uSQ->nitems; i++) {
         useq_t* u = (useq_t*)uSQ->items[i];
         if (u->canonical != u)
           break;
 
-        fprintf(OUTPUTF1, "%s\t", u->seq);
+        unpack_seq(u, seq, 0);
+        fprintf(outputf1, "%s\t", seq);
         if (showclusters) {
-          fprintf(OUTPUTF1, "%ld\t%s", u->sphere_c, u->seq);
+          fprintf(outputf1, "%ld\t%s", u->sphere_c, seq);
         } else {
-          fprintf(OUTPUTF1, "%ld", u->sphere_c);
+          fprintf(outputf1, "%ld", u->sphere_c);
         }
         // Reset stack and add canonical ids.
         if (showids) {
@@ -598,38 +1157,36 @@ starcode(                    // Public
         }
 
         // Get sequences and ids from matches.
-        if ((showclusters || showids) && u->matches != NULL) {
-          gstack_t* hits;
-          for (int j = 0; (hits = u->matches[j]) != TOWER_TOP; j++) {
-            for (size_t k = 0; k < hits->nitems; k++) {
-              useq_t* match = (useq_t*)hits->items[k];
-              if (match->canonical != u)
-                continue;
-              if (showclusters)
-                fprintf(OUTPUTF1, ",%s", match->seq);
-              if (showids)
-                idstack_push(match->seqid, match->nids, idstack);
-            }
+        if (showclusters || showids) {
+          for (size_t k = first_match(graph, u); k < end_match(graph, u);
+               k++) {
+            useq_t* match = graph->nodes[graph->nbr[k]];
+            if (match->canonical != u)
+              continue;
+            if (showclusters)
+              fprintf(outputf1, ",%s", unpack_seq(match, seq, 0));
+            if (showids)
+              idstack_push(match->seqid, match->nids, idstack);
           }
         }
         // Print cluster seqIDs.
         if (showids)
-          sort_and_print_ids(idstack);
-        fprintf(OUTPUTF1, "\n");
+          sort_and_print_ids(idstack, outputf1);
+        fprintf(outputf1, "\n");
       }
       if (showids)
         idstack_free(idstack);
     }
 
-    if (OUTPUTT == TIDY_OUTPUT) {
-      print_tidy(nseq, uSQ, FORMAT == PE_FASTQ);
+    if (outputt == TIDY_OUTPUT) {
+      print_tidy(nseq, uSQ, format == PE_FASTQ);
     }
 
     //
     //  CONNECTED COMPONENTS ALGORITHM
     //
 
-  } else if (CLUSTERALG == COMPONENTS_CLUSTER) {
+  } else if (clusteralg == COMPONENTS_CLUSTER) {
     if (verbose)
       fprintf(stderr, "connected components clustering\n");
     // Cluster connected components.
@@ -637,21 +1194,24 @@ starcode(                    // Public
     // clusters->item[i]->item[0] is the centroid of the i-th cluster. The
     // output is sorted by cluster count, which is stored in
     // centroid->count.
-    gstack_t* clusters = compute_clusters(uSQ);
+    gstack_t* clusters = compute_clusters(uSQ, graph, forest, thrmax);
+    free(forest);
 
     // Default output.
-    if (OUTPUTT == DEFAULT_OUTPUT) {
+    if (outputt == DEFAULT_OUTPUT) {
       idstack_t* idstack = NULL;
       if (showids)
         idstack = idstack_new(64);
+      char seq[MAXSEQLEN];
       for (size_t i = 0; i < clusters->nitems; i++) {
         gstack_t* cluster = (gstack_t*)clusters->items[i];
         // Get canonical.
         useq_t* canonical = (useq_t*)cluster->items[0];
         // Print canonical and cluster count.
-        fprintf(OUTPUTF1, "%s\t%ld", canonical->seq, canonical->count);
+        unpack_seq(canonical, seq, 0);
+        fprintf(outputf1, "%s\t%ld", seq, canonical->count);
         if (showclusters || showids) {
-          fprintf(OUTPUTF1, "\t%s", canonical->seq);
+          fprintf(outputf1, "\t%s", seq);
           if (showids) {
             idstack->pos = 0;
             idstack_push(canonical->seqid, canonical->nids, idstack);
@@ -659,1615 +1219,5749 @@ starcode(                    // Public
           for (size_t k = 1; k < cluster->nitems; k++) {
             useq_t* u = (useq_t*)cluster->items[k];
             if (showclusters)
-              fprintf(OUTPUTF1, ",%s", u->seq);
+              fprintf(outputf1, ",%s", unpack_seq(u, seq, 0));
             if (showids)
               idstack_push(u->seqid, u->nids, idstack);
           }
           if (showids)
-            sort_and_print_ids(idstack);
+            sort_and_print_ids(idstack, outputf1);
         }
-        fprintf(OUTPUTF1, "\n");
+        fprintf(outputf1, "\n");
       }
       if (showids)
         idstack_free(idstack);
-    } else if (OUTPUTT == NRED_OUTPUT) {
-      uSQ->nitems = 0;
-      // Fill uSQ with cluster centroids.
+    } else if (outputt == NRED_OUTPUT) {
+      // Fill the non-redundant output with cluster centroids.
+      nredS = new_gstack();
       for (size_t i = 0; i < clusters->nitems; i++)
-        push(((gstack_t*)clusters->items[i])->items[0], &uSQ);
+        push(((gstack_t*)clusters->items[i])->items[0], &nredS);
     }
+    free(clusters);
   }
 
   //
-  //  ALTERNATIVE OUTPUT FORMAT: NON-REDUNDANT
+  //  ALTERNATIVE OUTPUT format: NON-REDUNDANT
   //
 
-  if (OUTPUTT == NRED_OUTPUT) {
+  if (outputt == NRED_OUTPUT) {
     if (verbose)
       fprintf(stderr, "non-redundant output\n");
     // If print non redundant sequences, just print the
     // canonicals with their info.
 
-    void (*print_nr)(useq_t*) = {0};
-    if (FORMAT == FASTA)
+    void (*print_nr)(useq_t*, FILE*, FILE*) = {0};
+    if (format == FASTA)
       print_nr = print_nr_fasta;
-    else if (FORMAT == FASTQ)
+    else if (format == FASTQ)
       print_nr = print_nr_fastq;
-    else if (FORMAT == PE_FASTQ)
+    else if (format == PE_FASTQ)
       print_nr = print_nr_pe_fastq;
     else
       print_nr = print_nr_raw;
 
-    for (size_t i = 0; i < uSQ->nitems; i++) {
-      useq_t* u = (useq_t*)uSQ->items[i];
+    for (size_t i = 0; i < nredS->nitems; i++) {
+      useq_t* u = (useq_t*)nredS->items[i];
       if (u->canonical == NULL)
         break;
       if (u->canonical != u)
         continue;
-      print_nr(u);
+      print_nr(u, outputf1, outputf2);
     }
   }
 
-  free(uSQ);
-
-  OUTPUTF1 = NULL;
-  OUTPUTF2 = NULL;
+  if (nredS != uSQ)
+    free(nredS);
+  destroy_graph(graph);
+  release_reads(uSQ, arena);
 
   return 0;
 
 }
 
-void
-run_plan(mtplan_t* mtplan, const int verbose, const int thrmax) {
-  // Count total number of jobs.
-  int njobs = mtplan->ntries * (mtplan->ntries + 1) / 2;
-
-  // Thread Scheduler
-  int triedone = 0;
-  int idx = -1;
+int
+starcode_index(              // Public
+    FILE* inputf1,           // First input file
+    FILE* inputf2,           // Second input file (fastq)
+    const char* indexf,      // Index file
+    int tau,                 // Max Levenshtein distance
+    const int verbose,       // Verbose output (to stderr)
+    const int thrmax         // Max number of threads
+)
+// SYNOPSIS:
+//   Writes the index of the unique sequences of the input to a
+//   file (see 'write_index()').
+{
+  if (verbose) {
+    fprintf(stderr, "running %s (last revised %s) with %d thread%s\n",
+        VERSION, DATE, thrmax, thrmax > 1 ? "s" : "");
+    fprintf(stderr, "reading input files\n");
+  }
+  arena_t* arena = new_arena();
+  gstack_t* uSQ =
+      read_file(inputf1, inputf2, verbose, thrmax, arena, 0, NULL);
+  if (uSQ == NULL || uSQ->nitems < 1) {
+    fprintf(stderr, "input file empty\n");
+    free(uSQ);
+    destroy_arena(arena);
+    return 1;
+  }
 
-  while (triedone < mtplan->ntries) {
-    // Cycle through the tries in turn.
-    idx = (idx + 1) % mtplan->ntries;
-    mttrie_t* mttrie = mtplan->tries + idx;
-    pthread_mutex_lock(mtplan->mutex);
+  if (verbose)
+    fprintf(stderr, "sorting\n");
+  uSQ->nitems = seqsort((useq_t**)uSQ->items, uSQ->nitems, thrmax);
 
-    // Check whether trie is idle and there are available threads.
-    if (mttrie->flag == TRIE_FREE && mtplan->active < thrmax) {
-      // No more jobs on this trie.
-      if (mttrie->currentjob == mttrie->njobs) {
-        mttrie->flag = TRIE_DONE;
-        triedone++;
-      }
-
-      // Some more jobs to do.
-      else {
-        mttrie->flag = TRIE_BUSY;
-        mtplan->active++;
-        mtjob_t* job = mttrie->jobs + mttrie->currentjob++;
-        pthread_t thread;
-        // Start job and detach thread.
-        if (pthread_create(&thread, NULL, do_query, job)) {
-          alert();
-          krash();
-        }
-        pthread_detach(thread);
-        if (verbose) {
-          fprintf(stderr, "progress: %.2f%% \r",
-              100 * (float)(mtplan->jobsdone) / njobs);
-        }
-      }
+  int med = -1;
+  int height = pad_useq(uSQ, &med);
+  if (tau < 0) {
+    tau = med > 160 ? 8 : 2 + med / 30;
+    if (verbose) {
+      fprintf(stderr, "setting dist to %d\n", tau);
     }
+  }
 
-    // If max thread number is reached, wait for a thread.
-    while (mtplan->active == thrmax) {
-      pthread_cond_wait(mtplan->monitor, mtplan->mutex);
-    }
+  // The sequences are padded for the reads that are longer by
+  // up to 'tau' nucleotides (see 'starcode_reference()').
+  if (verbose)
+    fprintf(stderr, "writing index\n");
+  index_t* index = new_index(uSQ, tau, height + tau, med);
+  int err = write_index(indexf, index);
 
-    pthread_mutex_unlock(mtplan->mutex);
-  }
+  destroy_index(index);
+  release_reads(uSQ, arena);
 
-  return;
+  return err;
 }
 
-void*
-do_query(void* args) {
-  // Unpack arguments.
-  mtjob_t* job = (mtjob_t*)args;
-  gstack_t* useqS = job->useqS;
-  trie_t* trie = job->trie;
-  lookup_t* lut = job->lut;
-  const int tau = job->tau;
-  node_t* node_pos = job->node_pos;
+int
+starcode_reference(          // Public
+    FILE* inputf,            // Input file (reads)
+    const char* reference,   // Reference or index file
+    FILE* outputf,           // Output file
+    int tau,                 // Max Levenshtein distance
+    const int hamming,       // Substitutions only
+    const int kernel,        // Kernel of the trie search
+    const int verbose,       // Verbose output (to stderr)
+    int thrmax,              // Max number of threads
+    const int showids        // Print sequence ID numbers
+)
+// SYNOPSIS:
+//   Searches the reads against a fixed set of reference sequences
+//   and prints the nearest references of every unique read. The
+//   references are the sequences of an index file written with
+//   'starcode_index()', or are read from a sequence file. The
+//   reads are never compared with each other.
+{
+  if (verbose) {
+    fprintf(stderr, "running %s (last revised %s) with %d thread%s\n",
+        VERSION, DATE, thrmax, thrmax > 1 ? "s" : "");
+  }
 
-  // Create local hit stack.
-  gstack_t** hits = new_tower(tau + 1);
-  if (hits == NULL) {
+  // Index files are recognized by their magic number, the
+  // other references are sequence files.
+  FILE* reff = fopen(reference, "r");
+  char magic[8] = {0};
+  if (reff == NULL) {
+    fprintf(stderr, "cannot open reference file %s\n", reference);
+    return 1;
+  }
+  int is_index = fread(magic, 1, 8, reff) == 8 &&
+      memcmp(magic, INDEX_MAGIC, 8) == 0;
+  rewind(reff);
+
+  index_t* index = NULL;
+  gstack_t* refS = NULL;
+  arena_t* refarena = NULL;
+  int refmed = -1;
+  int height = 0;
+  if (is_index) {
+    fclose(reff);
+    if (verbose)
+      fprintf(stderr, "loading index\n");
+    index = load_index(reference);
+    if (index == NULL)
+      return 1;
+    height = index->height;
+    if (tau < 0)
+      tau = index->tau;
+    if (tau > index->tau) {
+      fprintf(stderr, "distance larger than the distance of the index "
+          "(%d)\n", index->tau);
+      destroy_index(index);
+      return 1;
+    }
+  } else {
+    if (verbose)
+      fprintf(stderr, "reading reference file\n");
+    refarena = new_arena();
+    refS = read_file(reff, NULL, verbose, thrmax, refarena, 0, NULL);
+    fclose(reff);
+    if (refS == NULL || refS->nitems < 1) {
+      fprintf(stderr, "reference file empty\n");
+      free(refS);
+      destroy_arena(refarena);
+      return 1;
+    }
+    refS->nitems = seqsort((useq_t**)refS->items, refS->nitems, thrmax);
+    height = pad_useq(refS, &refmed);
+    if (tau < 0) {
+      tau = refmed > 160 ? 8 : 2 + refmed / 30;
+      if (verbose) {
+        fprintf(stderr, "setting dist to %d\n", tau);
+      }
+    }
+  }
+
+  if (verbose)
+    fprintf(stderr, "reading input files\n");
+  arena_t* arena = new_arena();
+  gstack_t* uSQ = read_file(inputf, NULL, verbose, thrmax, arena, 0, NULL);
+  if (uSQ == NULL || uSQ->nitems < 1) {
+    fprintf(stderr, "input file empty\n");
+    free(uSQ);
+    destroy_arena(arena);
+    if (index != NULL)
+      destroy_index(index);
+    else
+      release_reads(refS, refarena);
+    return 1;
+  }
+
+  if (verbose)
+    fprintf(stderr, "sorting\n");
+  uSQ->nitems = seqsort((useq_t**)uSQ->items, uSQ->nitems, thrmax);
+  const size_t nreads = uSQ->nitems;
+  for (size_t i = 0; i < nreads; i++)
+    ((useq_t*)uSQ->items[i])->node = i;
+
+  // The references read from a file are padded to the length
+  // of the longest read as well. The sequences of an index file
+  // are padded to the length of the longest reference plus the
+  // distance of the index, so the reads that are longer cannot
+  // have a match. They come last in the sort order.
+  int med = -1;
+  int readlen = pad_useq(uSQ, &med);
+  size_t nsearch = nreads;
+  if (index == NULL) {
+    height = max(height, readlen);
+    if (verbose)
+      fprintf(stderr, "indexing references\n");
+    index = new_index(refS, tau, height, refmed);
+    release_reads(refS, refarena);
+  } else {
+    while (nsearch > 0 &&
+        ((useq_t*)uSQ->items[nsearch - 1])->len > height)
+      nsearch--;
+  }
+
+  // Split the reads in blocks of consecutive sequences, one
+  // per thread, so that the queries share long prefixes.
+  int njobs = nsearch < (size_t)thrmax ? max(1, (int)nsearch) : thrmax;
+  refjob_t* jobs = calloc(njobs, sizeof(refjob_t));
+  int* dist = malloc(nreads * sizeof(int));
+  size_t* first = malloc((nreads + 1) * sizeof(size_t));
+  pthread_t* threads = malloc(njobs * sizeof(pthread_t));
+  if (jobs == NULL || dist == NULL || first == NULL || threads == NULL) {
     alert();
     krash();
   }
 
-  // Define a constant to help the compiler recognize
-  // that only one of the two cases will ever be used
-  // in the loop below.
-  const int bidir_match =
-      (CLUSTERALG == SPHERES_CLUSTER || CLUSTERALG == COMPONENTS_CLUSTER);
-  useq_t* last_query = NULL;
-
-  for (int i = job->start; i <= job->end; i++) {
-    useq_t* query = (useq_t*)useqS->items[i];
-    int do_search = lut_search(lut, query) == 1;
+  if (verbose)
+    fprintf(stderr, "searching\n");
+  for (int i = 0; i < njobs; i++) {
+    jobs[i] = (refjob_t){
+        .index = index,
+        .useqS = uSQ,
+        .start = nsearch * i / njobs,
+        .end = nsearch * (i + 1) / njobs,
+        .tau = tau,
+        .height = height,
+        .hamming = hamming,
+        .kernel = kernel,
+        .dist = dist,
+        .first = first,
+        .nearest = new_gstack(),
+    };
+    if (jobs[i].nearest == NULL ||
+        pthread_create(threads + i, NULL, do_reference, jobs + i)) {
+      alert();
+      krash();
+    }
+  }
+  for (int i = 0; i < njobs; i++)
+    pthread_join(threads[i], NULL);
+
+  // Concatenate the nearest references of the jobs. The offsets
+  // recorded by the jobs are relative to their own stack.
+  size_t total = 0;
+  for (int i = 0; i < njobs; i++)
+    total += jobs[i].nearest->nitems;
+  void** nearest = malloc((total + 1) * sizeof(void*));
+  if (nearest == NULL) {
+    alert();
+    krash();
+  }
+  size_t base = 0;
+  for (int i = 0; i < njobs; i++) {
+    gstack_t* stack = jobs[i].nearest;
+    memcpy(nearest + base, stack->items, stack->nitems * sizeof(void*));
+    for (size_t j = jobs[i].start; j < jobs[i].end; j++)
+      first[j] += base;
+    base += stack->nitems;
+  }
+  for (size_t j = nsearch; j <= nreads; j++) {
+    first[j] = total;
+    if (j < nreads)
+      dist[j] = -1;
+  }
 
-    // Insert the new sequence in the lut and trie, but let
-    // the last pointer to NULL so that the query does not
-    // find itself upon search.
-    void** data = NULL;
-    if (job->build) {
-      if (lut_insert(lut, query)) {
-        alert();
-        krash();
-      }
-      data = insert_string_wo_malloc(trie, query->seq, &node_pos);
-      if (data == NULL || *data != NULL) {
-        alert();
-        krash();
+  // Print the unique reads by decreasing count, with their
+  // distance to the nearest references and these references
+  // in the order of the trie.
+  qsort(uSQ->items, nreads, sizeof(useq_t*), count_order);
+  idstack_t* idstack = showids ? idstack_new(64) : NULL;
+  char seq[MAXSEQLEN];
+  for (size_t i = 0; i < nreads; i++) {
+    useq_t* u = (useq_t*)uSQ->items[i];
+    fprintf(outputf, "%s\t%zd", unpack_seq(u, seq, 0), u->count);
+    if (dist[u->node] < 0) {
+      fprintf(outputf, "\t-\t-");
+    } else {
+      fprintf(outputf, "\t%d", dist[u->node]);
+      for (size_t k = first[u->node]; k < first[u->node + 1]; k++) {
+        size_t ref = (uintptr_t)nearest[k] - 1;
+        fprintf(outputf, "%c%s", k == first[u->node] ? '\t' : ',',
+            index->text + index->offsets[ref]);
       }
     }
+    if (showids) {
+      idstack->pos = 0;
+      idstack_push(u->seqid, u->nids, idstack);
+      sort_and_print_ids(idstack, outputf);
+    }
+    fprintf(outputf, "\n");
+  }
 
-    if (do_search) {
-      int trail = 0;
-      if (i < job->end) {
-        useq_t* next_query = (useq_t*)useqS->items[i + 1];
-        // The 'while' condition is guaranteed to be false
-        // before the end of the 'char' arrays because all
-        // the queries have the same length and are different.
-        while (query->seq[trail] == next_query->seq[trail]) {
-          trail++;
-        }
-      }
-
-      // Compute start height.
-      int start = 0;
-      if (last_query != NULL) {
-        while (query->seq[start] == last_query->seq[start])
-          start++;
-      }
-
-      // Clear hit stack. //
-      for (int j = 0; hits[j] != TOWER_TOP; j++) {
-        hits[j]->nitems = 0;
-      }
-
-      // Search the trie. //
-      int err = search(trie, query->seq, tau, hits, start, trail);
-      if (err) {
-        alert();
-        krash();
-      }
-
-      for (int j = 0; hits[j] != TOWER_TOP; j++) {
-        if (hits[j]->nitems > hits[j]->nslots) {
-          fprintf(stderr, "warning: incomplete search (%s)\n", query->seq);
-          break;
-        }
-      }
-
-      // Link matching pairs for clustering.
-      // Skip dist = 0, as this would be self.
-      for (int dist = 1; dist < tau + 1; dist++) {
-        for (size_t j = 0; j < hits[dist]->nitems; j++) {
-          useq_t* match = (useq_t*)hits[dist]->items[j];
-          if (bidir_match) {
-            // Make a bidirectional match reference.
-            // Add reference from query to matched node.
-            pthread_mutex_lock(job->mutex + job->queryid);
-            if (addmatch(query, match, dist, tau)) {
-              fprintf(stderr,
-                  "Please contact guillaume.filion@gmail.com "
-                  "for support with this issue.\n");
-              abort();
-            }
-            pthread_mutex_unlock(job->mutex + job->queryid);
-            // Add reference from matched node to query.
-            pthread_mutex_lock(job->mutex + job->trieid);
-            if (addmatch(match, query, dist, tau)) {
-              fprintf(stderr,
-                  "Please contact guillaume.filion@gmail.com "
-                  "for support with this issue.\n");
-              abort();
-            }
-            pthread_mutex_unlock(job->mutex + job->trieid);
-          }
-
-          else {
-            // The parent is the sequence with highest count.
-            // For ties, parent is the query and child is the match.
-            // Matches are stored in child only (i.e. children
-            // know their parents).
-            useq_t* parent = match->count > query->count ? match : query;
-            useq_t* child = match->count > query->count ? query : match;
-            // If clustering is done by message passing, do not link
-            // pair if counts are on the same order of magnitude.
-            int mincount = child->count;
-            int maxcount = parent->count;
-            if (maxcount < CLUSTER_RATIO * mincount)
-              continue;
-            // In case CLUSTER_RATIO is set to 1, set parent to the
-            // lexicographically smaller. This will avoid circular
-            // parent references that produce infinite loops when
-            // clustering.
-            if (maxcount == mincount) {
-              if (strcmp(parent->seq, child->seq) > 0) {
-                useq_t* t = parent;
-                parent = child;
-                child = t;
-              }
-            }
-            // The child is modified, use the child mutex.
-            int mutexid = parent == query ? job->trieid : job->queryid;
-            pthread_mutex_lock(job->mutex + mutexid);
-            if (addmatch(child, parent, dist, tau)) {
-              fprintf(stderr,
-                  "Please contact guillaume.filion@gmail.com "
-                  "for support with this issue.\n");
-              abort();
-            }
-            pthread_mutex_unlock(job->mutex + mutexid);
-          }
-        }
-      }
-
-      last_query = query;
-    }
-
-    if (job->build) {
-      // Finally set the pointer of the inserted tail node.
-      *data = query;
-    }
-  }
-
-  destroy_tower(hits);
-
-  // Flag trie, update thread count and signal scheduler.
-  // Use the general mutex. (job->mutex[0])
-  pthread_mutex_lock(job->mutex);
-  *(job->active) -= 1;
-  *(job->jobsdone) += 1;
-  *(job->trieflag) = TRIE_FREE;
-  pthread_cond_signal(job->monitor);
-  pthread_mutex_unlock(job->mutex);
+  if (showids)
+    idstack_free(idstack);
+  for (int i = 0; i < njobs; i++)
+    free(jobs[i].nearest);
+  destroy_index(index);
+  free(jobs);
+  free(threads);
+  free(nearest);
+  free(first);
+  free(dist);
+  release_reads(uSQ, arena);
 
-  return NULL;
+  return 0;
 }
 
-mtplan_t*
-plan_mt(int tau, int height, int medianlen, int ntries, gstack_t* useqS)
+starcode_t*
+new_starcode(                // Public
+    int tau,                 // Max Levenshtein distance
+    const int hamming,       // Substitutions only
+    const int thrmax,        // Max number of threads
+    const int clusteralg,    // Clustering algorithm
+    double parent_to_child   // Merging threshold
+)
 // SYNOPSIS:
-//   The scheduler makes the key assumption that the number of tries is
-//   an odd number, which allows to distribute the jobs among as in the
-//   example shown below. The rows indicate blocks of query strings and
-//   the columns are distinct tries. An circle (o) indicates a build job,
-//   a cross (x) indicates a query job, and a dot (.) indicates that the
-//   block is not queried in the given trie.
-//
-//                            --- Tries ---
-//                            1  2  3  4  5
-//                         1  o  .  .  x  x
-//                         2  x  o  .  .  x
-//                         3  x  x  o  .  .
-//                         4  .  x  x  o  .
-//                         5  .  .  x  x  o
+//   Creates the context of a clustering with the options of
+//   'starcode()'. The sequences are added with 'starcode_add()'
+//   and clustered with 'starcode_run()', then the clusters are
+//   read with 'starcode_next_cluster()'. Alternatively, the
+//   sequences of files are clustered with 'starcode_run_files()'.
+//   The search uses the bytewise kernel and the automatic engine
+//   unless they are set with 'starcode_set_kernel()' and
+//   'starcode_set_engine()'. Every option is held by the context,
+//   so different contexts can be used by different threads at the
+//   same time. If 'tau' is negative, it is set from the median length
+//   of the sequences.
 //
-//   This simple schedule ensures that each trie is built from one query
-//   block and that each block is queried against every other exactly one
-//   time (a query of block i in trie j is the same as a query of block j
-//   in trie i).
+// RETURN:
+//   A pointer to the context, or NULL if the options are not
+//   valid.
 {
-  if (ntries < 1) {
-    alert();
-    krash();
-  }
+  if (tau > STARCODE_MAX_TAU || thrmax < 1 || parent_to_child < 1.0 ||
+      clusteralg < MP_CLUSTER || clusteralg > COMPONENTS_CLUSTER)
+    return NULL;
 
-  // Initialize plan.
-  mtplan_t* mtplan = malloc(sizeof(mtplan_t));
-  if (mtplan == NULL) {
+  starcode_t* sc = calloc(1, sizeof(starcode_t));
+  gstack_t* useqS = new_gstack();
+  if (sc == NULL || useqS == NULL) {
     alert();
     krash();
   }
+  sc->tau = tau;
+  sc->hamming = hamming;
+  sc->engine = AUTO_ENGINE;
+  sc->kernel = BYTEWISE_KERNEL;
+  sc->thrmax = thrmax;
+  sc->clusteralg = clusteralg;
+  sc->ratio = parent_to_child;
+  sc->arena = new_arena();
+  sc->useqS = useqS;
+
+  return sc;
+}
 
-  // Initialize mutex.
-  pthread_mutex_t* mutex = calloc(ntries + 1, sizeof(pthread_mutex_t));
-  pthread_cond_t* monitor = malloc(sizeof(pthread_cond_t));
-  if (mutex == NULL || monitor == NULL) {
-    alert();
-    krash();
-  }
-  for (int i = 0; i < ntries + 1; i++)
-    pthread_mutex_init(mutex + i, NULL);
-  pthread_cond_init(monitor, NULL);
+int
+starcode_set_kernel(         // Public
+    starcode_t* sc,          // Context of the clustering
+    const int kernel         // Kernel of the trie search
+)
+// SYNOPSIS:
+//   Sets the kernel of the dynamic programming of the trie search
+//   of the context (see 'search()' in 'trie.c'). The kernels give
+//   the same results, only their speed differs. The setting only
+//   applies to this context.
+//
+// RETURN:
+//   0 upon success, 1 if the kernel is not valid or if the
+//   clustering has already run.
+{
+  if (sc->done || kernel < BYTEWISE_KERNEL || kernel > SIMD_KERNEL)
+    return 1;
+  sc->kernel = kernel;
+  return 0;
+}
 
-  // Initialize 'mttries'.
-  mttrie_t* mttries = calloc(ntries, sizeof(mttrie_t));
-  if (mttries == NULL) {
-    alert();
-    krash();
-  }
+int
+starcode_set_engine(         // Public
+    starcode_t* sc,          // Context of the clustering
+    const int engine         // Search engine
+)
+// SYNOPSIS:
+//   Sets the search engine of the context (see 'search_graph()').
+//   The engines give the same results, only their speed differs.
+//
+// RETURN:
+//   0 upon success, 1 if the engine is not valid or if the
+//   clustering has already run.
+{
+  if (sc->done || engine < AUTO_ENGINE || engine > SEED_ENGINE)
+    return 1;
+  sc->engine = engine;
+  return 0;
+}
 
-  // Boundaries of the query blocks.
-  int Q = useqS->nitems / ntries;
-  int R = useqS->nitems % ntries;
-  int* bounds = calloc(ntries + 1, sizeof(int));
-  for (int i = 0; i < ntries + 1; i++)
-    bounds[i] = Q * i + min(i, R);
+int
+starcode_set_checkpoints(    // Public
+    starcode_t* sc,          // Context of the clustering
+    const char* ckptin,      // Checkpoint to add the input to (or NULL)
+    const char* ckptout      // Checkpoint to write (or NULL)
+)
+// SYNOPSIS:
+//   Sets the checkpoints of 'starcode_run_files()'. The input
+//   of the clustering is added to the sequences of 'ckptin', and
+//   the distance must be that of the checkpoint. The sequences
+//   and their matches are written to 'ckptout'. The paths are
+//   not copied and must remain valid until the clustering.
+//
+// RETURN:
+//   0 upon success, 1 if the clustering has already run.
+{
+  if (sc->done)
+    return 1;
+  sc->ckptin = ckptin;
+  sc->ckptout = ckptout;
+  return 0;
+}
 
-  // Preallocated tries.
-  // Count with maxlen-1
-  long* nnodes = calloc(ntries, sizeof(long));
-  for (int i = 0; i < ntries; i++)
-    nnodes[i] =
-        count_trie_nodes((useq_t**)useqS->items, bounds[i], bounds[i + 1]);
+int
+starcode_add(                // Public
+    starcode_t* sc,          // Context of the clustering
+    const char* seq,         // Sequence
+    const int count          // Number of reads
+)
+// SYNOPSIS:
+//   Adds 'count' reads of the sequence 'seq' to the context. The
+//   reads have ids in the order they are added, as the lines of
+//   an input file. A sequence can be added several times, its
+//   counts are summed.
+//
+// RETURN:
+//   0 upon success, 1 if the sequence is not valid, if ids were
+//   given to 'starcode_add_seqs()' or if the clustering has
+//   already run.
+{
+  return starcode_add_seqs(sc, 1, &seq, &count, NULL);
+}
 
-  // Create jobs for the tries.
-  for (int i = 0; i < ntries; i++) {
-    // Remember that 'ntries' is odd.
-    int njobs = (ntries + 1) / 2;
-    trie_t* local_trie = new_trie(height);
-    node_t* local_nodes = (node_t*)calloc(nnodes[i], sizeof(node_t));
-    mtjob_t* jobs = calloc(njobs, sizeof(mtjob_t));
-    if (local_trie == NULL || jobs == NULL) {
+int
+starcode_add_seqs(           // Public
+    starcode_t* sc,          // Context of the clustering
+    const size_t n,          // Number of sequences
+    const char* const* seqs, // Sequences
+    const int* counts,       // Numbers of reads (or NULL)
+    const int* ids           // Ids of the sequences (or NULL)
+)
+// SYNOPSIS:
+//   Adds 'n' sequences to the context in one call, like 'n' calls
+//   to 'starcode_add()' but without parsing any text. If 'counts'
+//   is NULL, every sequence is one read. If 'ids' is NULL, the
+//   sequences have ids in the order they are added, otherwise
+//   'ids[i]' is the id of 'seqs[i]' and is reported with the
+//   cluster of the sequence (see 'starcode_next_cluster()').
+//   The ids given must be positive and unique in the context, and
+//   they cannot be mixed with automatic ids (including those of
+//   'starcode_add()'). The sequences and the ids are checked
+//   before any of them is added.
+//
+// RETURN:
+//   0 upon success, 1 if a sequence, a count or an id is not
+//   valid or if the clustering has already run. In this case, no
+//   sequence is added.
+{
+  if (sc->done || (n > 0 && seqs == NULL))
+    return 1;
+  if (n == 0)
+    return 0;
+  // Automatic and given ids would collide.
+  if (sc->userids == (ids == NULL ? 1 : -1))
+    return 1;
+  for (size_t i = 0; i < n; i++) {
+    if (seqs[i] == NULL || (counts != NULL && counts[i] < 1))
+      return 1;
+    size_t len = strlen(seqs[i]);
+    if (len == 0 || len >= MAXBRCDLEN || !valid_seq(seqs[i], len))
+      return 1;
+  }
+
+  if (ids != NULL) {
+    for (size_t i = 0; i < n; i++)
+      if (ids[i] < 1 || has_id(sc, ids[i]))
+        return 1;
+    // Duplicates within the batch are adjacent once sorted.
+    int* sorted = malloc(n * sizeof(int));
+    if (sorted == NULL) {
       alert();
       krash();
     }
+    memcpy(sorted, ids, n * sizeof(int));
+    qsort(sorted, n, sizeof(int), int_ascending);
+    size_t i = 1;
+    while (i < n && sorted[i] != sorted[i - 1])
+      i++;
+    free(sorted);
+    if (i < n)
+      return 1;
+    for (i = 0; i < n; i++)
+      insert_id(sc, ids[i]);
+  }
+  sc->userids = ids == NULL ? -1 : 1;
 
-    // Allocate lookup struct.
-    // TODO: Try only one lut as well (it will always return 1
-    // in the query step though).
-    lookup_t* local_lut = new_lookup(medianlen, height, tau);
-    if (local_lut == NULL) {
+  for (size_t i = 0; i < n; i++) {
+    int count = counts == NULL ? 1 : counts[i];
+    useq_t* new = pack_useq(sc->arena, count, seqs[i], strlen(seqs[i]),
+        NULL);
+    if (new == NULL) {
       alert();
       krash();
     }
-
-    mttries[i].flag = TRIE_FREE;
-    mttries[i].currentjob = 0;
-    mttries[i].njobs = njobs;
-    mttries[i].jobs = jobs;
-
-    for (int j = 0; j < njobs; j++) {
-      // Shift boundaries in a way that every trie is built
-      // exactly once and that no redundant jobs are allocated.
-      int idx = (i + j) % ntries;
-      int only_if_first_job = j == 0;
-      // Specifications of j-th job of the local trie.
-      jobs[j].start = bounds[idx];
-      jobs[j].end = bounds[idx + 1] - 1;
-      jobs[j].tau = tau;
-      jobs[j].build = only_if_first_job;
-      jobs[j].useqS = useqS;
-      jobs[j].trie = local_trie;
-      jobs[j].node_pos = local_nodes;
-      jobs[j].lut = local_lut;
-      jobs[j].mutex = mutex;
-      jobs[j].monitor = monitor;
-      jobs[j].jobsdone = &(mtplan->jobsdone);
-      jobs[j].trieflag = &(mttries[i].flag);
-      jobs[j].active = &(mtplan->active);
-      // Mutex ids. (mutex[0] is reserved for general mutex)
-      jobs[j].queryid = idx + 1;
-      jobs[j].trieid = i + 1;
+    new->nids = 1;
+    new->id = ids == NULL ? (int)sc->useqS->nitems + 1 : ids[i];
+    new->seqid = &new->id;
+    if (push(new, &sc->useqS)) {
+      alert();
+      krash();
     }
   }
 
-  free(bounds);
-  free(nnodes);
-
-  mtplan->active = 0;
-  mtplan->ntries = ntries;
-  mtplan->jobsdone = 0;
-  mtplan->mutex = mutex;
-  mtplan->monitor = monitor;
-  mtplan->tries = mttries;
-
-  return mtplan;
+  return 0;
 }
 
-long
-count_trie_nodes(useq_t** seqs, int start, int end) {
-  int seqlen = strlen(seqs[start]->seq) - 1;
-  long count = seqlen;
-  for (int i = start + 1; i < end; i++) {
-    char* a = seqs[i - 1]->seq;
-    char* b = seqs[i]->seq;
-    int prefix = 0;
-    while (a[prefix] == b[prefix])
-      prefix++;
-    count += seqlen - prefix;
+int
+has_id(const starcode_t* sc, int id)
+// SYNOPSIS:
+//   Checks whether 'id' was given to 'starcode_add_seqs()'. The
+//   ids are in an open addressing hash set, where 0 is an empty
+//   slot since the ids are positive.
+//
+// RETURN:
+//   1 if the id is in the set, 0 otherwise.
+{
+  if (sc->idslots == 0)
+    return 0;
+  size_t mask = sc->idslots - 1;
+  size_t slot = ((uint32_t)id * 2654435761U) & mask;
+  while (sc->idset[slot] != 0) {
+    if (sc->idset[slot] == id)
+      return 1;
+    slot = (slot + 1) & mask;
   }
-  return count;
+  return 0;
 }
 
 void
-connected_components(useq_t* useq, gstack_t** cluster) {
-  // Flag claimed.
-  useq->canonical = useq;
-  // Add myself to cluster.
-  push(useq, cluster);
-  // Recursive call on edges.
-  if (useq->matches == NULL)
-    return;
-  gstack_t* matches;
-  for (int j = 0; (matches = useq->matches[j]) != TOWER_TOP; j++) {
-    for (size_t k = 0; k < matches->nitems; k++) {
-      useq_t* match = (useq_t*)matches->items[k];
-      if (match->canonical != NULL)
-        continue;
-      connected_components(match, cluster);
+insert_id(starcode_t* sc, int id)
+// SYNOPSIS:
+//   Inserts a positive id in the hash set of the context (see
+//   'has_id()'). The set is at most half full, it is rebuilt
+//   twice larger when needed.
+{
+  if (2 * (sc->nidset + 1) > sc->idslots) {
+    int* old = sc->idset;
+    size_t oldslots = sc->idslots;
+    sc->idslots = oldslots ? 2 * oldslots : 64;
+    sc->idset = calloc(sc->idslots, sizeof(int));
+    if (sc->idset == NULL) {
+      alert();
+      krash();
     }
+    sc->nidset = 0;
+    for (size_t i = 0; i < oldslots; i++)
+      if (old[i] != 0)
+        insert_id(sc, old[i]);
+    free(old);
   }
+  size_t mask = sc->idslots - 1;
+  size_t slot = ((uint32_t)id * 2654435761U) & mask;
+  while (sc->idset[slot] != 0)
+    slot = (slot + 1) & mask;
+  sc->idset[slot] = id;
+  sc->nidset++;
 }
 
-gstack_t*
-compute_clusters(gstack_t* uSQ) {
-  gstack_t* clusters = new_gstack();
-  for (size_t i = 0; i < uSQ->nitems; i++) {
-    useq_t* useq = (useq_t*)uSQ->items[i];
+int
+starcode_run(                // Public
+    starcode_t* sc           // Context of the clustering
+)
+// SYNOPSIS:
+//   Clusters the sequences of the context like 'starcode()'. The
+//   clusters are those of the default output, in the same order,
+//   with the centroid first. The other members of the spheres are
+//   in the order of 'seqsort()', so they do not depend on the
+//   number of threads.
+//
+// RETURN:
+//   0 upon success, 1 if the clustering has already run.
+{
+  if (sc->done)
+    return 1;
+  sc->done = 1;
 
-    // Check sequence flag.
-    if (useq->canonical != NULL)
-      continue;
+  gstack_t* uSQ = sc->useqS;
+  if (uSQ->nitems == 0)
+    return 0;
+  int thrmax = sc->thrmax;
+  uSQ->nitems = seqsort((useq_t**)uSQ->items, uSQ->nitems, thrmax);
 
-    // Create new cluster.
-    gstack_t* cluster = new_gstack();
-
-    // Recursively gather connected components.
-    connected_components(useq, &cluster);
-
-    // Find centroid. (max: #counts THEN #edges).
-    // Count useq edges.
-    int edge_count = 0;
-    if (useq->matches != NULL) {
-      gstack_t* matches;
-      for (int j = 0; (matches = useq->matches[j]) != TOWER_TOP; j++)
-        edge_count += matches->nitems;
-    }
-
-    // Find centroid among cluster seqs.
-    size_t cluster_count = useq->count;
-    for (size_t k = 1; k < cluster->nitems; k++) {
-      useq_t* s = (useq_t*)cluster->items[k];
-      cluster_count += s->count;
-      // Select centroid by count.
-      if (s->count > useq->count) {
-        // Count centroid edges.
-        int cnt = 0;
-        gstack_t* matches;
-        for (int j = 0; (matches = s->matches[j]) != TOWER_TOP; j++)
-          cnt += matches->nitems;
-        // Store centroid at index 0.
-        cluster->items[0] = s;
-        cluster->items[k] = useq;
-        useq = s;
-        // Save centroid edge count.
-        edge_count = cnt;
-      }
-      // If same count, select by edge count.
-      else if (s->count == useq->count && s->matches != NULL) {
-        int cnt = 0;
-        gstack_t* matches;
-        for (int j = 0; (matches = s->matches[j]) != TOWER_TOP; j++)
-          cnt += matches->nitems;
-        if (cnt > edge_count) {
-          // Store centroid at index 0.
-          cluster->items[0] = s;
-          cluster->items[k] = useq;
-          useq = s;
-          // Save centroid edge count.
-          edge_count = cnt;
-        }
-      }
-    }
-    useq->count = cluster_count;
-    // Store cluster.
-    push(cluster, &clusters);
+  size_t ntries = 3 * thrmax + (thrmax % 2 == 0);
+  if (uSQ->nitems < ntries) {
+    ntries = 1;
+    thrmax = 1;
   }
 
-  // Sort clusters by size (counts).
-  qsort(
-      clusters->items, clusters->nitems, sizeof(gstack_t*), cluster_count);
+  int med = -1;
+  int height = pad_useq(uSQ, &med);
+  int tau = sc->tau;
+  if (tau < 0)
+    tau = med > 160 ? 8 : 2 + med / 30;
 
-  return clusters;
+  uint32_t* forest = NULL;
+  if (sc->clusteralg == COMPONENTS_CLUSTER)
+    forest = new_forest(uSQ->nitems);
+  graph_t* graph =
+      search_graph(sc, uSQ, tau, height, med, ntries, thrmax, forest);
+
+  // Every sequence is in at most one cluster.
+  const size_t nseq = uSQ->nitems;
+  useq_t** members = malloc(nseq * sizeof(useq_t*));
+  size_t* bounds = malloc((nseq + 1) * sizeof(size_t));
+  long int* counts = malloc(nseq * sizeof(long int));
+  if (members == NULL || bounds == NULL || counts == NULL) {
+    alert();
+    krash();
+  }
+  size_t n = 0;
+  size_t m = 0;
+
+  if (sc->clusteralg == MP_CLUSTER) {
+    message_passing_clustering(uSQ, graph, thrmax);
+    qsort(uSQ->items, nseq, sizeof(useq_t*), canonical_order);
+    // The clusters are consecutive, the canonical is moved
+    // to the front.
+    for (size_t i = 0; i < nseq; i++) {
+      useq_t* u = (useq_t*)uSQ->items[i];
+      if (u->canonical == NULL)
+        break;
+      if (n == 0 || u->canonical != members[bounds[n - 1]]->canonical) {
+        bounds[n] = m;
+        counts[n++] = u->canonical->count;
+      }
+      members[m++] = u;
+      if (u == u->canonical) {
+        members[m - 1] = members[bounds[n - 1]];
+        members[bounds[n - 1]] = u;
+      }
+    }
+  } else if (sc->clusteralg == SPHERES_CLUSTER) {
+    sphere_clustering(uSQ, graph, thrmax);
+    qsort(uSQ->items, nseq, sizeof(useq_t*), sphere_size_order);
+    for (size_t i = 0; i < nseq; i++) {
+      useq_t* u = (useq_t*)uSQ->items[i];
+      if (u->canonical != u)
+        break;
+      bounds[n] = m;
+      counts[n++] = u->sphere_c;
+      members[m++] = u;
+      for (size_t k = first_match(graph, u); k < end_match(graph, u); k++) {
+        useq_t* match = graph->nodes[graph->nbr[k]];
+        if (match->canonical == u)
+          members[m++] = match;
+      }
+      // The order of the matches depends on the number of
+      // threads, so the members are sorted after the centroid.
+      qsort(members + bounds[n - 1] + 1, m - bounds[n - 1] - 1,
+          sizeof(useq_t*), seq_order);
+    }
+  } else {
+    gstack_t* clusters = compute_clusters(uSQ, graph, forest, thrmax);
+    for (size_t i = 0; i < clusters->nitems; i++) {
+      gstack_t* cluster = (gstack_t*)clusters->items[i];
+      bounds[n] = m;
+      counts[n++] = ((useq_t*)cluster->items[0])->count;
+      for (size_t k = 0; k < cluster->nitems; k++)
+        members[m++] = (useq_t*)cluster->items[k];
+    }
+    free(clusters);
+  }
+  bounds[n] = m;
+  free(forest);
+  destroy_graph(graph);
+
+  // Buffers of 'starcode_next_cluster()' for the largest cluster.
+  size_t maxsize = 0;
+  size_t maxtext = 0;
+  size_t maxids = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t text = 0;
+    size_t nids = 0;
+    for (size_t k = bounds[i]; k < bounds[i + 1]; k++) {
+      text += members[k]->len + 1;
+      nids += members[k]->nids;
+    }
+    maxsize = max(maxsize, bounds[i + 1] - bounds[i]);
+    maxtext = max(maxtext, text);
+    maxids = max(maxids, nids);
+  }
+  sc->text = malloc(maxtext + 1);
+  sc->seqs = malloc((maxsize + 1) * sizeof(char*));
+  sc->ids = malloc((maxids + 1) * sizeof(int));
+  if (sc->text == NULL || sc->seqs == NULL || sc->ids == NULL) {
+    alert();
+    krash();
+  }
+
+  sc->nclusters = n;
+  sc->members = members;
+  sc->bounds = bounds;
+  sc->counts = counts;
+
+  return 0;
+}
+
+int
+starcode_next_cluster(       // Public
+    starcode_t* sc,          // Context of the clustering
+    starcode_cluster_t* cluster  // Next cluster
+)
+// SYNOPSIS:
+//   Reads the next cluster of the context after 'starcode_run()'.
+//   The sequences and the ids of the cluster belong to the context
+//   and are overwritten by the next call. The ids are in ascending
+//   order.
+//
+// RETURN:
+//   1 if the cluster is read, 0 if there is no more cluster.
+{
+  if (sc->next >= sc->nclusters)
+    return 0;
+
+  size_t i = sc->next++;
+  char* text = sc->text;
+  size_t nids = 0;
+  for (size_t k = sc->bounds[i]; k < sc->bounds[i + 1]; k++) {
+    useq_t* u = sc->members[k];
+    sc->seqs[k - sc->bounds[i]] = unpack_seq(u, text, 0);
+    text += u->len + 1;
+    memcpy(sc->ids + nids, u->seqid, u->nids * sizeof(int));
+    nids += u->nids;
+  }
+  qsort(sc->ids, nids, sizeof(int), int_ascending);
+  cluster->count = sc->counts[i];
+  cluster->size = sc->bounds[i + 1] - sc->bounds[i];
+  cluster->seqs = sc->seqs;
+  cluster->nids = nids;
+  cluster->ids = sc->ids;
+
+  return 1;
 }
 
 void
-sphere_clustering(gstack_t* useqS) {
-  // Sort in count order.
-  qsort(useqS->items, useqS->nitems, sizeof(useq_t*), count_order_spheres);
+destroy_starcode(            // Public
+    starcode_t* sc           // Context of the clustering
+)
+{
+  if (sc == NULL)
+    return;
+  release_reads(sc->useqS, sc->arena);
+  free(sc->members);
+  free(sc->bounds);
+  free(sc->counts);
+  free(sc->text);
+  free(sc->seqs);
+  free(sc->ids);
+  free(sc->idset);
+  free(sc);
+}
 
-  for (size_t i = 0; i < useqS->nitems; i++) {
-    useq_t* useq = (useq_t*)useqS->items[i];
-    if (useq->canonical != NULL)
-      continue;
-    useq->canonical = useq;
-    useq->sphere_c = useq->count;
-    useq->sphere_d = 0;
-    if (useq->matches == NULL)
-      continue;
-    // Bidirectional edge references simplifie the algorithm.
-    // Directly proceed to claim neighbor counts.
-    gstack_t* matches;
-    for (int j = 0; (matches = useq->matches[j]) != TOWER_TOP; j++) {
-      for (size_t k = 0; k < matches->nitems; k++) {
-        useq_t* match = (useq_t*)matches->items[k];
-        // If a sequence has been already claimed, remove it from list.
-        if (match->canonical != NULL) {
-          // Steal sequence from the other sphere if it is closer to this
-          // centroid.
-          if (j < match->sphere_d) {
-            // Update other sphere size.
-            match->canonical->sphere_c -= match->count;
-          } else {
-            matches->items[k--] = matches->items[--matches->nitems];
-            continue;
+void*
+do_reference(void* args)
+// SYNOPSIS:
+//   Searches a block of reads against the references (see
+//   'starcode_reference()') and records the distance to the
+//   nearest references of each read, and these references. The
+//   index is shared by the jobs and every job searches the trie
+//   through its own view, which holds the pebbles and the
+//   dynamic programming of its queries (see 'share_trie()').
+{
+  refjob_t* job = (refjob_t*)args;
+  if (job->start == job->end)
+    return NULL;
+
+  trie_t* trie = share_trie(job->index->trie);
+  const int tau = job->tau;
+  const int height = job->height;
+  gstack_t* useqS = job->useqS;
+  lookup_t* lut = job->index->lut;
+
+  gstack_t** hits = new_tower(tau + 1);
+  char* buffers = malloc(3 * (height + 1));
+  if (trie == NULL || hits == NULL || buffers == NULL) {
+    alert();
+    krash();
+  }
+  char* seq = buffers;
+  char* next_seq = buffers + (height + 1);
+  char* last_seq = buffers + 2 * (height + 1);
+  unpack_seq(useqS->items[job->start], seq, height);
+  int searched = 0;
+
+  for (size_t i = job->start; i < job->end; i++) {
+    if (i + 1 < job->end)
+      unpack_seq(useqS->items[i + 1], next_seq, height);
+    job->first[i] = job->nearest->nitems;
+    job->dist[i] = -1;
+
+    if (lut_search(lut, seq) == 1) {
+      // The reads are sorted and unique (see 'do_query()').
+      int trail = 0;
+      if (i + 1 < job->end) {
+        while (seq[trail] == next_seq[trail])
+          trail++;
+      }
+      int start = 0;
+      if (searched) {
+        while (seq[start] == last_seq[start])
+          start++;
+      }
+
+      for (int j = 0; hits[j] != TOWER_TOP; j++) {
+        hits[j]->nitems = 0;
+      }
+      int err = job->hamming ?
+          search_hamming(trie, seq, tau, hits, start, trail) :
+          search(trie, seq, tau, hits, start, trail, job->kernel);
+      if (err) {
+        alert();
+        krash();
+      }
+
+      for (int j = 0; hits[j] != TOWER_TOP; j++) {
+        if (hits[j]->nitems > hits[j]->nslots) {
+          fprintf(stderr, "warning: incomplete search (%s)\n", seq);
+          break;
+        }
+      }
+
+      // Keep the references at the smallest distance.
+      for (int d = 0; d <= tau; d++) {
+        if (hits[d]->nitems == 0)
+          continue;
+        job->dist[i] = d;
+        for (size_t j = 0; j < hits[d]->nitems; j++) {
+          if (push(hits[d]->items[j], &job->nearest)) {
+            alert();
+            krash();
           }
         }
-        // Claim the sequence.
-        useq->sphere_c += match->count;
-        match->canonical = useq;
-        match->sphere_d = j;
+        break;
       }
-    }
-  }
 
-  return;
-}
+      searched = 1;
+      char* tmp = last_seq;
+      last_seq = seq;
+      seq = tmp;
+    }
 
-void
-message_passing_clustering(gstack_t* useqS) {
-  // Transfer counts to parents recursively.
-  for (size_t i = 0; i < useqS->nitems; i++) {
-    useq_t* u = (useq_t*)useqS->items[i];
-    transfer_counts_and_update_canonicals(u);
+    char* tmp = seq;
+    seq = next_seq;
+    next_seq = tmp;
   }
 
-  // Resolve ambiguous assignments.
-  for (size_t i = 0; i < useqS->nitems; i++) {
-    useq_t* u = (useq_t*)useqS->items[i];
-    mp_resolve_ambiguous(u);
-  }
+  destroy_trie(trie, NULL);
+  destroy_tower(hits);
+  free(buffers);
 
-  return;
+  return NULL;
 }
 
-size_t
-seqsort(useq_t** data, size_t numels, int thrmax)
+graph_t*
+search_graph(
+    const starcode_t* sc,
+    gstack_t* useqS,
+    int tau,
+    int height,
+    int medianlen,
+    int ntries,
+    int thrmax,
+    uint32_t* forest)
 // SYNOPSIS:
-//   Recursive merge sort for 'useq_t' arrays, tailored for the
-//   problem of sorting merging identical sequences. When two
-//   identical sequences are detected during the sort, they are
-//   merged into a single one with more counts, and one of them
-//   is destroyed (freed). See 'nukesort()' for a description of
-//   the sort order.
-//
-// PARAMETERS:
-//   data:       an array of pointers to each element.
-//   numels:     number of elements, i.e. size of 'data'.
-//   thrmax: number of threads.
+//   Searches the pairs of sequences within distance 'tau' with the
+//   options of 'sc' and links them in the match graph. The search
+//   is split between 'ntries' tries (see 'plan_mt()'). If 'forest'
+//   is not NULL, the pairs of matching sequences are also joined
+//   in it (see 'union_nodes()').
 //
 // RETURN:
-//   Number of unique elements.
-//
-// SIDE EFFECTS:
-//   Pointers to repeated elements are set to NULL.
+//   A pointer to the match graph.
 {
-  // Copy to buffer.
-  useq_t** buffer = calloc(numels, sizeof(useq_t*));
-  memcpy(buffer, data, numels * sizeof(useq_t*));
+  // Index the nodes of the match graph.
+  for (size_t i = 0; i < useqS->nitems; i++)
+    ((useq_t*)useqS->items[i])->node = i;
+
+  // Make multithreading plan. A single worker gains nothing from
+  // work-stealing so the static plan is kept in this case.
+  const int steal = thrmax > 1;
+  mtplan_t* mtplan =
+      plan_mt(tau, height, medianlen, ntries, steal, sc->engine, useqS);
+  mtplan->forest = forest;
+  mtplan->hamming = sc->hamming;
+  mtplan->kernel = sc->kernel;
+  mtplan->bidir = sc->allpairs ||
+      (sc->clusteralg == SPHERES_CLUSTER ||
+          sc->clusteralg == COMPONENTS_CLUSTER);
+  mtplan->ratio = sc->ratio;
+  if (sc->verbose && mtplan->engine == SEED_ENGINE)
+    fprintf(stderr, "using seed-and-verify search\n");
 
-  // Prepare args struct.
-  sortargs_t args;
-  args.buf0 = data;
-  args.buf1 = buffer;
-  args.size = numels;
-  // There are two alternating buffers for the merge step.
-  // 'args.b' alternates on every call to 'nukesort()' to
-  // keep track of which is the source and which is the
-  // destination. It has to be initialized to 0 so that
-  // sorted elements end in 'data' and not in 'buffer'.
-  args.b = 0;
-  args.thread = 0;
-  args.repeats = 0;
+  // Run the query.
+  run_plan(mtplan, sc->verbose, thrmax);
+  if (sc->verbose)
+    fprintf(stderr, "progress: 100.00%%\n");
 
-  // Allocate a number of threads that is a power of 2.
-  while ((thrmax >> (args.thread + 1)) > 0)
-    args.thread++;
+  // Link the matching pairs.
+  graph_t* graph = merge_edges(mtplan, useqS);
 
-  nukesort(&args);
+  // Free mtplan.
+  free(mtplan->mutex);
+  free(mtplan->monitor);
+  free(mtplan->queue);
+  free(mtplan->bounds);
+  free(mtplan->unclaimed);
+  free(mtplan->claimed);
+  for (int i = 0 ; i < mtplan->ntries ; i++) {
+    mtjob_t* jobs = mtplan->tries[i].jobs;
+    if (jobs->seeds != NULL) {
+      destroy_seeds(jobs->seeds);
+    } else {
+      destroy_lookup(jobs->lut);
+      destroy_trie(jobs->trie, NULL);
+    }
+    free(jobs);
+  }
+  free(mtplan->tries);
+  free(mtplan);
 
-  free(buffer);
-  return numels - args.repeats;
+  return graph;
 }
 
-void*
-nukesort(void* args)
+void
+run_plan(mtplan_t* mtplan, const int verbose, const int thrmax)
 // SYNOPSIS:
-//   Recursive part of 'seqsort'. The code of 'nukesort()' is
-//   dangerous and should not be reused. It uses a very special
-//   sort order designed for starcode, it destroys some elements
-//   and sets them to NULL as it sorts. The sort order is based
-//   on the sequences and is such that a < b if a is shorter
-//   than b or if a has the same length as b and lower lexical
-//   order. When a is the same as b, the useq containing b is
-//   destroyed (freed) and replaced by NULL.
-//
-// ARGUMENTS:
-//   args: a sortargs_t struct (see private header file).
-//
-// RETURN:
-//   NULL pointer, regardless of the input
-//
-// SIDE EFFECTS:
-//   Sorts the array of 'useq_t' specified in 'args'.
+//   Runs the jobs of the plan on a pool of 'thrmax' persistent
+//   workers (see 'mt_worker()'). The tries with a pending job
+//   are kept in a ready queue so that the workers never have to
+//   scan the plan, and a trie is never in the queue while one
+//   of its jobs is running. The calling thread only sleeps until
+//   it is woken up by a worker and reports the progress.
 {
-  sortargs_t* sortargs = (sortargs_t*)args;
-  if (sortargs->size < 2)
-    return NULL;
+  pthread_t* workers = malloc(thrmax * sizeof(pthread_t));
+  if (workers == NULL) {
+    alert();
+    krash();
+  }
 
-  // Next level params.
-  sortargs_t arg1 = *sortargs, arg2 = *sortargs;
-  arg1.size /= 2;
-  arg2.size = arg1.size + arg2.size % 2;
-  arg2.buf0 += arg1.size;
-  arg2.buf1 += arg1.size;
-  arg1.b = arg2.b = (arg1.b + 1) % 2;
+  // Allocate the edge buffers of the workers, with one
+  // partition per thread for the merge.
+  mtplan->nworkers = 0;
+  mtplan->nparts = thrmax;
+  mtplan->edges = calloc(thrmax * thrmax, sizeof(edgebuf_t));
+  if (mtplan->edges == NULL) {
+    alert();
+    krash();
+  }
 
-  // Either run threads or DIY.
-  if (arg1.thread) {
-    // Decrease one level.
-    arg1.thread = arg2.thread = arg1.thread - 1;
-    // Create threads.
-    pthread_t thread1, thread2;
-    if (pthread_create(&thread1, NULL, nukesort, &arg1) ||
-        pthread_create(&thread2, NULL, nukesort, &arg2)) {
+  // Start the workers.
+  for (int i = 0; i < thrmax; i++) {
+    if (pthread_create(workers + i, NULL, mt_worker, mtplan)) {
       alert();
       krash();
     }
-    // Wait for threads.
-    pthread_join(thread1, NULL);
-    pthread_join(thread2, NULL);
-  } else {
-    nukesort(&arg1);
-    nukesort(&arg2);
   }
 
-  // Separate data and buffer (b specifies which is buffer).
-  useq_t** l = (sortargs->b ? arg1.buf0 : arg1.buf1);
-  useq_t** r = (sortargs->b ? arg2.buf0 : arg2.buf1);
-  useq_t** buf = (sortargs->b ? arg1.buf1 : arg1.buf0);
-
-  ssize_t i = 0;
-  ssize_t j = 0;
-  ssize_t idx = 0;
-  ssize_t repeats = 0;
-  int cmp = 0;
-
-  // Merge sets
-  while (i + j < sortargs->size) {
-    // Only NULLs at the end of the buffers.
-    if (j == arg2.size || r[j] == NULL) {
-      // Right buffer is exhausted. Copy left buffer...
-      memcpy(buf + idx, l + i, (arg1.size - i) * sizeof(useq_t*));
-      break;
-    }
-    if (i == arg1.size || l[i] == NULL) {
-      // ... or vice versa.
-      memcpy(buf + idx, r + j, (arg2.size - j) * sizeof(useq_t*));
-      break;
+  // Wait for all the jobs to complete.
+  pthread_mutex_lock(mtplan->mutex);
+  while (mtplan->jobsdone < mtplan->njobs) {
+    pthread_cond_wait(mtplan->monitor, mtplan->mutex);
+    if (verbose) {
+      fprintf(stderr, "progress: %.2f%% \r",
+          100 * (float)(mtplan->jobsdone) / mtplan->njobs);
     }
-    if (l[i] == NULL && r[j] == NULL)
-      break;
-
-    // Do the comparison.
-    useq_t* ul = (useq_t*)l[i];
-    useq_t* ur = (useq_t*)r[j];
-    ssize_t sl = strlen(ul->seq);
-    ssize_t sr = strlen(ur->seq);
-    if (sl == sr)
-      cmp = strcmp(ul->seq, ur->seq);
-    else
-      cmp = sl < sr ? -1 : 1;
-
-    if (cmp == 0) {
-      // Identical sequences, this is the "nuke" part.
-      // Add sequence counts.
-      ul->count += ur->count;
-      transfer_useq_ids(ul, ur);
-      destroy_useq(ur);
-      buf[idx++] = l[i++];
-      j++;
-      repeats++;
-    } else if (cmp < 0)
-      buf[idx++] = l[i++];
-    else
-      buf[idx++] = r[j++];
   }
+  pthread_mutex_unlock(mtplan->mutex);
 
-  // Accumulate repeats
-  sortargs->repeats = repeats + arg1.repeats + arg2.repeats;
+  for (int i = 0; i < thrmax; i++)
+    pthread_join(workers[i], NULL);
 
-  // Pad with NULLS.
-  ssize_t offset = sortargs->size - sortargs->repeats;
-  memset(buf + offset, 0, sortargs->repeats * sizeof(useq_t*));
+  free(workers);
 
-  return NULL;
+  return;
 }
 
-gstack_t*
-read_rawseq(FILE* inputf, gstack_t* uSQ) {
-  ssize_t nread;
-  size_t nchar = M;
-  char copy[MAXBRCDLEN];
-  char* line = malloc(M);
-  if (line == NULL) {
+graph_t*
+add_batch(gstack_t* useqS,
+    ckpt_t* ckpt,
+    int tau,
+    int height,
+    int medianlen,
+    int thrmax,
+    kernel_t kernel,
+    uint32_t* forest)
+// SYNOPSIS:
+//   Builds the match graph of the sequences of a checkpoint and
+//   of a new batch of reads, merged in sort order in 'useqS'. The
+//   sequences of the checkpoint have their index in the checkpoint
+//   in 'node', the new sequences have 'NEW_NODE'. Only the new
+//   sequences are searched: the new sequences are split in blocks,
+//   and every block is inserted and searched in a trie with the
+//   sequences of the checkpoint and of the previous blocks (see
+//   'do_batch()'), so every new match is found once. The matches
+//   of the checkpoint are kept, and all the matches are in both
+//   directions. If 'forest' is not NULL, the pairs of matching
+//   sequences are also joined in it (see 'union_nodes()').
+//
+// RETURN:
+//   A pointer to the match graph. The graph of the checkpoint is
+//   destroyed, its sequences must be in 'useqS'.
+{
+  const size_t nseq = useqS->nitems;
+  const size_t nold = ckpt->graph->nnodes;
+
+  // Index the nodes and the blocks of the new sequences. The
+  // sequences of the checkpoint are in block -1.
+  uint32_t* remap = malloc(nold * sizeof(uint32_t));
+  int* block = malloc(nseq * sizeof(int));
+  gstack_t* newS = new_gstack();
+  if (remap == NULL || block == NULL || newS == NULL) {
     alert();
     krash();
   }
-
-  char* seq = NULL;
-  int count = 0;
-  int lineno = 0;
-
-  while ((nread = getline(&line, &nchar, inputf)) != -1) {
-    if (nread > MAXBRCDLEN) {
-      // Could trigger an overflow in 'copy'.
-      fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
-      fprintf(stderr, "offending line:\n%s\n", line);
-      abort();
-    }
-    lineno++;
-    if (line[nread - 1] == '\n')
-      line[nread - 1] = '\0';
-    if (sscanf(line, "%s\t%d", copy, &count) != 2) {
-      count = 1;
-      seq = line;
+  for (size_t i = 0; i < nseq; i++) {
+    useq_t* u = (useq_t*)useqS->items[i];
+    if (u->node == NEW_NODE) {
+      if (push(u, &newS)) {
+        alert();
+        krash();
+      }
     } else {
-      seq = copy;
+      remap[u->node] = i;
     }
-    size_t seqlen = strlen(seq);
-    for (size_t i = 0; i < seqlen; i++) {
-      if (!valid_DNA_char[(int)seq[i]]) {
-        fprintf(stderr, "invalid input\n");
-        fprintf(stderr, "offending sequence:\n%s\n", seq);
-        abort();
-      }
+    u->node = i;
+  }
+  const size_t nnew = newS->nitems;
+  const int nblocks = nnew < (size_t)thrmax ? (int)nnew : thrmax;
+  for (size_t i = 0, j = 0, b = 0; i < nseq; i++) {
+    block[i] = -1;
+    if (j < nnew && newS->items[j] == useqS->items[i]) {
+      while (j >= nnew * (b + 1) / nblocks)
+        b++;
+      block[i] = b;
+      j++;
     }
-    useq_t* new = new_useq(count, seq, NULL);
-    if (new == NULL) {
-      alert();
-      krash();
+  }
+
+  // The matches of the checkpoint are the edges of the first
+  // worker, the blocks are searched by the other workers.
+  mtplan_t mtplan = {0};
+  mtplan.nworkers = nblocks + 1;
+  mtplan.nparts = thrmax;
+  mtplan.edges = calloc((nblocks + 1) * thrmax, sizeof(edgebuf_t));
+  batchargs_t* args = calloc(nblocks, sizeof(batchargs_t));
+  pthread_t* threads = malloc(nblocks * sizeof(pthread_t));
+  if (mtplan.edges == NULL || (nblocks > 0 &&
+      (args == NULL || threads == NULL))) {
+    alert();
+    krash();
+  }
+
+  graph_t* graph = ckpt->graph;
+  for (size_t i = 0; i < nold; i++) {
+    for (size_t k = graph->offsets[i]; k < graph->offsets[i + 1]; k++) {
+      push_edge(remap[i], remap[graph->nbr[k]], graph->dist[k], thrmax,
+          mtplan.edges);
+      if (forest != NULL)
+        union_nodes(forest, remap[i], remap[graph->nbr[k]]);
     }
-    new->nids = 1;
-    new->seqid = malloc(sizeof(int));
-    if (new->seqid == NULL) {
+  }
+  destroy_graph(graph);
+  ckpt->graph = NULL;
+
+  for (int b = 0; b < nblocks; b++) {
+    args[b].useqS = useqS;
+    args[b].block = block;
+    args[b].medianlen = medianlen;
+    args[b].job = (mtjob_t){
+        .start = nnew * b / nblocks,
+        .end = nnew * (b + 1) / nblocks - 1,
+        .tau = tau,
+        .height = height,
+        .build = 1,
+        .queryid = b,
+        .trieid = b,
+        .useqS = newS,
+        .nparts = thrmax,
+        .edges = mtplan.edges + (b + 1) * thrmax,
+        .forest = forest,
+        .hamming = ckpt->hamming,
+        .kernel = kernel,
+        .bidir = 1,
+    };
+    if (pthread_create(threads + b, NULL, do_batch, args + b)) {
       alert();
       krash();
     }
-    new->seqid[0] = uSQ->nitems + 1;
-    push(new, &uSQ);
   }
+  for (int b = 0; b < nblocks; b++)
+    pthread_join(threads[b], NULL);
 
-  free(line);
-  return uSQ;
+  graph = merge_edges(&mtplan, useqS);
+
+  free(threads);
+  free(args);
+  free(newS);
+  free(block);
+  free(remap);
+
+  return graph;
 }
 
-gstack_t*
-read_fasta(FILE* inputf, gstack_t* uSQ) {
-  ssize_t nread;
-  size_t nchar = M;
-  char* line = malloc(M);
-  if (line == NULL) {
+void*
+do_batch(void* args)
+// SYNOPSIS:
+//   Thread body of 'add_batch()' for one block of new sequences.
+//   The trie and the lookup table of the job are filled with the
+//   sequences of the previous blocks, then the sequences of the
+//   block are inserted and searched (see 'do_query()').
+{
+  batchargs_t* batchargs = (batchargs_t*)args;
+  mtjob_t* job = &batchargs->job;
+  gstack_t* useqS = batchargs->useqS;
+  const int height = job->height;
+
+  job->trie = new_trie(height);
+  job->lut = new_lookup(batchargs->medianlen, height, job->tau);
+  char* seq = malloc(height + 1);
+  if (job->trie == NULL || job->lut == NULL || seq == NULL ||
+      reserve_trie(job->trie,
+          count_trie_nodes((useq_t**)useqS->items, 0, useqS->nitems, height),
+          useqS->nitems)) {
     alert();
     krash();
   }
+  for (size_t i = 0; i < useqS->nitems; i++) {
+    if (batchargs->block[i] >= job->trieid)
+      continue;
+    unpack_seq(useqS->items[i], seq, height);
+    void** data = insert_string_wo_malloc(job->trie, seq);
+    if (data == NULL || *data != NULL || lut_insert(job->lut, seq)) {
+      alert();
+      krash();
+    }
+    *data = useqS->items[i];
+  }
+  free(seq);
 
-  char* header = NULL;
-  int lineno = 0;
+  do_query(job);
 
-  int const readh = OUTPUTT == NRED_OUTPUT;
-  while ((nread = getline(&line, &nchar, inputf)) != -1) {
-    lineno++;
-    // Strip newline character.
-    if (line[nread - 1] == '\n')
-      line[nread - 1] = '\0';
+  destroy_trie(job->trie, NULL);
+  destroy_lookup(job->lut);
 
-    if (lineno % 2 == 0) {
-      size_t seqlen = strlen(line);
-      if (seqlen > MAXBRCDLEN) {
-        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
-        fprintf(stderr, "offending sequence:\n%s\n", line);
-        abort();
-      }
-      for (size_t i = 0; i < seqlen; i++) {
-        if (!valid_DNA_char[(int)line[i]]) {
-          fprintf(stderr, "invalid input\n");
-          fprintf(stderr, "offending sequence:\n%s\n", line);
-          abort();
-        }
-      }
-      useq_t* new = new_useq(1, line, header);
-      if (new == NULL) {
-        alert();
-        krash();
-      }
-      if (header != NULL) {
-        free(header);
-        header = NULL;
-      }
-      new->nids = 1;
-      new->seqid = malloc(sizeof(int));
-      if (new->seqid == NULL) {
-        alert();
-        krash();
-      }
-      new->seqid[0] = uSQ->nitems + 1;
-      push(new, &uSQ);
-    } else if (readh) {
-      header = strdup(line);
-      if (header == NULL) {
-        alert();
-        krash();
-      }
+  return NULL;
+}
+
+void
+orient_graph(graph_t* graph, double ratio)
+// SYNOPSIS:
+//   Turns a match graph with the matches in both directions into
+//   the graph of message passing clustering, where the match of
+//   a pair is only kept by the child, i.e. the sequence with the
+//   lower count, and only if the count of the parent is large
+//   enough, i.e. 'ratio' times the count of the child (see
+//   'do_query()'). The graph is modified in place.
+{
+  size_t k = 0;
+  for (size_t i = 0; i < graph->nnodes; i++) {
+    useq_t* child = graph->nodes[i];
+    size_t lo = graph->offsets[i];
+    size_t hi = graph->offsets[i + 1];
+    graph->offsets[i] = k;
+    for (size_t j = lo; j < hi; j++) {
+      useq_t* parent = graph->nodes[graph->nbr[j]];
+      // For ties, the parent is the lexicographically smaller.
+      if (parent->count < child->count ||
+          (parent->count == child->count &&
+              seq_order(&parent, &child) > 0))
+        continue;
+      if (parent->count < ratio * child->count)
+        continue;
+      graph->nbr[k] = graph->nbr[j];
+      graph->dist[k++] = graph->dist[j];
     }
   }
+  graph->offsets[graph->nnodes] = k;
+}
 
-  if (header != NULL)
-    free(header);  // If number of lines is odd.
-  free(line);
-  return uSQ;
+void*
+mt_worker(void* args)
+// SYNOPSIS:
+//   Body of the persistent threads started by 'run_plan()'. The
+//   worker takes the next job (see 'next_job()'), runs it with the
+//   mutex released and then releases the trie of the job. Tries
+//   are never used by two jobs at the same time because the search
+//   modifies the trie (the cache of the nodes and the pebbles). The
+//   worker returns when all the jobs of the plan are done.
+{
+  mtplan_t* mtplan = (mtplan_t*)args;
+  mtjob_t job;
+  int idx;
+
+  pthread_mutex_lock(mtplan->mutex);
+
+  // Each worker has its own edge buffers.
+  edgebuf_t* edges = mtplan->edges + mtplan->nworkers++ * mtplan->nparts;
+
+  while (1) {
+    // Sleep until a job is ready or all the jobs are done.
+    while ((idx = next_job(mtplan, &job)) < 0 &&
+        mtplan->jobsdone < mtplan->njobs)
+      pthread_cond_wait(mtplan->monitor, mtplan->mutex);
+    if (idx < 0)
+      break;
+
+    pthread_mutex_unlock(mtplan->mutex);
+    job.nparts = mtplan->nparts;
+    job.edges = edges;
+    job.forest = mtplan->forest;
+    job.hamming = mtplan->hamming;
+    job.kernel = mtplan->kernel;
+    job.bidir = mtplan->bidir;
+    job.ratio = mtplan->ratio;
+    do_query(&job);
+    pthread_mutex_lock(mtplan->mutex);
+
+    release_trie(mtplan, idx);
+    mtplan->jobsdone++;
+
+    // Wake up idle workers and the scheduler.
+    pthread_cond_broadcast(mtplan->monitor);
+  }
+  pthread_mutex_unlock(mtplan->mutex);
+
+  return NULL;
 }
 
-gstack_t*
-read_fastq(FILE* inputf, gstack_t* uSQ) {
-  ssize_t nread;
-  size_t nchar = M;
-  char* line = malloc(M);
-  if (line == NULL) {
+int
+next_job(mtplan_t* mtplan, mtjob_t* job)
+// SYNOPSIS:
+//   Copies the next job of the plan to 'job' and flags its trie
+//   as busy. In the static plan, the next job is the current job
+//   of the first trie of the ready queue. The mutex of the plan
+//   must be held by the caller.
+//
+// RETURN:
+//   The index of the trie of the job, or -1 if no job is ready.
+{
+  if (mtplan->steal)
+    return steal_job(mtplan, job);
+
+  if (mtplan->qsize == 0)
+    return -1;
+
+  // Pop the next ready trie and take its current job.
+  int idx = mtplan->queue[mtplan->qhead];
+  mtplan->qhead = (mtplan->qhead + 1) % mtplan->ntries;
+  mtplan->qsize--;
+  mttrie_t* mttrie = mtplan->tries + idx;
+  mttrie->flag = TRIE_BUSY;
+  *job = mttrie->jobs[mttrie->currentjob++];
+
+  return idx;
+}
+
+int
+steal_job(mtplan_t* mtplan, mtjob_t* job)
+// SYNOPSIS:
+//   Work-stealing version of 'next_job()'. The query blocks are
+//   split in 'nchunks' chunks and the pairs of blocks are not
+//   assigned to a trie in advance. Since a query of block i in
+//   trie j is the same as a query of block j in trie i, a pair
+//   can be claimed by whichever of its two tries becomes free
+//   first, so that busy tries with dense blocks have their pairs
+//   stolen by the idle tries. Once claimed, the pair is pinned to
+//   the trie and its chunks are run one at a time. As in the
+//   static plan, each trie is built from its own block first and
+//   every pair of blocks is searched exactly once.
+//
+//   Jobs are taken in the following order of priority: build
+//   jobs, chunks of pinned pairs, and finally a new pair claimed
+//   by the free trie with the most unclaimed pairs, against the
+//   partner block with the most unclaimed pairs.
+//
+// RETURN:
+//   The index of the trie of the job, or -1 if no job is ready.
+{
+  const int ntries = mtplan->ntries;
+
+  int idx = -1;
+  int claim = -1;
+  for (int i = 0; i < ntries; i++) {
+    mttrie_t* mttrie = mtplan->tries + i;
+    if (mttrie->flag != TRIE_FREE)
+      continue;
+    if (mttrie->currentjob == 0 || mttrie->partner >= 0) {
+      idx = i;
+      break;
+    }
+    // The pairs of this trie may all have been claimed by others.
+    if (mtplan->unclaimed[i] == 0) {
+      mttrie->flag = TRIE_DONE;
+      continue;
+    }
+    if (claim < 0 || mtplan->unclaimed[i] > mtplan->unclaimed[claim])
+      claim = i;
+  }
+
+  if (idx < 0 && claim >= 0) {
+    // Pin the pair to the claiming trie.
+    char* claimed = mtplan->claimed + claim * ntries;
+    int partner = -1;
+    for (int j = 0; j < ntries; j++) {
+      if (claimed[j])
+        continue;
+      if (partner < 0 || mtplan->unclaimed[j] > mtplan->unclaimed[partner])
+        partner = j;
+    }
+    mtplan->claimed[claim * ntries + partner] = 1;
+    mtplan->claimed[partner * ntries + claim] = 1;
+    mtplan->unclaimed[claim]--;
+    mtplan->unclaimed[partner]--;
+    mtplan->tries[claim].partner = partner;
+    mtplan->tries[claim].nextchunk = 0;
+    idx = claim;
+  }
+
+  if (idx < 0)
+    return -1;
+
+  mttrie_t* mttrie = mtplan->tries + idx;
+  mttrie->flag = TRIE_BUSY;
+
+  // The only static job of the trie is the build job.
+  *job = mttrie->jobs[0];
+  if (mttrie->currentjob == 0) {
+    mttrie->currentjob++;
+    return idx;
+  }
+
+  // Query the next chunk of the partner block.
+  const int p = mttrie->partner;
+  const int k = mttrie->nextchunk++;
+  const int nchunks = mtplan->nchunks;
+  const int size = mtplan->bounds[p + 1] - mtplan->bounds[p];
+  job->start = mtplan->bounds[p] + k * size / nchunks;
+  job->end = mtplan->bounds[p] + (k + 1) * size / nchunks - 1;
+  job->build = 0;
+  job->queryid = p + 1;
+  if (mttrie->nextchunk == nchunks)
+    mttrie->partner = -1;
+
+  return idx;
+}
+
+void
+release_trie(mtplan_t* mtplan, int idx)
+// SYNOPSIS:
+//   Flags the trie as free after a job, or as done if it has
+//   nothing left to do. In the static plan, the trie is put back
+//   at the end of the ready queue if it has more jobs. The mutex
+//   of the plan must be held by the caller.
+{
+  mttrie_t* mttrie = mtplan->tries + idx;
+
+  if (mtplan->steal) {
+    int idle = mttrie->partner < 0 && mtplan->unclaimed[idx] == 0;
+    mttrie->flag = idle ? TRIE_DONE : TRIE_FREE;
+    return;
+  }
+
+  if (mttrie->currentjob < mttrie->njobs) {
+    mttrie->flag = TRIE_FREE;
+    int tail = (mtplan->qhead + mtplan->qsize) % mtplan->ntries;
+    mtplan->queue[tail] = idx;
+    mtplan->qsize++;
+  } else {
+    mttrie->flag = TRIE_DONE;
+  }
+}
+
+void
+push_edge(uint32_t to, uint32_t from, int dist, int nparts, edgebuf_t* edges)
+// SYNOPSIS:
+//   Records an edge in the buffers of a worker. The buffer is
+//   chosen from the destination node, so that all the edges to
+//   a given node end up in the same partition.
+{
+  edgebuf_t* buf = edges + to % nparts;
+  if (buf->nitems >= buf->nslots) {
+    size_t nslots = buf->nslots ? 2 * buf->nslots : 64;
+    edge_t* items = realloc(buf->items, nslots * sizeof(edge_t));
+    if (items == NULL) {
+      alert();
+      krash();
+    }
+    buf->items = items;
+    buf->nslots = nslots;
+  }
+  edge_t* edge = buf->items + buf->nitems++;
+  edge->to = to;
+  edge->from = from;
+  edge->dist = dist;
+}
+
+graph_t*
+merge_edges(mtplan_t* mtplan, gstack_t* useqS)
+// SYNOPSIS:
+//   Builds the match graph from the edges found by the workers
+//   and frees the edge buffers. Every partition is processed by
+//   a different thread, which requires no locking since the
+//   partitions have no destination in common. The work is done
+//   in two phases: the matches of every node are counted, and
+//   after the offsets are computed, the matches are written in
+//   their final position (see 'merge_edges_part()'). The matches
+//   of a node are sorted by distance; for a given distance they
+//   are in order of worker and, for a given worker, in the order
+//   they were found.
+//
+// RETURN:
+//   A pointer to the match graph.
+{
+  const int nparts = mtplan->nparts;
+  const size_t nnodes = useqS->nitems;
+
+  graph_t* graph = malloc(sizeof(graph_t));
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  mergeargs_t* args = malloc(nparts * sizeof(mergeargs_t));
+  if (graph == NULL || threads == NULL || args == NULL) {
     alert();
     krash();
   }
 
-  char seq[M + 1] = {0};
-  char header[M + 1] = {0};
-  char info[2 * M + 2] = {0};
-  size_t lineno = 0;
+  // The offsets are used to count the matches in the first phase.
+  graph->nnodes = nnodes;
+  graph->offsets = calloc(nnodes + 1, sizeof(size_t));
+  graph->nodes = malloc(nnodes * sizeof(useq_t*));
+  if (graph->offsets == NULL || graph->nodes == NULL) {
+    alert();
+    krash();
+  }
+  memcpy(graph->nodes, useqS->items, nnodes * sizeof(useq_t*));
 
-  int const readh = OUTPUTT == NRED_OUTPUT;
-  while ((nread = getline(&line, &nchar, inputf)) != -1) {
-    lineno++;
-    // Strip newline character.
-    if (line[nread - 1] == '\n')
-      line[nread - 1] = '\0';
+  for (int i = 0; i < nparts; i++) {
+    args[i].mtplan = mtplan;
+    args[i].graph = graph;
+    args[i].part = i;
+  }
 
-    if (readh && lineno % 4 == 1) {
-      strncpy(header, line, M);
-    } else if (lineno % 4 == 2) {
-      size_t seqlen = strlen(line);
-      if (seqlen > MAXBRCDLEN) {
-        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
-        fprintf(stderr, "offending sequence:\n%s\n", line);
-        abort();
-      }
-      for (size_t i = 0; i < seqlen; i++) {
-        if (!valid_DNA_char[(int)line[i]]) {
-          fprintf(stderr, "invalid input\n");
-          fprintf(stderr, "offending sequence:\n%s\n", line);
-          abort();
-        }
-      }
-      strncpy(seq, line, M);
-    } else if (lineno % 4 == 0) {
-      if (readh) {
-        int status = snprintf(info, 2 * M + 2, "%s\n%s", header, line);
-        if (status < 0 || status > 2 * M - 1) {
-          alert();
-          krash();
-        }
+  for (int phase = 0; phase < 2; phase++) {
+    if (phase == 1) {
+      // Compute the offsets from the counts.
+      size_t total = 0;
+      for (size_t i = 0; i < nnodes; i++) {
+        size_t count = graph->offsets[i];
+        graph->offsets[i] = total;
+        total += count;
       }
-      useq_t* new = new_useq(1, seq, info);
-      if (new == NULL) {
+      graph->offsets[nnodes] = total;
+      graph->nbr = malloc(total * sizeof(uint32_t));
+      graph->dist = malloc(total * sizeof(unsigned char));
+      if ((graph->nbr == NULL || graph->dist == NULL) && total > 0) {
         alert();
         krash();
       }
-      new->nids = 1;
-      new->seqid = malloc(sizeof(int));
-      if (new->seqid == NULL) {
+    }
+    for (int i = 0; i < nparts; i++)
+      args[i].phase = phase;
+    if (nparts == 1) {
+      merge_edges_part(args);
+      continue;
+    }
+    for (int i = 0; i < nparts; i++) {
+      if (pthread_create(threads + i, NULL, merge_edges_part, args + i)) {
         alert();
         krash();
       }
-      new->seqid[0] = uSQ->nitems + 1;
-      push(new, &uSQ);
     }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
   }
 
-  free(line);
-  return uSQ;
+  for (int i = 0; i < mtplan->nworkers * nparts; i++)
+    free(mtplan->edges[i].items);
+  free(mtplan->edges);
+  mtplan->edges = NULL;
+
+  free(threads);
+  free(args);
+
+  return graph;
 }
 
-gstack_t*
-read_PE_fastq(FILE* inputf1, FILE* inputf2, gstack_t* uSQ) {
-  char c1 = fgetc(inputf1);
-  char c2 = fgetc(inputf2);
-  if (c1 != '@' || c2 != '@') {
-    fprintf(stderr, "input not a pair of fastq files\n");
-    abort();
+void*
+merge_edges_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'merge_edges()' for one partition. In the
+//   first phase, the matches of the nodes are counted in the
+//   offsets of the graph. In the second phase, the matches are
+//   written to the graph and sorted by distance. The nodes of
+//   the partition are those whose index modulo the number of
+//   partitions is the index of the partition.
+{
+  mergeargs_t* mergeargs = (mergeargs_t*)args;
+  mtplan_t* mtplan = mergeargs->mtplan;
+  graph_t* graph = mergeargs->graph;
+  const int nparts = mtplan->nparts;
+  const int part = mergeargs->part;
+
+  if (mergeargs->phase == 0) {
+    for (int w = 0; w < mtplan->nworkers; w++) {
+      edgebuf_t* buf = mtplan->edges + w * nparts + part;
+      for (size_t i = 0; i < buf->nitems; i++)
+        graph->offsets[buf->items[i].to]++;
+    }
+    return NULL;
   }
-  if (ungetc(c1, inputf1) == EOF || ungetc(c2, inputf2) == EOF) {
+
+  // Write the matches after those of the node already written.
+  // The number of matches already written is kept in a cursor
+  // per node of the partition.
+  size_t npnodes = (graph->nnodes + nparts - 1 - part) / nparts;
+  size_t* cursor = calloc(npnodes + 1, sizeof(size_t));
+  if (cursor == NULL) {
     alert();
     krash();
   }
-
-  ssize_t nread;
-  size_t nchar = M;
-  char* line1 = malloc(M);
-  char* line2 = malloc(M);
-  if (line1 == NULL && line2 == NULL) {
+  for (int w = 0; w < mtplan->nworkers; w++) {
+    edgebuf_t* buf = mtplan->edges + w * nparts + part;
+    for (size_t i = 0; i < buf->nitems; i++) {
+      edge_t* edge = buf->items + i;
+      size_t k = graph->offsets[edge->to] + cursor[edge->to / nparts]++;
+      graph->nbr[k] = edge->from;
+      graph->dist[k] = edge->dist;
+    }
+  }
+  free(cursor);
+
+  // Stable counting sort of the matches of every node by
+  // distance. The buffers are resized on demand.
+  size_t bufsize = 0;
+  uint32_t* nbr = NULL;
+  for (size_t i = part; i < graph->nnodes; i += nparts) {
+    size_t lo = graph->offsets[i];
+    size_t hi = graph->offsets[i + 1];
+    int sorted = 1;
+    for (size_t k = lo + 1; k < hi; k++) {
+      if (graph->dist[k] < graph->dist[k - 1]) {
+        sorted = 0;
+        break;
+      }
+    }
+    if (sorted)
+      continue;
+    if (hi - lo > bufsize) {
+      bufsize = hi - lo;
+      free(nbr);
+      nbr = malloc(bufsize * sizeof(uint32_t));
+      if (nbr == NULL) {
+        alert();
+        krash();
+      }
+    }
+    size_t start[STARCODE_MAX_TAU + 2] = {0};
+    for (size_t k = lo; k < hi; k++)
+      start[graph->dist[k] + 1]++;
+    for (int d = 1; d < STARCODE_MAX_TAU + 2; d++)
+      start[d] += start[d - 1];
+    for (size_t k = lo; k < hi; k++)
+      nbr[start[graph->dist[k]]++] = graph->nbr[k];
+    // Distances are now the cumulative counts.
+    size_t k = lo;
+    for (int d = 0; d < STARCODE_MAX_TAU + 1; d++) {
+      size_t count = start[d] - (k - lo);
+      memset(graph->dist + k, d, count);
+      k += count;
+    }
+    memcpy(graph->nbr + lo, nbr, (hi - lo) * sizeof(uint32_t));
+  }
+  free(nbr);
+
+  return NULL;
+}
+
+void
+destroy_graph(graph_t* graph) {
+  free(graph->offsets);
+  free(graph->nbr);
+  free(graph->dist);
+  free(graph->nodes);
+  free(graph);
+}
+
+void
+parents(graph_t* graph, useq_t* useq, size_t* lo, size_t* hi)
+// SYNOPSIS:
+//   Used in message passing clustering, where the matches of
+//   a sequence are its parents (sequences with higher counts).
+//   The direct parents are the matches at the lowest distance,
+//   the others are disregarded (indirect). The direct parents
+//   are the matches from 'lo' to 'hi' (excluded), which is an
+//   empty range if the sequence has no match.
+{
+  *lo = *hi = first_match(graph, useq);
+  while (*hi < end_match(graph, useq) &&
+         graph->dist[*hi] == graph->dist[*lo])
+    (*hi)++;
+}
+
+void*
+do_query(void* args) {
+  // Unpack arguments.
+  mtjob_t* job = (mtjob_t*)args;
+  gstack_t* useqS = job->useqS;
+  trie_t* trie = job->trie;
+  lookup_t* lut = job->lut;
+  seeds_t* seeds = job->seeds;
+  const int tau = job->tau;
+  const int height = job->height;
+
+  // Create local hit stack, and candidate stack for the
+  // seed-and-verify engine.
+  gstack_t** hits = new_tower(tau + 1);
+  gstack_t* cands = new_gstack();
+  if (hits == NULL || cands == NULL) {
     alert();
     krash();
   }
 
-  char seq1[M] = {0};
-  char seq2[M] = {0};
-  char seq[2 * M + 8] = {0};
-  char header1[M] = {0};
-  char header2[M] = {0};
-  char info[4 * M] = {0};
-  int lineno = 0;
+  // Buffers for the unpacked queries, padded to the height
+  // of the trie. The next query is needed to compute the
+  // trail and the last searched query to compute the start.
+  // The last buffer holds the candidates of the index.
+  char* buffers = malloc(4 * (height + 1));
+  if (buffers == NULL) {
+    alert();
+    krash();
+  }
+  char* seq = buffers;
+  char* next_seq = buffers + (height + 1);
+  char* last_seq = buffers + 2 * (height + 1);
+  char* target = buffers + 3 * (height + 1);
+  unpack_seq(useqS->items[job->start], seq, height);
 
-  int const readh = OUTPUTT == NRED_OUTPUT;
-  char sep[STARCODE_MAX_TAU + 2] = {0};
-  memset(sep, '-', STARCODE_MAX_TAU + 1);
+  // Define a constant to help the compiler recognize
+  // that only one of the two cases will ever be used
+  // in the loop below.
+  const int bidir_match = job->bidir;
+  useq_t* last_query = NULL;
 
-  while ((nread = getline(&line1, &nchar, inputf1)) != -1) {
-    lineno++;
-    // Strip newline character.
-    if (line1[nread - 1] == '\n')
-      line1[nread - 1] = '\0';
+  for (int i = job->start; i <= job->end; i++) {
+    useq_t* query = (useq_t*)useqS->items[i];
+    if (i < job->end)
+      unpack_seq(useqS->items[i + 1], next_seq, height);
+    // The index has its own filter.
+    int do_search = seeds != NULL || lut_search(lut, seq) == 1;
 
-    // Read line from second file and strip newline.
-    if ((nread = getline(&line2, &nchar, inputf2)) == -1) {
-      fprintf(stderr, "non conformable paired-end fastq files\n");
-      abort();
+    // Insert the new sequence in the lut and trie, but let
+    // the last pointer to NULL so that the query does not
+    // find itself upon search. The index skips the query
+    // instead.
+    void** data = NULL;
+    if (job->build && seeds != NULL) {
+      if (seeds_insert(seeds, seq, query)) {
+        alert();
+        krash();
+      }
+    } else if (job->build) {
+      if (lut_insert(lut, seq)) {
+        alert();
+        krash();
+      }
+      data = insert_string_wo_malloc(trie, seq);
+      if (data == NULL || *data != NULL) {
+        alert();
+        krash();
+      }
     }
-    if (line2[nread - 1] == '\n')
-      line2[nread - 1] = '\0';
 
-    if (readh && lineno % 4 == 1) {
-      // No check that the headers match each other. At the
-      // time of this writing, there are already different
-      // formats to link paired-end record. We assume that
-      // the users know what they do.
-      strncpy(header1, line1, M-1);
-      strncpy(header2, line2, M-1);
-    } else if (lineno % 4 == 2) {
-      size_t seqlen1 = strlen(line1);
-      size_t seqlen2 = strlen(line2);
-      if (seqlen1 > MAXBRCDLEN || seqlen2 > MAXBRCDLEN) {
-        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
-        fprintf(stderr, "offending sequences:\n%s\n%s\n", line1, line2);
-        abort();
-      }
-      for (size_t i = 0; i < seqlen1; i++) {
-        if (!valid_DNA_char[(int)line1[i]]) {
-          fprintf(stderr, "invalid input\n");
-          fprintf(stderr, "offending sequence:\n%s\n", line1);
-          abort();
+    if (do_search) {
+      int trail = 0;
+      if (i < job->end) {
+        // The 'while' condition is guaranteed to be false
+        // before the end of the 'char' arrays because all
+        // the queries have the same length and are different.
+        while (seq[trail] == next_seq[trail]) {
+          trail++;
         }
       }
-      for (size_t i = 0; i < seqlen2; i++) {
-        if (!valid_DNA_char[(int)line2[i]]) {
-          fprintf(stderr, "invalid input\n");
-          fprintf(stderr, "offending sequence:\n%s\n", line2);
-          abort();
-        }
+
+      // Compute start height.
+      int start = 0;
+      if (last_query != NULL) {
+        while (seq[start] == last_seq[start])
+          start++;
       }
-      strncpy(seq1, line1, M-1);
-      strncpy(seq2, line2, M-1);
-    } else if (lineno % 4 == 0) {
-      if (readh) {
-        int scheck = snprintf(
-            info, 4 * M, "%s\n%s\n%s\n%s", header1, line1, header2, line2);
-        if (scheck < 0 || scheck > 4 * M - 1) {
-          alert();
-          krash();
-        }
-      } else {
-        // No need for the headers, the 'info' member is
-        // used to hold a string representation of the pair.
-        int scheck = snprintf(info, 2 * M, "%s/%s", seq1, seq2);
-        if (scheck < 0 || scheck > 2 * M - 1) {
-          alert();
-          krash();
-        }
+
+      // Clear hit stack. //
+      for (int j = 0; hits[j] != TOWER_TOP; j++) {
+        hits[j]->nitems = 0;
       }
-      int scheck = snprintf(seq, 2 * M + 8, "%s%s%s", seq1, sep, seq2);
-      if (scheck < 0 || scheck > 2 * M + 7) {
+
+      // Search the trie or the index. //
+      int err = seeds != NULL ?
+          seeds_search(seeds, seq, query, tau, job->hamming, hits, &cands,
+              target) :
+          job->hamming ?
+          search_hamming(trie, seq, tau, hits, start, trail) :
+          search(trie, seq, tau, hits, start, trail, job->kernel);
+      if (err) {
         alert();
         krash();
       }
-      useq_t* new = new_useq(1, seq, info);
-      if (new == NULL) {
-        alert();
-        krash();
+
+      for (int j = 0; hits[j] != TOWER_TOP; j++) {
+        if (hits[j]->nitems > hits[j]->nslots) {
+          fprintf(stderr, "warning: incomplete search (%s)\n", seq);
+          break;
+        }
       }
-      new->nids = 1;
-      new->seqid = malloc(sizeof(int));
-      if (new->seqid == NULL) {
-        alert();
-        krash();
+
+      // Link matching pairs for clustering.
+      // Skip dist = 0, as this would be self.
+      for (int dist = 1; dist < tau + 1; dist++) {
+        for (size_t j = 0; j < hits[dist]->nitems; j++) {
+          useq_t* match = (useq_t*)hits[dist]->items[j];
+          if (bidir_match) {
+            // Make a bidirectional match reference: from query
+            // to matched node and from matched node to query.
+            push_edge(
+                query->node, match->node, dist, job->nparts, job->edges);
+            push_edge(
+                match->node, query->node, dist, job->nparts, job->edges);
+            if (job->forest != NULL)
+              union_nodes(job->forest, query->node, match->node);
+          }
+
+          else {
+            // The parent is the sequence with highest count.
+            // For ties, parent is the query and child is the match.
+            // Matches are stored in child only (i.e. children
+            // know their parents).
+            useq_t* parent = match->count > query->count ? match : query;
+            useq_t* child = match->count > query->count ? query : match;
+            // If clustering is done by message passing, do not link
+            // pair if counts are on the same order of magnitude.
+            int mincount = child->count;
+            int maxcount = parent->count;
+            if (maxcount < job->ratio * mincount)
+              continue;
+            // In case the ratio is set to 1, set parent to the
+            // lexicographically smaller. This will avoid circular
+            // parent references that produce infinite loops when
+            // clustering.
+            if (maxcount == mincount) {
+              if (seq_order(&parent, &child) > 0) {
+                useq_t* t = parent;
+                parent = child;
+                child = t;
+              }
+            }
+            push_edge(
+                child->node, parent->node, dist, job->nparts, job->edges);
+          }
+        }
       }
-      new->seqid[0] = uSQ->nitems + 1;
-      push(new, &uSQ);
+
+      last_query = query;
+      char* tmp = last_seq;
+      last_seq = seq;
+      seq = tmp;
+    }
+
+    if (data != NULL) {
+      // Finally set the pointer of the inserted tail node.
+      *data = query;
     }
+
+    char* tmp = seq;
+    seq = next_seq;
+    next_seq = tmp;
+  }
+
+  destroy_tower(hits);
+  free(cands);
+  free(buffers);
+
+  return NULL;
+}
+
+mtplan_t*
+plan_mt(int tau,
+    int height,
+    int medianlen,
+    int ntries,
+    int steal,
+    int engine,
+    gstack_t* useqS)
+// SYNOPSIS:
+//   The scheduler makes the key assumption that the number of tries is
+//   an odd number, which allows to distribute the jobs among as in the
+//   example shown below. The rows indicate blocks of query strings and
+//   the columns are distinct tries. An circle (o) indicates a build job,
+//   a cross (x) indicates a query job, and a dot (.) indicates that the
+//   block is not queried in the given trie.
+//
+//                            --- Tries ---
+//                            1  2  3  4  5
+//                         1  o  .  .  x  x
+//                         2  x  o  .  .  x
+//                         3  x  x  o  .  .
+//                         4  .  x  x  o  .
+//                         5  .  .  x  x  o
+//
+//   This simple schedule ensures that each trie is built from one query
+//   block and that each block is queried against every other exactly one
+//   time (a query of block i in trie j is the same as a query of block j
+//   in trie i).
+//
+//   If 'steal' is set, only the build jobs are planned and the query
+//   jobs are distributed at run time (see 'steal_job()').
+//
+//   The blocks are indexed in tries, or in the inverted indices of
+//   the seed-and-verify engine (see 'seeds_search()'). In "auto" mode,
+//   the latter is chosen when the sequences are long enough to cut
+//   'tau+1' k-mers of the maximum length, which are selective seeds,
+//   or when the tries would take more than half of the memory.
+{
+  if (ntries < 1) {
+    alert();
+    krash();
+  }
+
+  // Initialize plan.
+  mtplan_t* mtplan = malloc(sizeof(mtplan_t));
+  if (mtplan == NULL) {
+    alert();
+    krash();
+  }
+
+  // Initialize mutex.
+  pthread_mutex_t* mutex = malloc(sizeof(pthread_mutex_t));
+  pthread_cond_t* monitor = malloc(sizeof(pthread_cond_t));
+  if (mutex == NULL || monitor == NULL) {
+    alert();
+    krash();
+  }
+  pthread_mutex_init(mutex, NULL);
+  pthread_cond_init(monitor, NULL);
+
+  // Initialize 'mttries'.
+  mttrie_t* mttries = calloc(ntries, sizeof(mttrie_t));
+  int* queue = malloc(ntries * sizeof(int));
+  if (mttries == NULL || queue == NULL) {
+    alert();
+    krash();
+  }
+
+  // Boundaries of the query blocks.
+  int Q = useqS->nitems / ntries;
+  int R = useqS->nitems % ntries;
+  int* bounds = calloc(ntries + 1, sizeof(int));
+  for (int i = 0; i < ntries + 1; i++)
+    bounds[i] = Q * i + min(i, R);
+
+  // Preallocated tries.
+  // Count with maxlen-1
+  long* nnodes = calloc(ntries, sizeof(long));
+  for (int i = 0; i < ntries; i++)
+    nnodes[i] =
+        count_trie_nodes(
+            (useq_t**)useqS->items, bounds[i], bounds[i + 1], height);
+
+  if (engine == AUTO_ENGINE) {
+    double bytes = 0;
+    for (int i = 0; i < ntries; i++)
+      bytes += (double)nnodes[i] * (sizeof(node_t) + 1);
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    double memory = pages == -1 || pagesize == -1 ?
+        0 : (double)pages * pagesize;
+    int too_big = memory > 0 && bytes > memory / 2;
+    int too_long = medianlen / (tau + 1) >= MAX_K_FOR_LOOKUP;
+    engine = too_big || too_long ? SEED_ENGINE : TRIE_ENGINE;
+  }
+
+  // Create jobs for the tries.
+  for (int i = 0; i < ntries; i++) {
+    // Remember that 'ntries' is odd.
+    int njobs = steal ? 1 : (ntries + 1) / 2;
+    mtjob_t* jobs = calloc(njobs, sizeof(mtjob_t));
+    if (jobs == NULL) {
+      alert();
+      krash();
+    }
+
+    // The index replaces both the trie and the lookup struct.
+    trie_t* local_trie = NULL;
+    lookup_t* local_lut = NULL;
+    seeds_t* local_seeds = NULL;
+    if (engine == SEED_ENGINE) {
+      local_seeds =
+          new_seeds(medianlen, height, tau, bounds[i + 1] - bounds[i]);
+      if (local_seeds == NULL) {
+        alert();
+        krash();
+      }
+    } else {
+      local_trie = new_trie(height);
+      if (local_trie == NULL ||
+          reserve_trie(local_trie, nnodes[i], bounds[i + 1] - bounds[i])) {
+        alert();
+        krash();
+      }
+
+      // Allocate lookup struct.
+      // TODO: Try only one lut as well (it will always return 1
+      // in the query step though).
+      local_lut = new_lookup(medianlen, height, tau);
+      if (local_lut == NULL) {
+        alert();
+        krash();
+      }
+    }
+
+    mttries[i].flag = TRIE_FREE;
+    mttries[i].currentjob = 0;
+    mttries[i].njobs = njobs;
+    mttries[i].partner = -1;
+    mttries[i].nextchunk = 0;
+    mttries[i].jobs = jobs;
+
+    // All the tries start with a pending (build) job.
+    queue[i] = i;
+
+    for (int j = 0; j < njobs; j++) {
+      // Shift boundaries in a way that every trie is built
+      // exactly once and that no redundant jobs are allocated.
+      int idx = (i + j) % ntries;
+      int only_if_first_job = j == 0;
+      // Specifications of j-th job of the local trie.
+      jobs[j].start = bounds[idx];
+      jobs[j].end = bounds[idx + 1] - 1;
+      jobs[j].tau = tau;
+      jobs[j].height = height;
+      jobs[j].build = only_if_first_job;
+      jobs[j].useqS = useqS;
+      jobs[j].trie = local_trie;
+      jobs[j].lut = local_lut;
+      jobs[j].seeds = local_seeds;
+      // Block ids (1-based).
+      jobs[j].queryid = idx + 1;
+      jobs[j].trieid = i + 1;
+    }
+  }
+
+  free(nnodes);
+
+  // Pairs of blocks are claimed at run time when stealing.
+  // Chunks must not be empty, so their number is at most the
+  // size of the smallest block.
+  int nchunks = min(STEAL_NCHUNKS, Q);
+  int* unclaimed = NULL;
+  char* claimed = NULL;
+  if (steal) {
+    unclaimed = malloc(ntries * sizeof(int));
+    claimed = calloc(ntries * ntries, sizeof(char));
+    if (unclaimed == NULL || claimed == NULL) {
+      alert();
+      krash();
+    }
+    for (int i = 0; i < ntries; i++) {
+      unclaimed[i] = ntries - 1;
+      claimed[i * ntries + i] = 1;
+    }
+  }
+
+  mtplan->ntries = ntries;
+  mtplan->njobs = steal ?
+      ntries + ntries * (ntries - 1) / 2 * nchunks :
+      ntries * (ntries + 1) / 2;
+  mtplan->jobsdone = 0;
+  mtplan->qhead = 0;
+  mtplan->qsize = ntries;
+  mtplan->queue = queue;
+  mtplan->steal = steal;
+  mtplan->nchunks = nchunks;
+  mtplan->bounds = bounds;
+  mtplan->unclaimed = unclaimed;
+  mtplan->claimed = claimed;
+  mtplan->engine = engine;
+  mtplan->nworkers = 0;
+  mtplan->nparts = 0;
+  mtplan->edges = NULL;
+  mtplan->forest = NULL;
+  mtplan->hamming = 0;
+  mtplan->kernel = BYTEWISE_KERNEL;
+  mtplan->bidir = 0;
+  mtplan->ratio = 1.0;
+  mtplan->mutex = mutex;
+  mtplan->monitor = monitor;
+  mtplan->tries = mttries;
+
+  return mtplan;
+}
+
+long
+count_trie_nodes(useq_t** seqs, int start, int end, int height) {
+  int seqlen = height - 1;
+  long count = seqlen;
+  for (int i = start + 1; i < end; i++) {
+    useq_t* a = seqs[i - 1];
+    useq_t* b = seqs[i];
+    // Sequences are padded to 'height' so the shortest
+    // padding is a common prefix.
+    int prefix = height - max(a->len, b->len);
+    if (a->len == b->len)
+      prefix += seq_prefix(a, b);
+    count += seqlen - prefix;
+  }
+  return count;
+}
+
+uint32_t*
+new_forest(size_t nnodes)
+// SYNOPSIS:
+//   Creates a union-find forest of 'nnodes' nodes where every
+//   node is a root. The parent of node 'i' is 'forest[i]'.
+{
+  uint32_t* forest = malloc(nnodes * sizeof(uint32_t));
+  if (forest == NULL) {
+    alert();
+    krash();
+  }
+  for (size_t i = 0; i < nnodes; i++)
+    forest[i] = i;
+  return forest;
+}
+
+uint32_t
+find_root(uint32_t* forest, uint32_t node)
+// SYNOPSIS:
+//   Finds the root of 'node' in the forest and halves the path
+//   on the way. A parent is only replaced by one of its ancestors
+//   with an atomic compare-and-swap, so the function is lock-free
+//   and can run concurrently with 'union_nodes()'.
+//
+// RETURN:
+//   The root of 'node'.
+{
+  while (1) {
+    uint32_t parent = __atomic_load_n(forest + node, __ATOMIC_ACQUIRE);
+    if (parent == node)
+      return node;
+    uint32_t grandparent =
+        __atomic_load_n(forest + parent, __ATOMIC_ACQUIRE);
+    if (grandparent != parent) {
+      __atomic_compare_exchange_n(forest + node, &parent, grandparent, 0,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    node = grandparent;
+  }
+}
+
+void
+union_nodes(uint32_t* forest, uint32_t a, uint32_t b)
+// SYNOPSIS:
+//   Joins the trees of 'a' and 'b' in the forest. The root with
+//   the higher index is linked to the other, so no cycle can form
+//   and the root of a tree is always its node with the lowest
+//   index, whatever the order of the calls. The link is an atomic
+//   compare-and-swap that fails if another thread has linked the
+//   root in the meantime, in which case the roots are searched
+//   again. The search workers call this function for every match
+//   (see 'do_query()').
+{
+  while (1) {
+    a = find_root(forest, a);
+    b = find_root(forest, b);
+    if (a == b)
+      return;
+    if (a < b) {
+      uint32_t tmp = a;
+      a = b;
+      b = tmp;
+    }
+    uint32_t root = a;
+    if (__atomic_compare_exchange_n(forest + a, &root, b, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return;
+  }
+}
+
+gstack_t*
+compute_clusters(gstack_t* uSQ, graph_t* graph, uint32_t* forest, int thrmax)
+// SYNOPSIS:
+//   Gathers the connected components of the match graph, which
+//   are the trees of 'forest' (see 'union_nodes()'), and selects
+//   their centroids in parallel (see 'cluster_part()'). The
+//   members of a cluster are in the order of 'uSQ', except the
+//   centroid, which is swapped with the first member.
+//
+// RETURN:
+//   A stack of clusters sorted by decreasing count. The stack and
+//   the clusters are a single allocation, freed with 'free()'.
+//
+// SIDE EFFECTS:
+//   All the nodes of the forest are linked to their root.
+{
+  const size_t nnodes = uSQ->nitems;
+
+  // Count the members of the clusters at their root.
+  size_t* slot = calloc(nnodes, sizeof(size_t));
+  if (slot == NULL) {
+    alert();
+    krash();
+  }
+  size_t nclusters = 0;
+  for (size_t i = 0; i < nnodes; i++) {
+    forest[i] = find_root(forest, i);
+    nclusters += forest[i] == i;
+    slot[forest[i]]++;
+  }
+
+  // The clusters follow the stack of clusters, in the order of
+  // their first member. The slot of a root becomes the offset
+  // of its cluster.
+  gstack_t* clusters = malloc(sizeof(gstack_t) +
+      nclusters * (sizeof(gstack_t*) + sizeof(gstack_t)) +
+      nnodes * sizeof(useq_t*));
+  if (clusters == NULL) {
+    alert();
+    krash();
+  }
+  clusters->nslots = clusters->nitems = nclusters;
+  size_t offset = sizeof(gstack_t) + nclusters * sizeof(gstack_t*);
+  for (size_t i = 0, k = 0; i < nnodes; i++) {
+    if (forest[i] != i)
+      continue;
+    gstack_t* cluster = (gstack_t*)((char*)clusters + offset);
+    cluster->nslots = slot[i];
+    cluster->nitems = 0;
+    clusters->items[k++] = cluster;
+    slot[i] = offset;
+    offset += sizeof(gstack_t) + cluster->nslots * sizeof(useq_t*);
+  }
+  for (size_t i = 0; i < nnodes; i++) {
+    gstack_t* cluster = (gstack_t*)((char*)clusters + slot[forest[i]]);
+    cluster->items[cluster->nitems++] = uSQ->items[i];
+  }
+  free(slot);
+
+  // Find the centroids.
+  const int nparts = thrmax > 1 ? thrmax : 1;
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  clusterargs_t* args = malloc(nparts * sizeof(clusterargs_t));
+  if (threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+  for (int i = 0; i < nparts; i++) {
+    args[i].clusters = clusters;
+    args[i].graph = graph;
+    args[i].part = i;
+    args[i].nparts = nparts;
+  }
+  if (nparts == 1) {
+    cluster_part(args);
+  } else {
+    for (int i = 0; i < nparts; i++) {
+      if (pthread_create(threads + i, NULL, cluster_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  free(args);
+
+  // Sort clusters by size (counts).
+  qsort(
+      clusters->items, clusters->nitems, sizeof(gstack_t*), cluster_count);
+
+  return clusters;
+}
+
+void*
+cluster_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'compute_clusters()' for one part of the
+//   clusters, those whose index modulo the number of parts is
+//   the index of the part. The centroid of a cluster is the
+//   member with the highest count, then with the most matches,
+//   then the first. It is swapped with the first member and its
+//   count is set to the count of the cluster.
+{
+  clusterargs_t* clusterargs = (clusterargs_t*)args;
+  gstack_t* clusters = clusterargs->clusters;
+  graph_t* graph = clusterargs->graph;
+
+  for (size_t i = clusterargs->part; i < clusters->nitems;
+      i += clusterargs->nparts) {
+    gstack_t* cluster = (gstack_t*)clusters->items[i];
+    useq_t** members = (useq_t**)cluster->items;
+    size_t centroid = 0;
+    size_t edge_count = nmatches(graph, members[0]);
+    size_t cluster_count = 0;
+    for (size_t k = 0; k < cluster->nitems; k++) {
+      useq_t* u = members[k];
+      // Flag claimed.
+      u->canonical = u;
+      cluster_count += u->count;
+      if (u->count < members[centroid]->count)
+        continue;
+      size_t cnt = nmatches(graph, u);
+      if (u->count > members[centroid]->count || cnt > edge_count) {
+        centroid = k;
+        edge_count = cnt;
+      }
+    }
+    useq_t* u = members[centroid];
+    members[centroid] = members[0];
+    members[0] = u;
+    u->count = cluster_count;
+  }
+
+  return NULL;
+}
+
+void
+sphere_clustering(gstack_t* useqS, graph_t* graph, int thrmax)
+// SYNOPSIS:
+//   Greedy sphere clustering: in count order, every sequence that
+//   is not claimed yet becomes a centroid and claims its matches
+//   (see 'claim_sphere()'). With several threads, the sequences
+//   are processed in batches. The centroids of a batch whose
+//   sphere does not contain a node of the sphere of a previous
+//   centroid of the batch claim their sphere in parallel, the
+//   others are processed after, in count order (see
+//   'sphere_part()'). The result is the same as with one thread.
+{
+  // Sort in count order. The keys hold the total count of
+  // the matches since it is used by the comparator.
+  spherekey_t* keys = malloc(useqS->nitems * sizeof(spherekey_t));
+  if (keys == NULL) {
+    alert();
+    krash();
+  }
+  for (size_t i = 0; i < useqS->nitems; i++) {
+    useq_t* useq = (useq_t*)useqS->items[i];
+    keys[i].useq = useq;
+    keys[i].weight = nmatches(graph, useq) ? 0 : -1;
+    for (size_t k = first_match(graph, useq); k < end_match(graph, useq); k++)
+      keys[i].weight += graph->nodes[graph->nbr[k]]->count;
+  }
+  qsort(keys, useqS->nitems, sizeof(spherekey_t), count_order_spheres);
+  for (size_t i = 0; i < useqS->nitems; i++)
+    useqS->items[i] = keys[i].useq;
+  free(keys);
+
+  const int nparts = thrmax > 1 ? thrmax : 1;
+  if (nparts == 1) {
+    for (size_t i = 0; i < useqS->nitems; i++) {
+      useq_t* useq = (useq_t*)useqS->items[i];
+      if (useq->canonical == NULL)
+        claim_sphere(useq, graph);
+    }
+    return;
+  }
+
+  uint64_t* owner = malloc(graph->nnodes * sizeof(uint64_t));
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  sphereargs_t* args = malloc(nparts * sizeof(sphereargs_t));
+  if (owner == NULL || threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+  memset(owner, 0xff, graph->nnodes * sizeof(uint64_t));
+
+  uint64_t tag = (uint64_t)UINT32_MAX << 32;
+  for (size_t lo = 0; lo < useqS->nitems; lo += SPHERE_BATCH) {
+    size_t hi = min(lo + SPHERE_BATCH, useqS->nitems);
+    for (int phase = 0; phase < 2; phase++) {
+      for (int i = 0; i < nparts; i++) {
+        args[i] = (sphereargs_t){
+            .useqS = useqS,
+            .graph = graph,
+            .owner = owner,
+            .tag = tag,
+            .lo = lo,
+            .hi = hi,
+            .phase = phase,
+            .part = i,
+            .nparts = nparts,
+        };
+        if (pthread_create(threads + i, NULL, sphere_part, args + i)) {
+          alert();
+          krash();
+        }
+      }
+      for (int i = 0; i < nparts; i++)
+        pthread_join(threads[i], NULL);
+    }
+    // The centroids that share nodes with a previous centroid.
+    for (size_t i = lo; i < hi; i++) {
+      useq_t* useq = (useq_t*)useqS->items[i];
+      if (useq->canonical == NULL)
+        claim_sphere(useq, graph);
+    }
+    tag -= (uint64_t)1 << 32;
+  }
+
+  free(owner);
+  free(threads);
+  free(args);
+
+  return;
+}
+
+void*
+sphere_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'sphere_clustering()' for one slice of a batch.
+//   In the first phase, the centroids of the batch, i.e. the
+//   sequences that are not claimed, take ownership of the nodes
+//   of their sphere if they have no owner with a lower key. In
+//   the second phase, the centroids that own all the nodes of
+//   their sphere claim it. The spheres of these centroids have
+//   no node in common, and none of the nodes is in the sphere of
+//   a previous centroid of the batch, so they are claimed as they
+//   would be in count order.
+{
+  sphereargs_t* sphereargs = (sphereargs_t*)args;
+  gstack_t* useqS = sphereargs->useqS;
+  graph_t* graph = sphereargs->graph;
+  uint64_t* owner = sphereargs->owner;
+  const size_t lo = sphereargs->lo;
+  const size_t size = sphereargs->hi - lo;
+  const size_t start = lo + size * sphereargs->part / sphereargs->nparts;
+  const size_t end = lo + size * (sphereargs->part + 1) / sphereargs->nparts;
+
+  for (size_t i = start; i < end; i++) {
+    useq_t* useq = (useq_t*)useqS->items[i];
+    // Only the second phase claims sequences. In the second phase,
+    // a sequence claimed before the batch has no key.
+    if (sphereargs->phase == 0 && useq->canonical != NULL)
+      continue;
+    const uint64_t key = sphereargs->tag | (i - lo);
+    size_t k = first_match(graph, useq);
+    uint32_t node = useq->node;
+    int owned = 1;
+    while (1) {
+      if (sphereargs->phase == 0) {
+        uint64_t old = __atomic_load_n(owner + node, __ATOMIC_RELAXED);
+        while (key < old && !__atomic_compare_exchange_n(owner + node, &old,
+                   key, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+          ;
+      } else if (owner[node] != key) {
+        owned = 0;
+        break;
+      }
+      if (k == end_match(graph, useq))
+        break;
+      node = graph->nbr[k++];
+    }
+    if (sphereargs->phase == 1 && owned)
+      claim_sphere(useq, graph);
+  }
+
+  return NULL;
+}
+
+void
+claim_sphere(useq_t* useq, graph_t* graph)
+// SYNOPSIS:
+//   Makes 'useq' a centroid in sphere clustering, which claims its
+//   matches that are not claimed and steals those that are claimed
+//   by a farther centroid. The size of the sphere of the other
+//   centroid is updated atomically (see 'sphere_part()').
+{
+  useq->canonical = useq;
+  useq->sphere_c = useq->count;
+  useq->sphere_d = 0;
+  // Bidirectional edge references simplifie the algorithm.
+  // Directly proceed to claim neighbor counts. The matches
+  // are visited by distance, 'lo' and 'hi' are the bounds
+  // of the matches at distance 'd'.
+  size_t lo = first_match(graph, useq);
+  while (lo < end_match(graph, useq)) {
+    int d = graph->dist[lo];
+    size_t hi = lo;
+    while (hi < end_match(graph, useq) && graph->dist[hi] == d)
+      hi++;
+    const size_t next = hi;
+    for (size_t k = lo; k < hi; k++) {
+      useq_t* match = graph->nodes[graph->nbr[k]];
+      // If a sequence has been already claimed, move it to
+      // the end of the stratum, where it is out of the way.
+      if (match->canonical != NULL) {
+        // Steal sequence from the other sphere if it is closer to this
+        // centroid.
+        if (d < match->sphere_d) {
+          // Update other sphere size.
+          __atomic_fetch_sub(&match->canonical->sphere_c, match->count,
+              __ATOMIC_RELAXED);
+        } else {
+          uint32_t tmp = graph->nbr[k];
+          graph->nbr[k--] = graph->nbr[--hi];
+          graph->nbr[hi] = tmp;
+          continue;
+        }
+      }
+      // Claim the sequence.
+      useq->sphere_c += match->count;
+      match->canonical = useq;
+      match->sphere_d = d;
+    }
+    lo = next;
+  }
+}
+
+void
+message_passing_clustering(gstack_t* useqS, graph_t* graph, int thrmax)
+// SYNOPSIS:
+//   The parents of a sequence have a higher count, or the same
+//   count and a lower sort order, so the sequences are assigned
+//   to their canonical in waves of decreasing count. The parents
+//   of a sequence are in the previous waves, or in the same wave
+//   if the cluster ratio is 1. The sequences of large waves are
+//   split between threads (see 'mp_part()'), and those with a
+//   parent in the same wave are assigned after, in sort order.
+//   The ambiguous sequences are resolved last, in the order of
+//   the sequences and of their parents, because their canonical
+//   depends on the counts added by the previous ones (see
+//   'mp_resolve_ambiguous()').
+{
+  const size_t nnodes = useqS->nitems;
+  uint32_t* order = malloc(nnodes * sizeof(uint32_t));
+  uint32_t* rank = malloc(nnodes * sizeof(uint32_t));
+  if (order == NULL || rank == NULL) {
+    alert();
+    krash();
+  }
+
+  // Stable radix sort of the nodes by decreasing count, so the
+  // nodes with the same count remain in sort order. The ranks
+  // are the buffer of the sort.
+  ssize_t maxcount = 0;
+  for (size_t i = 0; i < nnodes; i++) {
+    order[i] = i;
+    if (graph->nodes[i]->count > maxcount)
+      maxcount = graph->nodes[i]->count;
+  }
+  for (int shift = 0; shift < 64 && (maxcount >> shift) > 0; shift += 8) {
+    size_t count[257] = {0};
+    for (size_t i = 0; i < nnodes; i++)
+      count[256 - ((graph->nodes[order[i]]->count >> shift) & 0xff)]++;
+    for (int b = 1; b < 257; b++)
+      count[b] += count[b - 1];
+    for (size_t i = 0; i < nnodes; i++) {
+      int b = 255 - ((graph->nodes[order[i]]->count >> shift) & 0xff);
+      rank[count[b]++] = order[i];
+    }
+    uint32_t* tmp = order;
+    order = rank;
+    rank = tmp;
+  }
+  for (size_t k = 0; k < nnodes; k++)
+    rank[order[k]] = k;
+
+  const int nparts = thrmax > 1 ? thrmax : 1;
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  mpargs_t* args = malloc(nparts * sizeof(mpargs_t));
+  if (threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+
+  // Transfer counts to parents in waves. The counts of the
+  // sequences of a wave are not modified before the wave.
+  size_t hi = 0;
+  for (size_t lo = 0; lo < nnodes; lo = hi) {
+    ssize_t count = graph->nodes[order[lo]]->count;
+    hi = lo + 1;
+    while (hi < nnodes && graph->nodes[order[hi]]->count == count)
+      hi++;
+    if (nparts == 1 || hi - lo < MP_PARALLEL_WAVE) {
+      for (size_t k = lo; k < hi; k++)
+        transfer_counts_and_update_canonicals(graph->nodes[order[k]], graph);
+      continue;
+    }
+    for (int i = 0; i < nparts; i++) {
+      args[i] = (mpargs_t){
+          .graph = graph,
+          .order = order,
+          .rank = rank,
+          .lo = lo,
+          .hi = hi,
+          .part = i,
+          .nparts = nparts,
+      };
+      if (pthread_create(threads + i, NULL, mp_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+    for (size_t k = lo; k < hi; k++) {
+      useq_t* u = graph->nodes[order[k]];
+      if (wave_parent(graph, u, rank, lo))
+        transfer_counts_and_update_canonicals(u, graph);
+    }
+  }
+
+  free(threads);
+  free(args);
+  free(order);
+  free(rank);
+
+  // Resolve ambiguous assignments. The parents are resolved
+  // first, the recursion is unrolled in a stack of sequences
+  // with the position of their next parent.
+  size_t nslots = 0;
+  size_t depth = 0;
+  useq_t** stack = NULL;
+  size_t* next = NULL;
+  for (size_t i = 0; i < nnodes; i++) {
+    useq_t* u = graph->nodes[i];
+    while (u != NULL) {
+      if (depth == nslots) {
+        nslots = nslots ? 2 * nslots : 64;
+        stack = realloc(stack, nslots * sizeof(useq_t*));
+        next = realloc(next, nslots * sizeof(size_t));
+        if (stack == NULL || next == NULL) {
+          alert();
+          krash();
+        }
+      }
+      if (u->canonical == NULL) {
+        stack[depth] = u;
+        next[depth++] = first_match(graph, u);
+      }
+      u = NULL;
+      while (depth > 0 && u == NULL) {
+        useq_t* top = stack[depth - 1];
+        size_t lo, end;
+        parents(graph, top, &lo, &end);
+        size_t k = next[depth - 1];
+        while (k < end && graph->nodes[graph->nbr[k]]->canonical != NULL)
+          k++;
+        next[depth - 1] = k + 1;
+        if (k < end) {
+          u = graph->nodes[graph->nbr[k]];
+        } else {
+          depth--;
+          mp_resolve_ambiguous(top, graph);
+        }
+      }
+    }
+  }
+  free(stack);
+  free(next);
+
+  return;
+}
+
+void*
+mp_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'message_passing_clustering()' for one slice of
+//   a wave. The sequences with a parent in the same wave are left
+//   to the calling thread.
+{
+  mpargs_t* mpargs = (mpargs_t*)args;
+  graph_t* graph = mpargs->graph;
+  const size_t lo = mpargs->lo;
+  const size_t size = mpargs->hi - lo;
+  const size_t start = lo + size * mpargs->part / mpargs->nparts;
+  const size_t end = lo + size * (mpargs->part + 1) / mpargs->nparts;
+
+  for (size_t k = start; k < end; k++) {
+    useq_t* u = graph->nodes[mpargs->order[k]];
+    if (!wave_parent(graph, u, mpargs->rank, lo))
+      transfer_counts_and_update_canonicals(u, graph);
+  }
+
+  return NULL;
+}
+
+int
+wave_parent(graph_t* graph, useq_t* useq, const uint32_t* rank, size_t lo)
+// SYNOPSIS:
+//   Used in message passing clustering to check if a direct parent
+//   of 'useq' is in the wave that starts at position 'lo' of the
+//   count order (see 'message_passing_clustering()').
+//
+// RETURN:
+//   1 if there is such a parent, 0 otherwise.
+{
+  size_t k, end;
+  parents(graph, useq, &k, &end);
+  for (; k < end; k++) {
+    if (rank[graph->nbr[k]] >= lo)
+      return 1;
+  }
+  return 0;
+}
+
+size_t
+seqsort(useq_t** data, size_t numels, int thrmax)
+// SYNOPSIS:
+//   Sort for 'useq_t' arrays, tailored for the problem of sorting
+//   merging identical sequences. Identical sequences are first
+//   merged into a single one with more counts by a hash table
+//   (see 'dedup_useq()'), and only the unique sequences are
+//   sorted. See 'nukesort()' for a description of the sort
+//   order. The sort is a radix sort on the packed sequences if
+//   none of them contains 'N' or '-' (see 'radix_sort()'), and
+//   a recursive merge sort otherwise.
+//
+// PARAMETERS:
+//   data:       an array of pointers to each element.
+//   numels:     number of elements, i.e. size of 'data'.
+//   thrmax: number of threads.
+//
+// RETURN:
+//   Number of unique elements.
+//
+// SIDE EFFECTS:
+//   Pointers to repeated elements are set to NULL.
+{
+  size_t nuniq = dedup_useq(data, numels, thrmax);
+
+  int special = 0;
+  for (size_t i = 0; i < nuniq; i++)
+    special |= data[i]->special;
+  if (!special) {
+    radix_sort(data, nuniq, thrmax);
+    return nuniq;
+  }
+
+  // Copy to buffer.
+  useq_t** buffer = calloc(nuniq, sizeof(useq_t*));
+  if (buffer == NULL && nuniq > 0) {
+    alert();
+    krash();
+  }
+  memcpy(buffer, data, nuniq * sizeof(useq_t*));
+
+  // Prepare args struct.
+  sortargs_t args;
+  args.buf0 = data;
+  args.buf1 = buffer;
+  args.size = nuniq;
+  // There are two alternating buffers for the merge step.
+  // 'args.b' alternates on every call to 'nukesort()' to
+  // keep track of which is the source and which is the
+  // destination. It has to be initialized to 0 so that
+  // sorted elements end in 'data' and not in 'buffer'.
+  args.b = 0;
+  args.thread = 0;
+  args.repeats = 0;
+
+  // Allocate a number of threads that is a power of 2.
+  while ((thrmax >> (args.thread + 1)) > 0)
+    args.thread++;
+
+  nukesort(&args);
+
+  free(buffer);
+  return nuniq - args.repeats;
+}
+
+size_t
+dedup_useq(useq_t** data, size_t numels, int thrmax)
+// SYNOPSIS:
+//   Merges identical sequences with hash tables. The sequences
+//   are hashed in parallel, and then every thread takes a shard
+//   of the hashes and merges the sequences of its shard in a
+//   table of its own, which requires no locking. The first
+//   occurrence of a sequence is kept and the others are merged
+//   into it in the order of the array, so the counts, the IDs
+//   and the info are the same as with a merge sort.
+//
+// RETURN:
+//   Number of unique elements, which are moved to the beginning
+//   of the array in the original order.
+//
+// SIDE EFFECTS:
+//   Pointers to repeated elements are set to NULL. The repeated
+//   elements are not freed (see 'release_reads()').
+{
+  if (numels < 2)
+    return numels;
+
+  const int nparts = thrmax > 1 ? thrmax : 1;
+  uint64_t* hash = malloc(numels * sizeof(uint64_t));
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  dedupargs_t* args = malloc(nparts * sizeof(dedupargs_t));
+  if (hash == NULL || threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+
+  for (int i = 0; i < nparts; i++) {
+    args[i].data = data;
+    args[i].numels = numels;
+    args[i].hash = hash;
+    args[i].part = i;
+    args[i].nparts = nparts;
+  }
+
+  for (int phase = 0; phase < 2; phase++) {
+    for (int i = 0; i < nparts; i++)
+      args[i].phase = phase;
+    if (nparts == 1) {
+      dedup_part(args);
+      continue;
+    }
+    for (int i = 0; i < nparts; i++) {
+      if (pthread_create(threads + i, NULL, dedup_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  // Move the unique sequences to the beginning.
+  size_t nuniq = 0;
+  for (size_t i = 0; i < numels; i++) {
+    if (data[i] != NULL)
+      data[nuniq++] = data[i];
+  }
+  memset(data + nuniq, 0, (numels - nuniq) * sizeof(useq_t*));
+
+  free(hash);
+  free(threads);
+  free(args);
+
+  return nuniq;
+}
+
+void*
+dedup_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'dedup_useq()'. In the first phase, the
+//   sequences of a slice of the array are hashed. In the second
+//   phase, the sequences of the shard are merged. The shard of a
+//   sequence is given by the high bits of the hash, and its slot
+//   in the table by the low bits.
+{
+  dedupargs_t* dedupargs = (dedupargs_t*)args;
+  useq_t** data = dedupargs->data;
+  uint64_t* hash = dedupargs->hash;
+  const size_t numels = dedupargs->numels;
+  const int nparts = dedupargs->nparts;
+  const int part = dedupargs->part;
+
+  if (dedupargs->phase == 0) {
+    size_t start = numels * part / nparts;
+    size_t end = numels * (part + 1) / nparts;
+    for (size_t i = start; i < end; i++)
+      hash[i] = seq_hash(data[i]);
+    return NULL;
+  }
+
+  // Open addressing with linear probing. The table holds the
+  // indices of the sequences plus one, and is at most half full.
+  size_t nitems = 0;
+  for (size_t i = 0; i < numels; i++)
+    nitems += (hash[i] >> 32) % nparts == (uint64_t)part;
+  size_t size = 16;
+  while (size < 2 * nitems)
+    size *= 2;
+  size_t* table = calloc(size, sizeof(size_t));
+  if (table == NULL) {
+    alert();
+    krash();
+  }
+
+  for (size_t i = 0; i < numels; i++) {
+    if ((hash[i] >> 32) % nparts != (uint64_t)part)
+      continue;
+    size_t slot = hash[i] & (size - 1);
+    while (table[slot]) {
+      size_t j = table[slot] - 1;
+      if (hash[j] == hash[i] && seq_order(data + j, data + i) == 0)
+        break;
+      slot = (slot + 1) & (size - 1);
+    }
+    if (table[slot] == 0) {
+      table[slot] = i + 1;
+      continue;
+    }
+    // Identical sequences, the duplicate is dropped.
+    useq_t* u = data[table[slot] - 1];
+    u->count += data[i]->count;
+    transfer_useq_ids(u, data[i]);
+    data[i] = NULL;
+  }
+
+  free(table);
+  return NULL;
+}
+
+void
+radix_sort(useq_t** data, size_t numels, int thrmax)
+// SYNOPSIS:
+//   Parallel radix sort for 'useq_t' arrays in the order of
+//   'seq_order()', for sequences without special characters.
+//   The key is the length followed by the packed bytes, which
+//   have the lexical order of the sequences. The array is first
+//   split in buckets by length and first byte with two passes of
+//   counting sort. The buckets are then sorted on the next bytes
+//   by different threads (see 'radix_part()'), each thread
+//   taking the buckets that start in its slice of the array.
+{
+  if (numels < 2)
+    return;
+
+  useq_t** buf = malloc(numels * sizeof(useq_t*));
+  size_t* count = calloc(MAXSEQLEN + 2, sizeof(size_t));
+  if (buf == NULL || count == NULL) {
+    alert();
+    krash();
+  }
+
+  // Stable counting sort on the first byte and then on the length.
+  for (size_t i = 0; i < 257; i++)
+    count[i] = 0;
+  for (size_t i = 0; i < numels; i++)
+    count[(data[i]->len > 0 ? data[i]->pack[0] : 0) + 1]++;
+  for (size_t i = 1; i < 257; i++)
+    count[i] += count[i - 1];
+  for (size_t i = 0; i < numels; i++)
+    buf[count[data[i]->len > 0 ? data[i]->pack[0] : 0]++] = data[i];
+
+  memset(count, 0, (MAXSEQLEN + 2) * sizeof(size_t));
+  for (size_t i = 0; i < numels; i++)
+    count[buf[i]->len + 1]++;
+  for (size_t i = 1; i < MAXSEQLEN + 2; i++)
+    count[i] += count[i - 1];
+  for (size_t i = 0; i < numels; i++)
+    data[count[buf[i]->len]++] = buf[i];
+  free(count);
+
+  // Boundaries of the buckets.
+  size_t nbuckets = 0;
+  size_t* bounds = malloc((numels + 1) * sizeof(size_t));
+  if (bounds == NULL) {
+    alert();
+    krash();
+  }
+  for (size_t i = 0; i < numels; i++) {
+    if (i == 0 || data[i]->len != data[i - 1]->len ||
+        (data[i]->len > 0 && data[i]->pack[0] != data[i - 1]->pack[0]))
+      bounds[nbuckets++] = i;
+  }
+  bounds[nbuckets] = numels;
+
+  const int nparts = thrmax > 1 ? thrmax : 1;
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  radixargs_t* args = malloc(nparts * sizeof(radixargs_t));
+  if (threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+  for (int i = 0; i < nparts; i++) {
+    args[i].data = data;
+    args[i].buf = buf;
+    args[i].bounds = bounds;
+    args[i].nbuckets = nbuckets;
+    args[i].part = i;
+    args[i].nparts = nparts;
+  }
+
+  if (nparts == 1) {
+    radix_part(args);
+  } else {
+    for (int i = 0; i < nparts; i++) {
+      if (pthread_create(threads + i, NULL, radix_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  free(bounds);
+  free(threads);
+  free(args);
+  free(buf);
+}
+
+void*
+radix_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'radix_sort()'. Sorts the buckets that start
+//   in the slice of the array of the thread.
+{
+  radixargs_t* radixargs = (radixargs_t*)args;
+  const size_t numels = radixargs->bounds[radixargs->nbuckets];
+  const size_t start = numels * radixargs->part / radixargs->nparts;
+  const size_t end = numels * (radixargs->part + 1) / radixargs->nparts;
+
+  for (size_t b = 0; b < radixargs->nbuckets; b++) {
+    size_t lo = radixargs->bounds[b];
+    size_t hi = radixargs->bounds[b + 1];
+    if (lo < start || lo >= end)
+      continue;
+    radix_bytes(radixargs->data + lo, radixargs->buf + lo, hi - lo, 1);
+  }
+
+  return NULL;
+}
+
+void
+radix_bytes(useq_t** data, useq_t** buf, size_t numels, int depth)
+// SYNOPSIS:
+//   Most significant digit radix sort of sequences of the same
+//   length and the same first 'depth' packed bytes. Small
+//   buckets are sorted by insertion.
+{
+  if (numels < 2)
+    return;
+  const int nbytes = (data[0]->len + 3) / 4;
+  if (depth >= nbytes)
+    return;
+
+  if (numels < 32) {
+    for (size_t i = 1; i < numels; i++) {
+      useq_t* u = data[i];
+      size_t j = i;
+      while (j > 0 && memcmp(data[j - 1]->pack + depth, u->pack + depth,
+                             nbytes - depth) > 0) {
+        data[j] = data[j - 1];
+        j--;
+      }
+      data[j] = u;
+    }
+    return;
+  }
+
+  size_t count[257] = {0};
+  for (size_t i = 0; i < numels; i++)
+    count[data[i]->pack[depth] + 1]++;
+  for (int i = 1; i < 257; i++)
+    count[i] += count[i - 1];
+  // After the scatter, 'count[i]' is the end of the bucket of
+  // byte 'i'.
+  for (size_t i = 0; i < numels; i++)
+    buf[count[data[i]->pack[depth]]++] = data[i];
+  memcpy(data, buf, numels * sizeof(useq_t*));
+
+  size_t lo = 0;
+  for (int i = 0; i < 256; i++) {
+    radix_bytes(data + lo, buf + lo, count[i] - lo, depth + 1);
+    lo = count[i];
+  }
+}
+
+void*
+nukesort(void* args)
+// SYNOPSIS:
+//   Recursive part of 'seqsort'. The code of 'nukesort()' is
+//   dangerous and should not be reused. It uses a very special
+//   sort order designed for starcode, it destroys some elements
+//   and sets them to NULL as it sorts. The sort order is based
+//   on the sequences and is such that a < b if a is shorter
+//   than b or if a has the same length as b and lower lexical
+//   order. When a is the same as b, the useq containing b is
+//   dropped and replaced by NULL. It is not freed, the reads
+//   are released in bulk (see 'release_reads()').
+//
+// ARGUMENTS:
+//   args: a sortargs_t struct (see private header file).
+//
+// RETURN:
+//   NULL pointer, regardless of the input
+//
+// SIDE EFFECTS:
+//   Sorts the array of 'useq_t' specified in 'args'.
+{
+  sortargs_t* sortargs = (sortargs_t*)args;
+  if (sortargs->size < 2)
+    return NULL;
+
+  // Next level params.
+  sortargs_t arg1 = *sortargs, arg2 = *sortargs;
+  arg1.size /= 2;
+  arg2.size = arg1.size + arg2.size % 2;
+  arg2.buf0 += arg1.size;
+  arg2.buf1 += arg1.size;
+  arg1.b = arg2.b = (arg1.b + 1) % 2;
+
+  // Either run threads or DIY.
+  if (arg1.thread) {
+    // Decrease one level.
+    arg1.thread = arg2.thread = arg1.thread - 1;
+    // Create threads.
+    pthread_t thread1, thread2;
+    if (pthread_create(&thread1, NULL, nukesort, &arg1) ||
+        pthread_create(&thread2, NULL, nukesort, &arg2)) {
+      alert();
+      krash();
+    }
+    // Wait for threads.
+    pthread_join(thread1, NULL);
+    pthread_join(thread2, NULL);
+  } else {
+    nukesort(&arg1);
+    nukesort(&arg2);
+  }
+
+  // Separate data and buffer (b specifies which is buffer).
+  useq_t** l = (sortargs->b ? arg1.buf0 : arg1.buf1);
+  useq_t** r = (sortargs->b ? arg2.buf0 : arg2.buf1);
+  useq_t** buf = (sortargs->b ? arg1.buf1 : arg1.buf0);
+
+  ssize_t i = 0;
+  ssize_t j = 0;
+  ssize_t idx = 0;
+  ssize_t repeats = 0;
+  int cmp = 0;
+
+  // Merge sets
+  while (i + j < sortargs->size) {
+    // Only NULLs at the end of the buffers.
+    if (j == arg2.size || r[j] == NULL) {
+      // Right buffer is exhausted. Copy left buffer...
+      memcpy(buf + idx, l + i, (arg1.size - i) * sizeof(useq_t*));
+      break;
+    }
+    if (i == arg1.size || l[i] == NULL) {
+      // ... or vice versa.
+      memcpy(buf + idx, r + j, (arg2.size - j) * sizeof(useq_t*));
+      break;
+    }
+    if (l[i] == NULL && r[j] == NULL)
+      break;
+
+    // Do the comparison.
+    useq_t* ul = (useq_t*)l[i];
+    useq_t* ur = (useq_t*)r[j];
+    cmp = seq_order(&ul, &ur);
+
+    if (cmp == 0) {
+      // Identical sequences, this is the "nuke" part.
+      // Add sequence counts. The duplicate is dropped,
+      // it is released with the arena.
+      ul->count += ur->count;
+      transfer_useq_ids(ul, ur);
+      buf[idx++] = l[i++];
+      j++;
+      repeats++;
+    } else if (cmp < 0)
+      buf[idx++] = l[i++];
+    else
+      buf[idx++] = r[j++];
+  }
+
+  // Accumulate repeats
+  sortargs->repeats = repeats + arg1.repeats + arg2.repeats;
+
+  // Pad with NULLS.
+  ssize_t offset = sortargs->size - sortargs->repeats;
+  memset(buf + offset, 0, sortargs->repeats * sizeof(useq_t*));
+
+  return NULL;
+}
+
+gstack_t*
+read_rawseq(FILE* inputf, gstack_t* uSQ, arena_t* arena) {
+  ssize_t nread;
+  size_t nchar = M;
+  char copy[MAXBRCDLEN];
+  char* line = malloc(M);
+  if (line == NULL) {
+    alert();
+    krash();
+  }
+
+  char* seq = NULL;
+  int count = 0;
+  int lineno = 0;
+
+  while ((nread = getline(&line, &nchar, inputf)) != -1) {
+    if (nread > MAXBRCDLEN) {
+      // Could trigger an overflow in 'copy'.
+      fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+      fprintf(stderr, "offending line:\n%s\n", line);
+      abort();
+    }
+    lineno++;
+    if (line[nread - 1] == '\n')
+      line[nread - 1] = '\0';
+    if (sscanf(line, "%s\t%d", copy, &count) != 2) {
+      count = 1;
+      seq = line;
+    } else {
+      seq = copy;
+    }
+    size_t seqlen = strlen(seq);
+    for (size_t i = 0; i < seqlen; i++) {
+      if (!valid_DNA_char[(int)seq[i]]) {
+        fprintf(stderr, "invalid input\n");
+        fprintf(stderr, "offending sequence:\n%s\n", seq);
+        abort();
+      }
+    }
+    useq_t* new = arena_useq(arena, count, seq, NULL);
+    if (new == NULL) {
+      alert();
+      krash();
+    }
+    new->nids = 1;
+    new->id = uSQ->nitems + 1;
+    new->seqid = &new->id;
+    push(new, &uSQ);
+  }
+
+  free(line);
+  return uSQ;
+}
+
+gstack_t*
+read_fasta(FILE* inputf, gstack_t* uSQ, arena_t* arena, const int readh) {
+  ssize_t nread;
+  size_t nchar = M;
+  char* line = malloc(M);
+  if (line == NULL) {
+    alert();
+    krash();
+  }
+
+  char* header = NULL;
+  int lineno = 0;
+
+  while ((nread = getline(&line, &nchar, inputf)) != -1) {
+    lineno++;
+    // Strip newline character.
+    if (line[nread - 1] == '\n')
+      line[nread - 1] = '\0';
+
+    if (lineno % 2 == 0) {
+      size_t seqlen = strlen(line);
+      if (seqlen > MAXBRCDLEN) {
+        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+        fprintf(stderr, "offending sequence:\n%s\n", line);
+        abort();
+      }
+      for (size_t i = 0; i < seqlen; i++) {
+        if (!valid_DNA_char[(int)line[i]]) {
+          fprintf(stderr, "invalid input\n");
+          fprintf(stderr, "offending sequence:\n%s\n", line);
+          abort();
+        }
+      }
+      useq_t* new = arena_useq(arena, 1, line, header);
+      if (new == NULL) {
+        alert();
+        krash();
+      }
+      if (header != NULL) {
+        free(header);
+        header = NULL;
+      }
+      new->nids = 1;
+      new->id = uSQ->nitems + 1;
+      new->seqid = &new->id;
+      push(new, &uSQ);
+    } else if (readh) {
+      header = strdup(line);
+      if (header == NULL) {
+        alert();
+        krash();
+      }
+    }
+  }
+
+  if (header != NULL)
+    free(header);  // If number of lines is odd.
+  free(line);
+  return uSQ;
+}
+
+gstack_t*
+read_fastq(FILE* inputf, gstack_t* uSQ, arena_t* arena, const int readh) {
+  ssize_t nread;
+  size_t nchar = M;
+  char* line = malloc(M);
+  if (line == NULL) {
+    alert();
+    krash();
+  }
+
+  char seq[M + 1] = {0};
+  char header[M + 1] = {0};
+  char info[2 * M + 2] = {0};
+  size_t lineno = 0;
+
+  while ((nread = getline(&line, &nchar, inputf)) != -1) {
+    lineno++;
+    // Strip newline character.
+    if (line[nread - 1] == '\n')
+      line[nread - 1] = '\0';
+
+    if (readh && lineno % 4 == 1) {
+      strncpy(header, line, M);
+    } else if (lineno % 4 == 2) {
+      size_t seqlen = strlen(line);
+      if (seqlen > MAXBRCDLEN) {
+        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+        fprintf(stderr, "offending sequence:\n%s\n", line);
+        abort();
+      }
+      for (size_t i = 0; i < seqlen; i++) {
+        if (!valid_DNA_char[(int)line[i]]) {
+          fprintf(stderr, "invalid input\n");
+          fprintf(stderr, "offending sequence:\n%s\n", line);
+          abort();
+        }
+      }
+      strncpy(seq, line, M);
+    } else if (lineno % 4 == 0) {
+      if (readh) {
+        int status = snprintf(info, 2 * M + 2, "%s\n%s", header, line);
+        if (status < 0 || status > 2 * M - 1) {
+          alert();
+          krash();
+        }
+      }
+      useq_t* new = arena_useq(arena, 1, seq, info);
+      if (new == NULL) {
+        alert();
+        krash();
+      }
+      new->nids = 1;
+      new->id = uSQ->nitems + 1;
+      new->seqid = &new->id;
+      push(new, &uSQ);
+    }
+  }
+
+  free(line);
+  return uSQ;
+}
+
+gstack_t*
+read_PE_fastq(FILE* inputf1,
+    FILE* inputf2,
+    gstack_t* uSQ,
+    arena_t* arena,
+    const int readh) {
+  char c1 = fgetc(inputf1);
+  char c2 = fgetc(inputf2);
+  if (c1 != '@' || c2 != '@') {
+    fprintf(stderr, "input not a pair of fastq files\n");
+    abort();
+  }
+  if (ungetc(c1, inputf1) == EOF || ungetc(c2, inputf2) == EOF) {
+    alert();
+    krash();
+  }
+
+  ssize_t nread;
+  size_t nchar = M;
+  char* line1 = malloc(M);
+  char* line2 = malloc(M);
+  if (line1 == NULL && line2 == NULL) {
+    alert();
+    krash();
+  }
+
+  char seq1[M] = {0};
+  char seq2[M] = {0};
+  char seq[2 * M + 8] = {0};
+  char header1[M] = {0};
+  char header2[M] = {0};
+  char info[4 * M] = {0};
+  int lineno = 0;
+
+  char sep[STARCODE_MAX_TAU + 2] = {0};
+  memset(sep, '-', STARCODE_MAX_TAU + 1);
+
+  while ((nread = getline(&line1, &nchar, inputf1)) != -1) {
+    lineno++;
+    // Strip newline character.
+    if (line1[nread - 1] == '\n')
+      line1[nread - 1] = '\0';
+
+    // Read line from second file and strip newline.
+    if ((nread = getline(&line2, &nchar, inputf2)) == -1) {
+      fprintf(stderr, "non conformable paired-end fastq files\n");
+      abort();
+    }
+    if (line2[nread - 1] == '\n')
+      line2[nread - 1] = '\0';
+
+    if (readh && lineno % 4 == 1) {
+      // No check that the headers match each other. At the
+      // time of this writing, there are already different
+      // formats to link paired-end record. We assume that
+      // the users know what they do.
+      strncpy(header1, line1, M-1);
+      strncpy(header2, line2, M-1);
+    } else if (lineno % 4 == 2) {
+      size_t seqlen1 = strlen(line1);
+      size_t seqlen2 = strlen(line2);
+      if (seqlen1 > MAXBRCDLEN || seqlen2 > MAXBRCDLEN) {
+        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+        fprintf(stderr, "offending sequences:\n%s\n%s\n", line1, line2);
+        abort();
+      }
+      for (size_t i = 0; i < seqlen1; i++) {
+        if (!valid_DNA_char[(int)line1[i]]) {
+          fprintf(stderr, "invalid input\n");
+          fprintf(stderr, "offending sequence:\n%s\n", line1);
+          abort();
+        }
+      }
+      for (size_t i = 0; i < seqlen2; i++) {
+        if (!valid_DNA_char[(int)line2[i]]) {
+          fprintf(stderr, "invalid input\n");
+          fprintf(stderr, "offending sequence:\n%s\n", line2);
+          abort();
+        }
+      }
+      strncpy(seq1, line1, M-1);
+      strncpy(seq2, line2, M-1);
+    } else if (lineno % 4 == 0) {
+      if (readh) {
+        int scheck = snprintf(
+            info, 4 * M, "%s\n%s\n%s\n%s", header1, line1, header2, line2);
+        if (scheck < 0 || scheck > 4 * M - 1) {
+          alert();
+          krash();
+        }
+      } else {
+        // No need for the headers, the 'info' member is
+        // used to hold a string representation of the pair.
+        int scheck = snprintf(info, 2 * M, "%s/%s", seq1, seq2);
+        if (scheck < 0 || scheck > 2 * M - 1) {
+          alert();
+          krash();
+        }
+      }
+      int scheck = snprintf(seq, 2 * M + 8, "%s%s%s", seq1, sep, seq2);
+      if (scheck < 0 || scheck > 2 * M + 7) {
+        alert();
+        krash();
+      }
+      useq_t* new = arena_useq(arena, 1, seq, info);
+      if (new == NULL) {
+        alert();
+        krash();
+      }
+      new->nids = 1;
+      new->id = uSQ->nitems + 1;
+      new->seqid = &new->id;
+      push(new, &uSQ);
+    }
+  }
+
+  free(line1);
+  free(line2);
+  return uSQ;
+}
+
+gstack_t*
+read_mapped(FILE* inputf,
+    gstack_t* uSQ,
+    int thrmax,
+    arena_t* arena,
+    format_t format,
+    const int readh)
+// SYNOPSIS:
+//   Reads a raw, FASTA or FASTQ file mapped in memory. The
+//   records are scanned in place and the sequences are packed
+//   directly from the mapped pages, without intermediate copy.
+//   Large files are parsed by up to 'thrmax' threads (see
+//   'scan_chunks()').
+//
+// RETURN:
+//   'uSQ' with the reads, or NULL if the file cannot be mapped
+//   (e.g. a pipe), in which case nothing is read.
+{
+  struct stat st;
+  int fd = fileno(inputf);
+  if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode))
+    return NULL;
+  // The format was guessed from the stream (see 'read_file()').
+  long offset = ftell(inputf);
+  if (offset < 0 || offset >= st.st_size)
+    return NULL;
+
+  size_t size = st.st_size;
+  char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return NULL;
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  size -= offset;
+  int nparts = min(thrmax, (int)min(size / PARSE_CHUNK, 1024));
+  uSQ = scan_chunks(data + offset, size, uSQ, arena, nparts, format, readh);
+
+  munmap(data, size + offset);
+  return uSQ;
+}
+
+gstack_t*
+scan_chunks(const char* data,
+    size_t size,
+    gstack_t* uSQ,
+    arena_t* arena,
+    int nparts,
+    format_t format,
+    const int readh)
+// SYNOPSIS:
+//   Parses a mapped file in 'nparts' chunks in parallel. The
+//   chunks are aligned on records (lines for raw files, pairs
+//   of lines for FASTA and groups of 4 lines for FASTQ), so
+//   the records are the same as with the sequential parse. In
+//   the first phase, the lines of the chunks are counted to
+//   know the number of the first line of every chunk. In the
+//   second phase, every chunk is parsed in a stack and an arena
+//   of its own (see 'scan_part()'). The reads are then appended
+//   to 'uSQ' in the order of the file and their ids are shifted
+//   by the number of reads in the previous chunks.
+//
+// RETURN:
+//   'uSQ' with the reads.
+{
+  const int period = format == FASTQ ? 4 : format == FASTA ? 2 : 1;
+  if (nparts < 2) {
+    if (format == FASTQ)
+      return scan_fastq(data, size, uSQ, arena, readh);
+    if (format == FASTA)
+      return scan_fasta(data, size, uSQ, arena, readh);
+    return scan_rawseq(data, size, uSQ, arena);
+  }
+
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  scanargs_t* args = malloc(nparts * sizeof(scanargs_t));
+  if (threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+
+  // Chunks of equal size, moved to the start of the next line.
+  for (int i = 0; i < nparts; i++) {
+    size_t start = size * i / nparts;
+    if (start > 0) {
+      const char* eol = memchr(data + start - 1, '\n', size - start + 1);
+      start = eol == NULL ? size : (size_t)(eol - data) + 1;
+    }
+    args[i].data = data;
+    args[i].start = start;
+    args[i].useqS = NULL;
+    args[i].arena = NULL;
+    args[i].format = format;
+    args[i].readh = readh;
+  }
+  for (int i = 0; i < nparts; i++)
+    args[i].end = i + 1 < nparts ? args[i + 1].start : size;
+
+  for (int phase = 0; phase < 2; phase++) {
+    if (phase == 1) {
+      // Move the chunks to the start of the next record.
+      size_t lineno = 0;
+      for (int i = 0; i < nparts; i++) {
+        size_t skip = (period - lineno % period) % period;
+        lineno += args[i].nlines;
+        const char* pos = data + args[i].start;
+        size_t len;
+        for (size_t k = 0; k < skip; k++)
+          next_line(&pos, data + size, &len);
+        args[i].start = pos - data;
+        if (i > 0)
+          args[i - 1].end = args[i].start;
+      }
+    }
+    for (int i = 0; i < nparts; i++) {
+      args[i].phase = phase;
+      if (pthread_create(threads + i, NULL, scan_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < nparts; i++) {
+    gstack_t* useqS = args[i].useqS;
+    int base = uSQ->nitems;
+    for (size_t k = 0; k < useqS->nitems; k++) {
+      useq_t* u = useqS->items[k];
+      u->id += base;
+      push(u, &uSQ);
+    }
+    free(useqS);
+    arena_merge(arena, args[i].arena);
+  }
+
+  free(threads);
+  free(args);
+
+  return uSQ;
+}
+
+void*
+scan_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'scan_chunks()'. In the first phase, counts
+//   the lines of the chunk. In the second phase, parses the
+//   chunk in a new stack and a new arena.
+{
+  scanargs_t* scanargs = (scanargs_t*)args;
+  const char* data = scanargs->data + scanargs->start;
+  size_t size = scanargs->end - scanargs->start;
+
+  if (scanargs->phase == 0) {
+    // The last line may have no newline, but it is in the
+    // last chunk.
+    size_t nlines = 0;
+    const char* pos = data;
+    const char* end = data + size;
+    while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+      nlines++;
+      pos++;
+    }
+    scanargs->nlines = nlines;
+    return NULL;
+  }
+
+  gstack_t* useqS = new_gstack();
+  arena_t* arena = new_arena();
+  if (scanargs->format == FASTQ)
+    useqS = scan_fastq(data, size, useqS, arena, scanargs->readh);
+  else if (scanargs->format == FASTA)
+    useqS = scan_fasta(data, size, useqS, arena, scanargs->readh);
+  else
+    useqS = scan_rawseq(data, size, useqS, arena);
+  scanargs->useqS = useqS;
+  scanargs->arena = arena;
+
+  return NULL;
+}
+
+const char*
+next_line(const char** pos, const char* end, size_t* len)
+// SYNOPSIS:
+//   Finds the next line of a mapped file. The position is moved
+//   after the newline character, which is not included in 'len'.
+//
+// RETURN:
+//   A pointer to the line (not null-terminated), or NULL at the
+//   end of the file.
+{
+  const char* line = *pos;
+  if (line >= end)
+    return NULL;
+  const char* eol = memchr(line, '\n', end - line);
+  if (eol == NULL) {
+    *len = end - line;
+    *pos = end;
+  } else {
+    *len = eol - line;
+    *pos = eol + 1;
+  }
+  return line;
+}
+
+int
+valid_seq(const char* seq, size_t len)
+// SYNOPSIS:
+//   Checks that the characters of a sequence are valid (see
+//   'valid_DNA_char'). The characters are tested in blocks of 8
+//   without branch, which the compiler can unroll.
+//
+// RETURN:
+//   1 if the sequence is valid, 0 otherwise.
+{
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    int valid = 1;
+    for (int j = 0; j < 8; j++)
+      valid &= valid_DNA_char[(uint8_t)seq[i + j]];
+    if (!valid)
+      return 0;
+  }
+  int valid = 1;
+  for (; i < len; i++)
+    valid &= valid_DNA_char[(uint8_t)seq[i]];
+  return valid;
+}
+
+gstack_t*
+scan_rawseq(const char* data, size_t size, gstack_t* uSQ, arena_t* arena)
+// SYNOPSIS:
+//   Same as 'read_rawseq()' for a mapped file. The lines are
+//   parsed in place like with 'sscanf(line, "%s\t%d")'.
+{
+  const char* pos = data;
+  const char* end = data + size;
+  const char* line;
+  size_t len;
+
+  while ((line = next_line(&pos, end, &len)) != NULL) {
+    if (pos - line > MAXBRCDLEN) {
+      fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+      fprintf(stderr, "offending line:\n%.*s\n", (int)len, line);
+      abort();
+    }
+    // A word, blanks and an integer, otherwise the whole line.
+    const char* seq = line;
+    size_t seqlen = len;
+    int count = 1;
+    size_t i = 0;
+    while (i < len && isspace((uint8_t)line[i]))
+      i++;
+    size_t j = i;
+    while (j < len && !isspace((uint8_t)line[j]))
+      j++;
+    size_t k = j;
+    while (k < len && isspace((uint8_t)line[k]))
+      k++;
+    int sign = 1;
+    if (k < len && (line[k] == '-' || line[k] == '+'))
+      sign = line[k++] == '-' ? -1 : 1;
+    if (j > i && k < len && isdigit((uint8_t)line[k])) {
+      long n = 0;
+      while (k < len && isdigit((uint8_t)line[k]))
+        n = 10 * n + (line[k++] - '0');
+      count = sign * n;
+      seq = line + i;
+      seqlen = j - i;
+    }
+    if (!valid_seq(seq, seqlen)) {
+      fprintf(stderr, "invalid input\n");
+      fprintf(stderr, "offending sequence:\n%.*s\n", (int)seqlen, seq);
+      abort();
+    }
+    useq_t* new = pack_useq(arena, count, seq, seqlen, NULL);
+    if (new == NULL) {
+      alert();
+      krash();
+    }
+    new->nids = 1;
+    new->id = uSQ->nitems + 1;
+    new->seqid = &new->id;
+    push(new, &uSQ);
+  }
+
+  return uSQ;
+}
+
+gstack_t*
+scan_fasta(const char* data,
+    size_t size,
+    gstack_t* uSQ,
+    arena_t* arena,
+    const int readh)
+// SYNOPSIS:
+//   Same as 'read_fasta()' for a mapped file.
+{
+  const char* pos = data;
+  const char* end = data + size;
+  const char* line;
+  size_t len;
+  size_t lineno = 0;
+
+  // The header is copied only when it is needed.
+  size_t hsize = 0;
+  char* header = NULL;
+  int hasheader = 0;
+
+  while ((line = next_line(&pos, end, &len)) != NULL) {
+    lineno++;
+    if (lineno % 2 == 0) {
+      if (len > MAXBRCDLEN) {
+        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+        fprintf(stderr, "offending sequence:\n%.*s\n", (int)len, line);
+        abort();
+      }
+      if (!valid_seq(line, len)) {
+        fprintf(stderr, "invalid input\n");
+        fprintf(stderr, "offending sequence:\n%.*s\n", (int)len, line);
+        abort();
+      }
+      useq_t* new =
+          pack_useq(arena, 1, line, len, hasheader ? header : NULL);
+      if (new == NULL) {
+        alert();
+        krash();
+      }
+      hasheader = 0;
+      new->nids = 1;
+      new->id = uSQ->nitems + 1;
+      new->seqid = &new->id;
+      push(new, &uSQ);
+    } else if (readh) {
+      if (len + 1 > hsize) {
+        hsize = 2 * (len + 1);
+        char* buf = realloc(header, hsize);
+        if (buf == NULL) {
+          alert();
+          krash();
+        }
+        header = buf;
+      }
+      memcpy(header, line, len);
+      header[len] = '\0';
+      hasheader = 1;
+    }
+  }
+
+  free(header);
+  return uSQ;
+}
+
+gstack_t*
+scan_fastq(const char* data,
+    size_t size,
+    gstack_t* uSQ,
+    arena_t* arena,
+    const int readh)
+// SYNOPSIS:
+//   Same as 'read_fastq()' for a mapped file.
+{
+  const char* pos = data;
+  const char* end = data + size;
+  const char* line;
+  size_t len;
+  size_t lineno = 0;
+
+  const char* seq = "";
+  size_t seqlen = 0;
+  char header[M + 1] = {0};
+  char info[2 * M + 2] = {0};
+
+  while ((line = next_line(&pos, end, &len)) != NULL) {
+    lineno++;
+    if (readh && lineno % 4 == 1) {
+      size_t hlen = min(len, M);
+      memcpy(header, line, hlen);
+      header[hlen] = '\0';
+    } else if (lineno % 4 == 2) {
+      if (len > MAXBRCDLEN) {
+        fprintf(stderr, "max sequence length exceeded (%d)\n", MAXBRCDLEN);
+        fprintf(stderr, "offending sequence:\n%.*s\n", (int)len, line);
+        abort();
+      }
+      if (!valid_seq(line, len)) {
+        fprintf(stderr, "invalid input\n");
+        fprintf(stderr, "offending sequence:\n%.*s\n", (int)len, line);
+        abort();
+      }
+      seq = line;
+      seqlen = len;
+    } else if (lineno % 4 == 0) {
+      if (readh) {
+        int status =
+            snprintf(info, 2 * M + 2, "%s\n%.*s", header, (int)len, line);
+        if (status < 0 || status > 2 * M - 1) {
+          alert();
+          krash();
+        }
+      }
+      useq_t* new = pack_useq(arena, 1, seq, seqlen, info);
+      if (new == NULL) {
+        alert();
+        krash();
+      }
+      new->nids = 1;
+      new->id = uSQ->nitems + 1;
+      new->seqid = &new->id;
+      push(new, &uSQ);
+    }
+  }
+
+  return uSQ;
+}
+
+format_t
+guess_format(int c, int verbose)
+// SYNOPSIS:
+//   Guesses the format of the input from its first character.
+{
+  switch (c) {
+    case '>':
+      if (verbose)
+        fprintf(stderr, "FASTA format detected\n");
+      return FASTA;
+    case '@':
+      if (verbose)
+        fprintf(stderr, "FASTQ format detected\n");
+      return FASTQ;
+    default:
+      if (verbose)
+        fprintf(stderr, "raw format detected\n");
+      return RAW;
+  }
+}
+
+gzin_t*
+new_gzin(FILE* inputf)
+// SYNOPSIS:
+//   Opens the input for inflation if it is compressed with gzip.
+//   The compressed input is read ahead by pieces of 'GZIP_READ'
+//   bytes, so the whole file is never in memory. BGZF files
+//   (gzip files made of independent blocks with their size in
+//   the header) are detected from their first block.
+//
+// RETURN:
+//   A new reader, or NULL if the input is not compressed, in
+//   which case the stream is unchanged.
+{
+  int c1 = fgetc(inputf);
+  if (c1 != 0x1f) {
+    if (c1 != EOF && ungetc(c1, inputf) == EOF) {
+      alert();
+      krash();
+    }
+    return NULL;
+  }
+  int c2 = fgetc(inputf);
+  if (c2 != 0x8b) {
+    if ((c2 != EOF && ungetc(c2, inputf) == EOF) ||
+        ungetc(c1, inputf) == EOF) {
+      alert();
+      krash();
+    }
+    return NULL;
+  }
+
+  gzin_t* gz = calloc(1, sizeof(gzin_t));
+  if (gz == NULL || (gz->data = malloc(GZIP_READ)) == NULL ||
+      inflateInit2(&gz->strm, 16 + MAX_WBITS) != Z_OK) {
+    alert();
+    krash();
+  }
+  gz->inputf = inputf;
+  gz->data[0] = c1;
+  gz->data[1] = c2;
+  gz->end = 2;
+  fill_gzin(gz);
+  gz->bgzf = bgzf_block_size(gz->data, gz->end) > 0;
+
+  return gz;
+}
+
+void
+destroy_gzin(gzin_t* gz) {
+  inflateEnd(&gz->strm);
+  free(gz->data);
+  free(gz->blocks);
+  free(gz->offsets);
+  free(gz);
+}
+
+void
+fill_gzin(gzin_t* gz)
+// SYNOPSIS:
+//   Moves the compressed bytes that are not consumed to the
+//   start of the read-ahead buffer and reads more input after
+//   them.
+{
+  if (gz->eof)
+    return;
+  if (gz->start > 0) {
+    memmove(gz->data, gz->data + gz->start, gz->end - gz->start);
+    gz->end -= gz->start;
+    gz->start = 0;
+  }
+  gz->end += fread(gz->data + gz->end, 1, GZIP_READ - gz->end, gz->inputf);
+  if (feof(gz->inputf) || ferror(gz->inputf))
+    gz->eof = 1;
+}
+
+size_t
+bgzf_block_size(const unsigned char* data, size_t avail)
+// SYNOPSIS:
+//   Reads the size of a BGZF block from its header (a gzip
+//   header with an extra subfield 'BC' holding the size).
+//
+// RETURN:
+//   The size of the block, or 0 if it is not a BGZF block.
+{
+  if (avail < 18 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 ||
+      !(data[3] & 4))
+    return 0;
+  size_t xlen = data[10] | (data[11] << 8);
+  if (12 + xlen > avail)
+    return 0;
+  const unsigned char* sub = data + 12;
+  while (sub + 4 <= data + 12 + xlen) {
+    size_t slen = sub[2] | (sub[3] << 8);
+    if (sub[0] == 'B' && sub[1] == 'C' && slen == 2 &&
+        sub + 6 <= data + 12 + xlen) {
+      size_t bsize = (sub[4] | (sub[5] << 8)) + 1;
+      if (bsize < 12 + xlen + 8 || bsize > avail)
+        return 0;
+      return bsize;
+    }
+    sub += 4 + slen;
+  }
+  return 0;
+}
+
+size_t
+inflate_bgzf(gzin_t* gz, char* text, size_t avail, int thrmax)
+// SYNOPSIS:
+//   Inflates the complete BGZF blocks of the read-ahead buffer
+//   in parallel, as many as fit in 'avail' bytes of 'text'. The
+//   size of the text of a block is at the end of the block, so
+//   every thread can inflate a range of blocks to their final
+//   position (see 'gunzip_part()'). If the next block is not a
+//   BGZF block, or does not fit, the reader switches to the
+//   stream inflation (see 'inflate_gzin()').
+//
+// RETURN:
+//   The number of bytes of text, 0 if there is no BGZF block.
+{
+  size_t total = 0;
+  size_t nblocks = 0;
+  size_t pos = gz->start;
+  while (total == 0) {
+    fill_gzin(gz);
+    pos = gz->start;
+    nblocks = 0;
+    while (pos < gz->end) {
+      size_t bsize = bgzf_block_size(gz->data + pos, gz->end - pos);
+      if (bsize == 0)
+        break;
+      const unsigned char* isize = gz->data + pos + bsize - 4;
+      size_t tsize = (size_t)isize[0] | (size_t)isize[1] << 8 |
+                     (size_t)isize[2] << 16 | (size_t)isize[3] << 24;
+      if (total + tsize > avail)
+        break;
+      if (nblocks + 1 >= gz->maxblocks) {
+        gz->maxblocks = gz->maxblocks ? 2 * gz->maxblocks : 1024;
+        gz->blocks = realloc(gz->blocks, gz->maxblocks * sizeof(size_t));
+        gz->offsets = realloc(gz->offsets, gz->maxblocks * sizeof(size_t));
+        if (gz->blocks == NULL || gz->offsets == NULL) {
+          alert();
+          krash();
+        }
+      }
+      gz->blocks[nblocks] = pos;
+      gz->offsets[nblocks++] = total;
+      total += tsize;
+      pos += bsize;
+    }
+    if (nblocks == 0) {
+      // Not a BGZF block (or truncated), the rest is a stream.
+      if (gz->start < gz->end)
+        gz->bgzf = 0;
+      return 0;
+    }
+    if (total == 0)
+      // Only empty blocks (e.g. the end-of-file marker).
+      gz->start = pos;
+  }
+  gz->blocks[nblocks] = pos;
+  gz->offsets[nblocks] = total;
+
+  int nparts = max(1, (int)min((size_t)thrmax, nblocks));
+  pthread_t* threads = malloc(nparts * sizeof(pthread_t));
+  gunzipargs_t* args = malloc(nparts * sizeof(gunzipargs_t));
+  if (threads == NULL || args == NULL) {
+    alert();
+    krash();
+  }
+  for (int i = 0; i < nparts; i++) {
+    args[i].data = gz->data;
+    args[i].blocks = gz->blocks;
+    args[i].offsets = gz->offsets;
+    args[i].text = text;
+    args[i].start = nblocks * i / nparts;
+    args[i].end = nblocks * (i + 1) / nparts;
+  }
+  if (nparts == 1) {
+    gunzip_part(args);
+  } else {
+    for (int i = 0; i < nparts; i++) {
+      if (pthread_create(threads + i, NULL, gunzip_part, args + i)) {
+        alert();
+        krash();
+      }
+    }
+    for (int i = 0; i < nparts; i++)
+      pthread_join(threads[i], NULL);
+  }
+
+  free(threads);
+  free(args);
+  gz->start = pos;
+  return total;
+}
+
+void*
+gunzip_part(void* args)
+// SYNOPSIS:
+//   Thread body of 'inflate_bgzf()'. Inflates a range of blocks.
+{
+  gunzipargs_t* gunzipargs = (gunzipargs_t*)args;
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+    alert();
+    krash();
+  }
+  for (size_t i = gunzipargs->start; i < gunzipargs->end; i++) {
+    size_t bstart = gunzipargs->blocks[i];
+    size_t tstart = gunzipargs->offsets[i];
+    strm.next_in = (unsigned char*)gunzipargs->data + bstart;
+    strm.avail_in = gunzipargs->blocks[i + 1] - bstart;
+    strm.next_out = (unsigned char*)gunzipargs->text + tstart;
+    strm.avail_out = gunzipargs->offsets[i + 1] - tstart;
+    if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.avail_out != 0) {
+      fprintf(stderr, "corrupted gzip input\n");
+      abort();
+    }
+    inflateReset(&strm);
+  }
+  inflateEnd(&strm);
+  return NULL;
+}
+
+size_t
+inflate_gzin(gzin_t* gz, char* text, size_t avail)
+// SYNOPSIS:
+//   Inflates the compressed input as a stream, which may consist
+//   of several gzip members, until 'avail' bytes of 'text' are
+//   filled or the input ends.
+//
+// RETURN:
+//   The number of bytes of text, 0 at the end of the input.
+{
+  z_stream* strm = &gz->strm;
+  // The sizes of zlib are 32-bit.
+  avail = min(avail, (size_t)1 << 30);
+  strm->next_out = (unsigned char*)text;
+  strm->avail_out = avail;
+  while (strm->avail_out > 0) {
+    if (gz->start == gz->end) {
+      fill_gzin(gz);
+      if (gz->start == gz->end) {
+        if (gz->member) {
+          fprintf(stderr, "truncated gzip input\n");
+          abort();
+        }
+        break;
+      }
+    }
+    strm->next_in = gz->data + gz->start;
+    strm->avail_in = gz->end - gz->start;
+    int status = inflate(strm, Z_NO_FLUSH);
+    gz->start = gz->end - strm->avail_in;
+    if (status == Z_STREAM_END) {
+      // Next member.
+      inflateReset(strm);
+      gz->member = 0;
+    } else if (status == Z_OK) {
+      gz->member = 1;
+    } else {
+      fprintf(stderr, "corrupted gzip input\n");
+      abort();
+    }
+  }
+  return avail - strm->avail_out;
+}
+
+ssize_t
+read_gzin(void* cookie, char* buf, size_t size)
+// SYNOPSIS:
+//   Read function of the stream of 'open_gzin()'.
+{
+  return inflate_gzin((gzin_t*)cookie, buf, size);
+}
+
+int
+close_gzin(void* cookie)
+// SYNOPSIS:
+//   Close function of the stream of 'open_gzin()'.
+{
+  destroy_gzin((gzin_t*)cookie);
+  return 0;
+}
+
+FILE*
+open_gzin(gzin_t* gz)
+// SYNOPSIS:
+//   Opens the inflated input as a stream, for the readers that
+//   read line by line. The reader is destroyed when the stream
+//   is closed.
+//
+// RETURN:
+//   The stream, or NULL in case of failure.
+{
+  cookie_io_functions_t io = {
+      .read = read_gzin,
+      .write = NULL,
+      .seek = NULL,
+      .close = close_gzin,
+  };
+  return fopencookie(gz, "r", io);
+}
+
+size_t
+record_end(const char* text, size_t size, int period)
+// SYNOPSIS:
+//   Finds the end of the last complete record of the text, where
+//   a record is 'period' lines.
+//
+// RETURN:
+//   The size of the complete records, 0 if there is none.
+{
+  size_t nlines = 0;
+  const char* end = text + size;
+  const char* pos = text;
+  while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+    nlines++;
+    pos++;
+  }
+  nlines -= nlines % period;
+  pos = text;
+  for (size_t i = 0; i < nlines; i++)
+    pos = (const char*)memchr(pos, '\n', end - pos) + 1;
+  return pos - text;
+}
+
+gstack_t*
+read_gzip(gzin_t* gz,
+    int thrmax,
+    arena_t* arena,
+    size_t window,
+    const int verbose,
+    const int readh,
+    format_t* formatp)
+// SYNOPSIS:
+//   Reads compressed input in windows of about 'window' bytes of
+//   text. The complete records of a window are parsed by up to
+//   'thrmax' threads (see 'scan_chunks()') and the last partial
+//   record is carried over to the next window, so the memory
+//   does not depend on the size of the input. The window grows
+//   only if a record does not fit. The format is guessed from
+//   the first character and is returned in 'formatp' (if not
+//   NULL).
+//
+// RETURN:
+//   The reads, or NULL if the input is empty.
+{
+  size_t bufsize = window;
+  char* text = malloc(bufsize);
+  if (text == NULL) {
+    alert();
+    krash();
+  }
+  gstack_t* uSQ = NULL;
+  format_t format = UNSET;
+  int period = 1;
+  size_t carry = 0;
+  for (;;) {
+    // A BGZF block has at most 64 KB of text.
+    size_t need = gz->bgzf ? 1 << 16 : window / 2 + 1;
+    while (bufsize - carry < need) {
+      bufsize *= 2;
+      char* buf = realloc(text, bufsize);
+      if (buf == NULL) {
+        alert();
+        krash();
+      }
+      text = buf;
+    }
+    size_t n = 0;
+    if (gz->bgzf)
+      n = inflate_bgzf(gz, text + carry, bufsize - carry, thrmax);
+    if (n == 0)
+      n = inflate_gzin(gz, text + carry, bufsize - carry);
+
+    size_t size = carry + n;
+    if (format == UNSET) {
+      if (size == 0)
+        break;
+      format = guess_format(text[0], verbose);
+      period = format == FASTQ ? 4 : format == FASTA ? 2 : 1;
+      uSQ = new_gstack();
+      if (uSQ == NULL) {
+        alert();
+        krash();
+      }
+    }
+    // The last record may have no newline.
+    size_t cut = n == 0 ? size : record_end(text, size, period);
+    if (cut > 0) {
+      int nparts = min(thrmax, (int)min(cut / PARSE_CHUNK, 1024));
+      uSQ = scan_chunks(text, cut, uSQ, arena, nparts, format, readh);
+    }
+    if (n == 0)
+      break;
+    carry = size - cut;
+    memmove(text, text + cut, carry);
+  }
+
+  free(text);
+  if (formatp != NULL && format != UNSET)
+    *formatp = format;
+  return uSQ;
+}
+
+gstack_t*
+read_file(
+    FILE* inputf1,
+    FILE* inputf2,
+    const int verbose,
+    const int thrmax,
+    arena_t* arena,
+    const int readh,
+    format_t* formatp) {
+  // The format is guessed from the first character and is
+  // returned in 'formatp' (if not NULL).
+  format_t format = UNSET;
+
+  // Compressed inputs are inflated by windows.
+  gzin_t* gz1 = new_gzin(inputf1);
+  int zipped1 = gz1 != NULL;
+  int zipped2 = 0;
+
+  if (inputf2 != NULL) {
+    format = PE_FASTQ;
+    gzin_t* gz2 = new_gzin(inputf2);
+    zipped2 = gz2 != NULL;
+    // The reader of paired-end files reads the text as streams.
+    if (zipped1)
+      inputf1 = open_gzin(gz1);
+    if (zipped2)
+      inputf2 = open_gzin(gz2);
+    if (inputf1 == NULL || inputf2 == NULL) {
+      alert();
+      krash();
+    }
+  } else if (zipped1) {
+    // Enough text for every thread to parse a chunk.
+    size_t window = (size_t)max(4, thrmax) * PARSE_CHUNK;
+    gstack_t* uSQ =
+        read_gzip(gz1, thrmax, arena, window, verbose, readh, formatp);
+    destroy_gzin(gz1);
+    return uSQ;
+  } else {
+    // Read first line of the file to guess format.
+    int c = fgetc(inputf1);
+    if (c == EOF) {
+      // Empty file.
+      return NULL;
+    }
+    format = guess_format(c, verbose);
+    if (ungetc(c, inputf1) == EOF) {
+      alert();
+      krash();
+    }
+  }
+
+  if (formatp != NULL)
+    *formatp = format;
+
+  gstack_t* uSQ = new_gstack();
+  if (uSQ == NULL) {
+    alert();
+    krash();
+  }
+
+  // Regular files are mapped in memory, the other inputs
+  // are read line by line.
+  if (format != PE_FASTQ) {
+    gstack_t* mapped = read_mapped(inputf1, uSQ, thrmax, arena, format, readh);
+    if (mapped != NULL)
+      return mapped;
+  }
+
+  if (format == RAW)
+    return read_rawseq(inputf1, uSQ, arena);
+  if (format == FASTA)
+    return read_fasta(inputf1, uSQ, arena, readh);
+  if (format == FASTQ)
+    return read_fastq(inputf1, uSQ, arena, readh);
+  if (format == PE_FASTQ) {
+    uSQ = read_PE_fastq(inputf1, inputf2, uSQ, arena, readh);
+    if (zipped1)
+      fclose(inputf1);
+    if (zipped2)
+      fclose(inputf2);
+    return uSQ;
+  }
+
+  return NULL;
+}
+
+int
+pad_useq(gstack_t* useqS, int* median)
+// SYNOPSIS:
+//   Computes the length to which the sequences are padded
+//   with spaces for the search, and their median length. The
+//   padding is not stored, it is added when the sequences
+//   are unpacked (see 'unpack_seq()').
+//
+// RETURN:
+//   The padded length, i.e. the length of the longest sequence.
+{
+  // Compute maximum length.
+  int maxlen = 0;
+  for (size_t i = 0; i < useqS->nitems; i++) {
+    useq_t* u = useqS->items[i];
+    if (u->len > maxlen)
+      maxlen = u->len;
+  }
+
+  // Alloc median bins. (Initializes to 0)
+  size_t* count = calloc(maxlen + 1, sizeof(size_t));
+  if (count == NULL) {
+    alert();
+    krash();
+  }
+  for (size_t i = 0; i < useqS->nitems; i++) {
+    useq_t* u = useqS->items[i];
+    count[u->len]++;
+  }
+
+  // Compute median.
+  *median = 0;
+  size_t ccount = 0;
+  do {
+    ccount += count[++(*median)];
+  } while (ccount < useqS->nitems / 2);
+
+  // Free and return.
+  free(count);
+  return maxlen;
+}
+
+void
+transfer_useq_ids(useq_t* ud, useq_t* us)
+// Appends the sequence ID list from 'us' to 'ud',
+// the final list is unsorted. Lists of more than one
+// ID are on the heap with a capacity that is a power
+// of 2, and the list of 'us' is freed.
+{
+  if (us->nids < 1)
+    return;
+  unsigned int nids = ud->nids + us->nids;
+  int* ids = ud->seqid == &ud->id ? NULL : ud->seqid;
+  if (ids == NULL || nids > id_capacity(ud->nids)) {
+    // Realloc destination buffer.
+    int* buf = realloc(ids, id_capacity(nids) * sizeof(int));
+    if (buf == NULL) {
+      alert();
+      krash();
+    }
+    if (ids == NULL && ud->nids > 0)
+      buf[0] = ud->id;
+    ud->seqid = buf;
+  }
+  // Copy source list of ids to ud.
+  memcpy(ud->seqid + ud->nids, us->seqid, us->nids * sizeof(int));
+  // Update id counts in both sequences.
+  ud->nids = nids;
+  if (us->seqid != &us->id)
+    free(us->seqid);
+  us->seqid = NULL;
+  us->nids = 0;
+}
+
+unsigned int
+id_capacity(unsigned int nids)
+// Capacity of a list of 'nids' IDs on the heap.
+{
+  unsigned int capacity = 2;
+  while (capacity < nids)
+    capacity *= 2;
+  return capacity;
+}
+
+void
+transfer_sorted_useq_ids(useq_t* ud, useq_t* us)
+// Appends the sequence ID list from 'us' to 'ud'
+// and sorts the final list.
+{
+  if (us->nids < 1)
+    return;
+  // Alloc merge-sort buffer.
+  int* buf = calloc(id_capacity(ud->nids + us->nids), sizeof(int));
+  if (buf == NULL) {
+    alert();
+    krash();
+  }
+  int *s, *d;
+  d = ud->seqid;
+  s = us->seqid;
+  // Merge algorithm (keeps them sorted and unique).
+  uint32_t i = 0, j = 0, k = 0;
+  while (i < ud->nids && j < us->nids) {
+    if (d[i] < s[j])
+      buf[k++] = d[i++];
+    else if (d[i] > s[j])
+      buf[k++] = s[j++];
+    else {
+      buf[k++] = d[i];
+      i++;
+      j++;
+    }
+  }
+  // TODO: use memcpy.
+  for (; i < ud->nids; i++)
+    buf[k++] = d[i];
+  for (; j < us->nids; j++)
+    buf[k++] = s[j];
+  // Update ID count.
+  if (ud->seqid != &ud->id)
+    free(ud->seqid);
+  if (us->seqid != &us->id)
+    free(us->seqid);
+  ud->seqid = buf;
+  ud->nids = k;
+  us->seqid = NULL;
+  us->nids = 0;
+}
+
+void
+transfer_counts_and_update_canonicals(useq_t* useq, graph_t* graph)
+// SYNOPSIS:
+//   Function used in message passing clustering to assign a
+//   sequence once its parents are assigned. A sequence without
+//   parents is canonical. If all the direct parents have the same
+//   canonical, the sequence is assigned to it and its count is
+//   transferred, otherwise it is flagged as ambiguous and resolved
+//   later (see 'mp_resolve_ambiguous()'). The sphere size of a
+//   canonical is increased for every sequence assigned to it and
+//   for every direct child of these sequences. The canonicals are
+//   updated atomically so the sequences of a wave can be assigned
+//   by several threads (see 'message_passing_clustering()').
+{
+  // If the read has no matches, it has no parent, so
+  // it is an ancestor and it must be canonical.
+  if (nmatches(graph, useq) == 0) {
+    useq->canonical = useq;
+    return;
+  }
+
+  // The matches are parents (useq with higher counts)
+  // sorted by distance to self.
+  size_t lo, hi;
+  parents(graph, useq, &lo, &hi);
+
+  // Self canonical is the canonical of the first parent...
+  useq_t* canonical = graph->nodes[graph->nbr[lo]]->canonical;
+  // ... but if parents have different canonicals then
+  // self canonical is set to 'NULL'. (ambiguous)
+  for (size_t i = lo; i < hi; i++) {
+    useq_t* match = graph->nodes[graph->nbr[i]];
+    if (match->canonical == NULL || match->canonical != canonical)
+      canonical = NULL;
+    // The sphere of the canonical of an assigned parent
+    // counts its children.
+    if (match->canonical != NULL && match->canonical != match)
+      __atomic_fetch_add(&match->canonical->sphere_c, 1, __ATOMIC_RELAXED);
+  }
+
+  // Set canonical and transfer counts and ids.
+  if (canonical) {
+    useq->canonical = canonical;
+
+    // Transfer counts and seq_ids to canonical.
+    __atomic_fetch_add(&canonical->count, useq->count, __ATOMIC_RELAXED);
+    useq->count = 0;
+    // Increase canonical sphere size.
+    __atomic_fetch_add(&canonical->sphere_c, 1, __ATOMIC_RELAXED);
+  }
+  // Otherwise, flag as ambiguous.
+  else {
+    useq->sphere_d = 1;
+  }
+
+  return;
+}
+
+void
+mp_resolve_ambiguous(useq_t* useq, graph_t* graph)
+// SYNOPSIS:
+//   Function used in message passing clustering to assign an
+//   ambiguous sequence once its parents are assigned (see
+//   'message_passing_clustering()').
+{
+  // Ambiguous sequences must have NULL canonicals.
+  if (useq->canonical != NULL) {
+    return;
+  }
+
+  // Get parents.
+  size_t lo, hi;
+  parents(graph, useq, &lo, &hi);
+
+  // Select canonical. Criteria:
+  // 1. The canonical parent with more counts.
+  // 2. The canonical parent whose sphere has more sequences.
+  // 3. The parent whose canonical has more counts.
+
+  // Criteria 1 and 2.
+  useq_t* canonical = NULL;
+  int cnt_max = 0;
+  int ssz_max = 0;
+  for (size_t i = lo; i < hi; i++) {
+    useq_t* match = graph->nodes[graph->nbr[i]];
+    if (match->canonical == match) {
+      if (match->count > cnt_max) {
+        canonical = match;
+        cnt_max = canonical->count;
+        ssz_max = canonical->sphere_c;
+      }
+      // Same count, compare sphere size.
+      else if (match->count == cnt_max && match != canonical) {
+        if (match->sphere_c > ssz_max) {
+          canonical = match;
+          ssz_max = canonical->sphere_c;
+        } else if (match->sphere_c == ssz_max)
+          canonical = NULL;
+      }
+    }
+  }
+
+  // Criterion 3.
+  if (canonical == NULL) {
+    cnt_max = 0;
+    for (size_t i = lo; i < hi; i++) {
+      useq_t* match_canon = graph->nodes[graph->nbr[i]]->canonical;
+      if (match_canon->count > cnt_max) {
+        cnt_max = match_canon->count;
+        canonical = match_canon;
+      }
+    }
+  }
+
+  // This should not ever happen. It is only a security
+  // to avoid dereferencing a null pointer below.
+  if (canonical == NULL) {
+    alert();
+    krash();
+  }
+
+  // Transfer counts and seq ids to canonical.
+  useq->canonical = canonical;
+
+  // Transfer counts and seq_ids to canonical.
+  canonical->count += useq->count;
+  useq->count = 0;
+  // Increase canonical sphere size.
+  canonical->sphere_c += 1;
+}
+
+lookup_t*
+new_lookup(int slen, int maxlen, int tau) {
+  lookup_t* lut = (lookup_t*)malloc(
+      2 * sizeof(int) + sizeof(int*) + (tau + 1) * sizeof(char*));
+  if (lut == NULL) {
+    alert();
+    return NULL;
+  }
+
+  // Set parameters.
+  lut->slen = maxlen;
+  lut->kmers = tau + 1;
+  lut->klen = kmer_lengths(slen, tau);
+  if (lut->klen == NULL) {
+    free(lut);
+    alert();
+    return NULL;
+  }
+
+  // Allocate lookup tables.
+  for (int i = 0; i < tau + 1; i++) {
+    lut->lut[i] = calloc(LUT_BYTES(lut->klen[i]), sizeof(unsigned char));
+    if (lut->lut[i] == NULL) {
+      while (--i >= 0) {
+        free(lut->lut[i]);
+      }
+      free(lut);
+      alert();
+      return NULL;
+    }
+  }
+
+  return lut;
+}
+
+int*
+kmer_lengths(int slen, int tau)
+// SYNOPSIS:
+//   Computes the lengths of the 'tau+1' k-mers that are extracted
+//   from a sequence of length 'slen' for the lookup table and for
+//   the inverted index of the seed-and-verify engine.
+//
+// RETURN:
+//   An array of 'tau+1' lengths on the heap, or NULL in case of
+//   failure.
+{
+  int* klen = calloc(tau + 1, sizeof(int));
+  if (klen == NULL)
+    return NULL;
+
+  // Target size.
+  int k = slen / (tau + 1);
+  int rem = tau - slen % (tau + 1);
+
+  if (k > MAX_K_FOR_LOOKUP)
+    for (int i = 0; i < tau + 1; i++)
+      klen[i] = MAX_K_FOR_LOOKUP;
+  else
+    for (int i = 0; i < tau + 1; i++)
+      klen[i] = k - (rem-- > 0);
+
+  return klen;
+}
+
+void
+destroy_lookup(lookup_t* lut) {
+  for (int i = 0; i < lut->kmers; i++)
+    free(lut->lut[i]);
+  free(lut->klen);
+  free(lut);
+}
+
+int
+lut_search(lookup_t* lut, const char* query)
+// SYNOPSIS:
+//   Perform of a lookup search of the query and determine whether
+//   at least one of the k-mers extracted from the query was inserted
+//   in the lookup table. If this is not the case, the trie search can
+//   be skipped because the query cannot have a match for the given
+//   tau.
+//
+// ARGUMENTS:
+//   lut: the lookup table to search
+//   query: the query, padded to the length of the lookup.
+//
+// RETURN:
+//   1 if any of the k-mers extracted from the query is in the
+//   lookup table, 0 if not, and -1 in case of failure.
+//
+// SIDE-EFFECTS:
+//   None.
+{
+  // Start from the end of the sequence. This will avoid potential
+  // misalignments on the first kmer due to insertions.
+  int offset = lut->slen;
+  // Iterate for all k-mers and for ins/dels.
+  for (int i = lut->kmers - 1; i >= 0; i--) {
+    offset -= lut->klen[i];
+    for (int j = -(lut->kmers - 1 - i); j <= lut->kmers - 1 - i; j++) {
+      // If sequence contains 'N' seq2id will return -1.
+      int seqid = seq2id(query + offset + j, lut->klen[i]);
+      // Make sure to never proceed passed the end of string.
+      if (seqid == -2)
+        return -1;
+      if (seqid == -1)
+        continue;
+      // The lookup table proper is implemented as a bitmap.
+      if ((lut->lut[i][seqid / 8] >> (seqid % 8)) & 1)
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+int
+lut_insert(lookup_t* lut, const char* query) {
+  int seqlen = strlen(query);
+
+  int offset = lut->slen;
+  for (int i = lut->kmers - 1; i >= 0; i--) {
+    offset -= lut->klen[i];
+    if (offset + lut->klen[i] > seqlen)
+      continue;
+    int seqid = seq2id(query + offset, lut->klen[i]);
+    // The lookup table proper is implemented as a bitmap.
+    if (seqid >= 0)
+      lut->lut[i][seqid / 8] |= (1 << (seqid % 8));
+    // Make sure to never proceed passed the end of string.
+    else if (seqid == -2)
+      return 1;
+  }
+
+  // Insert successful.
+  return 0;
+}
+
+int
+seq2id(const char* seq, int slen) {
+  int seqid = 0;
+  // Use the last 16 characters to construct the id.
+  int imin = slen > 16 ? slen - 16 : 0;
+  for (int i = imin; i < slen; i++) {
+    // Padding spaces are substituted by 'A'. It does not hurt
+    // anyway to generate some false positives. The same goes
+    // for the separator of paired-end reads, which matches
+    // itself in the trie and must not discard the k-mer.
+    if (seq[i] == 'A' || seq[i] == 'a' || seq[i] == ' ' || seq[i] == '-') {
+    } else if (seq[i] == 'C' || seq[i] == 'c')
+      seqid += 1;
+    else if (seq[i] == 'G' || seq[i] == 'g')
+      seqid += 2;
+    else if (seq[i] == 'T' || seq[i] == 't')
+      seqid += 3;
+    // Non DNA character (including end of string).
+    else
+      return seq[i] == '\0' ? -2 : -1;
+    if (i < slen - 1)
+      seqid <<= 2;
   }
 
-  free(line1);
-  free(line2);
-  return uSQ;
+  return seqid;
 }
 
-gstack_t*
-read_file(FILE* inputf1, FILE* inputf2, const int verbose) {
-  if (inputf2 != NULL)
-    FORMAT = PE_FASTQ;
-  else {
-    // Read first line of the file to guess format.
-    // Store in global variable FORMAT.
-    char c = fgetc(inputf1);
-    switch (c) {
-      case EOF:
-        // Empty file.
-        return NULL;
-      case '>':
-        FORMAT = FASTA;
-        if (verbose)
-          fprintf(stderr, "FASTA format detected\n");
-        break;
-      case '@':
-        FORMAT = FASTQ;
-        if (verbose)
-          fprintf(stderr, "FASTQ format detected\n");
-        break;
-      default:
-        FORMAT = RAW;
-        if (verbose)
-          fprintf(stderr, "raw format detected\n");
-    }
-
-    if (ungetc(c, inputf1) == EOF) {
-      alert();
-      krash();
-    }
+seeds_t*
+new_seeds(int slen, int maxlen, int tau, size_t nseq)
+// SYNOPSIS:
+//   Creates the inverted index of the seed-and-verify engine for
+//   at most 'nseq' sequences padded to 'maxlen'. The segments are
+//   the k-mers of the lookup table (see 'kmer_lengths()').
+//
+// RETURN:
+//   A pointer to the index, or NULL in case of failure.
+{
+  seeds_t* seeds = calloc(1, sizeof(seeds_t));
+  if (seeds == NULL) {
+    alert();
+    return NULL;
   }
 
-  gstack_t* uSQ = new_gstack();
-  if (uSQ == NULL) {
+  seeds->slen = maxlen;
+  seeds->kmers = tau + 1;
+  seeds->klen = kmer_lengths(slen, tau);
+
+  // The hash tables are at most half full, and every
+  // sequence has at most one posting per segment.
+  size_t nslots = 1;
+  while (nslots < 2 * nseq)
+    nslots <<= 1;
+  seeds->nslots = nslots;
+  seeds->postslots = seeds->kmers * nseq;
+  seeds->keys = malloc(seeds->kmers * nslots * sizeof(int32_t));
+  seeds->heads = calloc(seeds->kmers * nslots, sizeof(uint32_t));
+  seeds->useqs = malloc(seeds->postslots * sizeof(useq_t*));
+  seeds->next = malloc(seeds->postslots * sizeof(uint32_t));
+  if (seeds->klen == NULL || seeds->keys == NULL || seeds->heads == NULL ||
+      seeds->useqs == NULL || seeds->next == NULL ||
+      seeds->postslots >= UINT32_MAX) {
+    destroy_seeds(seeds);
     alert();
-    krash();
+    return NULL;
   }
+  memset(seeds->keys, 0xff, seeds->kmers * nslots * sizeof(int32_t));
 
-  if (FORMAT == RAW)
-    return read_rawseq(inputf1, uSQ);
-  if (FORMAT == FASTA)
-    return read_fasta(inputf1, uSQ);
-  if (FORMAT == FASTQ)
-    return read_fastq(inputf1, uSQ);
-  if (FORMAT == PE_FASTQ)
-    return read_PE_fastq(inputf1, inputf2, uSQ);
+  return seeds;
+}
 
-  return NULL;
+void
+destroy_seeds(seeds_t* seeds) {
+  free(seeds->klen);
+  free(seeds->keys);
+  free(seeds->heads);
+  free(seeds->useqs);
+  free(seeds->next);
+  free(seeds);
+}
+
+size_t
+seeds_slot(const seeds_t* seeds, int i, int32_t seqid)
+// SYNOPSIS:
+//   Returns the slot of the k-mer 'seqid' in the hash table of the
+//   segment 'i', or the empty slot where it has to be inserted.
+{
+  const size_t mask = seeds->nslots - 1;
+  const int32_t* keys = seeds->keys + i * seeds->nslots;
+  size_t slot = (seqid * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+  while (keys[slot] != seqid && keys[slot] != -1)
+    slot = (slot + 1) & mask;
+  return i * seeds->nslots + slot;
 }
 
 int
-pad_useq(gstack_t* useqS, int* median) {
-  // Compute maximum length.
-  int maxlen = 0;
-  for (size_t i = 0; i < useqS->nitems; i++) {
-    useq_t* u = useqS->items[i];
-    int len = strlen(u->seq);
-    if (len > maxlen)
-      maxlen = len;
+seeds_insert(seeds_t* seeds, const char* query, useq_t* useq)
+// SYNOPSIS:
+//   Inserts the segments of a sequence in the inverted index, in
+//   the same way as 'lut_insert()'.
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+{
+  int seqlen = strlen(query);
+
+  int offset = seeds->slen;
+  for (int i = seeds->kmers - 1; i >= 0; i--) {
+    offset -= seeds->klen[i];
+    if (offset + seeds->klen[i] > seqlen)
+      continue;
+    int seqid = seq2id(query + offset, seeds->klen[i]);
+    // Make sure to never proceed passed the end of string.
+    if (seqid == -2 || seeds->npost == seeds->postslots)
+      return 1;
+    if (seqid == -1)
+      continue;
+    size_t slot = seeds_slot(seeds, i, seqid);
+    seeds->keys[slot] = seqid;
+    seeds->useqs[seeds->npost] = useq;
+    seeds->next[seeds->npost] = seeds->heads[slot];
+    seeds->heads[slot] = ++seeds->npost;
   }
 
-  // Alloc median bins. (Initializes to 0)
-  size_t* count = calloc(maxlen + 1, sizeof(size_t));
-  char* spaces = malloc(maxlen + 1);
-  if (spaces == NULL || count == NULL) {
-    alert();
-    krash();
+  return 0;
+}
+
+int
+seeds_search(seeds_t* seeds,
+    const char* query,
+    const useq_t* self,
+    int tau,
+    int hamming,
+    gstack_t** hits,
+    gstack_t** cands,
+    char* buf)
+// SYNOPSIS:
+//   Seed-and-verify search of the query in the inverted index. By
+//   the pigeonhole principle, a sequence within distance 'tau' of
+//   the query has one of its 'tau+1' segments identical in the
+//   query, up to a shift for the insertions and deletions (see
+//   'lut_search()'). Such sequences are the candidates, which are
+//   verified by the dynamic programming of the trie search. The
+//   hits are then sorted in the order of the trie so that both
+//   engines give the same results.
+//
+// ARGUMENTS:
+//   seeds: the index to search
+//   query: the query, padded to the length of the index
+//   self: the sequence of the query, which is not reported
+//   tau: the maximum distance
+//   hamming: whether the distance is the Hamming distance
+//   hits: a hit stack to push the hits
+//   cands: a stack for the candidates
+//   buf: a buffer for the candidates, as long as the query
+//
+// RETURN:
+//   0 upon success, 1 upon failure.
+//
+// SIDE-EFFECTS:
+//   The hits are pushed in 'hits' and 'cands' is overwritten.
+{
+  (*cands)->nitems = 0;
+
+  int offset = seeds->slen;
+  for (int i = seeds->kmers - 1; i >= 0; i--) {
+    offset -= seeds->klen[i];
+    // There are no insertions and deletions in Hamming mode.
+    int shift = hamming ? 0 : seeds->kmers - 1 - i;
+    for (int j = -shift; j <= shift; j++) {
+      int seqid = seq2id(query + offset + j, seeds->klen[i]);
+      if (seqid == -2)
+        return 1;
+      if (seqid == -1)
+        continue;
+      size_t slot = seeds_slot(seeds, i, seqid);
+      for (uint32_t p = seeds->heads[slot]; p > 0; p = seeds->next[p - 1]) {
+        useq_t* useq = seeds->useqs[p - 1];
+        if (useq != self && push(useq, cands))
+          return 1;
+      }
+    }
   }
-  for (int i = 0; i < maxlen; i++)
-    spaces[i] = ' ';
-  spaces[maxlen] = '\0';
 
-  // Pad all sequences with spaces.
-  for (size_t i = 0; i < useqS->nitems; i++) {
-    useq_t* u = useqS->items[i];
-    int len = strlen(u->seq);
-    count[len]++;
-    if (len == maxlen)
+  // A candidate is pushed once per segment found in the query.
+  gstack_t* candS = *cands;
+  qsort(candS->items, candS->nitems, sizeof(useq_t*), addr_order);
+  for (size_t k = 0; k < candS->nitems; k++) {
+    if (k > 0 && candS->items[k] == candS->items[k - 1])
       continue;
-    // Create a new sequence with padding characters.
-    char* padded = malloc(maxlen + 1);
-    if (padded == NULL) {
-      alert();
-      krash();
-    }
-    memcpy(padded, spaces, maxlen + 1);
-    memcpy(padded + maxlen - len, u->seq, len);
-    free(u->seq);
-    u->seq = padded;
+    useq_t* useq = (useq_t*)candS->items[k];
+    unpack_seq(useq, buf, seeds->slen);
+    int dist = hamming ? hamming_distance(query, buf, tau) :
+        band_distance(query, buf, tau);
+    if (dist <= tau && push(useq, hits + dist))
+      return 1;
   }
 
-  // Compute median.
-  *median = 0;
-  size_t ccount = 0;
-  do {
-    ccount += count[++(*median)];
-  } while (ccount < useqS->nitems / 2);
+  for (int dist = 0; dist <= tau; dist++)
+    qsort(hits[dist]->items, hits[dist]->nitems, sizeof(useq_t*),
+        trie_seq_order);
 
-  // Free and return.
-  free(count);
-  free(spaces);
-  return maxlen;
+  return 0;
 }
 
-void
-unpad_useq(gstack_t* useqS) {
-  // Take the length of the first sequence (assume all
-  // sequences have the same length).
-  int len = strlen(((useq_t*)useqS->items[0])->seq);
-  for (size_t i = 0; i < useqS->nitems; i++) {
+index_t*
+new_index(gstack_t* useqS, int tau, int height, int medianlen)
+// SYNOPSIS:
+//   Builds the trie and the lookup tables of the sequences in
+//   memory. The text of the sequences has the same layout as in
+//   the index files (see 'write_index()') and the leaf data are
+//   the sequence numbers plus 1.
+{
+  const size_t nseq = useqS->nitems;
+
+  size_t textsize = 0;
+  for (size_t i = 0; i < nseq; i++)
+    textsize += ((useq_t*)useqS->items[i])->len + 1;
+
+  index_t* index = calloc(1, sizeof(index_t));
+  uint64_t* offsets = malloc((nseq + 1) * sizeof(uint64_t) + textsize);
+  trie_t* trie = new_trie(height);
+  lookup_t* lut = new_lookup(medianlen, height, tau);
+  char* seq = malloc(height + 1);
+  if (index == NULL || offsets == NULL || trie == NULL || lut == NULL ||
+      seq == NULL ||
+      reserve_trie(trie,
+          count_trie_nodes((useq_t**)useqS->items, 0, nseq, height), nseq)) {
+    alert();
+    krash();
+  }
+
+  char* text = (char*)(offsets + nseq + 1);
+  offsets[0] = 0;
+  for (size_t i = 0; i < nseq; i++) {
     useq_t* u = (useq_t*)useqS->items[i];
-    int pad = 0;
-    while (u->seq[pad] == ' ')
-      pad++;
-    // Create a new sequence without paddings characters.
-    char* unpadded = calloc((len - pad + 1), sizeof(char));
-    if (unpadded == NULL) {
+    unpack_seq(u, text + offsets[i], 0);
+    offsets[i + 1] = offsets[i] + u->len + 1;
+    unpack_seq(u, seq, height);
+    void** data = insert_string_wo_malloc(trie, seq);
+    if (data == NULL || *data != NULL || lut_insert(lut, seq)) {
       alert();
       krash();
     }
-    memcpy(unpadded, u->seq + pad, len - pad + 1);
-    free(u->seq);
-    u->seq = unpadded;
+    *data = (void*)(uintptr_t)(i + 1);
   }
-  return;
+  free(seq);
+
+  index->tau = tau;
+  index->height = height;
+  index->medianlen = medianlen;
+  index->nseq = nseq;
+  index->offsets = offsets;
+  index->text = text;
+  index->lut = lut;
+  index->trie = trie;
+
+  return index;
 }
 
-void
-transfer_useq_ids(useq_t* ud, useq_t* us)
-// Appends the sequence ID list from 'us' to 'ud',
-// the final list is unsorted.
+int
+write_index(const char* path, const index_t* index)
+// SYNOPSIS:
+//   Writes an index built by 'new_index()' in a file, which can
+//   be mapped in memory instead of being rebuilt (see
+//   'load_index()'). The trie is written by 'write_trie()'.
+//
+// RETURN:
+//   0 upon success, 1 if the file cannot be written.
 {
-  if (us->nids < 1)
-    return;
-  // Realloc destination buffer.
-  ud->seqid = realloc(ud->seqid, (ud->nids + us->nids) * sizeof(int));
-  if (ud->seqid == NULL) {
-    alert();
-    krash();
+  const size_t nseq = index->nseq;
+  const lookup_t* lut = index->lut;
+
+  indexhdr_t header = {
+      .version = INDEX_VERSION,
+      .endian = INDEX_ENDIAN,
+      .tau = index->tau,
+      .height = index->height,
+      .medianlen = index->medianlen,
+      .kmers = lut->kmers,
+      .nseq = nseq,
+  };
+  memcpy(header.magic, INDEX_MAGIC, 8);
+
+  FILE* f = fopen(path, "w");
+  int err = f == NULL;
+
+  // Offsets and text of the sequences.
+  header.seqs = INDEX_ALIGN(sizeof(indexhdr_t));
+  size_t nbytes = (nseq + 1) * sizeof(uint64_t) + index->offsets[nseq];
+  err = err || fseek(f, header.seqs, SEEK_SET) ||
+      fwrite(index->offsets, 1, nbytes, f) != nbytes;
+
+  // Lengths of the k-mers and lookup tables.
+  header.lut = INDEX_ALIGN(header.seqs + nbytes);
+  err = err || fseek(f, header.lut, SEEK_SET) ||
+      fwrite(lut->klen, sizeof(int), lut->kmers, f) != (size_t)lut->kmers;
+  uint64_t pos = INDEX_ALIGN(header.lut + lut->kmers * sizeof(int));
+  for (int i = 0; !err && i < lut->kmers; i++) {
+    size_t nmemb = LUT_BYTES(lut->klen[i]);
+    err = fseek(f, pos, SEEK_SET) || fwrite(lut->lut[i], 1, nmemb, f) != nmemb;
+    pos = INDEX_ALIGN(pos + nmemb);
   }
-  // Copy source list of ids to ud.
-  memcpy(ud->seqid + ud->nids, us->seqid, us->nids * sizeof(int));
-  // Update id counts in both sequences.
-  ud->nids += us->nids;
-  us->nids = 0;
-}
 
-void
-transfer_sorted_useq_ids(useq_t* ud, useq_t* us)
-// Appends the sequence ID list from 'us' to 'ud'
-// and sorts the final list.
-{
-  if (us->nids < 1)
-    return;
-  // Alloc merge-sort buffer.
-  int* buf = calloc(ud->nids + us->nids, sizeof(int));
-  if (buf == NULL) {
-    alert();
-    krash();
-  }
-  int *s, *d;
-  d = ud->seqid;
-  s = us->seqid;
-  // Merge algorithm (keeps them sorted and unique).
-  uint32_t i = 0, j = 0, k = 0;
-  while (i < ud->nids && j < us->nids) {
-    if (d[i] < s[j])
-      buf[k++] = d[i++];
-    else if (d[i] > s[j])
-      buf[k++] = s[j++];
-    else {
-      buf[k++] = d[i];
-      i++;
-      j++;
-    }
+  // The trie comes last.
+  header.trie = pos;
+  err = err || fseek(f, header.trie, SEEK_SET) || write_trie(index->trie, f);
+  header.size = err ? 0 : ftell(f);
+  err = err || fseek(f, 0, SEEK_SET) ||
+      fwrite(&header, sizeof(indexhdr_t), 1, f) != 1;
+  if (f != NULL && fclose(f))
+    err = 1;
+
+  if (err) {
+    fprintf(stderr, "error: could not write index file %s\n", path);
   }
-  // TODO: use memcpy.
-  for (; i < ud->nids; i++)
-    buf[k++] = d[i];
-  for (; j < us->nids; j++)
-    buf[k++] = s[j];
-  // Update ID count.
-  free(ud->seqid);
-  ud->seqid = buf;
-  ud->nids = k;
-  us->nids = 0;
+
+  return err;
 }
 
-void
-transfer_counts_and_update_canonicals(useq_t* useq)
-// TODO: Write the doc.
+index_t*
+load_index(const char* path)
 // SYNOPSIS:
-//   Function used in message passing clustering.
+//   Loads an index file written by 'write_index()'. The file is
+//   mapped privately because the search writes in the trie, and
+//   nothing is copied or rebuilt, so the time to load an index
+//   does not depend on its size.
+//
+// RETURN:
+//   A pointer to the index, or NULL if the file cannot be mapped
+//   or is not a valid index.
 {
-  // Ambiguous flag set, skip.
-  if (useq->sphere_d) {
-    return;
+  void* mapping = MAP_FAILED;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(indexhdr_t))
+    mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+        fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "error: could not map index file %s\n", path);
+    return NULL;
   }
 
-  // If the read has no matches, it has no parent, so
-  // it is an ancestor and it must be canonical.
-  if (useq->matches == NULL) {
-    useq->canonical = useq;
-    return;
+  const size_t size = st.st_size;
+  const indexhdr_t* header = mapping;
+  char* base = mapping;
+  int valid = memcmp(header->magic, INDEX_MAGIC, 8) == 0 &&
+      header->version == INDEX_VERSION && header->endian == INDEX_ENDIAN &&
+      header->tau >= 0 && header->tau <= STARCODE_MAX_TAU &&
+      header->kmers == header->tau + 1 && header->height > 0 &&
+      header->size <= size && header->seqs >= sizeof(indexhdr_t) &&
+      header->seqs + (header->nseq + 1) * sizeof(uint64_t) <= header->lut &&
+      header->lut + header->kmers * sizeof(int) <= header->trie &&
+      header->trie <= header->size;
+
+  // The text of the sequences and the lookup tables must fit
+  // before the trie.
+  const uint64_t* offsets = (uint64_t*)(base + header->seqs);
+  const int* klen = (int*)(base + header->lut);
+  uint64_t pos = valid ?
+      INDEX_ALIGN(header->lut + header->kmers * sizeof(int)) : 0;
+  if (valid) {
+    uint64_t text = header->seqs + (header->nseq + 1) * sizeof(uint64_t);
+    valid = text + offsets[header->nseq] <= header->lut;
   }
-
-  // If the read has already been assigned a canonical, directly
-  // transfer counts and ids to the canonical and return.
-  if (useq->canonical != NULL) {
-    useq->canonical->count += useq->count;
-    // Counts transferred, remove from self.
-    useq->count = 0;
-    // Update canonical sphere size.
-    useq->canonical->sphere_c += 1;
-    return;
+  for (int i = 0; valid && i < header->kmers; i++) {
+    valid = klen[i] <= MAX_K_FOR_LOOKUP;
+    pos = INDEX_ALIGN(pos + LUT_BYTES(klen[i]));
+  }
+  valid = valid && pos <= header->trie;
+
+  index_t* index = valid ? calloc(1, sizeof(index_t)) : NULL;
+  lookup_t* lut = valid ?
+      malloc(sizeof(lookup_t) + header->kmers * sizeof(unsigned char*)) : NULL;
+  trie_t* trie = valid ?
+      map_trie(base + header->trie, header->size - header->trie) : NULL;
+  if (index == NULL || lut == NULL || trie == NULL) {
+    fprintf(stderr, "error: could not load index file %s\n", path);
+    if (trie != NULL)
+      destroy_trie(trie, NULL);
+    free(lut);
+    free(index);
+    munmap(mapping, size);
+    return NULL;
   }
 
-  // The field 'matches' stores parents (useq with higher
-  // counts) stratified by distance to self.
-  // Consider that direct parents are the lowest nonempty
-  // match stratum. Others are disregarded (indirect).
-  gstack_t* matches;
-  for (int i = 0; (matches = useq->matches[i]) != TOWER_TOP; i++) {
-    if (matches->nitems > 0)
-      break;
+  // The lookup tables are used in place.
+  lut->slen = header->height;
+  lut->kmers = header->kmers;
+  lut->klen = (int*)klen;
+  pos = INDEX_ALIGN(header->lut + header->kmers * sizeof(int));
+  for (int i = 0; i < header->kmers; i++) {
+    lut->lut[i] = (unsigned char*)(base + pos);
+    pos = INDEX_ALIGN(pos + LUT_BYTES(klen[i]));
   }
 
-  // Continue propagation to direct parents. This will update
-  // the canonicals of the whole ancestry.
-  for (size_t i = 0; i < matches->nitems; i++) {
-    useq_t* match = (useq_t*)matches->items[i];
-    transfer_counts_and_update_canonicals(match);
+  index->tau = header->tau;
+  index->height = header->height;
+  index->medianlen = header->medianlen;
+  index->nseq = header->nseq;
+  index->offsets = offsets;
+  index->text = (char*)(offsets + header->nseq + 1);
+  index->lut = lut;
+  index->trie = trie;
+  index->mapping = mapping;
+  index->size = size;
+
+  return index;
+}
+
+void
+destroy_index(index_t* index) {
+  destroy_trie(index->trie, NULL);
+  if (index->mapping != NULL) {
+    free(index->lut);
+    munmap(index->mapping, index->size);
+  } else {
+    destroy_lookup(index->lut);
+    free((void*)index->offsets);
   }
+  free(index);
+}
 
-  // Self canonical is the canonical of the first parent...
-  useq_t* canonical = ((useq_t*)matches->items[0])->canonical;
-  // ... but if parents have different canonicals then
-  // self canonical is set to 'NULL'. (ambiguous)
-  for (size_t i = 1; i < matches->nitems; i++) {
-    useq_t* match = (useq_t*)matches->items[i];
-    if (match->canonical == NULL || match->canonical != canonical) {
-      canonical = NULL;
-      break;
-    }
+int
+write_checkpoint(const char* path, const ckpt_t* ckpt)
+// SYNOPSIS:
+//   Writes the unique sequences, their counts, their ids and
+//   their match graph in a checkpoint file, so that a new batch
+//   of reads can be added without searching the sequences of
+//   the checkpoint again (see 'load_checkpoint()'). The matches
+//   must be in both directions and the sequences in sort order.
+//
+// RETURN:
+//   0 upon success, 1 if the file cannot be written.
+{
+  const gstack_t* useqS = ckpt->useqS;
+  const graph_t* graph = ckpt->graph;
+  const size_t nseq = useqS->nitems;
+
+  ckpthdr_t header = {
+      .version = CKPT_VERSION,
+      .endian = INDEX_ENDIAN,
+      .tau = ckpt->tau,
+      .hamming = ckpt->hamming,
+      .nseq = nseq,
+      .nreads = ckpt->nreads,
+      .nmatches = graph->offsets[nseq],
+  };
+  memcpy(header.magic, CKPT_MAGIC, 8);
+  for (size_t i = 0; i < nseq; i++) {
+    const useq_t* u = useqS->items[i];
+    header.nids += u->nids;
+    header.textsize += u->len + 1;
   }
 
-  // Set canonical and transfer counts and ids.
-  if (canonical) {
-    useq->canonical = canonical;
+  FILE* f = fopen(path, "w");
+  int err = f == NULL || fwrite(&header, sizeof(ckpthdr_t), 1, f) != 1;
 
-    // Transfer counts and seq_ids to canonical.
-    canonical->count += useq->count;
-    useq->count = 0;
-    // Increase canonical sphere size.
-    canonical->sphere_c += 1;
+  // Counts, numbers of ids, ids and text of the sequences.
+  char seq[MAXSEQLEN];
+  for (size_t i = 0; !err && i < nseq; i++) {
+    int64_t count = ((useq_t*)useqS->items[i])->count;
+    err = fwrite(&count, sizeof(int64_t), 1, f) != 1;
   }
-  // Otherwise, flag as ambiguous.
-  else {
-    useq->sphere_d = 1;
+  for (size_t i = 0; !err && i < nseq; i++) {
+    uint32_t nids = ((useq_t*)useqS->items[i])->nids;
+    err = fwrite(&nids, sizeof(uint32_t), 1, f) != 1;
+  }
+  for (size_t i = 0; !err && i < nseq; i++) {
+    const useq_t* u = useqS->items[i];
+    err = fwrite(u->seqid, sizeof(int), u->nids, f) != u->nids;
+  }
+  for (size_t i = 0; !err && i < nseq; i++) {
+    const useq_t* u = useqS->items[i];
+    err = fwrite(unpack_seq(u, seq, 0), 1, u->len + 1, f) != u->len + 1u;
   }
 
-  return;
+  // Match graph.
+  err = err ||
+      fwrite(graph->offsets, sizeof(size_t), nseq + 1, f) != nseq + 1 ||
+      fwrite(graph->nbr, sizeof(uint32_t), header.nmatches, f) !=
+          header.nmatches ||
+      fwrite(graph->dist, 1, header.nmatches, f) != header.nmatches;
+  if (f != NULL && fclose(f))
+    err = 1;
+
+  if (err) {
+    fprintf(stderr, "error: could not write checkpoint file %s\n", path);
+  }
+
+  return err;
 }
 
 void
-mp_resolve_ambiguous(useq_t* useq) {
-  // Ambiguous sequences must have NULL canonicals.
-  if (useq->canonical != NULL) {
-    return;
-  }
-
-  // Get parents.
-  gstack_t* matches;
-  for (int i = 0; (matches = useq->matches[i]) != TOWER_TOP; i++) {
-    if (matches->nitems > 0)
-      break;
+destroy_ckpt(ckpt_t* ckpt)
+// SYNOPSIS:
+//   Destroys a checkpoint, except the sequences, which are in an
+//   arena (see 'load_checkpoint()').
+{
+  if (ckpt->useqS != NULL) {
+    for (size_t i = 0; i < ckpt->useqS->nitems; i++) {
+      useq_t* u = ckpt->useqS->items[i];
+      if (u->seqid != &u->id)
+        free(u->seqid);
+    }
+    free(ckpt->useqS);
   }
+  if (ckpt->graph != NULL)
+    destroy_graph(ckpt->graph);
+  free(ckpt);
+}
 
-  // Propagate if this is descendant of ambiguous.
-  for (size_t i = 0; i < matches->nitems; i++) {
-    useq_t* match = (useq_t*)matches->items[i];
-    if (match->canonical == NULL)
-      mp_resolve_ambiguous(match);
+ckpt_t*
+load_checkpoint(const char* path, arena_t* arena)
+// SYNOPSIS:
+//   Loads a checkpoint file written by 'write_checkpoint()'. The
+//   sequences are allocated in 'arena' and the 'node' of each
+//   sequence is its index in the checkpoint.
+//
+// RETURN:
+//   A pointer to the checkpoint, or NULL if the file cannot be
+//   read or is not a valid checkpoint.
+{
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    fprintf(stderr, "error: could not open checkpoint file %s\n", path);
+    return NULL;
   }
 
-  // Select canonical. Criteria:
-  // 1. The canonical parent with more counts.
-  // 2. The canonical parent whose sphere has more sequences.
-  // 3. The parent whose canonical has more counts.
-
-  // Criteria 1 and 2.
-  useq_t* canonical = NULL;
-  int cnt_max = 0;
-  int ssz_max = 0;
-  for (size_t i = 0; i < matches->nitems; i++) {
-    useq_t* match = (useq_t*)matches->items[i];
-    if (match->canonical == match) {
-      if (match->count > cnt_max) {
-        canonical = match;
-        cnt_max = canonical->count;
-        ssz_max = canonical->sphere_c;
-      }
-      // Same count, compare sphere size.
-      else if (match->count == cnt_max && match != canonical) {
-        if (match->sphere_c > ssz_max) {
-          canonical = match;
-          ssz_max = canonical->sphere_c;
-        } else if (match->sphere_c == ssz_max)
-          canonical = NULL;
+  ckpthdr_t header;
+  int valid = fread(&header, sizeof(ckpthdr_t), 1, f) == 1 &&
+      memcmp(header.magic, CKPT_MAGIC, 8) == 0 &&
+      header.version == CKPT_VERSION && header.endian == INDEX_ENDIAN &&
+      header.tau >= 0 && header.tau <= STARCODE_MAX_TAU &&
+      header.nseq > 0 && header.nseq < UINT32_MAX &&
+      header.nids <= header.nreads && header.nreads < INT_MAX;
+
+  const size_t nseq = valid ? header.nseq : 0;
+  int64_t* counts = malloc(nseq * sizeof(int64_t));
+  uint32_t* nids = malloc(nseq * sizeof(uint32_t));
+  int* ids = malloc(valid ? header.nids * sizeof(int) : 0);
+  char* text = malloc(valid ? header.textsize : 0);
+  graph_t* graph = calloc(1, sizeof(graph_t));
+  gstack_t* useqS = new_gstack();
+  if (valid && (counts == NULL || nids == NULL || ids == NULL ||
+      text == NULL || graph == NULL || useqS == NULL)) {
+    alert();
+    krash();
+  }
+  valid = valid &&
+      fread(counts, sizeof(int64_t), nseq, f) == nseq &&
+      fread(nids, sizeof(uint32_t), nseq, f) == nseq &&
+      fread(ids, sizeof(int), header.nids, f) == header.nids &&
+      fread(text, 1, header.textsize, f) == header.textsize &&
+      header.textsize > 0 && text[header.textsize - 1] == '\0';
+
+  // Rebuild the sequences with their ids. Lists of more than one
+  // id are on the heap (see 'transfer_useq_ids()').
+  char* seq = text;
+  uint64_t nextid = 0;
+  for (size_t i = 0; valid && i < nseq; i++) {
+    size_t len = strnlen(seq, text + header.textsize - seq);
+    useq_t* u = len > 0 && len < MAXSEQLEN && nids[i] > 0 &&
+        nextid + nids[i] <= header.nids ?
+        pack_useq(arena, 0, seq, len, NULL) : NULL;
+    if (u == NULL) {
+      valid = 0;
+      break;
+    }
+    u->count = counts[i];
+    u->nids = nids[i];
+    u->node = i;
+    u->id = ids[nextid];
+    u->seqid = &u->id;
+    if (nids[i] > 1) {
+      u->seqid = malloc(id_capacity(nids[i]) * sizeof(int));
+      if (u->seqid == NULL) {
+        alert();
+        krash();
       }
+      memcpy(u->seqid, ids + nextid, nids[i] * sizeof(int));
+    }
+    nextid += nids[i];
+    if (push(u, &useqS)) {
+      alert();
+      krash();
     }
+    seq += len + 1;
   }
-
-  // Criterion 3.
-  if (canonical == NULL) {
-    cnt_max = 0;
-    for (size_t i = 0; i < matches->nitems; i++) {
-      useq_t* match_canon = ((useq_t*)matches->items[i])->canonical;
-      if (match_canon->count > cnt_max) {
-        cnt_max = match_canon->count;
-        canonical = match_canon;
-      }
+  valid = valid && nextid == header.nids;
+
+  // Match graph.
+  if (valid) {
+    graph->nnodes = nseq;
+    graph->offsets = malloc((nseq + 1) * sizeof(size_t));
+    graph->nbr = malloc(header.nmatches * sizeof(uint32_t));
+    graph->dist = malloc(header.nmatches);
+    graph->nodes = malloc(nseq * sizeof(useq_t*));
+    if (graph->offsets == NULL || graph->nodes == NULL ||
+        ((graph->nbr == NULL || graph->dist == NULL) &&
+            header.nmatches > 0)) {
+      alert();
+      krash();
     }
+    memcpy(graph->nodes, useqS->items, nseq * sizeof(useq_t*));
+    valid = fread(graph->offsets, sizeof(size_t), nseq + 1, f) == nseq + 1 &&
+        fread(graph->nbr, sizeof(uint32_t), header.nmatches, f) ==
+            header.nmatches &&
+        fread(graph->dist, 1, header.nmatches, f) == header.nmatches &&
+        graph->offsets[0] == 0 && graph->offsets[nseq] == header.nmatches;
+    for (size_t i = 0; valid && i < nseq; i++)
+      valid = graph->offsets[i] <= graph->offsets[i + 1];
+    for (size_t k = 0; valid && k < header.nmatches; k++)
+      valid = graph->nbr[k] < nseq && graph->dist[k] <= header.tau;
   }
-
-  // This should not ever happen. It is only a security
-  // to avoid dereferencing a null pointer below.
-  if (canonical == NULL) {
+  fclose(f);
+  free(counts);
+  free(nids);
+  free(ids);
+  free(text);
+
+  ckpt_t* ckpt = malloc(sizeof(ckpt_t));
+  if (ckpt == NULL) {
     alert();
     krash();
   }
+  if (!valid) {
+    fprintf(stderr, "error: invalid checkpoint file %s\n", path);
+    ckpt->useqS = useqS;
+    ckpt->graph = graph != NULL && graph->offsets != NULL ? graph : NULL;
+    if (ckpt->graph == NULL)
+      free(graph);
+    destroy_ckpt(ckpt);
+    return NULL;
+  }
 
-  // Transfer counts and seq ids to canonical.
-  useq->canonical = canonical;
+  ckpt->tau = header.tau;
+  ckpt->hamming = header.hamming;
+  ckpt->nreads = header.nreads;
+  ckpt->useqS = useqS;
+  ckpt->graph = graph;
 
-  // Transfer counts and seq_ids to canonical.
-  canonical->count += useq->count;
-  useq->count = 0;
-  // Increase canonical sphere size.
-  canonical->sphere_c += 1;
+  return ckpt;
 }
 
-int
-addmatch(useq_t* to, useq_t* from, int dist, int maxtau)
+useq_t*
+new_useq(int count, char* seq, char* info)
 // SYNOPSIS:
-//   Add a sequence to the match record of another.
-//
-// ARGUMENTS:
-//   to: pointer to the sequence to add the match to
-//   from: pointer to the sequence to add as a match
-//   dist: distance between the sequences
-//   maxtau: maximum allowed distance
+//   Creates a 'useq_t' on the heap, to be destroyed with
+//   'destroy_useq()'.
+{
+  return arena_useq(NULL, count, seq, info);
+}
+
+useq_t*
+arena_useq(arena_t* arena, int count, char* seq, char* info)
+// SYNOPSIS:
+//   Creates a 'useq_t' in 'arena', or on the heap if 'arena'
+//   is NULL. The sequence and the info are in the same place.
 //
 // RETURN:
-//   0 upon success, 1 upon failure.
-//
-// SIDE EFFECT:
-//   Updates sequence pointed to by 'to' in place, potentially
-//   creating a match record,
+//   A pointer to the 'useq_t', or NULL if 'seq' is NULL or is
+//   not a valid sequence (see 'pack_seq()').
 {
-  // Cannot add a match at a distance greater than 'maxtau'
-  // (this lead to a segmentation fault).
-  if (dist > maxtau)
-    return 1;
-  // Create stack if not done before.
-  if (to->matches == NULL)
-    to->matches = new_tower(maxtau + 1);
-  return push(from, to->matches + dist);
+  // Check input.
+  if (seq == NULL)
+    return NULL;
+
+  return pack_useq(arena, count, seq, strlen(seq), info);
 }
 
-lookup_t*
-new_lookup(int slen, int maxlen, int tau) {
-  lookup_t* lut = (lookup_t*)malloc(
-      2 * sizeof(int) + sizeof(int*) + (tau + 1) * sizeof(char*));
-  if (lut == NULL) {
-    alert();
+useq_t*
+pack_useq(arena_t* arena, int count, const char* seq, size_t len, char* info)
+// SYNOPSIS:
+//   Same as 'arena_useq()' for the first 'len' characters of
+//   'seq', which need not be null-terminated.
+{
+  useq_t* new = arena_alloc(arena, sizeof(useq_t));
+  if (pack_seq(new, seq, len, arena)) {
+    // Memory in the arena is lost until it is released.
+    if (arena == NULL)
+      free(new);
     return NULL;
   }
+  new->count = count;
+  new->nids = 0;
+  new->sphere_c = 0;
+  new->sphere_d = 0;
+  new->seqid = NULL;
+  if (info != NULL) {
+    size_t len = strlen(info);
+    new->info = arena_alloc(arena, len + 1);
+    memcpy(new->info, info, len + 1);
+  }
 
-  // Target size.
-  int k = slen / (tau + 1);
-  int rem = tau - slen % (tau + 1);
+  return new;
+}
 
-  // Set parameters.
-  lut->slen = maxlen;
-  lut->kmers = tau + 1;
-  lut->klen = calloc(lut->kmers, sizeof(int));
+void
+destroy_useq(useq_t* useq) {
+  if (useq->info != NULL)
+    free(useq->info);
+  if (useq->seqid != &useq->id)
+    free(useq->seqid);
+  free(useq->pack);
+  free(useq);
+}
 
-  // Compute k-mer lengths.
-  if (k > MAX_K_FOR_LOOKUP)
-    for (int i = 0; i < tau + 1; i++)
-      lut->klen[i] = MAX_K_FOR_LOOKUP;
-  else
-    for (int i = 0; i < tau + 1; i++)
-      lut->klen[i] = k - (rem-- > 0);
+arena_t*
+new_arena(void) {
+  arena_t* arena = calloc(1, sizeof(arena_t));
+  if (arena == NULL) {
+    alert();
+    krash();
+  }
+  return arena;
+}
 
-  // Allocate lookup tables.
-  for (int i = 0; i < tau + 1; i++) {
-    size_t nmemb = 1 << max(0, (2 * lut->klen[i] - 3));
-    lut->lut[i] = calloc(nmemb, sizeof(unsigned char));
-    if (lut->lut[i] == NULL) {
-      while (--i >= 0) {
-        free(lut->lut[i]);
-      }
-      free(lut);
+void*
+arena_alloc(arena_t* arena, size_t size)
+// SYNOPSIS:
+//   Allocates zeroed memory from 'arena', or from the heap if
+//   'arena' is NULL. Arena allocations are aligned on
+//   'ARENA_ALIGN' bytes and cannot be freed individually.
+//
+// RETURN:
+//   A pointer to the memory. Failures are fatal.
+{
+  if (arena == NULL) {
+    void* ptr = calloc(1, size > 0 ? size : 1);
+    if (ptr == NULL) {
       alert();
-      return NULL;
+      krash();
+    }
+    return ptr;
+  }
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (arena->block == NULL || arena->used + size > arena->size) {
+    // Start a new block, large allocations have their own.
+    size_t bsize = max(ARENA_BLOCK, size + ARENA_ALIGN);
+    char* block = calloc(1, bsize);
+    if (block == NULL) {
+      alert();
+      krash();
     }
+    *(char**)block = arena->block;
+    arena->block = block;
+    arena->used = ARENA_ALIGN;
+    arena->size = bsize;
   }
+  void* ptr = arena->block + arena->used;
+  arena->used += size;
+  return ptr;
+}
 
-  return lut;
+void
+arena_merge(arena_t* arena, arena_t* other)
+// SYNOPSIS:
+//   Moves the blocks of 'other' to 'arena' and destroys
+//   'other'. The current block of 'arena' is unchanged.
+{
+  if (other->block != NULL) {
+    if (arena->block == NULL) {
+      arena->block = other->block;
+      arena->used = other->used;
+      arena->size = other->size;
+    } else {
+      // Insert the chain of 'other' after the current block.
+      char* tail = other->block;
+      while (*(char**)tail != NULL)
+        tail = *(char**)tail;
+      *(char**)tail = *(char**)arena->block;
+      *(char**)arena->block = other->block;
+    }
+  }
+  free(other);
 }
 
 void
-destroy_lookup(lookup_t* lut) {
-  for (int i = 0; i < lut->kmers; i++)
-    free(lut->lut[i]);
-  free(lut->klen);
-  free(lut);
+destroy_arena(arena_t* arena) {
+  char* block = arena->block;
+  while (block != NULL) {
+    char* prev = *(char**)block;
+    free(block);
+    block = prev;
+  }
+  free(arena);
+}
+
+void
+release_reads(gstack_t* useqS, arena_t* arena)
+// SYNOPSIS:
+//   Releases the reads allocated in 'arena' with the stack.
+//   The lists of ids on the heap are freed individually, the
+//   rest is released in bulk.
+{
+  for (size_t i = 0; i < useqS->nitems; i++) {
+    useq_t* u = (useq_t*)useqS->items[i];
+    if (u->seqid != &u->id)
+      free(u->seqid);
+  }
+  free(useqS);
+  destroy_arena(arena);
 }
 
 int
-lut_search(lookup_t* lut, useq_t* query)
+pack_seq(useq_t* useq, const char* seq, size_t slen, arena_t* arena)
 // SYNOPSIS:
-//   Perform of a lookup search of the query and determine whether
-//   at least one of the k-mers extracted from the query was inserted
-//   in the lookup table. If this is not the case, the trie search can
-//   be skipped because the query cannot have a match for the given
-//   tau.
-//
-// ARGUMENTS:
-//   lut: the lookup table to search
-//   query: the query as a useq.
+//   Packs the 'slen' characters of a sequence in a 'useq_t'. The
+//   nucleotides are stored on 2 bits, four per byte starting from
+//   the most significant bits, with codes A=0, C=1, G=2 and T=3.
+//   The codes are in the same order as the characters, so packed
+//   sequences of the same length compare like strings. If the
+//   sequence contains 'N' or '-' (the separator of paired-end
+//   reads), 'special' is set and a bitmap of the positions of
+//   these characters follows the packed bytes. Their code is 0
+//   for 'N' and 1 for '-'. Lower case characters are capitalized.
+//   There is no padding, see 'unpack_seq()'. The packed bytes are
+//   allocated in 'arena', or on the heap if 'arena' is NULL.
 //
 // RETURN:
-//   1 if any of the k-mers extracted from the query is in the
-//   lookup table, 0 if not, and -1 in case of failure.
-//
-// SIDE-EFFECTS:
-//   None.
+//   0 upon success, 1 if the sequence is too long or if it
+//   contains other characters.
 {
-  // Start from the end of the sequence. This will avoid potential
-  // misalignments on the first kmer due to insertions.
-  int offset = lut->slen;
-  // Iterate for all k-mers and for ins/dels.
-  for (int i = lut->kmers - 1; i >= 0; i--) {
-    offset -= lut->klen[i];
-    for (int j = -(lut->kmers - 1 - i); j <= lut->kmers - 1 - i; j++) {
-      // If sequence contains 'N' seq2id will return -1.
-      int seqid = seq2id(query->seq + offset + j, lut->klen[i]);
-      // Make sure to never proceed passed the end of string.
-      if (seqid == -2)
-        return -1;
-      if (seqid == -1)
-        continue;
-      // The lookup table proper is implemented as a bitmap.
-      if ((lut->lut[i][seqid / 8] >> (seqid % 8)) & 1)
+  if (slen > MAXSEQLEN)
+    return 1;
+
+  int special = 0;
+  for (size_t i = 0; i < slen; i++) {
+    switch (seq[i] & 0x80 ? 0 : capitalize[(int)seq[i]]) {
+      case 'A':
+      case 'C':
+      case 'G':
+      case 'T':
+        break;
+      case 'N':
+      case '-':
+        special = 1;
+        break;
+      default:
         return 1;
     }
   }
 
-  return 0;
-}
-
-int
-lut_insert(lookup_t* lut, useq_t* query) {
-  int seqlen = strlen(query->seq);
+  size_t nbytes = (slen + 3) / 4;
+  size_t nbits = special ? (slen + 7) / 8 : 0;
+  uint8_t* pack = arena_alloc(arena, nbytes + nbits);
 
-  int offset = lut->slen;
-  for (int i = lut->kmers - 1; i >= 0; i--) {
-    offset -= lut->klen[i];
-    if (offset + lut->klen[i] > seqlen)
-      continue;
-    int seqid = seq2id(query->seq + offset, lut->klen[i]);
-    // The lookup table proper is implemented as a bitmap.
-    if (seqid >= 0)
-      lut->lut[i][seqid / 8] |= (1 << (seqid % 8));
-    // Make sure to never proceed passed the end of string.
-    else if (seqid == -2)
-      return 1;
+  for (size_t i = 0; i < slen; i++) {
+    int code = 0;
+    switch (capitalize[(int)seq[i]]) {
+      case 'C':
+        code = 1;
+        break;
+      case 'G':
+        code = 2;
+        break;
+      case 'T':
+        code = 3;
+        break;
+      case '-':
+        code = 1;
+        // fall through
+      case 'N':
+        pack[nbytes + i / 8] |= 1 << (i % 8);
+        break;
+      default:
+        break;
+    }
+    pack[i / 4] |= code << (6 - 2 * (i % 4));
   }
 
-  // Insert successful.
+  useq->pack = pack;
+  useq->len = slen;
+  useq->special = special;
+
   return 0;
 }
 
+char
+seq_at(const useq_t* useq, int i)
+// SYNOPSIS:
+//   Returns the character at position 'i' of a packed sequence.
+{
+  static const char nucleotides[4] = {'A', 'C', 'G', 'T'};
+  int code = (useq->pack[i / 4] >> (6 - 2 * (i % 4))) & 3;
+  if (useq->special &&
+      (useq->pack[(useq->len + 3) / 4 + i / 8] >> (i % 8)) & 1)
+    return code ? '-' : 'N';
+  return nucleotides[code];
+}
+
+char*
+unpack_seq(const useq_t* useq, char* buf, int width)
+// SYNOPSIS:
+//   Writes the sequence as a string in 'buf', preceded by spaces
+//   if it is shorter than 'width'. Buffers of size 'MAXSEQLEN'
+//   are large enough for any sequence without padding.
+//
+// RETURN:
+//   A pointer to 'buf'.
+{
+  int pad = width > useq->len ? width - useq->len : 0;
+  memset(buf, ' ', pad);
+  for (int i = 0; i < useq->len; i++)
+    buf[pad + i] = seq_at(useq, i);
+  buf[pad + useq->len] = '\0';
+  return buf;
+}
+
 int
-seq2id(char* seq, int slen) {
-  int seqid = 0;
-  // Use the last 16 characters to construct the id.
-  int imin = slen > 16 ? slen - 16 : 0;
-  for (int i = imin; i < slen; i++) {
-    // Padding spaces are substituted by 'A'. It does not hurt
-    // anyway to generate some false positives.
-    if (seq[i] == 'A' || seq[i] == 'a' || seq[i] == ' ') {
-    } else if (seq[i] == 'C' || seq[i] == 'c')
-      seqid += 1;
-    else if (seq[i] == 'G' || seq[i] == 'g')
-      seqid += 2;
-    else if (seq[i] == 'T' || seq[i] == 't')
-      seqid += 3;
-    // Non DNA character (including end of string).
-    else
-      return seq[i] == '\0' ? -2 : -1;
-    if (i < slen - 1)
-      seqid <<= 2;
+seq_prefix(const useq_t* u1, const useq_t* u2)
+// SYNOPSIS:
+//   Returns the length of the common prefix of two sequences.
+{
+  int len = min(u1->len, u2->len);
+  int i = 0;
+  if (!u1->special && !u2->special) {
+    // Skip the identical words, then the identical bytes.
+    while (i + 32 <= len && memcmp(u1->pack + i / 4, u2->pack + i / 4, 8) == 0)
+      i += 32;
+    while (i + 4 <= len && u1->pack[i / 4] == u2->pack[i / 4])
+      i += 4;
   }
-
-  return seqid;
+  while (i < len && seq_at(u1, i) == seq_at(u2, i))
+    i++;
+  return i;
 }
 
-useq_t*
-new_useq(int count, char* seq, char* info) {
-  // Check input.
-  if (seq == NULL)
-    return NULL;
+int
+seqcmp(const useq_t* u1, const useq_t* u2)
+// SYNOPSIS:
+//   Compares the sequences like 'strcmp()'.
+{
+  int i = seq_prefix(u1, u2);
+  if (i < u1->len && i < u2->len)
+    return seq_at(u1, i) < seq_at(u2, i) ? -1 : 1;
+  if (u1->len == u2->len)
+    return 0;
+  return u1->len < u2->len ? -1 : 1;
+}
 
-  useq_t* new = calloc(1, sizeof(useq_t));
-  if (new == NULL) {
-    alert();
-    krash();
-  }
-  size_t slen = strlen(seq);
-  new->seq = malloc(slen + 1);
-  for (size_t i = 0; i < slen; i++)
-    new->seq[i] = capitalize[(uint8_t)seq[i]];
-  new->seq[slen] = 0;
-  new->count = count;
-  new->nids = 0;
-  new->sphere_c = 0;
-  new->sphere_d = 0;
-  new->seqid = NULL;
-  if (info != NULL) {
-    new->info = strdup(info);
-    if (new->info == NULL) {
-      alert();
-      krash();
-    }
+uint64_t
+seq_hash(const useq_t* useq)
+// SYNOPSIS:
+//   Hash of a sequence (FNV-1a on the packed bytes). Identical
+//   sequences have the same packed bytes, including the bitmap
+//   of special characters.
+{
+  size_t nbytes = (useq->len + 3) / 4;
+  if (useq->special)
+    nbytes += (useq->len + 7) / 8;
+  uint64_t h = 14695981039346656037ULL ^ useq->len;
+  for (size_t i = 0; i < nbytes; i++) {
+    h ^= useq->pack[i];
+    h *= 1099511628211ULL;
   }
+  // Mix the bits because the shard and the slot use different
+  // parts of the hash.
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 32;
+  return h;
+}
 
-  return new;
+int
+seq_order(const void* a, const void* b)
+// SYNOPSIS:
+//   Sort order of 'seqsort()'. Shorter sequences come first, and
+//   sequences of the same length are in lexical order. This is
+//   also the lexical order of the sequences padded with spaces.
+{
+  const useq_t* u1 = *((useq_t**)a);
+  const useq_t* u2 = *((useq_t**)b);
+  if (u1->len != u2->len)
+    return u1->len < u2->len ? -1 : 1;
+  // Packed sequences of the same length without special
+  // characters have the order of the bytes.
+  if (!u1->special && !u2->special)
+    return memcmp(u1->pack, u2->pack, (u1->len + 3) / 4);
+  return seqcmp(u1, u2);
 }
 
-void
-destroy_useq(useq_t* useq) {
-  if (useq->matches != NULL)
-    destroy_tower(useq->matches);
-  if (useq->info != NULL)
-    free(useq->info);
-  free(useq->seqid);
-  free(useq->seq);
-  free(useq);
+int
+trie_seq_order(const void* a, const void* b)
+// SYNOPSIS:
+//   Order of the hits of the trie search, i.e. the order of the
+//   leaves of the trie (see 'trie_order()').
+{
+  const useq_t* u1 = *((useq_t**)a);
+  const useq_t* u2 = *((useq_t**)b);
+  char s1[MAXSEQLEN];
+  char s2[MAXSEQLEN];
+  // Padding to the longest is the same as padding to the height.
+  int width = max(u1->len, u2->len);
+  return trie_order(unpack_seq(u1, s1, width), unpack_seq(u2, s2, width));
+}
+
+int
+addr_order(const void* a, const void* b) {
+  uintptr_t p1 = (uintptr_t)*((useq_t**)a);
+  uintptr_t p2 = (uintptr_t)*((useq_t**)b);
+  return (p1 > p2) - (p1 < p2);
 }
 
 int
@@ -2275,13 +6969,13 @@ canonical_order(const void* a, const void* b) {
   useq_t* u1 = *((useq_t**)a);
   useq_t* u2 = *((useq_t**)b);
   if (u1->canonical == u2->canonical)
-    return strcmp(u1->seq, u2->seq);
+    return seqcmp(u1, u2);
   if (u1->canonical == NULL)
     return 1;
   if (u2->canonical == NULL)
     return -1;
   if (u1->canonical->count == u2->canonical->count) {
-    return strcmp(u1->canonical->seq, u2->canonical->seq);
+    return seqcmp(u1->canonical, u2->canonical);
   }
   if (u1->canonical->count > u2->canonical->count)
     return -1;
@@ -2293,7 +6987,7 @@ sphere_size_order(const void* a, const void* b) {
   useq_t* u1 = *((useq_t**)a);
   useq_t* u2 = *((useq_t**)b);
   if (u1->sphere_c == u2->sphere_c)
-    return strcmp(u1->seq, u2->seq);
+    return seqcmp(u1, u2);
   else
     return u1->sphere_c < u2->sphere_c ? 1 : -1;
 }
@@ -2303,37 +6997,27 @@ count_order(const void* a, const void* b) {
   useq_t* u1 = *((useq_t**)a);
   useq_t* u2 = *((useq_t**)b);
   if (u1->count == u2->count)
-    return strcmp(u1->seq, u2->seq);
+    return seqcmp(u1, u2);
   else
     return u1->count < u2->count ? 1 : -1;
 }
 
 int
 count_order_spheres(const void* a, const void* b) {
-  useq_t* u1 = *((useq_t**)a);
-  useq_t* u2 = *((useq_t**)b);
+  const spherekey_t* k1 = (const spherekey_t*)a;
+  const spherekey_t* k2 = (const spherekey_t*)b;
   // Same count, sort by cluster size.
-  if (u1->count == u2->count) {
-    if (u2->matches == NULL)
+  if (k1->useq->count == k2->useq->count) {
+    if (k2->weight < 0)
       return -1;
-    if (u1->matches == NULL)
+    if (k1->weight < 0)
       return 1;
 
     // This counts the whole cluster size because the edge
     // references are bidirectional in spheres clustering.
-    long cnt1 = 0, cnt2 = 0;
-    gstack_t* matches;
-    for (int j = 0; (matches = u1->matches[j]) != TOWER_TOP; j++)
-      for (size_t k = 0; k < matches->nitems; k++)
-        cnt1 += ((useq_t*)matches->items[k])->count;
-
-    for (int j = 0; (matches = u2->matches[j]) != TOWER_TOP; j++)
-      for (size_t k = 0; k < matches->nitems; k++)
-        cnt2 += ((useq_t*)matches->items[k])->count;
-
-    return cnt1 < cnt2 ? 1 : -1;
+    return k1->weight < k2->weight ? 1 : -1;
   } else
-    return u1->count < u2->count ? 1 : -1;
+    return k1->useq->count < k2->useq->count ? 1 : -1;
 }
 
 int
@@ -27,10 +27,15 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 
+#include "kernel.h"
+
 #define VERSION "starcode-v1.4"
 #define DATE "2021-09-22"
 #define STARCODE_MAX_TAU 8
 
+// Functions exported by the shared library.
+#define STARCODE_API __attribute__((visibility("default")))
+
 typedef enum {
    DEFAULT_OUTPUT,
    CLUSTER_OUTPUT,
@@ -44,7 +49,25 @@ typedef enum {
    COMPONENTS_CLUSTER
 } cluster_t;
 
-int starcode(
+typedef enum {
+   AUTO_ENGINE,
+   TRIE_ENGINE,
+   SEED_ENGINE
+} engine_t;
+
+// Context of a clustering (see 'new_starcode()').
+typedef struct starcode_t starcode_t;
+
+// Cluster read with 'starcode_next_cluster()'.
+typedef struct {
+   long int             count;   // Number of reads
+   size_t               size;    // Number of sequences
+   const char * const * seqs;    // Sequences (centroid first)
+   size_t               nids;    // Number of read ids
+   const int          * ids;     // Ids of the reads (ascending)
+} starcode_cluster_t;
+
+STARCODE_API int starcode(
    FILE *inputf1,
    FILE *inputf2,
    FILE *outputf1,
@@ -59,4 +82,88 @@ int starcode(
    const int outputt
 );
 
+STARCODE_API int starcode_index(
+   FILE *inputf1,
+   FILE *inputf2,
+   const char *indexf,
+         int tau,
+   const int verbose,
+   const int thrmax
+);
+
+STARCODE_API int starcode_reference(
+   FILE *inputf,
+   const char *reference,
+   FILE *outputf,
+         int tau,
+   const int hamming,
+   const int kernel,
+   const int verbose,
+         int thrmax,
+   const int showids
+);
+
+STARCODE_API starcode_t * new_starcode(
+         int tau,
+   const int hamming,
+   const int thrmax,
+   const int clusteralg,
+         double parent_to_child
+);
+
+STARCODE_API int starcode_set_kernel(
+         starcode_t *sc,
+   const int kernel
+);
+
+STARCODE_API int starcode_set_engine(
+         starcode_t *sc,
+   const int engine
+);
+
+STARCODE_API int starcode_set_checkpoints(
+         starcode_t *sc,
+   const char *ckptin,
+   const char *ckptout
+);
+
+STARCODE_API int starcode_run_files(
+         starcode_t *sc,
+   FILE *inputf1,
+   FILE *inputf2,
+   FILE *outputf1,
+   FILE *outputf2,
+   const int verbose,
+   const int showclusters,
+   const int showids,
+   const int outputt
+);
+
+STARCODE_API int starcode_add(
+         starcode_t *sc,
+   const char *seq,
+   const int count
+);
+
+STARCODE_API int starcode_add_seqs(
+         starcode_t *sc,
+   const size_t n,
+   const char * const *seqs,
+   const int *counts,
+   const int *ids
+);
+
+STARCODE_API int starcode_run(
+         starcode_t *sc
+);
+
+STARCODE_API int starcode_next_cluster(
+         starcode_t *sc,
+         starcode_cluster_t *cluster
+);
+
+STARCODE_API void destroy_starcode(
+         starcode_t *sc
+);
+
 #endif
@@ -21,13 +21,65 @@
 **
 */
 
+#define _GNU_SOURCE
 #include "trie.h"
 
+// The SIMD kernel is compiled for x86 processors with GCC or Clang,
+// and the instruction set is chosen at run time (see 'simd_arms()').
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define X86_SIMD
+#include <immintrin.h>
+#endif
+
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 
 #define PAD 5              // Position of padding nodes.
 #define EOS -1             // End Of String, for 'dash()'.
+#define TAIL 0x80000000u   // Flag of the children that are tails.
+
+// Cache of node 'idx', in the node or private to a view of the trie
+// (see 'share_trie()').
+#define CACHE(arg,idx) ((arg).caches == NULL ? (arg).nodes[idx].cache : \
+      (arg).caches + (size_t) (idx) * (2*TAU+1))
+
+// Format of the images of the tries (see 'write_trie()').
+#define IMAGE_MAGIC "STRCTRIE"
+#define IMAGE_VERSION 1
+#define IMAGE_ENDIAN 0x01020304u
+#define IMAGE_ALIGN(x) (((x) + 63) & ~(uint64_t) 63)
+
+// Byte lanes of the bit-parallel kernel (see 'upper_arm()').
+#define LANES(x) (0x0101010101010101ULL * (x))
+#define HIGHBITS LANES(0x80)
+
+// Horizontal arms of all the children of a node (see 'simd_arms()').
+typedef void (*arms_t) (const char*, const char*, int, int, uint64_t*);
+
+// Header of the image of a trie. The offsets of the arrays are
+// relative to the header and aligned on 64 bytes. The node arena
+// has room for the nodes of the tails, which are not written.
+typedef struct {
+   char       magic[8];             // 'IMAGE_MAGIC'.
+   uint32_t   version;              // 'IMAGE_VERSION'.
+   uint32_t   endian;               // 'IMAGE_ENDIAN' in native order.
+   uint32_t   nodesize;             // Size of a node.
+   uint32_t   datasize;             // Size of a leaf data slot.
+   uint32_t   height;               // Height of the trie.
+   uint32_t   nnodes;               // Number of nodes.
+   uint32_t   nlazy;                // Number of nodes left in tails.
+   uint32_t   ndata;                // Number of leaf slots.
+   uint32_t   ntails;               // Number of tails.
+   uint32_t   nlabels;              // Number of label characters.
+   uint64_t   nodes;                // Offset of the node arena.
+   uint64_t   data;                 // Offset of the leaf data.
+   uint64_t   tails;                // Offset of the tails.
+   uint64_t   labels;               // Offset of the labels.
+   uint64_t   size;                 // Size of the image.
+} image_t;
+
+// Initial cache of the nodes (see 'poucet()').
+static const char CACHE_INIT[2*TAU+1] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
 
 // Translation table to insert nodes in the trie.
 //          ' ': PAD (5)
@@ -84,28 +136,61 @@ static const int altranslate[256] = {
 };
 
 struct arg_t {
+   trie_t    * trie;
+   node_t    * nodes;
+   void     ** data;
+   tail_t    * tails;
+   char      * labels;
+   char      * caches;
    gstack_t ** hits;
    gstack_t ** pebbles;
    char        tau;
    char        maxtau;
    int       * query;
+   char      * packed;
+   char      * qbytes;
+   kernel_t    kernel;
+   arms_t      arms;
    int         seed_depth;
    int         height;
    int         err;
 };
 
+uint32_t append_node (trie_t *, uint32_t);
 void     dash (node_t*, const int*, struct arg_t);
-void     destroy_from (node_t*, void(*)(void*), int, int, int);
+void     dash_tail (const tail_t*, uint32_t, const int*, struct arg_t);
+uint64_t lanes_load (const char *);
+uint64_t lanes_min (uint64_t, uint64_t);
+uint64_t lanes_neq (uint64_t);
+void     lanes_store (char *, uint64_t);
+uint64_t horizontal_arm (const char*, const char*, int, int, int);
+void     store_arm (char *, uint64_t, int);
+void     upper_arm (const char*, char*, uint32_t, int, int, int);
+void     horizontal_arms (const char*, const char*, int, int, uint64_t*);
+arms_t   simd_arms (void);
+#ifdef X86_SIMD
+void     horizontal_arms_avx2 (const char*, const char*, int, int, uint64_t*);
+void     horizontal_arms_sse4 (const char*, const char*, int, int, uint64_t*);
+#endif
+uint32_t expand_tail (trie_t *, uint32_t, uint32_t);
 int      get_height (trie_t*);
-void     init_pebbles (node_t*);
-node_t * insert (node_t *, int);
-node_t * insert_wo_malloc (node_t *, int, node_t *);
-node_t * new_trienode (void);
+void   * grow_array (void *, size_t, size_t);
+int      grow_nodes (trie_t *, size_t);
+int      has_room (trie_t *, size_t, size_t);
+void  ** insert_path (trie_t *, const char *, int);
+info_t * new_info (unsigned int);
+void  ** leaf_slot (trie_t *, uint32_t, int, int);
 void     poucet (node_t*, int, struct arg_t);
-int      recursive_count_nodes (node_t * node, int, int);
+void     poucet_tail (const tail_t*, char*, uint32_t, int, struct arg_t);
+int      push_mark (info_t*, int, const tail_t*, uint32_t, uint32_t,
+               const char*);
+void     hamming (node_t*, int, struct arg_t);
+void     hamming_tail (const tail_t*, int, int, struct arg_t);
+int      search_trie (trie_t*, const char*, int, gstack_t**, int, int,
+               kernel_t, void (*)(node_t*, int, struct arg_t));
 
 // Globals.
-int ERROR = 0;
+__thread int ERROR = 0;
 gstack_t * const TOWER_TOP;
 
 int get_height(trie_t *trie) { return trie->info->height; }
@@ -114,6 +199,27 @@ int get_height(trie_t *trie) { return trie->info->height; }
 
 int
 search
+(
+         trie_t   *  trie,
+   const char     *  query,
+   const int         tau,
+         gstack_t ** hits,
+         int         start_depth,
+   const int         seed_depth,
+   const kernel_t    kernel
+)
+// SYNOPSIS:                                                              
+//   Front end query of a trie within Levenshtein distance 'tau' with     
+//   the dynamic programming kernel 'kernel' (see 'search_trie()' and     
+//   'poucet()').                                                         
+{
+   return search_trie(trie, query, tau, hits, start_depth, seed_depth,
+         kernel, poucet);
+}
+
+
+int
+search_hamming
 (
          trie_t   *  trie,
    const char     *  query,
@@ -123,7 +229,29 @@ search
    const int         seed_depth
 )
 // SYNOPSIS:                                                              
-//   Front end query of a trie with the "poucet search" algorithm. Search 
+//   Front end query of a trie within Hamming distance 'tau', i.e. among  
+//   the sequences of the same length as the query, with substitutions    
+//   only (see 'search_trie()' and 'hamming()').                          
+{
+   return search_trie(trie, query, tau, hits, start_depth, seed_depth,
+         BYTEWISE_KERNEL, hamming);
+}
+
+
+int
+search_trie
+(
+         trie_t   *  trie,
+   const char     *  query,
+   const int         tau,
+         gstack_t ** hits,
+         int         start_depth,
+   const int         seed_depth,
+   const kernel_t    kernel,
+         void     (* descend) (node_t*, int, struct arg_t)
+)
+// SYNOPSIS:                                                              
+//   Back end query of a trie with the "poucet search" algorithm. Search  
 //   does not start from root. Instead, it starts from a given depth      
 //   corresponding to the length of the prefix from the previous search.  
 //   Since initial computations are identical for queries starting with   
@@ -137,6 +265,8 @@ search
 //   hits: a hit stack to push the hits                                   
 //   start_depth: the depth to start the search                           
 //   seed_depth: how deep to seed pebbles                                 
+//   kernel: the dynamic programming kernel (Levenshtein only)            
+//   descend: the recursive search from a node                            
 //                                                                        
 // RETURN:                                                                
 //   A pointer to 'hits' node array.                                      
@@ -145,7 +275,8 @@ search
 //   The non 'const' parameters of the function are modified. The node    
 //   array can be resized (which is why the address of the pointers is    
 //   passed as a parameter) and the trie is modified by the trailinng of  
-//   effect of the search.                                                
+//   effect of the search. Only the caches and the pebbles of a view are  
+//   modified (see 'share_trie()').                                       
 {
    ERROR = 0;
 
@@ -168,32 +299,69 @@ search
    start_depth = max(start_depth, 0);
    for (int i = start_depth+1 ; i <= min(seed_depth, height) ; i++) {
       info->pebbles[i]->nitems = 0;
+      if (info->marks != NULL) info->nmarks[i] = 0;
    }
 
    // Translate the query string. The first 'char' is kept to store
    // the length of the query, which shifts the array by 1 position.
+   // The query is also packed in bytes to be compared with the
+   // labels of the tails, where non DNA letters and 'PAD' are
+   // changed to a value that never matches (see 'dash()'). The
+   // bit-parallel kernel reads the query 8 bytes at a time from
+   // 'qbytes', which is shifted by 'TAU' more positions.
    int translated[M];
+   char packed[M];
+   char qbytes[M+TAU];
    translated[0] = length;
    translated[length+1] = EOS;
+   packed[length+1] = EOS;
+   memset(qbytes, EOS, TAU+1);
+   qbytes[TAU+length+1] = EOS;
    for (int i = max(0, start_depth-TAU) ; i < length ; i++) {
       translated[i+1] = altranslate[(int) query[i]];
+      packed[i+1] = translated[i+1] > 4 ? 7 : translated[i+1];
+      qbytes[TAU+i+1] = translated[i+1];
    }
 
    // Set the search options.
    struct arg_t arg = {
+      .trie    = trie,
+      .nodes   = trie->nodes,
+      .data    = trie->data,
+      .tails   = trie->tails,
+      .labels  = trie->labels,
+      .caches  = trie->caches,
       .hits    = hits,
       .query   = translated,
+      .packed  = packed,
+      .qbytes  = qbytes + TAU,
+      .kernel  = kernel,
+      .arms    = kernel == SIMD_KERNEL ? simd_arms() : NULL,
       .tau     = tau,
       .pebbles = info->pebbles,
       .seed_depth    = seed_depth,
       .height  = height,
    };
 
-   // Run recursive search from cached nodes.
+   // Run recursive search from cached nodes. The pebbles are
+   // indices so that they survive the growth of the node arena.
+   // The pebbles of a view can also be marks in the tails.
    gstack_t *pebbles = info->pebbles[start_depth];
    for (unsigned int i = 0 ; i < pebbles->nitems ; i++) {
-      node_t *start_node = (node_t *) pebbles->items[i];
-      poucet(start_node, start_depth + 1, arg);
+      uint32_t start_node = (uintptr_t) pebbles->items[i];
+      if (start_node & TAIL) {
+         mark_t *mark = info->marks[start_depth] + (start_node & ~TAIL);
+         if (descend == hamming) {
+            hamming_tail(&mark->rest, mark->cache[TAU], start_depth + 1,
+                  arg);
+         }
+         else {
+            poucet_tail(&mark->rest, mark->cache + TAU, mark->path,
+                  start_depth + 1, arg);
+         }
+         continue;
+      }
+      descend(trie->nodes + start_node, start_depth + 1, arg);
    }
 
    // Return the error code of the process (the line of
@@ -250,6 +418,11 @@ poucet
 //   The solution is to initialize the alignment score to 0 whenever the
 //   padding character is met, which in effect is equivalent to ignoring
 //   starting the alignment after the PADs.
+//
+//   The children may be path-compressed tails (see 'insert_path()').
+//   Above the trailing depth, a tail is expanded by one node so that it
+//   can be cached in the pebbles. Below, the search continues along its
+//   label in 'poucet_tail()' or checks it at once in 'dash()'.
 //                                                                        
 // PARAMETERS:                                                            
 //   node: the focus node in the trie                                     
@@ -267,7 +440,8 @@ poucet
    // with positive index and requiring the path, from the part that
    // goes horizontally, with negative index and requiring previous
    // characters of the query.
-   char *pcache = node->cache + TAU;
+   char *pcache = (arg.caches == NULL ? node->cache :
+         CACHE(arg, node - arg.nodes)) + TAU;
    // Risk of overflow at depth lower than 'tau'.
    int maxa = min((depth-1), arg.tau);
 
@@ -282,7 +456,11 @@ poucet
    // is computed separately. It will be copied later.
    int32_t path = node->path;
    // Upper arm of the L (need the path).
-   if (maxa > 0) {
+   if (maxa > 0 && arg.kernel != BYTEWISE_KERNEL) {
+      upper_arm(pcache, common, path, maxa, arg.query[depth],
+            arg.query[depth-1] == PAD);
+   }
+   else if (maxa > 0) {
       // Special initialization for first character. If the previous
       // character was a PAD, there is no cost to start the alignment.
       // This is the "PAD exeption" mentioned in the SYNOPSIS.
@@ -297,19 +475,35 @@ poucet
       }
    }
 
-   node_t *child;
+   // The SIMD kernel computes the horizontal arms of the L
+   // for all the children at once. They are stored below.
+   uint64_t arms[8];
+   if (maxa > 0 && arg.kernel == SIMD_KERNEL) {
+      arg.arms(pcache, arg.qbytes+depth, maxa, (path & 15) == PAD, arms);
+   }
+
    for (int i = 0 ; i < 6 ; i++) {
       // Skip if current node has no child at this position.
-      if ((child = node->child[i]) == NULL) continue;
+      uint32_t idx = node->child[i];
+      if (idx == 0) continue;
 
-      // Same remark as for parent cache.
+      // Same remark as for parent cache. At the height of the
+      // trie, 'idx' refers to the data of a leaf, not a node.
+      // The tails have no node, so their cache is also local.
       char local_cache[] = {9,8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8,9};
-      char *ccache = depth == arg.height ?
-         local_cache + 9 : child->cache + TAU;
+      char *ccache = depth == arg.height || (idx & TAIL) ?
+         local_cache + 9 : CACHE(arg, idx) + TAU;
       memcpy(ccache+1, common, TAU * sizeof(char));
 
       // Horizontal arm of the L (need previous characters).
-      if (maxa > 0) {
+      if (maxa > 0 && arg.kernel == SIMD_KERNEL) {
+         store_arm(ccache, arms[i], maxa);
+      }
+      else if (maxa > 0 && arg.kernel == BITPARALLEL_KERNEL) {
+         store_arm(ccache, horizontal_arm(pcache, arg.qbytes+depth, i,
+                  maxa, (path & 15) == PAD), maxa);
+      }
+      else if (maxa > 0) {
          // See comment above for initialization.
          // This is the "PAD exeption" mentioned in the SYNOPSIS.
          mmatch = ((path & 15) == PAD ? 0 : pcache[-maxa]) +
@@ -330,33 +524,63 @@ poucet
       // Stop searching if 'tau' is exceeded.
       if (ccache[0] > arg.tau) continue;
 
-      // Reached height of the trie: it's a hit!
+      // Reached height of the trie: it's a hit! Leaves
+      // without data are not reported.
       if (depth == arg.height) {
-         if (push(child, arg.hits + ccache[0])) ERROR = __LINE__;
+         if (arg.data[idx] == NULL) continue;
+         if (push(arg.data[idx], arg.hits + ccache[0])) ERROR = __LINE__;
          continue;
       }
 
-      // Cache nodes in pebbles when trailing.
-      if (depth <= arg.seed_depth) {
-         if (push(child, (arg.pebbles)+depth)) ERROR = __LINE__;
+      // Cache nodes in pebbles when trailing. A tail has to be
+      // expanded by one node, which inherits the local cache,
+      // except in a view, where it is cached in a mark.
+      if (depth <= arg.seed_depth && (idx & TAIL) && arg.trie->caches) {
+         if (push_mark(arg.trie->info, depth, arg.tails + (idx & ~TAIL),
+                  0, ((uint32_t) path << 4) + i, ccache - TAU)) {
+            ERROR = __LINE__;
+         }
+      }
+      else if (depth <= arg.seed_depth) {
+         if (idx & TAIL) {
+            idx = expand_tail(arg.trie, idx, ((uint32_t) path << 4) + i);
+            node->child[i] = idx;
+            memcpy(CACHE(arg, idx), ccache - TAU, 2*TAU+1);
+         }
+         if (push((void *) (uintptr_t) idx, (arg.pebbles)+depth)) {
+            ERROR = __LINE__;
+         }
       }
 
       if (depth > arg.seed_depth) {
-         // Use 'dash()' if no more mismatches allowed.
-         int can_dash = 1;
-         for (int a = -maxa ; a < maxa+1 ; a++) {
+         // Use 'dash()' if no more mismatches allowed. The 'PAD'
+         // is at the start of the query and 'dash()' rejects it.
+         int can_dash = arg.query[depth+1] != PAD;
+         for (int a = -maxa ; can_dash && a < maxa+1 ; a++) {
             if (ccache[a] < arg.tau) {
                can_dash = 0;
                break;
             }
          }
          if (can_dash) {
-            dash(child, arg.query+depth+1, arg);
+            if (idx & TAIL) {
+               dash_tail(arg.tails + (idx & ~TAIL), 0,
+                     arg.query+depth+1, arg);
+            }
+            else {
+               dash(arg.nodes + idx, arg.query+depth+1, arg);
+            }
             continue;
          }
       }
 
-      poucet(child, depth+1, arg);
+      if (idx & TAIL) {
+         poucet_tail(arg.tails + (idx & ~TAIL), ccache,
+               ((uint32_t) path << 4) + i, depth+1, arg);
+         continue;
+      }
+
+      poucet(arg.nodes + idx, depth+1, arg);
 
    }
 
@@ -386,321 +610,1544 @@ dash
 {
 
    int c;
-   node_t *child;
+   uint32_t idx = 0;
 
-   // Early return if the suffix path is broken.
+   // Early return if the suffix path is broken. The last
+   // index of the path refers to the data of a leaf.
    while ((c = *suffix++) != EOS) {
-      if ((c > 4) || (child = (node_t *) node->child[c]) == NULL) return;
-      node = child;
+      if ((c > 4) || (idx = node->child[c]) == 0) return;
+      if (idx & TAIL) {
+         // The rest of the path is the label of the tail.
+         dash_tail(arg.tails + (idx & ~TAIL), 0, suffix, arg);
+         return;
+      }
+      if (*suffix != EOS) node = arg.nodes + idx;
    }
 
    // End of query, check whether node is a tail.
-   if (push(node, arg.hits + arg.tau)) ERROR = __LINE__;
+   if (arg.data[idx] == NULL) return;
+   if (push(arg.data[idx], arg.hits + arg.tau)) ERROR = __LINE__;
 
    return;
 
 }
 
 
-// ------  TRIE CONSTRUCTION AND DESTRUCTION  ------ //
-
-
-trie_t *
-new_trie
+void
+poucet_tail
 (
-   unsigned int  height
+   const  tail_t * restrict tail,
+          char   *          pcache,
+          uint32_t          path,
+   const  int               depth,
+   struct arg_t             arg
 )
 // SYNOPSIS:                                                              
-//   Front end trie constructor.                                          
+//   Back end "poucet search" along the label of a tail. This is the same 
+//   dynamic programming as in 'poucet()', but every node of the label    
+//   has a single child, so the search is a loop instead of a recursion.  
+//   The columns of the dynamic programming table are kept in two local   
+//   buffers instead of the nodes. The tails of a trie are expanded above 
+//   the trailing depth (see 'expand_tail()'), but not those of a view,   
+//   so the characters above the trailing depth are cached in marks (see  
+//   'push_mark()').                                                      
 //                                                                        
 // PARAMETERS:                                                            
-//   height: the fixed depth of the leaves                                
+//   tail: the tail to search                                             
+//   pcache: the cache of the first character of the tail                 
+//   path: the path to the first character of the tail                    
+//   depth: the depth of the first character of the label                 
 //                                                                        
 // RETURN:                                                                
-//   A pointer to trie root with meta information and no children.        
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Updates 'arg.hits' if the leaf of the tail is a hit.                 
 {
 
-   if (height < 1) {
-      fprintf(stderr, "error: the minimum trie height is 1\n");
-      ERROR = __LINE__;
-      return NULL;
-   }
+   const char *label = arg.labels + tail->label;
+   char buffers[2][2*TAU+1] = {
+      {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8},
+      {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8},
+   };
 
-   trie_t *trie = malloc(sizeof(trie_t));
-   if (trie == NULL) {
-      fprintf(stderr, "error: could not create trie\n");
-      ERROR = __LINE__;
-      return NULL;
-   }
+   unsigned char mmatch;
+   unsigned char shift;
 
-   node_t *root = new_trienode();
-   if (root == NULL) {
-      fprintf(stderr, "error: could not create root\n");
-      ERROR = __LINE__;
-      free(trie);
-      return NULL;
-   }
+   for (uint32_t k = 0 ; k < tail->len ; k++) {
+      const int d = depth + k;
+      const int i = label[k];
+      int maxa = min((d-1), arg.tau);
+      char common[9] = {1,2,3,4,5,6,7,8,9};
 
-   info_t *info = malloc(sizeof(info_t));
-   if (info == NULL) {
-      fprintf(stderr, "error: could not create trie\n");
-      ERROR = __LINE__;
-      free(root);
-      free(trie);
-      return NULL;
-   }
+      // Upper arm of the L (see 'poucet()').
+      if (maxa > 0 && arg.kernel != BYTEWISE_KERNEL) {
+         upper_arm(pcache, common, path, maxa, arg.query[d],
+               arg.query[d-1] == PAD);
+      }
+      else if (maxa > 0) {
+         mmatch = (arg.query[d-1] == PAD ? 0 : pcache[maxa]) +
+                     ((int) (path >> 4*(maxa-1) & 15) != arg.query[d]);
+         shift = min(pcache[maxa-1], common[maxa]) + 1;
+         common[maxa-1] = min(mmatch, shift);
+         for (int a = maxa-1 ; a > 0 ; a--) {
+            mmatch = pcache[a] +
+                     ((int) (path >> 4*(a-1) & 15) != arg.query[d]);
+            shift = min(pcache[a-1], common[a]) + 1;
+            common[a-1] = min(mmatch, shift);
+         }
+      }
 
-   // Set the values of the meta information.
-   info->height = height;
-   info->pebbles = new_tower(M);
+      char *ccache = buffers[k & 1] + TAU;
+      memcpy(ccache+1, common, TAU * sizeof(char));
 
-   // Push the root to the ground level of 'pebbles'.
-   // This will be the only node at this level for
-   // the lifetime of the trie.
-   if (info->pebbles == NULL || push(root, info->pebbles)) {
-      fprintf(stderr, "error: could not create trie\n");
-      ERROR = __LINE__;
-      free(info);
-      free(root);
-      free(trie);
-      return NULL;
-   }
+      // Horizontal arm of the L. A tail has one child, so the
+      // SIMD kernel does not apply.
+      if (maxa > 0 && arg.kernel != BYTEWISE_KERNEL) {
+         store_arm(ccache, horizontal_arm(pcache, arg.qbytes+d, i,
+                  maxa, (path & 15) == PAD), maxa);
+      }
+      else if (maxa > 0) {
+         mmatch = ((path & 15) == PAD ? 0 : pcache[-maxa]) +
+                     (i != arg.query[d-maxa]);
+         shift = min(pcache[1-maxa], maxa+1) + 1;
+         ccache[-maxa] = min(mmatch, shift);
+         for (int a = maxa-1 ; a > 0 ; a--) {
+            mmatch = pcache[-a] + (i != arg.query[d-a]);
+            shift = min(pcache[1-a], ccache[-a-1]) + 1;
+            ccache[-a] = min(mmatch, shift);
+         }
+      }
+      // Center cell.
+      mmatch = pcache[0] + (i != arg.query[d]);
+      shift = min(ccache[-1], ccache[1]) + 1;
+      ccache[0] = min(mmatch, shift);
 
-   trie->root = root;
-   trie->info = info;
+      // Stop searching if 'tau' is exceeded.
+      if (ccache[0] > arg.tau) return;
 
-   return trie;
+      // The label ends at the height of the trie.
+      if (d == arg.height) {
+         if (arg.data[tail->data] == NULL) return;
+         if (push(arg.data[tail->data], arg.hits + ccache[0])) {
+            ERROR = __LINE__;
+         }
+         return;
+      }
+
+      // Cache the character in a mark when trailing (views only).
+      if (d <= arg.seed_depth) {
+         if (push_mark(arg.trie->info, d, tail, k+1, (path << 4) + i,
+                  ccache - TAU)) {
+            ERROR = __LINE__;
+         }
+      }
+
+      // Check the rest of the label if no more mismatches allowed
+      // (see 'poucet()' for the 'PAD').
+      int can_dash = d > arg.seed_depth && arg.query[d+1] != PAD;
+      for (int a = -maxa ; can_dash && a < maxa+1 ; a++) {
+         if (ccache[a] < arg.tau) {
+            can_dash = 0;
+            break;
+         }
+      }
+      if (can_dash) {
+         dash_tail(tail, k+1, arg.query+d+1, arg);
+         return;
+      }
+
+      path = (path << 4) + i;
+      pcache = ccache;
+
+   }
 
 }
 
 
-node_t *
-new_trienode
-(void)
+void
+dash_tail
+(
+   const  tail_t * restrict tail,
+   const  uint32_t          skip,
+   const  int    * restrict suffix,
+   struct arg_t             arg
+)
 // SYNOPSIS:                                                              
-//   Back end constructor for a trie node. All values are initialized to  
-//   null, except the cache for dynamic programming which is initialized  
-//   as a root node.                                                      
+//   Checks whether the label of a tail (past the first 'skip' characters)
+//   is the given suffix and reports a hit if this is the case. The label 
+//   is compared at once with the packed query, where the characters that 
+//   'dash()' rejects never match.                                        
+//                                                                        
+// PARAMETERS:                                                            
+//   tail: the tail to test                                               
+//   skip: the number of characters of the label already matched         
+//   suffix: the suffix to test as a translated sequence                  
 //                                                                        
 // RETURN:                                                                
-//   A pointer to trie node with no data and no children.                 
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Updates 'arg.hits' if the suffix is found.                           
 {
 
-   node_t *node = calloc(1, sizeof(node_t));
-   if (node == NULL) {
-      fprintf(stderr, "error: could not create trie node\n");
-      ERROR = __LINE__;
-      return NULL;
-   }
+   const char *packed = arg.packed + (suffix - arg.query);
+   const uint32_t len = tail->len - skip;
+
+   if (memcmp(arg.labels + tail->label + skip, packed, len)) return;
+   if (packed[len] != (char) EOS) return;
 
-   // Initialize the cache. This is important for the
-   // dynamic programming algorithm.
-   const char init[] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
-   memcpy(node->cache, init, 2*TAU+1);
-   return node;
+   if (arg.data[tail->data] == NULL) return;
+   if (push(arg.data[tail->data], arg.hits + arg.tau)) ERROR = __LINE__;
 
 }
 
 
-void **
-insert_string
+void
+hamming
 (
-         trie_t * trie,
-   const char   * string
+          node_t * restrict node,
+   const  int      depth,
+   struct arg_t    arg
 )
 // SYNOPSIS:                                                              
-//   Front end function to fill in a trie. Insert a string from root, or  
-//   simply return the node at the end of the string path if it already   
-//   exists.                                                              
+//   Back end recursive search within Hamming distance. This is the same  
+//   descent as 'poucet()', with pebbles, tails and 'dash()', but there   
+//   is no band of dynamic programming: the cache of a node only holds    
+//   the number of mismatches of its path in the center cell. The 'PAD'   
+//   only matches itself, so the hits have the same length as the query. 
+//                                                                        
+// PARAMETERS:                                                            
+//   node: the focus node in the trie                                     
+//   depth: the depth of the children in the trie.                        
 //                                                                        
 // RETURN:                                                                
-//   The leaf node in case of succes, 'NULL' otherwise.                   
+//   'void'.                                                              
 //                                                                        
-// NB: This function is not used by 'starcode()'.
+// SIDE EFFECTS:                                                          
+//   Same as 'poucet()'.                                                  
 {
 
-   int i;
+   const int c = arg.query[depth];
+   const char count = arg.caches == NULL ? node->cache[TAU] :
+         CACHE(arg, node - arg.nodes)[TAU];
 
-   int nchar = strlen(string);
-   if (nchar != get_height(trie)) {
-      fprintf(stderr, "error: can only insert string of length %d\n",
-            get_height(trie));
-      ERROR = __LINE__;
-      return NULL;
-   }
-   
-   // Find existing path.
-   node_t *node = trie->root;
-   for (i = 0 ; i < nchar-1; i++) {
-      node_t *child;
-      int c = translate[(int) string[i]];
-      if ((child = (node_t *) node->child[c]) == NULL) {
-         break;
+   for (int i = 0 ; i < 6 ; i++) {
+      // Skip if current node has no child at this position.
+      uint32_t idx = node->child[i];
+      if (idx == 0) continue;
+
+      // Sequences of different lengths never match.
+      if (i != c && (i == PAD || c == PAD)) continue;
+      char ccount = count + (i != c);
+
+      // Stop searching if 'tau' is exceeded.
+      if (ccount > arg.tau) continue;
+
+      // Reached height of the trie: it's a hit! Leaves
+      // without data are not reported.
+      if (depth == arg.height) {
+         if (arg.data[idx] == NULL) continue;
+         if (push(arg.data[idx], arg.hits + ccount)) ERROR = __LINE__;
+         continue;
       }
-      node = child;
-   }
 
-   // Append more nodes.
-   for ( ; i < nchar-1 ; i++) {
-      int c = translate[(int) string[i]];
-      node = insert(node, c);
-      if (node == NULL) {
-         fprintf(stderr, "error: could not insert string\n");
-         ERROR = __LINE__;
-         return NULL;
+      // Cache nodes in pebbles when trailing (see 'poucet()').
+      if (depth <= arg.seed_depth && (idx & TAIL) && arg.trie->caches) {
+         char cache[2*TAU+1] = {0};
+         cache[TAU] = ccount;
+         if (push_mark(arg.trie->info, depth, arg.tails + (idx & ~TAIL),
+                  0, ((uint32_t) node->path << 4) + i, cache)) {
+            ERROR = __LINE__;
+         }
+      }
+      else if (depth <= arg.seed_depth) {
+         if (idx & TAIL) {
+            idx = expand_tail(arg.trie, idx,
+                  ((uint32_t) node->path << 4) + i);
+            node->child[i] = idx;
+         }
+         if (push((void *) (uintptr_t) idx, (arg.pebbles)+depth)) {
+            ERROR = __LINE__;
+         }
+      }
+
+      if (idx & TAIL) {
+         hamming_tail(arg.tails + (idx & ~TAIL), ccount, depth+1, arg);
+         continue;
+      }
+
+      // Use 'dash()' if no more mismatches allowed. The 'PAD'
+      // is at the start of the query and 'dash()' rejects it.
+      if (depth > arg.seed_depth && ccount == arg.tau &&
+            arg.query[depth+1] != PAD) {
+         dash(arg.nodes + idx, arg.query+depth+1, arg);
+         continue;
       }
-   }
 
-   return node->child + translate[(int) string[nchar-1]];
+      CACHE(arg, idx)[TAU] = ccount;
+      hamming(arg.nodes + idx, depth+1, arg);
+
+   }
 
 }
 
 
-node_t *
-insert
+void
+hamming_tail
 (
-   node_t * parent,
-   int      position
+   const  tail_t * restrict tail,
+          int               count,
+   const  int               depth,
+   struct arg_t             arg
 )
 // SYNOPSIS:                                                              
-//   Back end function to construct tries. Append a child to an existing  
-//   node at specifieid position.                                         
-//   NO CHECKING IS PERFORMED to make sure that this does not overwrite   
-//   an existings node child (causing a memory leak) or that 'c' is an    
-//   integer less than 5. Since 'insert' is called exclusiverly by        
-//   'insert_string' after a call to 'find_path', this checking is not    
-//   required. If 'insert' is called in another context, this check has   
-//   to be performed.                                                     
+//   Back end search within Hamming distance along the label of a tail    
+//   (see 'hamming()' and 'poucet_tail()').                               
 //                                                                        
 // PARAMETERS:                                                            
-//   parent: the parent to append the node to                             
-//   position: the position of the child                                  
+//   tail: the tail to search                                             
+//   count: the number of mismatches before the label                     
+//   depth: the depth of the first character of the label                 
 //                                                                        
 // RETURN:                                                                
-//   The appended child node in case of success, 'NULL' otherwise.        
+//   'void'.                                                              
 //                                                                        
-// NB: This function is not used by 'starcode()'.
+// SIDE EFFECTS:                                                          
+//   Updates 'arg.hits' if the leaf of the tail is a hit.                 
 {
-   // Initilalize child node.
-   node_t *child = new_trienode();
-   if (child == NULL) {
-      fprintf(stderr, "error: could not insert node\n");
-      ERROR = __LINE__;
-      return NULL;
+
+   const char *label = arg.labels + tail->label;
+
+   for (uint32_t k = 0 ; k < tail->len ; k++) {
+      const int d = depth + k;
+      // Check the rest of the label if no more mismatches allowed
+      // (see 'hamming()' for the 'PAD').
+      if (d > arg.seed_depth && count == arg.tau && arg.query[d] != PAD) {
+         dash_tail(tail, k, arg.query+d, arg);
+         return;
+      }
+      const int i = label[k];
+      const int c = arg.query[d];
+      if (i != c && (i == PAD || c == PAD)) return;
+      if ((count += (i != c)) > arg.tau) return;
+      // Cache the character in a mark when trailing (views only,
+      // see 'poucet_tail()').
+      if (d <= arg.seed_depth && d < arg.height) {
+         char cache[2*TAU+1] = {0};
+         cache[TAU] = count;
+         if (push_mark(arg.trie->info, d, tail, k+1, 0, cache)) {
+            ERROR = __LINE__;
+         }
+      }
    }
-   // Update child path and parent pointer.
-   child->path = (parent->path << 4) + position;
-   // Update parent node.
-   parent->child[position] = child;
 
-   return child;
+   if (arg.data[tail->data] == NULL) return;
+   if (push(arg.data[tail->data], arg.hits + count)) ERROR = __LINE__;
 
 }
 
 
-void **
-insert_string_wo_malloc
+int
+push_mark
 (
-         trie_t  * trie,
-   const char    * string,
-         node_t ** from_addr
+         info_t   * info,
+   const int        depth,
+   const tail_t   * tail,
+   const uint32_t   skip,
+   const uint32_t   path,
+   const char     * cache
 )
-// TODO: document the function, explain that 'from_addr' is
-// incremented.
 // SYNOPSIS:                                                              
+//   Back end function to cache a character of a tail in the pebbles of a 
+//   view (see 'share_trie()'). The mark holds the rest of the tail past  
+//   the first 'skip' characters of the label, so that the search can     
+//   restart below the character with 'poucet_tail()' or 'hamming_tail()'.
+//   The pebble is the index of the mark with the 'TAIL' flag.            
+//                                                                        
+// PARAMETERS:                                                            
+//   info: the meta information of the view                               
+//   depth: the depth of the character                                    
+//   tail: the tail of the character                                      
+//   skip: the number of characters of the label down to the character   
+//   path: the path to the character                                      
+//   cache: the cache of the character                                    
 //                                                                        
 // RETURN:                                                                
+//   0 upon success, 1 upon failure.                                      
 {
 
-   int i;
-
-   int nchar = strlen(string);
-   if (nchar != get_height(trie)) {
-      fprintf(stderr, "error: can only insert string of length %d\n",
-            get_height(trie));
-      ERROR = __LINE__;
-      return NULL;
-   }
-   
-   // Find existing path.
-   node_t *node = trie->root;
-   for (i = 0 ; i < nchar-1; i++) {
-      node_t *child;
-      int c = translate[(int) string[i]];
-      if ((child = (node_t *) node->child[c]) == NULL) {
-         break;
+   if (info->nmarks[depth] == info->markslots[depth]) {
+      uint32_t slots = info->markslots[depth] ?
+         2 * info->markslots[depth] : GSTACK_INIT_SIZE;
+      mark_t *marks = realloc(info->marks[depth], slots * sizeof(mark_t));
+      if (marks == NULL) {
+         fprintf(stderr, "error: could not push mark\n");
+         return 1;
       }
-      node = child;
+      info->marks[depth] = marks;
+      info->markslots[depth] = slots;
    }
 
-   // Append more nodes.
-   for ( ; i < nchar-1 ; i++) {
-      int c = translate[(int) string[i]];
-      node = insert_wo_malloc(node, c, *from_addr);
-      (*from_addr)++; 
-   }
+   uint32_t idx = info->nmarks[depth]++;
+   mark_t *mark = info->marks[depth] + idx;
+   mark->rest.label = tail->label + skip;
+   mark->rest.len = tail->len - skip;
+   mark->rest.data = tail->data;
+   mark->path = path;
+   memcpy(mark->cache, cache, 2*TAU+1);
 
-   return node->child + translate[(int) string[nchar-1]];
+   return push((void *) (uintptr_t) (TAIL | idx), info->pebbles + depth);
 
 }
 
-node_t *
-insert_wo_malloc
+
+// ------  VERIFICATION FUNCTIONS  ------ //
+
+int
+band_distance
 (
-   node_t * parent,
-   int      position,
-   node_t * at_address
+   const char * query,
+   const char * target,
+   const int    tau
 )
 // SYNOPSIS:                                                              
-//   Adds a child to the specified node without calling 'malloc()'.
-//   The data is copied at the addres given by the 'at_address'
-//   pointer.
-//   Checks whether the position to insert the node is free. If not,
-//   nothing is done and 'NULL' is returned.
+//   Levenshtein distance between two sequences padded to the same length 
+//   with the dynamic programming of 'poucet()', along the single path of 
+//   'target' instead of the trie. The band, the "PAD exception" and the  
+//   pruning on the center cell are the same, so that the distance is     
+//   the one that the search of 'query' in a trie would report.           
 //                                                                        
 // PARAMETERS:                                                            
-//   parent: the parent node on which to add the child.
-//   position: a number from 0 to 5 indicating the rank of the child.
-//   at_address: the position in memory where to copy the child data.
+//   query: the query as an ascii string                                  
+//   target: the target as an ascii string of the same length             
+//   tau: the maximum edit distance                                       
 //                                                                        
 // RETURN:                                                                
-//   The address of the child node if the insert position is free,
-//   'NULL' otherwise.
-//
-// SIDE EFFECTS:
-//   Modifies the data pointed to by 'at_address'. Also modifies the
-//   parent node
+//   The distance if it is at most 'tau', 'tau+1' otherwise.              
 {
 
-   if (parent->child[position] != NULL) return NULL;
-   node_t *newnode = at_address; // for clarity
+   const int length = strlen(query);
+   if (tau > TAU || (int) strlen(target) != length) return tau+1;
 
-   // Initialize child data.
-   memset(newnode->child, 0, 6 * sizeof(void *));
-   newnode->path = (parent->path << 4) + position;
-   const char init[] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
-   memcpy(newnode->cache, init, 2*TAU+1);
+   int translated[M];
+   translated[0] = length;
+   for (int i = 0 ; i < length ; i++) {
+      translated[i+1] = altranslate[(int) query[i]];
+   }
 
-   parent->child[position] = newnode;
+   // The columns of the dynamic programming table are kept
+   // in local buffers, as in 'poucet_tail()'. The third is
+   // the cache of the root.
+   char buffers[3][2*TAU+1] = {
+      {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8},
+      {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8},
+      {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8},
+   };
 
-   return newnode;
+   char *pcache = buffers[2] + TAU;
+   char *ccache = pcache;
+   uint32_t path = 0;
 
-}
+   unsigned char mmatch;
+   unsigned char shift;
+
+   for (int d = 1 ; d <= length ; d++) {
+      const int i = translate[(int) target[d-1]];
+      int maxa = min((d-1), tau);
+      char common[9] = {1,2,3,4,5,6,7,8,9};
+
+      // Upper arm of the L (see 'poucet()').
+      if (maxa > 0) {
+         mmatch = (translated[d-1] == PAD ? 0 : pcache[maxa]) +
+                     ((int) (path >> 4*(maxa-1) & 15) != translated[d]);
+         shift = min(pcache[maxa-1], common[maxa]) + 1;
+         common[maxa-1] = min(mmatch, shift);
+         for (int a = maxa-1 ; a > 0 ; a--) {
+            mmatch = pcache[a] +
+                     ((int) (path >> 4*(a-1) & 15) != translated[d]);
+            shift = min(pcache[a-1], common[a]) + 1;
+            common[a-1] = min(mmatch, shift);
+         }
+      }
+
+      ccache = buffers[d & 1] + TAU;
+      memcpy(ccache+1, common, TAU * sizeof(char));
+
+      // Horizontal arm of the L.
+      if (maxa > 0) {
+         mmatch = ((path & 15) == PAD ? 0 : pcache[-maxa]) +
+                     (i != translated[d-maxa]);
+         shift = min(pcache[1-maxa], maxa+1) + 1;
+         ccache[-maxa] = min(mmatch, shift);
+         for (int a = maxa-1 ; a > 0 ; a--) {
+            mmatch = pcache[-a] + (i != translated[d-a]);
+            shift = min(pcache[1-a], ccache[-a-1]) + 1;
+            ccache[-a] = min(mmatch, shift);
+         }
+      }
+      // Center cell.
+      mmatch = pcache[0] + (i != translated[d]);
+      shift = min(ccache[-1], ccache[1]) + 1;
+      ccache[0] = min(mmatch, shift);
+
+      // Stop if 'tau' is exceeded.
+      if (ccache[0] > tau) return tau+1;
+
+      path = (path << 4) + i;
+      pcache = ccache;
+
+   }
+
+   return ccache[0];
+
+}
+
+
+int
+hamming_distance
+(
+   const char * query,
+   const char * target,
+   const int    tau
+)
+// SYNOPSIS:                                                              
+//   Hamming distance between two sequences padded to the same length,    
+//   with the matching rules of 'hamming()': the 'PAD' only matches       
+//   itself and the non DNA letters of the query never match.             
+//                                                                        
+// PARAMETERS:                                                            
+//   query: the query as an ascii string                                  
+//   target: the target as an ascii string of the same length             
+//   tau: the maximum Hamming distance                                    
+//                                                                        
+// RETURN:                                                                
+//   The distance if it is at most 'tau', 'tau+1' otherwise.              
+{
+
+   const int length = strlen(query);
+   if ((int) strlen(target) != length) return tau+1;
+
+   int count = 0;
+   for (int k = 0 ; k < length ; k++) {
+      const int c = altranslate[(int) query[k]];
+      const int i = translate[(int) target[k]];
+      if (i != c && (i == PAD || c == PAD)) return tau+1;
+      if ((count += (i != c)) > tau) return tau+1;
+   }
+
+   return count;
+
+}
+
+
+int
+trie_order
+(
+   const char * a,
+   const char * b
+)
+// SYNOPSIS:                                                              
+//   Compares two sequences padded to the same length in the order of the 
+//   leaves of a trie, which is the order of the hits of 'search()'.      
+//                                                                        
+// PARAMETERS:                                                            
+//   a: the first sequence as an ascii string                             
+//   b: the second sequence as an ascii string                            
+//                                                                        
+// RETURN:                                                                
+//   A negative, zero or positive value as 'strcmp()'.                    
+{
+
+   for ( ; *a != '\0' && *b != '\0' ; a++, b++) {
+      const int diff = translate[(int) *a] - translate[(int) *b];
+      if (diff) return diff;
+   }
+
+   return (*a != '\0') - (*b != '\0');
+
+}
+
+
+// ------  BIT-PARALLEL KERNEL  ------ //
+
+// The arms of the L computed by 'poucet()' are at most 'TAU' = 8
+// cells long and the values stay far below 128, so each arm fits in
+// the 8 byte lanes of a 64-bit word. The recurrence of an arm is
+// D[k] = min(X[k], D[k+1]+1) along the arm, where X[k] is the min
+// of the diagonal and of the perpendicular move, which do not
+// depend on the arm itself. So X is computed for all the lanes at
+// once, and the dependency along the arm is solved as a prefix min
+// in 3 shifts by doubling, instead of cell by cell.
+
+uint64_t
+lanes_load
+(
+   const char * bytes
+)
+// SYNOPSIS:                                                              
+//   Loads 8 consecutive cells in the lanes of a word, the first cell in  
+//   the lowest lane whatever the endianness of the machine.              
+{
+   uint64_t lanes;
+   memcpy(&lanes, bytes, sizeof(lanes));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   lanes = __builtin_bswap64(lanes);
+#endif
+   return lanes;
+}
+
+
+void
+lanes_store
+(
+   char     * bytes,
+   uint64_t   lanes
+)
+// SYNOPSIS:                                                              
+//   Stores the lanes of a word in 8 consecutive cells (see 'lanes_load()').
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   lanes = __builtin_bswap64(lanes);
+#endif
+   memcpy(bytes, &lanes, sizeof(lanes));
+}
+
+
+uint64_t
+lanes_min
+(
+   uint64_t a,
+   uint64_t b
+)
+// SYNOPSIS:                                                              
+//   Lane-wise min of two words whose lanes are all lower than 128. The   
+//   high bit of the lanes of '(b|HIGHBITS)-a' is set where 'a <= b'.     
+{
+   uint64_t le = ((b | HIGHBITS) - a) & HIGHBITS;
+   uint64_t mask = (le >> 7) * 0xFF;
+   return b ^ ((a ^ b) & mask);
+}
+
+
+uint64_t
+lanes_neq
+(
+   uint64_t x
+)
+// SYNOPSIS:                                                              
+//   1 in the lanes of 'x' that are not 0, and 0 in the others, for the   
+//   words whose lanes are all lower than 128.                            
+{
+   return (((x + LANES(0x7F)) | x) & HIGHBITS) >> 7;
+}
+
+
+void
+upper_arm
+(
+   const  char     * pcache,
+          char     * common,
+   const  uint32_t   path,
+   const  int        maxa,
+   const  int        query,
+   const  int        pad
+)
+// SYNOPSIS:                                                              
+//   Bit-parallel version of the upper arm of the L in 'poucet()'. Lane   
+//   'k' holds 'common[k]', and 'common[maxa]' is the end of the arm, so  
+//   the prefix min runs from the high lanes to the low lanes. The lanes  
+//   from 'maxa' up keep their initial value 'k+1'.                       
+//                                                                        
+// PARAMETERS:                                                            
+//   pcache: the center of the cache of the parent                        
+//   common: the arm shared by the children (9 cells)                     
+//   path: the path of the parent                                         
+//   maxa: the length of the arm (from 1 to 'TAU')                        
+//   query: the character of the query at the depth of the children      
+//   pad: whether the previous character of the query is 'PAD'            
+//                                                                        
+// RETURN:                                                                
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Sets the first 8 cells of 'common'.                                  
+{
+
+   uint64_t diag = lanes_load(pcache+1);
+   uint64_t left = lanes_load(pcache);
+
+   // Spread the 8 characters of the path in the lanes.
+   uint64_t chars = path;
+   chars = (chars | chars << 16) & 0x0000FFFF0000FFFFULL;
+   chars = (chars | chars <<  8) & 0x00FF00FF00FF00FFULL;
+   chars = (chars | chars <<  4) & 0x0F0F0F0F0F0F0F0FULL;
+   uint64_t mmatch = lanes_neq(chars ^ LANES(query & 15));
+
+   // This is the "PAD exeption" (see 'poucet()').
+   if (pad) diag &= ~(0xFFULL << 8*(maxa-1));
+
+   uint64_t arm = lanes_min(diag + mmatch, left + LANES(1));
+   uint64_t inside = maxa < 8 ? (1ULL << 8*maxa) - 1 : ~0ULL;
+   arm = (arm & inside) | (0x0807060504030201ULL & ~inside);
+
+   // Prefix min from 'common[maxa]' down to 'common[0]', which
+   // takes one step per power of 2 up to 'maxa'. The lanes shifted
+   // in from the top are the initial values of the cells past
+   // 'common[7]', i.e. 9, 10, 11...
+   arm = lanes_min(arm, (arm >>  8 | 0x09ULL << 56) + LANES(1));
+   if (maxa > 1) {
+      arm = lanes_min(arm, (arm >> 16 | 0x0A09ULL << 48) + LANES(2));
+   }
+   if (maxa > 3) {
+      arm = lanes_min(arm, (arm >> 32 | 0x0C0B0A09ULL << 32) + LANES(4));
+   }
+   if (maxa > 7) {
+      arm = lanes_min(arm, 0x100F0E0D0C0B0A09ULL + LANES(8));
+   }
+
+   lanes_store(common, arm);
+
+}
+
+
+uint64_t
+horizontal_arm
+(
+   const  char * pcache,
+   const  char * qbytes,
+   const  int    i,
+   const  int    maxa,
+   const  int    pad
+)
+// SYNOPSIS:                                                              
+//   Bit-parallel version of the horizontal arm of the L in 'poucet()'.   
+//   Lane 'm' holds 'ccache[m-8]', so the prefix min runs from the low    
+//   lanes to the high lanes. The lanes below '8-maxa' keep their initial 
+//   value '8-m'.                                                         
+//                                                                        
+// PARAMETERS:                                                            
+//   pcache: the center of the cache of the parent                        
+//   qbytes: the query as bytes, from the depth of the child              
+//   i: the position of the child                                         
+//   maxa: the length of the arm (from 1 to 'TAU')                        
+//   pad: whether the parent is a 'PAD'                                   
+//                                                                        
+// RETURN:                                                                
+//   The arm, to be stored with 'store_arm()'.                            
+{
+
+   uint64_t diag = lanes_load(pcache-8);
+   uint64_t up = lanes_load(pcache-7);
+   uint64_t chars = lanes_load(qbytes-8) & LANES(15);
+   uint64_t mmatch = lanes_neq(chars ^ LANES(i));
+
+   // This is the "PAD exeption" (see 'poucet()').
+   if (pad) diag &= ~(0xFFULL << 8*(8-maxa));
+
+   uint64_t arm = lanes_min(diag + mmatch, up + LANES(1));
+   uint64_t inside = ~0ULL << 8*(8-maxa);
+   arm = (arm & inside) | (0x0102030405060708ULL & ~inside);
+
+   // Same as in 'upper_arm()', from 'ccache[-maxa]' up.
+   arm = lanes_min(arm, (arm <<  8 | 0x09ULL) + LANES(1));
+   if (maxa > 1) {
+      arm = lanes_min(arm, (arm << 16 | 0x090AULL) + LANES(2));
+   }
+   if (maxa > 3) {
+      arm = lanes_min(arm, (arm << 32 | 0x090A0B0CULL) + LANES(4));
+   }
+   if (maxa > 7) {
+      arm = lanes_min(arm, 0x090A0B0C0D0E0F10ULL + LANES(8));
+   }
+
+   return arm;
+
+}
+
+
+void
+store_arm
+(
+          char     * ccache,
+   const  uint64_t   arm,
+   const  int        maxa
+)
+// SYNOPSIS:                                                              
+//   Stores a horizontal arm in the cache of a child. As in the bytewise  
+//   kernel, the cells beyond 'maxa' are not modified.                    
+{
+   uint64_t inside = ~0ULL << 8*(8-maxa);
+   uint64_t outside = lanes_load(ccache-8) & ~inside;
+   lanes_store(ccache-8, (arm & inside) | outside);
+}
+
+
+// ------  SIMD KERNEL  ------ //
+
+// The children of a node share the parent cache and the query, and
+// their horizontal arms only differ by the mismatches against their
+// own character. The SIMD kernel computes the arms of all children
+// in one pass, with the same lanes as 'horizontal_arm()', but with
+// one child per 64-bit lane of the vector registers.
+
+void
+horizontal_arms
+(
+   const  char     * pcache,
+   const  char     * qbytes,
+   const  int        maxa,
+   const  int        pad,
+          uint64_t * arms
+)
+// SYNOPSIS:                                                              
+//   Portable version of the SIMD kernel, which runs 'horizontal_arm()'   
+//   for each child.                                                      
+//                                                                        
+// PARAMETERS:                                                            
+//   pcache: the center of the cache of the parent                        
+//   qbytes: the query as bytes, from the depth of the children           
+//   maxa: the length of the arms (from 1 to 'TAU')                       
+//   pad: whether the parent is a 'PAD'                                   
+//   arms: the 8 slots where the arms of the 6 children are written       
+//                                                                        
+// RETURN:                                                                
+//   'void'.                                                              
+//                                                                        
+// SIDE EFFECTS:                                                          
+//   Writes 'arms', to be stored with 'store_arm()'.                      
+{
+   for (int i = 0 ; i < 6 ; i++) {
+      arms[i] = horizontal_arm(pcache, qbytes, i, maxa, pad);
+   }
+}
+
+
+#ifdef X86_SIMD
+
+__attribute__((target("avx2")))
+void
+horizontal_arms_avx2
+(
+   const  char     * pcache,
+   const  char     * qbytes,
+   const  int        maxa,
+   const  int        pad,
+          uint64_t * arms
+)
+// SYNOPSIS:                                                              
+//   AVX2 version of the SIMD kernel, 4 children at a time (see           
+//   'horizontal_arms()' for the parameters).                             
+{
+
+   uint64_t diag = lanes_load(pcache-8);
+   uint64_t up = lanes_load(pcache-7) + LANES(1);
+   uint64_t chars = lanes_load(qbytes-8) & LANES(15);
+   uint64_t inside = ~0ULL << 8*(8-maxa);
+
+   // This is the "PAD exeption" (see 'poucet()').
+   if (pad) diag &= ~(0xFFULL << 8*(8-maxa));
+
+   const __m256i one = _mm256_set1_epi8(1);
+   const __m256i vdiag = _mm256_set1_epi64x((long long) diag);
+   const __m256i vup = _mm256_set1_epi64x((long long) up);
+   const __m256i vchars = _mm256_set1_epi64x((long long) chars);
+   const __m256i vinside = _mm256_set1_epi64x((long long) inside);
+   const __m256i vinit = _mm256_set1_epi64x(0x0102030405060708LL);
+
+   for (int i = 0 ; i < 6 ; i += 4) {
+      __m256i pos = _mm256_set_epi64x((long long) LANES(i+3),
+            (long long) LANES(i+2), (long long) LANES(i+1),
+            (long long) LANES(i));
+      // 0 where the query matches the child, 1 elsewhere.
+      __m256i mmatch = _mm256_add_epi8(_mm256_cmpeq_epi8(vchars, pos), one);
+      __m256i arm = _mm256_min_epu8(_mm256_add_epi8(vdiag, mmatch), vup);
+      arm = _mm256_blendv_epi8(vinit, arm, vinside);
+
+      // Prefix min (see 'horizontal_arm()').
+      arm = _mm256_min_epu8(arm, _mm256_add_epi8(_mm256_or_si256(
+            _mm256_slli_epi64(arm, 8), _mm256_set1_epi64x(0x09)), one));
+      if (maxa > 1) {
+         arm = _mm256_min_epu8(arm, _mm256_add_epi8(_mm256_or_si256(
+               _mm256_slli_epi64(arm, 16), _mm256_set1_epi64x(0x090A)),
+               _mm256_set1_epi8(2)));
+      }
+      if (maxa > 3) {
+         arm = _mm256_min_epu8(arm, _mm256_add_epi8(_mm256_or_si256(
+               _mm256_slli_epi64(arm, 32), _mm256_set1_epi64x(0x090A0B0C)),
+               _mm256_set1_epi8(4)));
+      }
+      if (maxa > 7) {
+         arm = _mm256_min_epu8(arm,
+               _mm256_set1_epi64x(0x090A0B0C0D0E0F10LL + LANES(8)));
+      }
+
+      _mm256_storeu_si256((__m256i *) (arms+i), arm);
+   }
+
+}
+
+
+__attribute__((target("sse4.1")))
+void
+horizontal_arms_sse4
+(
+   const  char     * pcache,
+   const  char     * qbytes,
+   const  int        maxa,
+   const  int        pad,
+          uint64_t * arms
+)
+// SYNOPSIS:                                                              
+//   SSE4.1 version of the SIMD kernel, 2 children at a time (see         
+//   'horizontal_arms()' for the parameters).                             
+{
+
+   uint64_t diag = lanes_load(pcache-8);
+   uint64_t up = lanes_load(pcache-7) + LANES(1);
+   uint64_t chars = lanes_load(qbytes-8) & LANES(15);
+   uint64_t inside = ~0ULL << 8*(8-maxa);
+
+   // This is the "PAD exeption" (see 'poucet()').
+   if (pad) diag &= ~(0xFFULL << 8*(8-maxa));
+
+   const __m128i one = _mm_set1_epi8(1);
+   const __m128i vdiag = _mm_set1_epi64x((long long) diag);
+   const __m128i vup = _mm_set1_epi64x((long long) up);
+   const __m128i vchars = _mm_set1_epi64x((long long) chars);
+   const __m128i vinside = _mm_set1_epi64x((long long) inside);
+   const __m128i vinit = _mm_set1_epi64x(0x0102030405060708LL);
+
+   for (int i = 0 ; i < 6 ; i += 2) {
+      __m128i pos = _mm_set_epi64x((long long) LANES(i+1),
+            (long long) LANES(i));
+      // 0 where the query matches the child, 1 elsewhere.
+      __m128i mmatch = _mm_add_epi8(_mm_cmpeq_epi8(vchars, pos), one);
+      __m128i arm = _mm_min_epu8(_mm_add_epi8(vdiag, mmatch), vup);
+      arm = _mm_blendv_epi8(vinit, arm, vinside);
+
+      // Prefix min (see 'horizontal_arm()').
+      arm = _mm_min_epu8(arm, _mm_add_epi8(_mm_or_si128(
+            _mm_slli_epi64(arm, 8), _mm_set1_epi64x(0x09)), one));
+      if (maxa > 1) {
+         arm = _mm_min_epu8(arm, _mm_add_epi8(_mm_or_si128(
+               _mm_slli_epi64(arm, 16), _mm_set1_epi64x(0x090A)),
+               _mm_set1_epi8(2)));
+      }
+      if (maxa > 3) {
+         arm = _mm_min_epu8(arm, _mm_add_epi8(_mm_or_si128(
+               _mm_slli_epi64(arm, 32), _mm_set1_epi64x(0x090A0B0C)),
+               _mm_set1_epi8(4)));
+      }
+      if (maxa > 7) {
+         arm = _mm_min_epu8(arm,
+               _mm_set1_epi64x(0x090A0B0C0D0E0F10LL + LANES(8)));
+      }
+
+      _mm_storeu_si128((__m128i *) (arms+i), arm);
+   }
+
+}
+
+#endif
+
+
+arms_t
+simd_arms
+(void)
+// SYNOPSIS:                                                              
+//   Chooses the version of the SIMD kernel for the processor at run time,
+//   so that the same binary runs with AVX2, with SSE4.1 or without both. 
+//                                                                        
+// RETURN:                                                                
+//   The function that computes the horizontal arms of the children.      
+{
+#ifdef X86_SIMD
+   if (__builtin_cpu_supports("avx2")) return horizontal_arms_avx2;
+   if (__builtin_cpu_supports("sse4.1")) return horizontal_arms_sse4;
+#endif
+   return horizontal_arms;
+}
+
+
+// ------  TRIE CONSTRUCTION AND DESTRUCTION  ------ //
+
+
+trie_t *
+new_trie
+(
+   unsigned int  height
+)
+// SYNOPSIS:                                                              
+//   Front end trie constructor.                                          
+//                                                                        
+// PARAMETERS:                                                            
+//   height: the fixed depth of the leaves                                
+//                                                                        
+// RETURN:                                                                
+//   A pointer to trie root with meta information and no children.        
+{
+
+   if (height < 1) {
+      fprintf(stderr, "error: the minimum trie height is 1\n");
+      ERROR = __LINE__;
+      return NULL;
+   }
+
+   trie_t *trie = calloc(1, sizeof(trie_t));
+   if (trie == NULL) {
+      fprintf(stderr, "error: could not create trie\n");
+      ERROR = __LINE__;
+      return NULL;
+   }
+
+   info_t *info = new_info(height);
+   if (info == NULL || reserve_trie(trie, TRIE_INIT_SIZE, TRIE_INIT_SIZE)) {
+      fprintf(stderr, "error: could not create trie\n");
+      ERROR = __LINE__;
+      if (info != NULL) destroy_tower(info->pebbles);
+      free(info);
+      free(trie->nodes);
+      free(trie->data);
+      free(trie->tails);
+      free(trie->labels);
+      free(trie);
+      return NULL;
+   }
+
+   // The root is the first node and the first leaf
+   // slot is unused, so that 0 means "no child".
+   append_node(trie, 0);
+   trie->data[0] = NULL;
+   trie->ndata = 1;
+
+   trie->info = info;
+
+   return trie;
+
+}
+
+
+trie_t *
+share_trie
+(
+   trie_t * trie
+)
+// SYNOPSIS:                                                              
+//   Front end constructor of a view of a trie, so that several threads   
+//   can search the same trie at the same time, each with its own view.   
+//   The view has its own pebbles and caches for the dynamic programming, 
+//   and uses the nodes, the tails and the leaf data of the trie, which   
+//   the search of a view never writes. For this reason, the tails are    
+//   not expanded and the pebbles in the tails are marks (see            
+//   'push_mark()'). Nothing can be inserted in a view and the trie must  
+//   not be modified while it has views.                                  
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to share                                              
+//                                                                        
+// RETURN:                                                                
+//   A pointer to the view, 'NULL' in case of failure. The view is        
+//   destroyed with 'destroy_trie()', which leaves the trie untouched.    
+{
+
+   trie_t *view = malloc(sizeof(trie_t));
+   info_t *info = new_info(get_height(trie));
+   char *caches = malloc((size_t) trie->nnodes * (2*TAU+1));
+   if (info != NULL) {
+      info->marks = calloc(M, sizeof(mark_t *));
+      info->nmarks = calloc(M, sizeof(uint32_t));
+      info->markslots = calloc(M, sizeof(uint32_t));
+   }
+   if (view == NULL || info == NULL || caches == NULL ||
+         info->marks == NULL || info->nmarks == NULL ||
+         info->markslots == NULL) {
+      fprintf(stderr, "error: could not share trie\n");
+      ERROR = __LINE__;
+      if (info != NULL) {
+         destroy_tower(info->pebbles);
+         free(info->marks);
+         free(info->nmarks);
+         free(info->markslots);
+      }
+      free(info);
+      free(caches);
+      free(view);
+      return NULL;
+   }
+
+   // The root is the only pebble and the only cache that
+   // is read before being written.
+   memcpy(view, trie, sizeof(trie_t));
+   memcpy(caches, CACHE_INIT, 2*TAU+1);
+   view->caches = caches;
+   view->info = info;
+
+   return view;
+
+}
+
+
+info_t *
+new_info
+(
+   unsigned int  height
+)
+// SYNOPSIS:                                                              
+//   Back end constructor of the meta information of a trie.              
+//                                                                        
+// RETURN:                                                                
+//   A pointer to the meta information, 'NULL' in case of failure.        
+{
+
+   info_t *info = malloc(sizeof(info_t));
+   if (info == NULL) {
+      fprintf(stderr, "error: could not create trie\n");
+      ERROR = __LINE__;
+      return NULL;
+   }
+
+   // Set the values of the meta information.
+   info->height = height;
+   info->pebbles = new_tower(M);
+   info->marks = NULL;
+   info->nmarks = NULL;
+   info->markslots = NULL;
+
+   // Push the root to the ground level of 'pebbles'.
+   // This will be the only node at this level for
+   // the lifetime of the trie.
+   if (info->pebbles == NULL || push((void *) 0, info->pebbles)) {
+      fprintf(stderr, "error: could not create trie\n");
+      ERROR = __LINE__;
+      if (info->pebbles != NULL) destroy_tower(info->pebbles);
+      free(info);
+      return NULL;
+   }
+
+   return info;
+
+}
+
+
+int
+grow_nodes
+(
+   trie_t * trie,
+   size_t   nslots
+)
+// SYNOPSIS:                                                              
+//   Back end function to resize the node arena of a trie. The arena is   
+//   aligned on cache lines, which 'realloc()' does not guarantee, so the 
+//   nodes are copied to a new arena.                                     
+//                                                                        
+// RETURN:                                                                
+//   0 upon success, 1 upon failure.                                      
+{
+
+   if (nslots >= TAIL) {
+      fprintf(stderr, "error: too many trie nodes\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   void *ptr;
+   if (posix_memalign(&ptr, 64, nslots * sizeof(node_t))) {
+      fprintf(stderr, "error: could not allocate trie nodes\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   if (trie->nodes != NULL) {
+      memcpy(ptr, trie->nodes, trie->nnodes * sizeof(node_t));
+      free(trie->nodes);
+   }
+
+   trie->nodes = ptr;
+   trie->nodeslots = nslots;
+
+   return 0;
+
+}
+
+
+void *
+grow_array
+(
+   void   * array,
+   size_t   nslots,
+   size_t   size
+)
+// SYNOPSIS:                                                              
+//   Back end function to resize the leaf data, the tails or the labels   
+//   of a trie, which are all indexed with 32 bits.                       
+//                                                                        
+// RETURN:                                                                
+//   The resized array in case of success, 'NULL' otherwise.              
+{
+   if (nslots >= TAIL) return NULL;
+   return realloc(array, nslots * size);
+}
+
+
+int
+reserve_trie
+(
+   trie_t * trie,
+   size_t   nnodes,
+   size_t   nleaves
+)
+// SYNOPSIS:                                                              
+//   Front end function to make room for more nodes and leaves in a trie, 
+//   so that 'insert_string_wo_malloc()' can insert them. The arena keeps 
+//   room for the nodes of all the tails, which can then be expanded      
+//   during the search without moving the arena.                          
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to resize                                             
+//   nnodes: the number of nodes to add (root and leaves excluded)        
+//   nleaves: the number of leaves to add                                 
+//                                                                        
+// RETURN:                                                                
+//   0 upon success, 1 upon failure.                                      
+{
+
+   // The arrays of a mapped trie belong to its image.
+   if (trie->image != NULL) {
+      fprintf(stderr, "error: cannot resize a mapped trie\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   // The arrays of a view belong to the shared trie.
+   if (trie->caches != NULL) {
+      fprintf(stderr, "error: cannot resize a view of a trie\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   size_t nodeslots = (size_t) trie->nnodes + trie->nlazy + nnodes;
+   if (nodeslots > trie->nodeslots && grow_nodes(trie, nodeslots)) {
+      return 1;
+   }
+
+   // A tail has one character of label per node.
+   size_t labelslots = (size_t) trie->nlabels + nnodes;
+   if (labelslots > trie->labelslots) {
+      char *labels = grow_array(trie->labels, labelslots, sizeof(char));
+      if (labels == NULL) {
+         fprintf(stderr, "error: could not allocate trie labels\n");
+         ERROR = __LINE__;
+         return 1;
+      }
+      trie->labels = labels;
+      trie->labelslots = labelslots;
+   }
+
+   size_t dataslots = (size_t) trie->ndata + nleaves;
+   if (dataslots > trie->dataslots) {
+      void **data = grow_array(trie->data, dataslots, sizeof(void *));
+      if (data == NULL) {
+         fprintf(stderr, "error: could not allocate trie leaves\n");
+         ERROR = __LINE__;
+         return 1;
+      }
+      trie->data = data;
+      trie->dataslots = dataslots;
+   }
+
+   // A leaf has at most one tail.
+   size_t tailslots = (size_t) trie->ntails + nleaves;
+   if (tailslots > trie->tailslots) {
+      tail_t *tails = grow_array(trie->tails, tailslots, sizeof(tail_t));
+      if (tails == NULL) {
+         fprintf(stderr, "error: could not allocate trie leaves\n");
+         ERROR = __LINE__;
+         return 1;
+      }
+      trie->tails = tails;
+      trie->tailslots = tailslots;
+   }
+
+   return 0;
+
+}
+
+
+int
+has_room
+(
+   trie_t * trie,
+   size_t   nnodes,
+   size_t   nleaves
+)
+// SYNOPSIS:                                                              
+//   Back end function to check whether 'nnodes' nodes and 'nleaves'      
+//   leaves can be added to a trie without resizing it.                   
+//                                                                        
+// RETURN:                                                                
+//   1 if there is room, 0 otherwise.                                     
+{
+   return (size_t) trie->nnodes + trie->nlazy + nnodes <= trie->nodeslots
+       && (size_t) trie->nlabels + nnodes <= trie->labelslots
+       && (size_t) trie->ndata + nleaves <= trie->dataslots
+       && (size_t) trie->ntails + nleaves <= trie->tailslots;
+}
+
+
+void **
+insert_string
+(
+         trie_t * trie,
+   const char   * string
+)
+// SYNOPSIS:                                                              
+//   Front end function to fill in a trie. Insert a string from root, or  
+//   simply return the node at the end of the string path if it already   
+//   exists. The trie grows as needed, which invalidates the addresses    
+//   returned by previous calls.                                          
+//                                                                        
+// RETURN:                                                                
+//   The leaf node in case of succes, 'NULL' otherwise.                   
+//                                                                        
+// NB: This function is not used by 'starcode()'.
+{
+   return insert_path(trie, string, 1);
+}
+
+
+void **
+insert_string_wo_malloc
+(
+         trie_t  * trie,
+   const char    * string
+)
+// SYNOPSIS:                                                              
+//   Same as 'insert_string()', but the string is inserted in the room    
+//   made by 'reserve_trie()' and the trie is never resized, so that the  
+//   addresses returned by previous calls remain valid.                   
+//                                                                        
+// RETURN:                                                                
+//   The leaf node in case of succes, 'NULL' otherwise.                   
+{
+   return insert_path(trie, string, 0);
+}
+
+
+void **
+insert_path
+(
+         trie_t * trie,
+   const char   * string,
+         int      grow
+)
+// SYNOPSIS:                                                              
+//   Back end function to insert a string in a trie. The trie is path-    
+//   compressed: below the point where the string leaves the paths of     
+//   the other strings, the chain of single-child nodes down to the leaf  
+//   is stored as a tail. The tails met on the path of the string are     
+//   expanded one node at a time, until the string leaves them.           
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie to insert the string in                               
+//   string: the string to insert                                         
+//   grow: whether the trie can be resized                                
+//                                                                        
+// RETURN:                                                                
+//   The leaf node in case of succes, 'NULL' otherwise.                   
+{
+
+   int i;
+
+   int nchar = strlen(string);
+   if (nchar != get_height(trie)) {
+      fprintf(stderr, "error: can only insert string of length %d\n",
+            get_height(trie));
+      ERROR = __LINE__;
+      return NULL;
+   }
+
+   // The nodes of a view belong to the shared trie.
+   if (trie->caches != NULL) {
+      fprintf(stderr, "error: cannot insert in a view of a trie\n");
+      ERROR = __LINE__;
+      return NULL;
+   }
+   
+   // Find existing path.
+   uint32_t node = 0;
+   for (i = 0 ; i < nchar-1; i++) {
+      int c = translate[(int) string[i]];
+      uint32_t child = trie->nodes[node].child[c];
+      if (child == 0) {
+         break;
+      }
+      if (child & TAIL) {
+         uint32_t path = (trie->nodes[node].path << 4) + c;
+         child = expand_tail(trie, child, path);
+         trie->nodes[node].child[c] = child;
+      }
+      node = child;
+   }
+
+   // The string ends on the path, only the leaf may be new.
+   if (i == nchar-1) {
+      return leaf_slot(trie, node, translate[(int) string[i]], grow);
+   }
+
+   // Append the rest of the string as a tail.
+   uint32_t len = nchar-1 - i;
+   if (!has_room(trie, len, 1)) {
+      if (!grow) {
+         fprintf(stderr, "error: no room left in trie\n");
+         ERROR = __LINE__;
+         return NULL;
+      }
+      if (reserve_trie(trie, max(len, trie->nodeslots), trie->dataslots)) {
+         fprintf(stderr, "error: could not insert string\n");
+         ERROR = __LINE__;
+         return NULL;
+      }
+   }
+
+   tail_t *tail = trie->tails + trie->ntails;
+   tail->label = trie->nlabels;
+   tail->len = len;
+   tail->data = trie->ndata;
+   for (int j = i+1 ; j < nchar ; j++) {
+      trie->labels[trie->nlabels++] = translate[(int) string[j]];
+   }
+   trie->data[trie->ndata++] = NULL;
+   trie->nlazy += len;
+
+   int c = translate[(int) string[i]];
+   trie->nodes[node].child[c] = TAIL | trie->ntails++;
+
+   return trie->data + tail->data;
+
+}
+
+
+uint32_t
+expand_tail
+(
+   trie_t   * trie,
+   uint32_t   child,
+   uint32_t   path
+)
+// SYNOPSIS:                                                              
+//   Back end function to replace the first character of a tail by a     
+//   node, whose only child is the rest of the tail (or the leaf). The    
+//   node was accounted for when the tail was inserted, so there is      
+//   always room for it and the arena is never resized.                   
+//   NO CHECKING IS PERFORMED that 'child' is a tail. The caller has to   
+//   replace the tail by the returned node in the parent.                 
+//                                                                        
+// PARAMETERS:                                                            
+//   trie: the trie of the tail                                           
+//   child: the tail as a child index                                     
+//   path: the path of the new node                                       
+//                                                                        
+// RETURN:                                                                
+//   The index of the new node.                                           
+{
+
+   tail_t *tail = trie->tails + (child & ~TAIL);
+   uint32_t idx = append_node(trie, path);
+
+   int c = trie->labels[tail->label];
+   if (tail->len == 1) {
+      trie->nodes[idx].child[c] = tail->data;
+   }
+   else {
+      tail->label++;
+      tail->len--;
+      trie->nodes[idx].child[c] = child;
+   }
+   trie->nlazy--;
+
+   return idx;
+
+}
+
+
+uint32_t
+append_node
+(
+   trie_t   * trie,
+   uint32_t   path
+)
+// SYNOPSIS:                                                              
+//   Back end function to initialize the next node of the arena. The     
+//   arena must have room for the node.                                   
+//                                                                        
+// RETURN:                                                                
+//   The index of the node.                                               
+{
+
+   uint32_t idx = trie->nnodes++;
+   node_t *newnode = trie->nodes + idx;
+
+   // Initialize node data. The cache is important
+   // for the dynamic programming algorithm.
+   memset(newnode->child, 0, 6 * sizeof(uint32_t));
+   newnode->path = path;
+   memcpy(newnode->cache, CACHE_INIT, 2*TAU+1);
+
+   return idx;
+
+}
+
+
+void **
+leaf_slot
+(
+   trie_t   * trie,
+   uint32_t   parent,
+   int        position,
+   int        grow
+)
+// SYNOPSIS:                                                              
+//   Back end function to get the data slot of a leaf, creating it if     
+//   the leaf is new. The leaf data can grow only if 'grow' is set.       
+//                                                                        
+// RETURN:                                                                
+//   The address of the data slot in case of success, 'NULL' otherwise.   
+{
+
+   uint32_t *child = trie->nodes[parent].child + position;
+   if (*child == 0) {
+      if (!has_room(trie, 0, 1)) {
+         if (!grow) {
+            fprintf(stderr, "error: no room left in trie\n");
+            ERROR = __LINE__;
+            return NULL;
+         }
+         if (reserve_trie(trie, 0, trie->dataslots)) {
+            fprintf(stderr, "error: could not insert leaf\n");
+            ERROR = __LINE__;
+            return NULL;
+         }
+      }
+      trie->data[trie->ndata] = NULL;
+      *child = trie->ndata++;
+   }
+
+   return trie->data + *child;
+
+}
 
 
 void
 destroy_trie
 (
    trie_t * trie,
-   int      free_nodes,
    void     (*destruct)(void *)
 )
 // SYNOPSIS:                                                              
 //   Front end function to recycle the memory allocated to a trie. Node   
 //   data may or may not be recycled as well, depending on the destructor 
-//   passed as argument. This function is essentially a wrapper for       
-//   'destroy_nodes_()', the only difference is that it      
-//   destroys the meta-data of the trie first.                            
+//   passed as argument.                                                  
 //                                                                        
 // PARAMETERS:                                                            
 //   trie: the trie to destroy                                            
@@ -712,59 +2159,202 @@ destroy_trie
 // SIDE EFFECTS:                                                          
 //   Frees the memory allocated to the nodes of a trie, the meta-data     
 //   associated to the root, and possibly the data associated to the tail 
-//   nodes.                                                               
+//   nodes. The image of a mapped trie is left to the caller. A view only 
+//   frees its own pebbles, marks and caches (see 'share_trie()').        
 {
    // Free the milesones.
    destroy_tower(trie->info->pebbles);
-   destroy_from(trie->root, destruct, free_nodes, get_height(trie), 0);
-   if (!free_nodes) {
-      free(trie->root);
-      trie->root = NULL;
+   // The arrays and the data of a view belong to the shared trie.
+   if (trie->caches != NULL) {
+      for (int i = 0 ; i < M ; i++) free(trie->info->marks[i]);
+      free(trie->info->marks);
+      free(trie->info->nmarks);
+      free(trie->info->markslots);
+      free(trie->caches);
+      free(trie->info);
+      free(trie);
+      return;
+   }
+   if (destruct != NULL) {
+      for (uint32_t i = 1 ; i < trie->ndata ; i++) {
+         if (trie->data[i] != NULL) (*destruct)(trie->data[i]);
+      }
+   }
+   if (trie->image == NULL) {
+      free(trie->nodes);
+      free(trie->data);
+      free(trie->tails);
+      free(trie->labels);
    }
    free(trie->info);
    free(trie);
 }
 
 
-void
-destroy_from
+// ------  TRIE IMAGES  ------ //
+
+
+int
+write_trie
 (
-   node_t * node,
-   void     (*destruct)(void *),
-   int      free_nodes,
-   int      maxdepth,
-   int      depth
+   trie_t * trie,
+   FILE   * f
 )
 // SYNOPSIS:                                                              
-//   Back end function to free the memory allocated on a trie. It should  
-//   not be called directly on a trie to prevent memory leaks (otherwise  
-//   the pebbles will not be freed).                                      
+//   Front end function to write the image of a trie in a file, so that   
+//   it can be mapped in memory and searched without being rebuilt (see   
+//   'map_trie()'). The image starts at the current position, which must  
+//   be aligned on 64 bytes, and the room for the nodes of the tails is   
+//   skipped, which leaves a hole in the file. The caches of the nodes    
+//   are reset. The leaf data are written as they are, so they should be  
+//   indices rather than pointers.                                        
 //                                                                        
-// RETURN:                                                                
-//   'void'.                                                              
+// PARAMETERS:                                                            
+//   trie: the trie to write                                              
+//   f: the file to write to, which must be seekable                      
 //                                                                        
-// SIDE EFFECTS:                                                          
-//   Frees the memory allocated to the nodes of a trie, and possibly the  
-//   data associated to the tail nodes.                                   
-{  
-   if (node != NULL) {
-      if (depth == maxdepth) {
-         if (destruct != NULL) (*destruct)(node);
-         return;
-      }
-      for (int i = 0 ; i < 6 ; i++) {
-         node_t * child = (node_t *) node->child[i];
-         destroy_from(child, destruct, free_nodes, maxdepth, depth+1);
-      }
-      if (free_nodes) {
-         free(node);
-         node = NULL;
+// RETURN:                                                                
+//   0 upon success, 1 upon failure.                                      
+{
+
+   long start = ftell(f);
+   if (start < 0 || start % 64) {
+      fprintf(stderr, "error: trie image must start at an aligned offset\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   image_t header = {
+      .version  = IMAGE_VERSION,
+      .endian   = IMAGE_ENDIAN,
+      .nodesize = sizeof(node_t),
+      .datasize = sizeof(void *),
+      .height   = get_height(trie),
+      .nnodes   = trie->nnodes,
+      .nlazy    = trie->nlazy,
+      .ndata    = trie->ndata,
+      .ntails   = trie->ntails,
+      .nlabels  = trie->nlabels,
+   };
+   memcpy(header.magic, IMAGE_MAGIC, 8);
+   header.nodes = IMAGE_ALIGN(sizeof(image_t));
+   header.data = IMAGE_ALIGN(header.nodes +
+         ((uint64_t) trie->nnodes + trie->nlazy) * sizeof(node_t));
+   header.tails = IMAGE_ALIGN(header.data + trie->ndata * sizeof(void *));
+   header.labels = IMAGE_ALIGN(header.tails + trie->ntails * sizeof(tail_t));
+   header.size = IMAGE_ALIGN(header.labels + trie->nlabels);
+
+   int err = fwrite(&header, sizeof(image_t), 1, f) != 1;
+
+   // The nodes are copied field by field so that the
+   // padding bytes of the image are always zero.
+   node_t buffer[256];
+   memset(buffer, 0, sizeof(buffer));
+   err |= fseek(f, start + header.nodes, SEEK_SET);
+   for (uint32_t i = 0 ; !err && i < trie->nnodes ; i += 256) {
+      uint32_t n = min(256, trie->nnodes - i);
+      for (uint32_t k = 0 ; k < n ; k++) {
+         memcpy(buffer[k].child, trie->nodes[i+k].child,
+               sizeof(buffer[k].child));
+         buffer[k].path = trie->nodes[i+k].path;
+         memcpy(buffer[k].cache, CACHE_INIT, 2*TAU+1);
       }
+      err |= fwrite(buffer, sizeof(node_t), n, f) != n;
    }
-   return;
+
+   err |= fseek(f, start + header.data, SEEK_SET) ||
+      fwrite(trie->data, sizeof(void *), trie->ndata, f) != trie->ndata;
+   err |= fseek(f, start + header.tails, SEEK_SET) ||
+      fwrite(trie->tails, sizeof(tail_t), trie->ntails, f) != trie->ntails;
+   err |= fseek(f, start + header.labels, SEEK_SET) ||
+      fwrite(trie->labels, 1, trie->nlabels, f) != trie->nlabels;
+
+   // Pad the end of the image.
+   const char zeros[64] = {0};
+   size_t end = header.size - header.labels - trie->nlabels;
+   err |= fwrite(zeros, 1, end, f) != end;
+
+   if (err) {
+      fprintf(stderr, "error: could not write trie image\n");
+      ERROR = __LINE__;
+      return 1;
+   }
+
+   return 0;
+
 }
 
 
+trie_t *
+map_trie
+(
+   void   * image,
+   size_t   size
+)
+// SYNOPSIS:                                                              
+//   Front end function to use an image written by 'write_trie()' as a    
+//   trie, typically mapped from a file with 'mmap()'. The arrays of the  
+//   trie are in the image, which must be aligned on 64 bytes and remain  
+//   valid until the trie is destroyed. The search writes in the image,   
+//   so a file has to be mapped privately ('MAP_PRIVATE'). The trie has   
+//   no room for new strings.                                             
+//                                                                        
+// PARAMETERS:                                                            
+//   image: the image of the trie                                         
+//   size: the number of bytes available in 'image'                       
+//                                                                        
+// RETURN:                                                                
+//   A pointer to the trie, 'NULL' in case of failure.                    
+{
+
+   image_t *header = image;
+   char *base = image;
+
+   if ((uintptr_t) image % 64 || size < sizeof(image_t) ||
+         memcmp(header->magic, IMAGE_MAGIC, 8) ||
+         header->version != IMAGE_VERSION ||
+         header->endian != IMAGE_ENDIAN ||
+         header->nodesize != sizeof(node_t) ||
+         header->datasize != sizeof(void *) ||
+         header->size > size || header->height < 1 ||
+         header->nodes + ((uint64_t) header->nnodes + header->nlazy) *
+               sizeof(node_t) > header->data ||
+         header->data + header->ndata * sizeof(void *) > header->tails ||
+         header->tails + header->ntails * sizeof(tail_t) > header->labels ||
+         header->labels + header->nlabels > header->size) {
+      fprintf(stderr, "error: invalid trie image\n");
+      ERROR = __LINE__;
+      return NULL;
+   }
+
+   trie_t *trie = calloc(1, sizeof(trie_t));
+   info_t *info = new_info(header->height);
+   if (trie == NULL || info == NULL) {
+      fprintf(stderr, "error: could not map trie\n");
+      ERROR = __LINE__;
+      if (info != NULL) destroy_tower(info->pebbles);
+      free(info);
+      free(trie);
+      return NULL;
+   }
+
+   trie->nodes = (node_t *) (base + header->nodes);
+   trie->data = (void **) (base + header->data);
+   trie->tails = (tail_t *) (base + header->tails);
+   trie->labels = base + header->labels;
+   trie->nnodes = header->nnodes;
+   trie->nodeslots = header->nnodes + header->nlazy;
+   trie->nlazy = header->nlazy;
+   trie->ndata = trie->dataslots = header->ndata;
+   trie->ntails = trie->tailslots = header->ntails;
+   trie->nlabels = trie->labelslots = header->nlabels;
+   trie->image = image;
+   trie->info = info;
+
+   return trie;
+
+}
+
 
 // ------  UTILITY FUNCTIONS ------ //
 
@@ -888,7 +2478,9 @@ push
 
 
 // Snippet to check whether everything went fine.
-// If not, ERROR is the line raising the error.
+// If not, ERROR is the line raising the error. Every
+// thread has its own ERROR, so the error is that of
+// the last search of the calling thread.
 int check_trie_error_and_reset(void) {
    if (ERROR) {
       int last_error_at_line = ERROR;
@@ -898,18 +2490,9 @@ int check_trie_error_and_reset(void) {
    return 0;
 }
 
-// Snippet to count nodes of a trie.
+// Snippet to count nodes of a trie (leaves included), as if
+// the tails were expanded. Every node of the arena is on the
+// path of an inserted string.
 int count_nodes(trie_t * trie) {
-   return recursive_count_nodes(trie->root, get_height(trie), 0);
-}
-
-int recursive_count_nodes(node_t * node, int maxdepth, int depth) {
-   int count = 1;
-   for (int i = 0 ; i < 6 ; i++) {
-      if (node->child[i] == NULL) continue;
-      node_t *child = (node_t *) node->child[i];
-      count += depth < maxdepth - 1 ?
-         recursive_count_nodes(child, maxdepth, depth+1) : 1;
-   }
-   return count;
+   return trie->nnodes + trie->nlazy + trie->ndata - 1;
 }
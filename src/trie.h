@@ -28,24 +28,27 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "kernel.h"
+
 #ifndef _STARCODE_TRIE_HEADER
 #define _STARCODE_TRIE_HEADER
 
-#define DESTROY_NODES_YES 1
-#define DESTROY_NODES_NO 0
-
 #define gstack_size(elm) (2*sizeof(int) + elm * sizeof(void *))
 
 static const char BASES[8] = "ACGTN";
 
 struct gstack_t;
 struct info_t;
+struct mark_t;
 struct node_t;
+struct tail_t;
 struct trie_t;
 
 typedef struct gstack_t gstack_t;
 typedef struct info_t info_t;
+typedef struct mark_t mark_t;
 typedef struct node_t node_t;
+typedef struct tail_t tail_t;
 typedef struct trie_t trie_t;
 
 // Global constants.
@@ -53,35 +56,76 @@ typedef struct trie_t trie_t;
 #define M 1024              // MAXBRCDLEN + 1, for short.
 #define MAXBRCDLEN 1023     // Maximum barcode length.
 #define GSTACK_INIT_SIZE 16 // Initial slots of 'gstack'.
+#define TRIE_INIT_SIZE 16   // Initial node and leaf slots of 'trie'.
 
 extern gstack_t * const TOWER_TOP;
 
+int         band_distance (const char*, const char*, int);
 int         check_trie_error_and_reset (void);
 int         count_nodes (trie_t*);
 void        destroy_tower (gstack_t **);
-void        destroy_trie (trie_t*, int, void(*)(void *));
-void     ** insert_string_wo_malloc (trie_t *, const char *, node_t **);
+void        destroy_trie (trie_t*, void(*)(void *));
+void     ** insert_string_wo_malloc (trie_t *, const char *);
+int         hamming_distance (const char*, const char*, int);
 void     ** insert_string (trie_t*, const char*);
+trie_t   *  map_trie (void *, size_t);
 gstack_t *  new_gstack (void);
 gstack_t ** new_tower (int);
 trie_t   *  new_trie (unsigned int);
 int         push (void*, gstack_t**);
-int         search (trie_t*, const char*, int, gstack_t**, int, int);
+int         reserve_trie (trie_t*, size_t, size_t);
+int         search (trie_t*, const char*, int, gstack_t**, int, int,
+                  kernel_t);
+int         search_hamming (trie_t*, const char*, int, gstack_t**, int, int);
+trie_t   *  share_trie (trie_t*);
+int         trie_order (const char*, const char*);
+int         write_trie (trie_t*, FILE*);
 
 struct trie_t
 {
-   node_t * root;
-   info_t * info;
+   node_t   * nodes;                // Node arena (the root is node 0).
+   void    ** data;                 // Leaf data (slot 0 is unused).
+   tail_t   * tails;                // Path-compressed tails.
+   char     * labels;               // Characters of the tails.
+   uint32_t   nnodes;               // Number of nodes in use.
+   uint32_t   nodeslots;            // Number of allocated nodes.
+   uint32_t   nlazy;                // Number of nodes left in tails.
+   uint32_t   ndata;                // Number of leaf slots in use.
+   uint32_t   dataslots;            // Number of allocated leaf slots.
+   uint32_t   ntails;               // Number of tails in use.
+   uint32_t   tailslots;            // Number of allocated tails.
+   uint32_t   nlabels;              // Number of label characters in use.
+   uint32_t   labelslots;           // Number of allocated characters.
+   void     * image;                // Image of a mapped trie (or NULL).
+   char     * caches;               // Caches of a view (or NULL).
+   info_t   * info;
 };
 
 
+// The children are 32-bit indices into the node arena of the trie,
+// or into 'data' for the nodes just above the leaves, and 0 means
+// that there is no child (the root is nobody's child). Children
+// with the top bit set are indices into 'tails'. A node is 48
+// bytes and the arena is aligned on 64 bytes, so that a node
+// spans at most two cache lines and one in two fits in one line.
 struct node_t
 {
-   void     * child[6];             // Array of 6 children pointers.
+   uint32_t   child[6];             // Indices of the 6 children.
    uint32_t   path;                 // Encoded path end to the node.
    char       cache[2*TAU+1];       // Dynamic programming space.
 };
 
+// A tail stands for the chain of single-child nodes from the point
+// where a string leaves the paths of the other strings down to its
+// leaf. The first character of the tail is given by its position in
+// the parent, and the label holds the others, as translated codes.
+struct tail_t
+{
+   uint32_t   label;                // Offset of the label in 'labels'.
+   uint32_t   len;                  // Number of characters in label.
+   uint32_t   data;                 // Leaf data index.
+};
+
 struct gstack_t
 {
    size_t    nslots;                // Stack size.
@@ -89,10 +133,23 @@ struct gstack_t
    void    * items[];               // Items as 'void' pointers.
 };
 
+// A view of a trie does not expand the tails (see 'share_trie()'), so
+// the pebbles in a tail are marks, which hold the rest of the tail with
+// the path and the cache of the character of the pebble.
+struct mark_t
+{
+   tail_t     rest;                 // Rest of the tail below the mark.
+   uint32_t   path;                 // Encoded path end to the mark.
+   char       cache[2*TAU+1];       // Dynamic programming space.
+};
+
 struct info_t
 {
    unsigned int         height;     // Critical depth with all hits.
-   struct   gstack_t ** pebbles;    // White pebbles for the search.
+   struct   gstack_t ** pebbles;    // White pebbles (node indices).
+   struct   mark_t   ** marks;      // Marks by depth (views only).
+   uint32_t           * nmarks;     // Number of marks by depth.
+   uint32_t           * markslots;  // Number of allocated marks.
 };
 
 #endif
@@ -1,46 +1,91 @@
+#define _GNU_SOURCE
 #include <math.h>
 #include "unittest.h"
 #include "starcode.c"
 
 static const char untranslate[7] = "NACGT N";
 
+graph_t *
+graph_from_edges
+(
+   useq_t       ** u,
+   size_t          n,
+   const int     (*edges)[3],
+   size_t          nedges
+)
+// Build the match graph of 'u' with the given edges as
+// '{to, from, dist}' triplets, with one worker.
+{
+   gstack_t *useqS = new_gstack();
+   for (size_t i = 0 ; i < n ; i++) {
+      u[i]->node = i;
+      push(u[i], &useqS);
+   }
+   mtplan_t mtplan = {0};
+   mtplan.nworkers = 1;
+   mtplan.nparts = 1;
+   mtplan.edges = calloc(1, sizeof(edgebuf_t));
+   for (size_t i = 0 ; i < nedges ; i++) {
+      push_edge(edges[i][0], edges[i][1], edges[i][2], 1, mtplan.edges);
+   }
+   graph_t *graph = merge_edges(&mtplan, useqS);
+   free(useqS);
+   return graph;
+}
+
 void
 test_starcode_1
 // Basic tests of useq.
 (void)
 {
+   char buf[MAXSEQLEN];
+
    // Regular initialization without info.
-   useq_t *u = new_useq(1, "some sequence", NULL);
+   useq_t *u = new_useq(1, "acgtnACGTN", NULL);
    test_assert_critical(u != NULL);
    test_assert(u->count == 1);
+   test_assert(u->len == 10);
+   test_assert(u->special);
    // Call to 'new_useq()' capitalizes the sequence.
-   test_assert(strcmp(u->seq, "SOME SEQUENCE") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "ACGTNACGTN") == 0);
    test_assert(u->info == NULL);
-   test_assert(u->matches == NULL);
    test_assert(u->canonical == NULL);
    destroy_useq(u);
 
    // Regular initialization with info.
-   u = new_useq(1, "some sequence", "some info");
+   u = new_useq(1, "gattaca", "some info");
    test_assert_critical(u != NULL);
    test_assert(u->count == 1);
+   test_assert(u->len == 7);
+   test_assert(!u->special);
    // Call to 'new_useq()' capitalizes the sequence.
-   test_assert(strcmp(u->seq, "SOME SEQUENCE") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "GATTACA") == 0);
    test_assert(strcmp(u->info, "some info") == 0);
-   test_assert(u->matches == NULL);
    test_assert(u->canonical == NULL);
    destroy_useq(u);
 
+   // Paired-end separator.
+   u = new_useq(1, "ACGT---------TGCA", NULL);
+   test_assert_critical(u != NULL);
+   test_assert(u->special);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "ACGT---------TGCA") == 0);
+   // Padding.
+   test_assert(strcmp(unpack_seq(u, buf, 20), "   ACGT---------TGCA") == 0);
+   destroy_useq(u);
+
    // Initialize with negative value and \0 string.
    u = new_useq(-1, "", NULL);
    test_assert_critical(u != NULL);
    test_assert(u->count == -1);
-   test_assert(strcmp(u->seq, "") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "") == 0);
    test_assert(u->info == NULL);
-   test_assert(u->matches == NULL);
    test_assert(u->canonical == NULL);
    destroy_useq(u);
 
+   // Initialize with non DNA string.
+   u = new_useq(1, "some sequence", NULL);
+   test_assert(u == NULL);
+
    // Initialize with NULL string.
    u = new_useq(0, NULL, NULL);
    test_assert(u == NULL);
@@ -49,37 +94,79 @@ test_starcode_1
 
 
 void
-test_starcode_2
+test_arena
 (void)
-// Test addmatch().
+// Test 'arena_alloc()' and 'arena_useq()'.
 {
+   char buf[MAXSEQLEN];
+   arena_t *arena = new_arena();
+
+   // Allocations are aligned and zeroed.
+   for (int i = 1 ; i < 100 ; i++) {
+      char *ptr = arena_alloc(arena, i);
+      test_assert_critical(ptr != NULL);
+      test_assert(((uintptr_t) ptr) % ARENA_ALIGN == 0);
+      for (int j = 0 ; j < i ; j++) test_assert(ptr[j] == 0);
+      memset(ptr, 0xff, i);
+   }
 
-   useq_t *u1 = new_useq(12983, "string 1", NULL);
-   test_assert_critical(u1 != NULL);
-   test_assert(u1->matches == NULL);
-   useq_t *u2 = new_useq(-20838, "string 2", NULL);
-   test_assert_critical(u2 != NULL);
-   test_assert(u2->matches == NULL);
+   // Allocations larger than a block.
+   char *big = arena_alloc(arena, 2 * ARENA_BLOCK);
+   test_assert_critical(big != NULL);
+   test_assert(big[2 * ARENA_BLOCK - 1] == 0);
+   char *small = arena_alloc(arena, 16);
+   test_assert_critical(small != NULL);
 
-   // Add match to u1.
-   addmatch(u1, u2, 1, 2);
+   useq_t *u = arena_useq(arena, 3, "gattaca", "some info");
+   test_assert_critical(u != NULL);
+   test_assert(u->count == 3);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "GATTACA") == 0);
+   test_assert(strcmp(u->info, "some info") == 0);
+   test_assert(arena_useq(arena, 1, "some sequence", NULL) == NULL);
 
-   test_assert(u2->matches == NULL);
-   test_assert(u1->matches != NULL);
+   destroy_arena(arena);
 
-   // Check failure.
-   test_assert(addmatch(u1, u2, 3, 2) == 1);
+}
 
-   // Add match again to u1.
-   addmatch(u1, u2, 1, 2);
 
-   test_assert(u2->matches == NULL);
-   test_assert_critical(u1->matches != NULL);
-   test_assert_critical(u1->matches[1] != NULL);
-   test_assert(u1->matches[1]->nitems == 2);
+void
+test_starcode_2
+(void)
+// Test 'merge_edges()'.
+{
 
-   destroy_useq(u1);
-   destroy_useq(u2);
+   useq_t *u[3];
+   u[0] = new_useq(12983, "AAAA", NULL);
+   u[1] = new_useq(-20838, "CCCC", NULL);
+   u[2] = new_useq(1, "GGGG", NULL);
+   test_assert_critical(u[0] != NULL);
+   test_assert_critical(u[1] != NULL);
+   test_assert_critical(u[2] != NULL);
+
+   // Add match to 'u[0]' twice, and a closer one.
+   const int edges[3][3] = {{0,1,2}, {0,1,2}, {0,2,1}};
+   graph_t *graph = graph_from_edges(u, 3, edges, 3);
+   test_assert_critical(graph != NULL);
+
+   test_assert(graph->nnodes == 3);
+   test_assert(nmatches(graph, u[0]) == 3);
+   test_assert(nmatches(graph, u[1]) == 0);
+   test_assert(nmatches(graph, u[2]) == 0);
+
+   // Matches are sorted by distance.
+   size_t k = first_match(graph, u[0]);
+   test_assert(graph->nbr[k] == 2);
+   test_assert(graph->dist[k] == 1);
+   test_assert(graph->nbr[k+1] == 1);
+   test_assert(graph->dist[k+1] == 2);
+   test_assert(graph->nbr[k+2] == 1);
+   test_assert(graph->dist[k+2] == 2);
+   test_assert(graph->nodes[graph->nbr[k]] == u[2]);
+
+   destroy_graph(graph);
+   for (int i = 0 ; i < 3 ; i++) {
+      destroy_useq(u[i]);
+   }
 
 }
 
@@ -87,19 +174,21 @@ test_starcode_2
 void
 test_starcode_3
 (void)
-// Test 'addmatch', 'transfer_counts_and_update_canonicals'.
+// Test 'transfer_counts_and_update_canonicals'.
 {
-   useq_t *u1 = new_useq(1, "B}d2)$ChPyDC=xZ D-C", NULL);
-   useq_t *u2 = new_useq(2, "RCD67vQc80:~@FV`?o%D", NULL);
+   useq_t *u1 = new_useq(1, "GATCNAtcGNTaCCtA", NULL);
+   useq_t *u2 = new_useq(2, "CACCgtTTGAcnGCAATaaG", NULL);
 
    // Add match to 'u1'.
-   addmatch(u1, u2, 1, 1);
+   useq_t *pair[2] = {u1, u2};
+   const int edge[1][3] = {{0,1,1}};
+   graph_t *graph = graph_from_edges(pair, 2, edge, 1);
 
    test_assert(u1->count == 1);
    test_assert(u2->count == 2);
 
    // This should not transfer counts but update canonical.
-   transfer_counts_and_update_canonicals(u2);
+   transfer_counts_and_update_canonicals(u2, graph);
 
    test_assert(u1->count == 1);
    test_assert(u2->count == 2);
@@ -107,35 +196,40 @@ test_starcode_3
    test_assert(u2->canonical == u2);
 
    // This should transfer the counts from 'u1' to 'u2'.
-   transfer_counts_and_update_canonicals(u1);
+   transfer_counts_and_update_canonicals(u1, graph);
 
    test_assert(u1->count == 0);
    test_assert(u2->count == 3);
    test_assert(u1->canonical == u2);
    test_assert(u2->canonical == u2);
 
+   destroy_graph(graph);
    destroy_useq(u1);
    destroy_useq(u2);
 
-   useq_t *u3 = new_useq(1, "{Lu[T}FOCMs}L_zx", NULL);
-   useq_t *u4 = new_useq(2, "|kAV|Ch|RZ]h~WjCoDpX", NULL);
-   useq_t *u5 = new_useq(2, "}lzHolUky", NULL);
-   useq_t *u6 = new_useq(3, "][asdf31!3R]", NULL);
-   useq_t *u7 = new_useq(1, "kjkdfdHK!}33-34", NULL);
+   useq_t *u3 = new_useq(1, "AGTTCGATcgAnTCga", NULL);
+   useq_t *u4 = new_useq(2, "ttgACaTGCaGAgTNCCCtA", NULL);
+   useq_t *u5 = new_useq(2, "GTcaTCCgA", NULL);
+   useq_t *u6 = new_useq(3, "cAGGacACTtAN", NULL);
+   useq_t *u7 = new_useq(1, "AcTTGAcgATcgGTA", NULL);
 
    // Add matches to 'u3'.
-   addmatch(u3, u4, 1, 1);
-   addmatch(u3, u5, 1, 1);
-   addmatch(u5, u6, 1, 1);
-   addmatch(u7, u3, 1, 1);
+   useq_t *useqs[5] = {u3, u4, u5, u6, u7};
+   const int edges[4][3] = {{0,1,1}, {0,2,1}, {2,3,1}, {4,0,1}};
+   graph = graph_from_edges(useqs, 5, edges, 4);
 
    test_assert(u3->count == 1);
    test_assert(u4->count == 2);
    test_assert(u5->count == 2);
    test_assert(u6->count == 3);
 
-   // u7 points to u3, which is ambiguous.
-   transfer_counts_and_update_canonicals(u7);
+   // The parents are assigned first. u7 points
+   // to u3, which is ambiguous.
+   transfer_counts_and_update_canonicals(u4, graph);
+   transfer_counts_and_update_canonicals(u6, graph);
+   transfer_counts_and_update_canonicals(u5, graph);
+   transfer_counts_and_update_canonicals(u3, graph);
+   transfer_counts_and_update_canonicals(u7, graph);
 
 
    test_assert(u3->canonical == NULL);
@@ -159,12 +253,13 @@ test_starcode_3
    test_assert(u4->sphere_d == 0);
 
    // Resolve ambiguous canonicals.
-   mp_resolve_ambiguous(u5);
+   mp_resolve_ambiguous(u5, graph);
    test_assert(u3->canonical == NULL);
    test_assert(u5->canonical == u6);
 
    // u3 canonical must be u4, because is a true canonical.
-   mp_resolve_ambiguous(u7);
+   mp_resolve_ambiguous(u3, graph);
+   mp_resolve_ambiguous(u7, graph);
 
    test_assert(u3->canonical == u4);
    test_assert(u7->canonical == u4);
@@ -177,11 +272,42 @@ test_starcode_3
    test_assert(u5->count == 0);
    test_assert(u6->count == 5);
 
+   destroy_graph(graph);
    destroy_useq(u3);
    destroy_useq(u4);
    destroy_useq(u5);
    destroy_useq(u6);
    destroy_useq(u7);
+
+   // The same with 'message_passing_clustering()'.
+   u3 = new_useq(1, "AGTTCGATcgAnTCga", NULL);
+   u4 = new_useq(2, "ttgACaTGCaGAgTNCCCtA", NULL);
+   u5 = new_useq(2, "GTcaTCCgA", NULL);
+   u6 = new_useq(3, "cAGGacACTtAN", NULL);
+   u7 = new_useq(1, "AcTTGAcgATcgGTA", NULL);
+   useq_t *again[5] = {u3, u4, u5, u6, u7};
+   graph = graph_from_edges(again, 5, edges, 4);
+   gstack_t *useqS = new_gstack();
+   test_assert_critical(useqS != NULL);
+   for (int i = 0 ; i < 5 ; i++) {
+      push(again[i], &useqS);
+   }
+
+   message_passing_clustering(useqS, graph, 2);
+
+   test_assert(u3->canonical == u4);
+   test_assert(u4->canonical == u4);
+   test_assert(u5->canonical == u6);
+   test_assert(u6->canonical == u6);
+   test_assert(u7->canonical == u4);
+   test_assert(u4->count == 4);
+   test_assert(u6->count == 5);
+
+   destroy_graph(graph);
+   free(useqS);
+   for (int i = 0 ; i < 5 ; i++) {
+      destroy_useq(again[i]);
+   }
 }
 
 
@@ -190,8 +316,9 @@ test_starcode_4
 (void)
 // Test 'canonical_order'.
 {
-   useq_t *u1 = new_useq(1, "ABCD", NULL);
-   useq_t *u2 = new_useq(2, "EFGH", NULL);
+   const int edge[1][3] = {{0,1,1}};
+   useq_t *u1 = new_useq(1, "ACGT", NULL);
+   useq_t *u2 = new_useq(2, "GTAC", NULL);
    test_assert_critical(u1 != NULL);
    test_assert_critical(u2 != NULL);
 
@@ -201,9 +328,12 @@ test_starcode_4
    test_assert(canonical_order(&u2, &u1) > 0);
 
    // Add match to 'u1', and update canonicals.
-   addmatch(u1, u2, 1, 1);
-   test_assert_critical(u1->matches != NULL);
-   transfer_counts_and_update_canonicals(u1);
+   useq_t *pair_u1[2] = {u1, u2};
+   graph_t *graph_u1 = graph_from_edges(pair_u1, 2, edge, 1);
+   test_assert_critical(nmatches(graph_u1, u1) == 1);
+   transfer_counts_and_update_canonicals(u2, graph_u1);
+   transfer_counts_and_update_canonicals(u1, graph_u1);
+   destroy_graph(graph_u1);
    test_assert(u1->count == 0);
    test_assert(u2->count == 3);
 
@@ -212,8 +342,8 @@ test_starcode_4
    test_assert(canonical_order(&u1, &u2) < 0);
    test_assert(canonical_order(&u2, &u1) > 0);
 
-   useq_t *u3 = new_useq(1, "CDEF", NULL);
-   useq_t *u4 = new_useq(2, "GHIJ", NULL);
+   useq_t *u3 = new_useq(1, "CGTA", NULL);
+   useq_t *u4 = new_useq(2, "TACG", NULL);
    test_assert_critical(u3 != NULL);
    test_assert_critical(u4 != NULL);
 
@@ -232,9 +362,12 @@ test_starcode_4
    test_assert(canonical_order(&u4, &u3) > 0);
 
    // Add match to 'u3', and update canonicals.
-   addmatch(u3, u4, 1, 1);
-   test_assert_critical(u3->matches != NULL);
-   transfer_counts_and_update_canonicals(u3);
+   useq_t *pair_u3[2] = {u3, u4};
+   graph_t *graph_u3 = graph_from_edges(pair_u3, 2, edge, 1);
+   test_assert_critical(nmatches(graph_u3, u3) == 1);
+   transfer_counts_and_update_canonicals(u4, graph_u3);
+   transfer_counts_and_update_canonicals(u3, graph_u3);
+   destroy_graph(graph_u3);
    test_assert(u3->count == 0);
    test_assert(u4->count == 3);
 
@@ -251,8 +384,8 @@ test_starcode_4
    test_assert(canonical_order(&u3, &u4) < 0);
    test_assert(canonical_order(&u4, &u3) > 0);
 
-   useq_t *u5 = new_useq(1, "CDEF", NULL);
-   useq_t *u6 = new_useq(3, "GHIJ", NULL);
+   useq_t *u5 = new_useq(1, "CGTA", NULL);
+   useq_t *u6 = new_useq(3, "TACG", NULL);
    test_assert_critical(u5 != NULL);
    test_assert_critical(u6 != NULL);
 
@@ -278,9 +411,12 @@ test_starcode_4
    test_assert(canonical_order(&u6, &u5) > 0);
 
    // Add match to 'u5', and update canonicals.
-   addmatch(u5, u6, 1, 1);
-   test_assert_critical(u5->matches != NULL);
-   transfer_counts_and_update_canonicals(u5);
+   useq_t *pair_u5[2] = {u5, u6};
+   graph_t *graph_u5 = graph_from_edges(pair_u5, 2, edge, 1);
+   test_assert_critical(nmatches(graph_u5, u5) == 1);
+   transfer_counts_and_update_canonicals(u6, graph_u5);
+   transfer_counts_and_update_canonicals(u5, graph_u5);
+   destroy_graph(graph_u5);
    test_assert(u5->count == 0);
    test_assert(u6->count == 4);
 
@@ -328,8 +464,9 @@ test_starcode_5
 // Test 'count_order()'.
 {
 
-   useq_t *u1 = new_useq(1, "L@[ohztp{2@V(u(x7fLt&x80", NULL);
-   useq_t *u2 = new_useq(2, "$Ee6xkB+.Q;Nk)|w[KQ;", NULL);
+   char buf[MAXSEQLEN];
+   useq_t *u1 = new_useq(1, "GTNtcAANtTCTNtcTTaaCgTGA", NULL);
+   useq_t *u2 = new_useq(2, "CagnGCGnGtCGNTCNGnNC", NULL);
    test_assert(count_order(&u1, &u2) == 1);
    test_assert(count_order(&u2, &u1) == -1);
    test_assert(count_order(&u1, &u1) == 0);
@@ -359,19 +496,19 @@ test_starcode_5
 
    // Case 1 (no repeat).
    char *sequences_1[10] = {
-      "IRrLv<'*3S?UU<JF4S<,", "tcKvz5JTm!h*X0mSTg",
-      "tW:0K&Mvtax<PP/qY6er", "hcU+f!=`.Xs6[a,C7XpN",
-      ":3ILp'w?)f]4(a;mf%A9", "RlEF',$6[}ouJQyWqqT#",
-      "U Ct`3w8(#KAE+z;vh,",  "[S^jXvNS VP' cwg~_iq",
-      ".*/@*Q/]]}32kNB#`qqv", "#`Hwp(&,z|bN~07CSID'",
+      "NNCAGcttTTGACATTnTaA", "GCgNTaAAgNNctGCnaA",
+      "gCtAGtgTCAgNaCtcgCCT", "AAcGcCNTAgTGGtCAaAGA",
+      "aTATAagCANGgGGNaGGGG", "nCggTgNANctCCtAATNng",
+      "GgGGCtCCCCcgncGATGC",  "TNGAanNGCAGgCACgANCa",
+      "NgttAGCTTcAtctAATNGT", "AtGaNTaNCCNTNCTCNCaT",
    };
    // Call to 'new_useq()' will also capitalize the letters.
    const char *sorted_1[10] = {
-      "#`HWP(&,Z|BN~07CSID'", ".*/@*Q/]]}32KNB#`QQV", 
-      "[S^JXVNS VP' CWG~_IQ", "U CT`3W8(#KAE+Z;VH,", 
-      "RLEF',$6[}OUJQYWQQT#", ":3ILP'W?)F]4(A;MF%A9", 
-      "HCU+F!=`.XS6[A,C7XPN", "TW:0K&MVTAX<PP/QY6ER", 
-      "TCKVZ5JTM!H*X0MSTG",   "IRRLV<'*3S?UU<JF4S<,", 
+      "ATGANTANCCNTNCTCNCAT", "NGTTAGCTTCATCTAATNGT",
+      "TNGAANNGCAGGCACGANCA", "GGGGCTCCCCCGNCGATGC",
+      "NCGGTGNANCTCCTAATNNG", "ATATAAGCANGGGGNAGGGG",
+      "AACGCCNTAGTGGTCAAAGA", "GCTAGTGTCAGNACTCGCCT",
+      "GCGNTAAAGNNCTGCNAA",   "NNCAGCTTTTGACATTNTAA",
    };
 
    useq_t *to_sort_1[10];
@@ -381,19 +518,19 @@ test_starcode_5
 
    qsort(to_sort_1, 10, sizeof(useq_t *), count_order);
    for (int i = 0 ; i < 10 ; i++) {
-      test_assert(strcmp(to_sort_1[i]->seq, sorted_1[i]) == 0);
+      test_assert(strcmp(unpack_seq(to_sort_1[i], buf, 0), sorted_1[i]) == 0);
       test_assert(to_sort_1[i]->count == 9-i);
       destroy_useq(to_sort_1[i]);
    }
 
    // Case 2 (repeats).
    char *sequences_2[6] = {
-      "repeat", "repeat", "repeat", "abc", "abc", "xyz"
+      "gattaca", "gattaca", "gattaca", "acg", "acg", "tgc"
    };
    int counts[6] = {1,1,2,3,4,4};
    // Call to 'new_useq()' will also capitalize the letters.
    char *sorted_2[6] = {
-      "ABC", "XYZ", "ABC", "REPEAT", "REPEAT", "REPEAT",
+      "ACG", "TGC", "ACG", "GATTACA", "GATTACA", "GATTACA",
    };
    int sorted_counts[6] = {4,4,3,2,1,1};
 
@@ -404,7 +541,7 @@ test_starcode_5
 
    qsort(to_sort_2, 6, sizeof(useq_t *), count_order);
    for (int i = 0 ; i < 6 ; i++) {
-      test_assert(strcmp(to_sort_2[i]->seq, sorted_2[i]) == 0);
+      test_assert(strcmp(unpack_seq(to_sort_2[i], buf, 0), sorted_2[i]) == 0);
       test_assert(to_sort_2[i]->count == sorted_counts[i]);
       destroy_useq(to_sort_2[i]);
    }
@@ -415,43 +552,51 @@ test_starcode_5
 void
 test_starcode_6
 (void)
-// Test 'pad_useq()' and 'unpad_useq()'
+// Test 'pad_useq()' and 'unpack_seq()'.
 {
 
+   char buf[MAXSEQLEN];
    gstack_t * useqS = new_gstack();
    test_assert_critical(useqS != NULL);
 
-   useq_t *u1 = new_useq(1, "L@[ohztp{2@V(u(x7fLt&x80", NULL);
-   useq_t *u2 = new_useq(2, "$Ee6xkB+.Q;Nk)|w[KQ;", NULL);
+   useq_t *u1 = new_useq(1, "GTNtcAANtTCTNtcTTaaCgTGA", NULL);
+   useq_t *u2 = new_useq(2, "CagnGCGnGtCGNTCNGnNC", NULL);
    test_assert_critical(u1 != NULL);
    test_assert_critical(u2 != NULL);
+   uint8_t *pack = u2->pack;
 
    push(u1, &useqS);
    push(u2, &useqS);
    test_assert(useqS->nitems == 2);
 
    int med;
-   pad_useq(useqS, &med);
-   // The call to 'new_useq()' will capitalize the sequence.
-   test_assert(strcmp(u2->seq, "    $EE6XKB+.Q;NK)|W[KQ;") == 0);
+   test_assert(pad_useq(useqS, &med) == 24);
    test_assert(med == 20);
+   // Sequences are padded when they are unpacked.
+   test_assert(u2->pack == pack);
+   test_assert(strcmp(unpack_seq(u2, buf, 24),
+            "    CAGNGCGNGTCGNTCNGNNC") == 0);
 
-   useq_t *u3 = new_useq(23, "0sdfd:'!'@{1$Ee6xkB+.Q;[Nk)|w[KQ;", NULL);
+   useq_t *u3 = new_useq(23, "TGgtGNCGGAtCCnaGNGgnGaACcGNTTNGAc", NULL);
    test_assert_critical(u3 != NULL);
    push(u3, &useqS);
    test_assert(useqS->nitems == 3);
 
-   pad_useq(useqS, &med);
-   // The call to 'new_useq()' will capitalize the sequence.
-   test_assert(strcmp(u1->seq, "         L@[OHZTP{2@V(U(X7FLT&X80") == 0);
-   test_assert(strcmp(u2->seq, "             $EE6XKB+.Q;NK)|W[KQ;") == 0);
-   test_assert(med == 24);
-
-   unpad_useq(useqS);
-   // The call to 'new_useq()' will capitalize the sequence.
-   test_assert(strcmp(u1->seq, "L@[OHZTP{2@V(U(X7FLT&X80") == 0);
-   test_assert(strcmp(u2->seq, "$EE6XKB+.Q;NK)|W[KQ;") == 0);
-   test_assert(strcmp(u3->seq, "0SDFD:'!'@{1$EE6XKB+.Q;[NK)|W[KQ;") == 0);
+   test_assert(pad_useq(useqS, &med) == 33);
+   // The sequences are not modified by the first call.
+   test_assert(med == 20);
+   test_assert(strcmp(unpack_seq(u1, buf, 33),
+            "         GTNTCAANTTCTNTCTTAACGTGA") == 0);
+   test_assert(strcmp(unpack_seq(u2, buf, 33),
+            "             CAGNGCGNGTCGNTCNGNNC") == 0);
+
+   // Without padding.
+   test_assert(strcmp(unpack_seq(u1, buf, 0),
+            "GTNTCAANTTCTNTCTTAACGTGA") == 0);
+   test_assert(strcmp(unpack_seq(u2, buf, 0),
+            "CAGNGCGNGTCGNTCNGNNC") == 0);
+   test_assert(strcmp(unpack_seq(u3, buf, 0),
+            "TGGTGNCGGATCCNAGNGGNGAACCGNTTNGAC") == 0);
 
    destroy_useq(u1);
    destroy_useq(u2);
@@ -569,52 +714,34 @@ test_starcode_9
    test_assert_critical(lut != NULL);
 
    // Insert a too short string (nothing happens).
-   useq_t *u = new_useq(0, "", NULL);
-   test_assert_critical(u != NULL);
+   const char *u = "";
    test_assert(lut_insert(lut, u) == 0);
-   destroy_useq(u);
 
    // Insert the following k-mers: ACG|TAGC|GCTA|TAGC|GATCA
-   u = new_useq(0, "ACGTAGCGCTATAGCGATCA", NULL);
-   test_assert_critical(u != NULL);
+   u = "ACGTAGCGCTATAGCGATCA";
    test_assert(lut_insert(lut, u) == 0);
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "CGTAGCGCTATAGCGATCAA", NULL);
-   test_assert_critical(u != NULL);
+   u = "CGTAGCGCTATAGCGATCAA";
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "AAAATAGCGCCCCCCCCCCC", NULL);
-   test_assert_critical(u != NULL);
+   u = "AAAATAGCGCCCCCCCCCCC";
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "CCCCCCCCCCCCCCCGATCA", NULL);
-   test_assert_critical(u != NULL);
+   u = "CCCCCCCCCCCCCCCGATCA";
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "CCCCCGCTACCCCCCCCCCC", NULL);
-   test_assert_critical(u != NULL);
+   u = "CCCCCGCTACCCCCCCCCCC";
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "TAGCAAAAAAAAAAAAAAAA", NULL);
-   test_assert_critical(u != NULL);
+   u = "TAGCAAAAAAAAAAAAAAAA";
    test_assert(lut_search(lut, u) == 1);
-   destroy_useq(u);
 
-   u = new_useq(0, "CCCCCCCCCCCCCCGATCAC", NULL);
-   test_assert_critical(u != NULL);
+   u = "CCCCCCCCCCCCCCGATCAC";
    test_assert(lut_search(lut, u) == 0);
-   destroy_useq(u);
 
-   u = new_useq(0, "AAAAAAAAAAAAAAAAAAAA", NULL);
-   test_assert_critical(u != NULL);
+   u = "AAAAAAAAAAAAAAAAAAAA";
    test_assert(lut_search(lut, u) == 0);
-   destroy_useq(u);
 
    destroy_lookup(lut);
    lut = NULL;
@@ -628,10 +755,9 @@ test_starcode_9
       for (int j = 0 ; j < 20 ; j++) {
          seq[j] = untranslate[(int)(1 + 4*drand48())];
       } 
-      u = new_useq(0, seq, NULL);
+      u = seq;
       test_assert(lut_insert(lut, u) == 0);
       test_assert(lut_search(lut, u) == 1);
-      destroy_useq(u);
    }
 
    destroy_lookup(lut);
@@ -645,10 +771,8 @@ test_starcode_9
          char nt = untranslate[1 + (int)((i >> (2*j)) & 3)];
          seq[j+3] = seq[j+7] = seq[j+11] = seq[j+15] = nt;   
       }
-      u = new_useq(0, seq, NULL);
-      test_assert_critical(u != NULL);
+      u = seq;
       test_assert(lut_insert(lut, u) == 0);
-      destroy_useq(u);
    }
 
    for (int i = 0 ; i < 4 ; i++) {
@@ -670,10 +794,8 @@ test_starcode_9
       for (int j = 0 ; j < 64 ; j++) {
          seq[j] = untranslate[(int)(1 + 4*drand48())];
       } 
-      u = new_useq(0, seq, NULL);
-      test_assert_critical(u != NULL);
+      u = seq;
       test_assert(lut_insert(lut, u) == 0);
-      destroy_useq(u);
    }
 
    const int set_bits_per_byte[256] = {
@@ -716,6 +838,8 @@ test_starcode_10
 // Test 'read_file()'
 {
 
+   char buf[MAXSEQLEN];
+
    const char * expected[] = {
    "AGGGCTTACAAGTATAGGCC",
    "TGCGCCAAGTACGATTTCCG",
@@ -755,54 +879,52 @@ test_starcode_10
    };
 
    // Read raw file.
+   format_t format = UNSET;
    FILE *f = fopen("test_file.txt", "r");
-   gstack_t *useqS = read_file(f, NULL, 0);
+   arena_t *arena = new_arena();
+   gstack_t *useqS = read_file(f, NULL, 0, 1, arena, 0, &format);
+   test_assert(format == RAW);
    test_assert(useqS->nitems == 35);
    for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
       test_assert(u->count == 1);
-      test_assert(strcmp(u->seq, expected[i]) == 0);
+      test_assert(strcmp(unpack_seq(u, buf, 0), expected[i]) == 0);
    }
 
    // Clean.
-   for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
-      destroy_useq(useqS->items[i]);
-   }
-   free(useqS);
+   release_reads(useqS, arena);
    fclose(f);
 
    // Read fasta file.
    f = fopen("test_file.fasta", "r");
-   useqS = read_file(f, NULL, 0);
+   arena = new_arena();
+   useqS = read_file(f, NULL, 0, 1, arena, 0, &format);
+   test_assert(format == FASTA);
    test_assert(useqS->nitems == 5);
    for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
       test_assert(u->count == 1);
-      test_assert(strcmp(u->seq, expected[i]) == 0);
+      test_assert(strcmp(unpack_seq(u, buf, 0), expected[i]) == 0);
    }
 
    // Clean.
-   for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
-      destroy_useq(useqS->items[i]);
-   }
-   free(useqS);
+   release_reads(useqS, arena);
    fclose(f);
 
    // Read fastq file.
    f = fopen("test_file1.fastq", "r");
-   useqS = read_file(f, NULL, 0);
+   arena = new_arena();
+   useqS = read_file(f, NULL, 0, 1, arena, 0, &format);
+   test_assert(format == FASTQ);
    test_assert(useqS->nitems == 5);
    for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
       test_assert(u->count == 1);
-      test_assert(strcmp(u->seq, expected[i]) == 0);
+      test_assert(strcmp(unpack_seq(u, buf, 0), expected[i]) == 0);
    }
 
    // Clean.
-   for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
-      destroy_useq(useqS->items[i]);
-   }
-   free(useqS);
+   release_reads(useqS, arena);
    fclose(f);
 
    char *PE_expected[]= {
@@ -824,24 +946,485 @@ test_starcode_10
    // Read paired-end fastq file.
    FILE *f1 = fopen("test_file1.fastq", "r");
    FILE *f2 = fopen("test_file2.fastq", "r");
-   useqS = read_file(f1, f2, 0);
+   arena = new_arena();
+   useqS = read_file(f1, f2, 0, 1, arena, 0, &format);
+   test_assert(format == PE_FASTQ);
    test_assert(useqS->nitems == 5);
    for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
       useq_t * u = (useq_t *) useqS->items[i];
       test_assert(u->count == 1);
-      test_assert(strcmp(u->seq, PE_expected[i]) == 0);
+      test_assert(strcmp(unpack_seq(u, buf, 0), PE_expected[i]) == 0);
       test_assert(strcmp(u->info, PE_fastq_headers[i]) == 0);
    }
 
    // Clean.
-   for (unsigned int i = 0 ; i < useqS->nitems ; i++) {
+   release_reads(useqS, arena);
+   fclose(f1);
+   fclose(f2);
+
+
+
+}
+
+
+void
+test_scan_rawseq
+(void)
+// Test 'scan_rawseq()' on a buffer (no terminal newline).
+{
+
+   char buf[MAXSEQLEN];
+   const char data[] = "ACGT\t5\nacga 3\n GATC\t+2\nTTTT";
+   const char *expected[] = { "ACGT", "ACGA", "GATC", "TTTT" };
+   int counts[] = {5, 3, 2, 1};
+
+   arena_t *arena = new_arena();
+   gstack_t *useqS = new_gstack();
+   useqS = scan_rawseq(data, strlen(data), useqS, arena);
+   test_assert_critical(useqS->nitems == 4);
+   for (int i = 0 ; i < 4 ; i++) {
+      useq_t *u = useqS->items[i];
+      test_assert(strcmp(unpack_seq(u, buf, 0), expected[i]) == 0);
+      test_assert(u->count == counts[i]);
+      test_assert(u->seqid[0] == i+1);
+   }
+   release_reads(useqS, arena);
+
+}
+
+
+void
+test_scan_chunks
+(void)
+// Test 'scan_chunks()' with records split across chunks.
+{
+
+   char buf[MAXSEQLEN];
+   char seq[50][16];
+   char data[50 * 64];
+   const char *nt = "ACGT";
+
+   // Quality lines start with '@' to look like headers.
+   size_t size = 0;
+   srand(123);
+   for (int i = 0 ; i < 50 ; i++) {
+      int len = 4 + rand() % 12;
+      for (int j = 0 ; j < len ; j++) seq[i][j] = nt[rand() % 4];
+      seq[i][len] = '\0';
+      size += sprintf(data + size, "@read%d\n%s\n+\n@%*d\n",
+            i, seq[i], len-1, i);
+   }
+
+   for (int t = 1 ; t < 9 ; t++) {
+      arena_t *arena = new_arena();
+      gstack_t *useqS = new_gstack();
+      useqS = scan_chunks(data, size, useqS, arena, t, FASTQ, 0);
+      test_assert_critical(useqS->nitems == 50);
+      for (int i = 0 ; i < 50 ; i++) {
+         useq_t *u = useqS->items[i];
+         test_assert(strcmp(unpack_seq(u, buf, 0), seq[i]) == 0);
+         test_assert(u->nids == 1);
+         test_assert(u->seqid[0] == i+1);
+      }
+      release_reads(useqS, arena);
+   }
+
+   // Raw file without final newline.
+   size = 0;
+   for (int i = 0 ; i < 50 ; i++) {
+      size += sprintf(data + size, i < 49 ? "%s\t%d\n" : "%s\t%d",
+            seq[i], i+1);
+   }
+
+   for (int t = 1 ; t < 9 ; t++) {
+      arena_t *arena = new_arena();
+      gstack_t *useqS = new_gstack();
+      useqS = scan_chunks(data, size, useqS, arena, t, RAW, 0);
+      test_assert_critical(useqS->nitems == 50);
+      for (int i = 0 ; i < 50 ; i++) {
+         useq_t *u = useqS->items[i];
+         test_assert(strcmp(unpack_seq(u, buf, 0), seq[i]) == 0);
+         test_assert(u->count == i+1);
+         test_assert(u->seqid[0] == i+1);
+      }
+      release_reads(useqS, arena);
+   }
+
+}
+
+
+size_t
+gzip_member
+(
+   const char     * text,
+   size_t           len,
+   int              bgzf,
+   unsigned char  * member
+)
+// Compress 'text' as a gzip member, or as a BGZF block, in
+// 'member' and return the size of the member.
+{
+   z_stream strm;
+   memset(&strm, 0, sizeof(strm));
+   deflateInit2(&strm, 6, Z_DEFLATED, bgzf ? -MAX_WBITS : 16 + MAX_WBITS,
+         8, Z_DEFAULT_STRATEGY);
+   strm.next_in = (unsigned char *) text;
+   strm.avail_in = len;
+   strm.next_out = member + (bgzf ? 18 : 0);
+   strm.avail_out = 4096;
+   deflate(&strm, Z_FINISH);
+   size_t size = strm.total_out;
+   deflateEnd(&strm);
+   if (bgzf) {
+      const unsigned char header[18] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0,
+         0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0};
+      memcpy(member, header, 18);
+      uLong crc = crc32(0, (const unsigned char *) text, len);
+      for (int k = 0 ; k < 4 ; k++) {
+         member[18 + size + k] = (crc >> (8*k)) & 0xff;
+         member[22 + size + k] = (len >> (8*k)) & 0xff;
+      }
+      size += 26;
+      member[16] = (size - 1) & 0xff;
+      member[17] = (size - 1) >> 8;
+   }
+   return size;
+}
+
+
+void
+test_gunzip
+(void)
+// Test 'new_gzin()', 'inflate_gzin()', 'inflate_bgzf()' and
+// 'read_gzip()'.
+{
+
+   char buf[MAXSEQLEN];
+   char seq[50][16];
+   char text[50 * 64];
+   unsigned char data[16384];
+   const char *nt = "ACGT";
+
+   size_t len = 0;
+   srand(123);
+   for (int i = 0 ; i < 50 ; i++) {
+      int slen = 4 + rand() % 12;
+      for (int j = 0 ; j < slen ; j++) seq[i][j] = nt[rand() % 4];
+      seq[i][slen] = '\0';
+      len += sprintf(text + len, "@read%d\n%s\n+\n%*d\n",
+            i, seq[i], slen, i);
+   }
+
+   // Plain input is left untouched.
+   FILE *f = fmemopen(text, len, "r");
+   test_assert_critical(f != NULL);
+   test_assert(new_gzin(f) == NULL);
+   test_assert(fgetc(f) == '@');
+   fclose(f);
+
+   // Three gzip members (split in the middle of records), then
+   // BGZF blocks of about 300 bytes and the empty end block.
+   size_t nbytes[2] = {0};
+   unsigned char *members = data;
+   unsigned char *blocks = data + 8192;
+   for (int i = 0 ; i < 3 ; i++) {
+      size_t from = len * i / 3;
+      nbytes[0] += gzip_member(text + from, len * (i+1) / 3 - from, 0,
+            members + nbytes[0]);
+   }
+   for (size_t from = 0 ; from < len ; from += 300) {
+      nbytes[1] += gzip_member(text + from, min(300, len - from), 1,
+            blocks + nbytes[1]);
+   }
+   nbytes[1] += gzip_member("", 0, 1, blocks + nbytes[1]);
+   test_assert(bgzf_block_size(members, nbytes[0]) == 0);
+   test_assert(bgzf_block_size(blocks, nbytes[1]) > 0);
+
+   for (int b = 0 ; b < 2 ; b++) {
+      unsigned char *input = b ? blocks : members;
+
+      // The whole text in pieces of at most 100 bytes.
+      char out[50 * 64];
+      f = fmemopen(input, nbytes[b], "r");
+      gzin_t *gz = new_gzin(f);
+      test_assert_critical(gz != NULL);
+      test_assert(gz->bgzf == b);
+      size_t size = 0;
+      size_t n;
+      do {
+         n = 0;
+         if (gz->bgzf) {
+            n = inflate_bgzf(gz, out + size, 400, 2);
+            test_assert(n <= 400);
+         }
+         if (n == 0) {
+            n = inflate_gzin(gz, out + size, 100);
+            test_assert(n <= 100);
+         }
+         size += n;
+      } while (n > 0);
+      test_assert(size == len);
+      test_assert(memcmp(out, text, len) == 0);
+      destroy_gzin(gz);
+      fclose(f);
+
+      // Records are carried over small windows.
+      for (int t = 1 ; t < 5 ; t++) {
+         f = fmemopen(input, nbytes[b], "r");
+         gz = new_gzin(f);
+         test_assert_critical(gz != NULL);
+         format_t format = UNSET;
+         arena_t *arena = new_arena();
+         gstack_t *useqS = read_gzip(gz, t, arena, 8, 0, 0, &format);
+         test_assert(format == FASTQ);
+         test_assert_critical(useqS != NULL);
+         test_assert_critical(useqS->nitems == 50);
+         for (int i = 0 ; i < 50 ; i++) {
+            useq_t *u = useqS->items[i];
+            test_assert(strcmp(unpack_seq(u, buf, 0), seq[i]) == 0);
+            test_assert(u->seqid[0] == i+1);
+         }
+         release_reads(useqS, arena);
+         destroy_gzin(gz);
+         fclose(f);
+      }
+   }
+
+   // Complete records.
+   test_assert(record_end(text, len, 4) == len);
+   test_assert(record_end(text, len - 1, 4) < len);
+   test_assert(text[record_end(text, len - 1, 4)] == '@');
+   test_assert(record_end(text, 10, 4) == 0);
+
+}
+
+
+void
+test_index
+(void)
+// Test 'write_index()' and 'load_index()'.
+{
+
+   char *seqs[] = {"GATTACA", "GATTAGA", "ACGTACGTA", "TTTTT", "CATTACA"};
+   gstack_t *useqS = new_gstack();
+   test_assert_critical(useqS != NULL);
+   for (int i = 0 ; i < 5 ; i++) {
+      push(new_useq(1, seqs[i], NULL), &useqS);
+   }
+
+   char path[] = "/tmp/starcode-test-index-XXXXXX";
+   int fd = mkstemp(path);
+   test_assert_critical(fd >= 0);
+   close(fd);
+   index_t *index = new_index(useqS, 1, 9, 7);
+   test_assert_critical(index != NULL);
+   test_assert(index->mapping == NULL);
+   test_assert(strcmp(index->text + index->offsets[3], "TTTTT") == 0);
+   test_assert(write_index(path, index) == 0);
+   destroy_index(index);
+
+   index = load_index(path);
+   unlink(path);
+   test_assert_critical(index != NULL);
+   test_assert(index->tau == 1);
+   test_assert(index->height == 9);
+   test_assert(index->medianlen == 7);
+   test_assert(index->nseq == 5);
+   for (int i = 0 ; i < 5 ; i++) {
+      test_assert(strcmp(index->text + index->offsets[i], seqs[i]) == 0);
+   }
+
+   // The lookup tables and the trie are used in place.
+   test_assert(lut_search(index->lut, "  GATTACA") == 1);
+   test_assert(lut_search(index->lut, "  GGGGGGG") == 0);
+   gstack_t **hits = new_tower(2);
+   test_assert_critical(hits != NULL);
+   test_assert(search(index->trie, "  GATTACA", 1, hits, 0, 0,
+            BYTEWISE_KERNEL) == 0);
+   test_assert(hits[0]->nitems == 1);
+   test_assert(hits[0]->items[0] == (void *) 1);
+   test_assert(hits[1]->nitems == 2);
+   test_assert(hits[1]->items[0] == (void *) 5);
+   test_assert(hits[1]->items[1] == (void *) 2);
+   destroy_tower(hits);
+   destroy_index(index);
+
+   // Other files are rejected.
+   redirect_stderr();
+   test_assert(load_index("/dev/null") == NULL);
+   unredirect_stderr();
+   test_assert_stderr("error: could not map index file /dev/null\n");
+
+   for (size_t i = 0 ; i < useqS->nitems ; i++) {
       destroy_useq(useqS->items[i]);
    }
    free(useqS);
-   fclose(f1);
-   fclose(f2);
 
+}
+
+
+void
+test_reference
+(void)
+// Test 'starcode_reference()'.
+{
+
+   char path[] = "/tmp/starcode-test-ref-XXXXXX";
+   int fd = mkstemp(path);
+   test_assert_critical(fd >= 0);
+   const char *refs = "GATTACA\nCATTACA\nTTTTTTTT\n";
+   test_assert_critical(write(fd, refs, strlen(refs)) ==
+         (ssize_t) strlen(refs));
+   close(fd);
+
+   char *reads = "GATTACA\nGATTACA\nAATTACA\nGGGGGGG\nTTTTTTTTT\n";
+   char *expected =
+      "GATTACA\t2\t0\tGATTACA\t1,2\n"
+      "AATTACA\t1\t1\tCATTACA,GATTACA\t3\n"
+      "GGGGGGG\t1\t-\t-\t4\n"
+      "TTTTTTTTT\t1\t1\tTTTTTTTT\t5\n";
+
+   char output[256] = {0};
+   FILE *inputf = fmemopen(reads, strlen(reads), "r");
+   FILE *outputf = fmemopen(output, sizeof(output), "w");
+   test_assert_critical(inputf != NULL && outputf != NULL);
+   test_assert(starcode_reference(inputf, path, outputf,
+            1, 0, 0, 0, 2, 1) == 0);
+   fclose(inputf);
+   fclose(outputf);
+   test_assert(strcmp(output, expected) == 0);
+
+   // The same with an index of the references.
+   char index[] = "/tmp/starcode-test-idx-XXXXXX";
+   fd = mkstemp(index);
+   test_assert_critical(fd >= 0);
+   close(fd);
+   FILE *reff = fopen(path, "r");
+   test_assert_critical(reff != NULL);
+   test_assert(starcode_index(reff, NULL, index, 1, 0, 1) == 0);
+   fclose(reff);
+
+   memset(output, 0, sizeof(output));
+   inputf = fmemopen(reads, strlen(reads), "r");
+   outputf = fmemopen(output, sizeof(output), "w");
+   test_assert_critical(inputf != NULL && outputf != NULL);
+   test_assert(starcode_reference(inputf, index, outputf,
+            1, 0, 0, 0, 1, 1) == 0);
+   fclose(inputf);
+   fclose(outputf);
+   test_assert(strcmp(output, expected) == 0);
+
+   // The distance cannot exceed that of the index.
+   inputf = fmemopen(reads, strlen(reads), "r");
+   test_assert_critical(inputf != NULL);
+   redirect_stderr();
+   test_assert(starcode_reference(inputf, index, stdout,
+            2, 0, 0, 0, 1, 0) == 1);
+   unredirect_stderr();
+   fclose(inputf);
+   test_assert_stderr("distance larger than the distance of the index (1)\n");
+
+   unlink(path);
+   unlink(index);
+
+}
+
+
+int
+run_starcode
+(
+   char *reads,
+   char *output,
+   size_t size,
+   int tau,
+   int clusteralg,
+   const char *ckptin,
+   const char *ckptout
+)
+// Runs 'starcode_run_files()' on 'reads' with the ids of the
+// sequences in the output.
+{
+   memset(output, 0, size);
+   FILE *inputf = fmemopen(reads, strlen(reads), "r");
+   FILE *outputf = fmemopen(output, size, "w");
+   if (inputf == NULL || outputf == NULL) return -1;
+   starcode_t *sc = new_starcode(tau, 0, 2, clusteralg, 5);
+   if (sc == NULL) return -1;
+   starcode_set_checkpoints(sc, ckptin, ckptout);
+   int rc = starcode_run_files(sc, inputf, NULL, outputf, NULL, 0,
+         0, 1, DEFAULT_OUTPUT);
+   destroy_starcode(sc);
+   fclose(inputf);
+   fclose(outputf);
+   return rc;
+}
+
+
+void
+test_checkpoint
+(void)
+// Test 'write_checkpoint()', 'load_checkpoint()' and the
+// incremental clustering of 'starcode_run_files()'.
+{
+
+   char *batch1 = "GATTACA\nGATTACA\nGATTACA\nGATTACA\nGATTACA\n"
+      "TTTTTTTT\nCATTAGA\n";
+   char *batch2 = "GATTACA\nGATTAGA\nTTTTTTTT\nCCCCCCC\nGATTACA\n";
+   char *all = "GATTACA\nGATTACA\nGATTACA\nGATTACA\nGATTACA\n"
+      "TTTTTTTT\nCATTAGA\nGATTACA\nGATTAGA\nTTTTTTTT\nCCCCCCC\nGATTACA\n";
+
+   char path[] = "/tmp/starcode-test-ckpt-XXXXXX";
+   int fd = mkstemp(path);
+   test_assert_critical(fd >= 0);
+   close(fd);
+
+   char expected[256];
+   char output[256];
+   test_assert(run_starcode(batch1, output, 256, 1, MP_CLUSTER,
+            NULL, path) == 0);
+   test_assert(run_starcode(batch1, expected, 256, 1, MP_CLUSTER,
+            NULL, NULL) == 0);
+   // Writing a checkpoint does not change the output.
+   test_assert(strcmp(output, expected) == 0);
+
+   arena_t *arena = new_arena();
+   test_assert_critical(arena != NULL);
+   ckpt_t *ckpt = load_checkpoint(path, arena);
+   test_assert_critical(ckpt != NULL);
+   test_assert(ckpt->tau == 1);
+   test_assert(ckpt->hamming == 0);
+   test_assert(ckpt->nreads == 7);
+   test_assert_critical(ckpt->useqS->nitems == 3);
+   test_assert(ckpt->graph->nnodes == 3);
+   size_t nedges = 0;
+   for (size_t i = 0 ; i < 3 ; i++) {
+      useq_t *u = ckpt->useqS->items[i];
+      test_assert(u->node == i);
+      if (u->count == 5) test_assert(u->nids == 5 && u->seqid[4] == 5);
+      nedges += ckpt->graph->offsets[i+1] - ckpt->graph->offsets[i];
+   }
+   // GATTACA and CATTAGA are not neighbors, the graph is empty.
+   test_assert(nedges == 0);
+   destroy_ckpt(ckpt);
+   destroy_arena(arena);
+
+   // Adding a batch gives the clusters of all the reads.
+   for (int alg = MP_CLUSTER ; alg <= COMPONENTS_CLUSTER ; alg++) {
+      test_assert(run_starcode(batch2, output, 256, 1, alg,
+               path, NULL) == 0);
+      test_assert(run_starcode(all, expected, 256, 1, alg,
+               NULL, NULL) == 0);
+      test_assert(strcmp(output, expected) == 0);
+   }
+
+   // The distance must be that of the checkpoint.
+   redirect_stderr();
+   test_assert(run_starcode(batch2, output, 256, 2, MP_CLUSTER,
+            path, NULL) == 1);
+   unredirect_stderr();
+   test_assert_stderr("the distance must be that of the checkpoint (1)\n");
 
+   unlink(path);
 
 }
 
@@ -851,27 +1434,30 @@ test_seqsort
 (void)
 {
 
+   char buf[MAXSEQLEN];
+   // Duplicates are not destroyed, they are released
+   // with the arena.
+   arena_t * arena = new_arena();
    gstack_t * useqS = new_gstack();
 
    // Basic cases.
    for (int i = 0 ; i < 9 ; i++) {
-      push(new_useq(1, "A", NULL), &useqS);
+      push(arena_useq(arena, 1, "A", NULL), &useqS);
    }
    test_assert(useqS->nitems == 9);
    test_assert(seqsort((useq_t **) useqS->items, 9, 1) == 1);
    test_assert_critical(useqS->items[0] != NULL);
    useq_t *u = useqS->items[0];
-   test_assert(strcmp(u->seq, "A") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "A") == 0);
    test_assert(u->count == 9);
    test_assert(u->canonical == NULL);
    for (int i = 1 ; i < 9 ; i++) {
       test_assert(useqS->items[i] == NULL);
    }
-   destroy_useq(useqS->items[0]);
 
    useqS->nitems = 0;
    for (int i = 0 ; i < 9 ; i++) {
-      push(new_useq(1, i % 2 ? "A":"B", NULL), &useqS);
+      push(arena_useq(arena, 1, i % 2 ? "A":"C", NULL), &useqS);
    }
    test_assert(useqS->nitems == 9);
    test_assert(seqsort((useq_t **) useqS->items, 9, 1) == 2);
@@ -881,94 +1467,89 @@ test_seqsort
       test_assert(useqS->items[i] == NULL);
    }
    u = useqS->items[0];
-   test_assert(strcmp(u->seq, "A") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "A") == 0);
    test_assert(u->count == 4);
    test_assert(u->canonical == NULL);
    u = useqS->items[1];
-   test_assert(strcmp(u->seq, "B") == 0);
+   test_assert(strcmp(unpack_seq(u, buf, 0), "C") == 0);
    test_assert(u->count == 5);
    test_assert(u->canonical == NULL);
-   destroy_useq(useqS->items[0]);
-   destroy_useq(useqS->items[1]);
 
    // Case 1 (no repeat).
    char *sequences_1[10] = {
-      "IRrLv<'*3S?UU<JF4S<,", "tcKvz5JTm!h*X0mSTg",
-      "tW:0K&Mvtax<PP/qY6er", "hcU+f!=`.Xs6[a,C7XpN",
-      ":3ILp'w?)f]4(a;mf%A9", "RlEF',$6[}ouJQyWqqT#",
-      "U Ct`3w8(#KAE+z;vh,",  "[S^jXvNS VP' cwg~_iq",
-      ".*/@*Q/]]}32kNB#`qqv", "#`Hwp(&,z|bN~07CSID'",
+      "GCtaANAGNaNcaaTTaCAN", "nANANCtNtGTNTgGCCC",
+      "gntNtaAGtAAGNTgTGATg", "CCCCATNCGGACtNGnNgCN",
+      "gnAaCntCGgNgTAATtTtG", "NNNGCNCctccNTGAAGtGC",
+      "CTCTGatTTACCCAcntcN",  "gNtCAGTNNTnCncNNATCN",
+      "NNNNcGtNNTNcnGNcTcTa", "tNtGtCggAgAGNTTATGNN",
    };
-   // The call to 'new_useq()' will capitalize the sequences.
+   // The call to 'arena_useq()' will capitalize the sequences.
    const char *sorted_1[10] = {
-      "TCKVZ5JTM!H*X0MSTG",   "U CT`3W8(#KAE+Z;VH,",
-      "#`HWP(&,Z|BN~07CSID'", ".*/@*Q/]]}32KNB#`QQV",
-      ":3ILP'W?)F]4(A;MF%A9", "HCU+F!=`.XS6[A,C7XPN",
-      "IRRLV<'*3S?UU<JF4S<,", "RLEF',$6[}OUJQYWQQT#",
-      "TW:0K&MVTAX<PP/QY6ER", "[S^JXVNS VP' CWG~_IQ",
+      "NANANCTNTGTNTGGCCC",   "CTCTGATTTACCCACNTCN",
+      "CCCCATNCGGACTNGNNGCN", "GCTAANAGNANCAATTACAN",
+      "GNAACNTCGGNGTAATTTTG", "GNTCAGTNNTNCNCNNATCN",
+      "GNTNTAAGTAAGNTGTGATG", "NNNGCNCCTCCNTGAAGTGC",
+      "NNNNCGTNNTNCNGNCTCTA", "TNTGTCGGAGAGNTTATGNN",
    };
 
    useq_t *to_sort_1[10];
    for (int i = 0 ; i < 10 ; i++) {
-      to_sort_1[i] = new_useq(1, sequences_1[i], NULL);
+      to_sort_1[i] = arena_useq(arena, 1, sequences_1[i], NULL);
    }
 
    test_assert(seqsort(to_sort_1, 10, 1) == 10);
    for (int i = 0 ; i < 10 ; i++) {
-      test_assert(strcmp(to_sort_1[i]->seq, sorted_1[i]) == 0);
+      test_assert(strcmp(unpack_seq(to_sort_1[i], buf, 0), sorted_1[i]) == 0);
       test_assert(to_sort_1[i]->count == 1);
-      destroy_useq(to_sort_1[i]);
    }
 
    // Case 2 (different lengths).
    char *sequences_2[10] = {
-      "IRr",                  "tcKvz5JTm!h*X0mSTg",
-      "tW:0K&Mvtax<PP/qY6er", "hcU+f!=`.Xs6[a,C7XpNwoi~OWe88",
-      "z3ILp'w?)f]4(a;mf9",   "RlEFWqqT#",
-      "U Ct`3w8(#Kz;vh,",     "aS^jXvNS VP' cwg~_iq",
-      ".*/@*Q/]]}32#`",       "(&,z|bN~07CSID'",
+      "GaC",                  "AGAncAGAtAGnTGncAN",
+      "nTCTaTTNTNGccgcCTGAc", "GCgCAGTATgNcCNAAGACTNAtAGGCAn",
+      "aCGATTnAaNCTgAtaNn",   "NCGggNNcA",
+      "anCgATAgtANTGtCC",     "TGCTGtgaGaGgtAcAGGGA",
+      "nNcaATTnCGtAnC",       "tncTGTTCNCCacGn",
    };
-   // The call to 'new_useq()' will capitalize the sequences.
+   // The call to 'arena_useq()' will capitalize the sequences.
    const char *sorted_2[10] = {
-      "IRR",                  "RLEFWQQT#",
-      ".*/@*Q/]]}32#`",       "(&,Z|BN~07CSID'",
-      "U CT`3W8(#KZ;VH,",     "TCKVZ5JTM!H*X0MSTG",
-      "Z3ILP'W?)F]4(A;MF9",   "AS^JXVNS VP' CWG~_IQ",
-      "TW:0K&MVTAX<PP/QY6ER", "HCU+F!=`.XS6[A,C7XPNWOI~OWE88",
+      "GAC",                  "NCGGGNNCA",
+      "NNCAATTNCGTANC",       "TNCTGTTCNCCACGN",
+      "ANCGATAGTANTGTCC",     "ACGATTNAANCTGATANN",
+      "AGANCAGATAGNTGNCAN",   "NTCTATTNTNGCCGCCTGAC",
+      "TGCTGTGAGAGGTACAGGGA", "GCGCAGTATGNCCNAAGACTNATAGGCAN",
    };
 
    useq_t *to_sort_2[10];
    for (int i = 0 ; i < 10 ; i++) {
-      to_sort_2[i] = new_useq(1, sequences_2[i], NULL);
+      to_sort_2[i] = arena_useq(arena, 1, sequences_2[i], NULL);
    }
 
    test_assert(seqsort(to_sort_2, 10, 1) == 10);
    for (int i = 0 ; i < 10 ; i++) {
-      test_assert(strcmp(to_sort_2[i]->seq, sorted_2[i]) == 0);
+      test_assert(strcmp(unpack_seq(to_sort_2[i], buf, 0), sorted_2[i]) == 0);
       test_assert(to_sort_2[i]->count == 1);
-      destroy_useq(to_sort_2[i]);
    }
 
    // Case 3 (repeats).
    char *sequences_3[6] = {
-      "repeat", "repeat", "repeat", "repeat", "repeat", "xyz"
+      "gattaca", "gattaca", "gattaca", "gattaca", "gattaca", "tgc"
    };
-   // The call to 'new_useq()' will capitalize the sequences.
+   // The call to 'arena_useq()' will capitalize the sequences.
    char *sorted_3[6] = {
-      "XYZ", "REPEAT", NULL, NULL, NULL, NULL,
+      "TGC", "GATTACA", NULL, NULL, NULL, NULL,
    };
    int counts[2] = {1,5};
 
    useq_t *to_sort_3[6];
    for (int i = 0 ; i < 6 ; i++) {
-      to_sort_3[i] = new_useq(1, sequences_3[i], NULL);
+      to_sort_3[i] = arena_useq(arena, 1, sequences_3[i], NULL);
    }
 
    test_assert(seqsort(to_sort_3, 6, 1) == 2);
    for (int i = 0 ; i < 2 ; i++) {
-      test_assert(strcmp(to_sort_3[i]->seq, sorted_3[i]) == 0);
+      test_assert(strcmp(unpack_seq(to_sort_3[i], buf, 0), sorted_3[i]) == 0);
       test_assert(to_sort_3[i]->count == counts[i]);
-      destroy_useq(to_sort_3[i]);
    }
    for (int i = 2 ; i < 6 ; i++) {
       test_assert(to_sort_3[i] == NULL);
@@ -1034,17 +1615,16 @@ test_seqsort
 
       useqS->nitems = 0;
       for (int i = 0 ; i < 35 ; i++) {
-         push(new_useq(1, seq[i], NULL), &useqS);
+         push(arena_useq(arena, 1, seq[i], NULL), &useqS);
       }
 
       test_assert(seqsort((useq_t **) useqS->items, 35, t) == 10);
       for (int i = 0 ; i < 10 ; i++) {
          test_assert_critical(useqS->items[i] != NULL);
          u = useqS->items[i];
-         test_assert(strcmp(u->seq, sorted_4[i]) == 0);
+         test_assert(strcmp(unpack_seq(u, buf, 0), sorted_4[i]) == 0);
          test_assert(u->count == counts_4[i]);
          test_assert(u->canonical == NULL);
-         destroy_useq(u);
       }
       for (int i = 10 ; i < 35 ; i++) {
          test_assert(useqS->items[i] == NULL);
@@ -1053,6 +1633,651 @@ test_seqsort
    }
 
    free(useqS);
+   destroy_arena(arena);
+
+}
+
+
+void
+test_dedup
+(void)
+// Test 'dedup_useq()'.
+{
+
+   char buf[MAXSEQLEN];
+   char *seq[8] = {
+      "GATTACA", "acg", "gattaca", "ACG", "GATTNCA",
+      "GATTACA", "ACGT", "GATTnCA",
+   };
+   char *uniq[4] = { "GATTACA", "ACG", "GATTNCA", "ACGT" };
+   int counts[4] = {10,6,13,7};
+   int ids[4][3] = { {1,3,6}, {2,4,0}, {5,8,0}, {7,0,0} };
+   unsigned int nids[4] = {3,2,2,1};
+
+   // Test 'dedup_useq()' with 1 to 8 threads.
+   for (int t = 1 ; t < 9 ; t++) {
+      arena_t *arena = new_arena();
+      useq_t *u[8];
+      for (int i = 0 ; i < 8 ; i++) {
+         u[i] = arena_useq(arena, i+1, seq[i], NULL);
+         u[i]->nids = 1;
+         u[i]->id = i+1;
+         u[i]->seqid = &u[i]->id;
+      }
+
+      test_assert(dedup_useq(u, 8, t) == 4);
+      for (int i = 0 ; i < 4 ; i++) {
+         test_assert_critical(u[i] != NULL);
+         test_assert(strcmp(unpack_seq(u[i], buf, 0), uniq[i]) == 0);
+         test_assert(u[i]->count == counts[i]);
+         test_assert(u[i]->nids == nids[i]);
+         for (unsigned int k = 0 ; k < nids[i] ; k++) {
+            // Duplicates are merged in the order of the input.
+            test_assert(u[i]->seqid[k] == ids[i][k]);
+         }
+      }
+      for (int i = 4 ; i < 8 ; i++) {
+         test_assert(u[i] == NULL);
+      }
+
+      gstack_t *useqS = new_gstack();
+      for (int i = 0 ; i < 4 ; i++) push(u[i], &useqS);
+      release_reads(useqS, arena);
+   }
+
+}
+
+
+void
+test_radix_sort
+(void)
+// Test 'radix_sort()'.
+{
+
+   char seq[64];
+   const char *nt = "ACGT";
+   arena_t *arena = new_arena();
+   useq_t *u[1000];
+   useq_t *sorted[1000];
+
+   srand(123);
+   for (int i = 0 ; i < 1000 ; i++) {
+      // Short sequences to have many identical prefixes.
+      int len = 1 + rand() % (i % 2 ? 8 : 40);
+      for (int j = 0 ; j < len ; j++) seq[j] = nt[rand() % 4];
+      seq[len] = '\0';
+      u[i] = arena_useq(arena, 1, seq, NULL);
+   }
+   memcpy(sorted, u, sizeof(u));
+   qsort(sorted, 1000, sizeof(useq_t *), seq_order);
+
+   // Test 'radix_sort()' with 1 to 8 threads.
+   for (int t = 1 ; t < 9 ; t++) {
+      useq_t *to_sort[1000];
+      memcpy(to_sort, u, sizeof(u));
+      radix_sort(to_sort, 1000, t);
+      for (int i = 0 ; i < 1000 ; i++) {
+         test_assert(seq_order(to_sort + i, sorted + i) == 0);
+      }
+   }
+
+   destroy_arena(arena);
+
+}
+
+
+void
+test_steal_plan
+(void)
+// Test 'plan_mt()' and 'next_job()' in work-stealing mode.
+{
+
+   // Seven blocks of four sequences (first nucleotide is the block).
+   gstack_t * useqS = new_gstack();
+   const char nt[4] = "ACGT";
+   char seq[9] = {0};
+   for (int i = 0 ; i < 28 ; i++) {
+      for (int j = 0 ; j < 8 ; j++) seq[j] = nt[(i >> (2*(7-j))) & 3];
+      push(new_useq(1, seq, NULL), &useqS);
+   }
+
+   mtplan_t *mtplan = plan_mt(2, 8, 8, 7, 1, TRIE_ENGINE, useqS);
+   test_assert_critical(mtplan != NULL);
+   test_assert(mtplan->steal);
+   test_assert(mtplan->nchunks == 4);
+   test_assert(mtplan->njobs == 7 + 21*4);
+
+   // Run the plan serially and record which pairs of blocks
+   // are searched (the trie block and the query block).
+   int searched[7][7] = {{0}};
+   mtjob_t job;
+   int idx;
+   int njobs = 0;
+   while ((idx = next_job(mtplan, &job)) >= 0) {
+      test_assert(mtplan->tries[idx].flag == TRIE_BUSY);
+      int qblock = job.queryid - 1;
+      test_assert(job.trieid == idx + 1);
+      test_assert(job.build == (qblock == idx));
+      test_assert(job.start >= mtplan->bounds[qblock]);
+      test_assert(job.end < mtplan->bounds[qblock+1]);
+      searched[idx][qblock] += job.end - job.start + 1;
+      release_trie(mtplan, idx);
+      njobs++;
+   }
+   test_assert(njobs == mtplan->njobs);
+
+   // Every pair of blocks is searched exactly once.
+   for (int i = 0 ; i < 7 ; i++) {
+      test_assert(mtplan->tries[i].flag == TRIE_DONE);
+      test_assert(searched[i][i] == 4);
+      for (int j = i+1 ; j < 7 ; j++) {
+         test_assert(searched[i][j] + searched[j][i] == 4);
+         test_assert(searched[i][j] == 0 || searched[j][i] == 0);
+      }
+   }
+
+   for (int i = 0 ; i < mtplan->ntries ; i++) {
+      destroy_lookup(mtplan->tries[i].jobs->lut);
+      destroy_trie(mtplan->tries[i].jobs->trie, NULL);
+      free(mtplan->tries[i].jobs);
+   }
+   free(mtplan->tries);
+   free(mtplan->queue);
+   free(mtplan->bounds);
+   free(mtplan->unclaimed);
+   free(mtplan->claimed);
+   free(mtplan->mutex);
+   free(mtplan->monitor);
+   free(mtplan);
+
+   for (size_t i = 0 ; i < useqS->nitems ; i++) {
+      destroy_useq(useqS->items[i]);
+   }
+   free(useqS);
+
+}
+
+
+void
+test_merge_edges
+(void)
+{
+
+   useq_t *u[4];
+   for (int i = 0 ; i < 4 ; i++) {
+      u[i] = new_useq(1, "AAAA", NULL);
+   }
+
+   // Two workers with three partitions each.
+   mtplan_t mtplan = {0};
+   mtplan.nworkers = 2;
+   mtplan.nparts = 3;
+   mtplan.edges = calloc(6, sizeof(edgebuf_t));
+   test_assert_critical(mtplan.edges != NULL);
+
+   // Edges to 'u[0]' from both workers.
+   push_edge(0, 1, 1, 3, mtplan.edges);
+   push_edge(0, 2, 2, 3, mtplan.edges + 3);
+   push_edge(0, 3, 1, 3, mtplan.edges);
+   // Edge to 'u[1]' and to 'u[3]'.
+   push_edge(1, 0, 1, 3, mtplan.edges + 3);
+   push_edge(3, 0, 1, 3, mtplan.edges);
+
+   // Edges to the same sequence are in the same partition.
+   int nitems = 0;
+   int part = -1;
+   for (int i = 0 ; i < 6 ; i++) {
+      nitems += mtplan.edges[i].nitems;
+      for (size_t j = 0 ; j < mtplan.edges[i].nitems ; j++) {
+         if (mtplan.edges[i].items[j].to != 0) continue;
+         if (part < 0) part = i % 3;
+         test_assert(i % 3 == part);
+      }
+   }
+   test_assert(nitems == 5);
+
+   gstack_t *useqS = new_gstack();
+   for (int i = 0 ; i < 4 ; i++) {
+      u[i]->node = i;
+      push(u[i], &useqS);
+   }
+
+   graph_t *graph = merge_edges(&mtplan, useqS);
+   test_assert(mtplan.edges == NULL);
+   test_assert_critical(graph != NULL);
+
+   // Edges are added in order of worker and then sorted
+   // by distance.
+   size_t k = first_match(graph, u[0]);
+   test_assert(nmatches(graph, u[0]) == 3);
+   test_assert(graph->nodes[graph->nbr[k]] == u[1]);
+   test_assert(graph->nodes[graph->nbr[k+1]] == u[3]);
+   test_assert(graph->nodes[graph->nbr[k+2]] == u[2]);
+   test_assert(graph->dist[k] == 1);
+   test_assert(graph->dist[k+1] == 1);
+   test_assert(graph->dist[k+2] == 2);
+   test_assert(nmatches(graph, u[1]) == 1);
+   test_assert(nmatches(graph, u[2]) == 0);
+   test_assert(nmatches(graph, u[3]) == 1);
+   test_assert(graph->nbr[first_match(graph, u[3])] == 0);
+
+   destroy_graph(graph);
+   free(useqS);
+   for (int i = 0 ; i < 4 ; i++) {
+      destroy_useq(u[i]);
+   }
+
+}
+
+
+void *
+union_chain
+(
+   void *args
+)
+// Joins the nodes of a chain, in a different order in
+// every thread.
+{
+   uint32_t *forest = ((uint32_t **) args)[0];
+   int part = (int) (intptr_t) ((uint32_t **) args)[1];
+   for (int i = 9999 - part ; i > 0 ; i -= 4) {
+      union_nodes(forest, i, i-1);
+   }
+   return NULL;
+}
+
+
+void
+test_union_find
+(void)
+{
+
+   uint32_t *forest = new_forest(6);
+   test_assert_critical(forest != NULL);
+   union_nodes(forest, 4, 2);
+   union_nodes(forest, 5, 4);
+   union_nodes(forest, 1, 3);
+   // The root is the node with the lowest index.
+   test_assert(find_root(forest, 5) == 2);
+   test_assert(find_root(forest, 4) == 2);
+   test_assert(find_root(forest, 3) == 1);
+   test_assert(find_root(forest, 0) == 0);
+   union_nodes(forest, 5, 3);
+   test_assert(find_root(forest, 4) == 1);
+   test_assert(find_root(forest, 0) == 0);
+   free(forest);
+
+   // Concurrent unions.
+   forest = new_forest(10000);
+   test_assert_critical(forest != NULL);
+   pthread_t threads[4];
+   void *args[4][2];
+   for (int i = 0 ; i < 4 ; i++) {
+      args[i][0] = forest;
+      args[i][1] = (void *) (intptr_t) i;
+      test_assert_critical(pthread_create(threads + i, NULL,
+               union_chain, args[i]) == 0);
+   }
+   for (int i = 0 ; i < 4 ; i++) {
+      pthread_join(threads[i], NULL);
+   }
+   for (int i = 0 ; i < 10000 ; i++) {
+      test_assert(find_root(forest, i) == 0);
+   }
+   free(forest);
+
+}
+
+
+void
+test_compute_clusters
+(void)
+{
+
+   int counts[] = {1, 3, 3, 2, 1};
+   useq_t *u[5];
+   gstack_t *useqS = new_gstack();
+   test_assert_critical(useqS != NULL);
+   for (int i = 0 ; i < 5 ; i++) {
+      u[i] = new_useq(counts[i], "AAAA", NULL);
+      u[i]->node = i;
+      push(u[i], &useqS);
+   }
+
+   // Chain 0-1-2-3 and single 4.
+   mtplan_t mtplan = {0};
+   mtplan.nworkers = 1;
+   mtplan.nparts = 1;
+   mtplan.edges = calloc(1, sizeof(edgebuf_t));
+   test_assert_critical(mtplan.edges != NULL);
+   uint32_t *forest = new_forest(5);
+   test_assert_critical(forest != NULL);
+   for (int i = 0 ; i < 3 ; i++) {
+      push_edge(i, i+1, 1, 1, mtplan.edges);
+      push_edge(i+1, i, 1, 1, mtplan.edges);
+      union_nodes(forest, i, i+1);
+   }
+   graph_t *graph = merge_edges(&mtplan, useqS);
+   test_assert_critical(graph != NULL);
+
+   gstack_t *clusters = compute_clusters(useqS, graph, forest, 2);
+   test_assert_critical(clusters != NULL);
+   test_assert_critical(clusters->nitems == 2);
+   // 'u[1]' and 'u[2]' have the highest count and the
+   // same number of matches, the first is the centroid.
+   gstack_t *cluster = clusters->items[0];
+   test_assert_critical(cluster->nitems == 4);
+   test_assert(cluster->items[0] == u[1]);
+   test_assert(cluster->items[1] == u[0]);
+   test_assert(cluster->items[2] == u[2]);
+   test_assert(cluster->items[3] == u[3]);
+   test_assert(u[1]->count == 9);
+   cluster = clusters->items[1];
+   test_assert(cluster->nitems == 1);
+   test_assert(cluster->items[0] == u[4]);
+   for (int i = 0 ; i < 5 ; i++) {
+      test_assert(u[i]->canonical == u[i]);
+   }
+
+   free(clusters);
+   free(forest);
+   destroy_graph(graph);
+   free(useqS);
+   for (int i = 0 ; i < 5 ; i++) {
+      destroy_useq(u[i]);
+   }
+
+}
+
+
+void
+test_sphere_clustering
+(void)
+{
+
+   // Run the serial and the parallel clustering on two
+   // copies of the same random graph.
+   const int n = 300;
+   useq_t *u[2][300];
+   gstack_t *useqS[2];
+   graph_t *graph[2];
+   for (int c = 0 ; c < 2 ; c++) {
+      srand48(123);
+      useqS[c] = new_gstack();
+      test_assert_critical(useqS[c] != NULL);
+      for (int i = 0 ; i < n ; i++) {
+         char seq[7] = {0};
+         for (int j = 0 ; j < 6 ; j++) seq[j] = "ACGT"[(int)(4 * drand48())];
+         u[c][i] = new_useq(1 + (int)(5 * drand48()), seq, NULL);
+         u[c][i]->node = i;
+         push(u[c][i], useqS + c);
+      }
+      mtplan_t mtplan = {0};
+      mtplan.nworkers = 1;
+      mtplan.nparts = 1;
+      mtplan.edges = calloc(1, sizeof(edgebuf_t));
+      test_assert_critical(mtplan.edges != NULL);
+      for (int i = 0 ; i < n ; i++) {
+         for (int j = i+1 ; j < n ; j++) {
+            if (drand48() < .01) {
+               int d = 1 + (int)(3 * drand48());
+               push_edge(i, j, d, 1, mtplan.edges);
+               push_edge(j, i, d, 1, mtplan.edges);
+            }
+         }
+      }
+      graph[c] = merge_edges(&mtplan, useqS[c]);
+      test_assert_critical(graph[c] != NULL);
+   }
+
+   sphere_clustering(useqS[0], graph[0], 1);
+   sphere_clustering(useqS[1], graph[1], 4);
+
+   int ncentroids = 0;
+   for (int i = 0 ; i < n ; i++) {
+      test_assert_critical(u[0][i]->canonical != NULL);
+      test_assert_critical(u[1][i]->canonical != NULL);
+      test_assert(u[0][i]->canonical->node == u[1][i]->canonical->node);
+      test_assert(u[0][i]->sphere_d == u[1][i]->sphere_d);
+      if (u[0][i]->canonical == u[0][i]) {
+         ncentroids++;
+         test_assert(u[0][i]->sphere_c == u[1][i]->sphere_c);
+      }
+   }
+   // Some spheres have more than one sequence.
+   test_assert(ncentroids > 0 && ncentroids < n);
+
+   for (int c = 0 ; c < 2 ; c++) {
+      destroy_graph(graph[c]);
+      free(useqS[c]);
+      for (int i = 0 ; i < n ; i++) {
+         destroy_useq(u[c][i]);
+      }
+   }
+
+}
+
+
+void *
+run_context
+(
+   void *args
+)
+// Clusters the sequences of a context in a thread.
+{
+   starcode_t *sc = (starcode_t *) args;
+   return (void *) (intptr_t) starcode_run(sc);
+}
+
+
+void
+test_context
+(void)
+{
+
+   // Invalid options.
+   test_assert(new_starcode(9, 0, 1, MP_CLUSTER, 5.0) == NULL);
+   test_assert(new_starcode(2, 0, 0, MP_CLUSTER, 5.0) == NULL);
+   test_assert(new_starcode(2, 0, 1, MP_CLUSTER, 0.5) == NULL);
+
+   // The same clustering in four contexts at the same time,
+   // with different kernels and engines and a different
+   // algorithm for the last one.
+   starcode_t *sc[4];
+   pthread_t threads[4];
+   for (int i = 0 ; i < 4 ; i++) {
+      sc[i] = new_starcode(1, 0, 1 + i % 2,
+            i < 3 ? MP_CLUSTER : COMPONENTS_CLUSTER, 5.0);
+      test_assert_critical(sc[i] != NULL);
+      test_assert(starcode_set_kernel(sc[i], SIMD_KERNEL + 1) == 1);
+      test_assert(starcode_set_kernel(sc[i], i % 3) == 0);
+      test_assert(starcode_set_engine(sc[i], SEED_ENGINE + 1) == 1);
+      test_assert(starcode_set_engine(sc[i], i % 3) == 0);
+      test_assert(starcode_add(sc[i], "GATTACA", 0) == 1);
+      test_assert(starcode_add(sc[i], "GATXACA", 1) == 1);
+      test_assert(starcode_add(sc[i], "", 1) == 1);
+      test_assert(starcode_add(sc[i], "GATTACA", 6) == 0);
+      test_assert(starcode_add(sc[i], "CCCCCCC", 5) == 0);
+      test_assert(starcode_add(sc[i], "GATTACC", 1) == 0);
+      test_assert(starcode_add(sc[i], "GATTACA", 4) == 0);
+      test_assert(starcode_add(sc[i], "CCCCCCG", 1) == 0);
+   }
+   for (int i = 0 ; i < 4 ; i++) {
+      test_assert_critical(
+            pthread_create(threads + i, NULL, run_context, sc[i]) == 0);
+   }
+   for (int i = 0 ; i < 4 ; i++) {
+      void *ret;
+      pthread_join(threads[i], &ret);
+      test_assert(ret == NULL);
+   }
+
+   for (int i = 0 ; i < 4 ; i++) {
+      test_assert(starcode_add(sc[i], "GATTACA", 1) == 1);
+      test_assert(starcode_run(sc[i]) == 1);
+      test_assert(starcode_set_kernel(sc[i], BYTEWISE_KERNEL) == 1);
+      test_assert(starcode_set_engine(sc[i], TRIE_ENGINE) == 1);
+      test_assert(starcode_set_checkpoints(sc[i], NULL, NULL) == 1);
+      test_assert(starcode_run_files(sc[i], stdin, NULL, stdout, NULL,
+               0, 0, 0, DEFAULT_OUTPUT) == 1);
+      starcode_cluster_t cluster;
+      test_assert_critical(starcode_next_cluster(sc[i], &cluster));
+      test_assert(cluster.count == 11);
+      test_assert_critical(cluster.size == 2);
+      test_assert(strcmp(cluster.seqs[0], "GATTACA") == 0);
+      test_assert(strcmp(cluster.seqs[1], "GATTACC") == 0);
+      // The ids are in the order of addition.
+      test_assert_critical(cluster.nids == 3);
+      test_assert(cluster.ids[0] == 1);
+      test_assert(cluster.ids[1] == 3);
+      test_assert(cluster.ids[2] == 4);
+      test_assert_critical(starcode_next_cluster(sc[i], &cluster));
+      test_assert_critical(cluster.size == 2);
+      test_assert(cluster.count == 6);
+      test_assert(strcmp(cluster.seqs[0], "CCCCCCC") == 0);
+      test_assert(strcmp(cluster.seqs[1], "CCCCCCG") == 0);
+      test_assert_critical(cluster.nids == 2);
+      test_assert(cluster.ids[0] == 2);
+      test_assert(cluster.ids[1] == 5);
+      test_assert(!starcode_next_cluster(sc[i], &cluster));
+      destroy_starcode(sc[i]);
+   }
+
+   // An empty context has no cluster.
+   starcode_t *empty = new_starcode(-1, 1, 2, SPHERES_CLUSTER, 1.0);
+   test_assert_critical(empty != NULL);
+   test_assert(starcode_run(empty) == 0);
+   starcode_cluster_t cluster;
+   test_assert(!starcode_next_cluster(empty, &cluster));
+   destroy_starcode(empty);
+
+   // The members of the spheres are in the same order with any
+   // number of threads, the centroid first and then the others
+   // in lexical order.
+   starcode_t *sp[2];
+   sp[0] = new_starcode(2, 0, 1, SPHERES_CLUSTER, 5.0);
+   sp[1] = new_starcode(2, 0, 4, SPHERES_CLUSTER, 5.0);
+   test_assert_critical(sp[0] != NULL && sp[1] != NULL);
+   srand(123);
+   char seq[16] = {0};
+   for (int i = 0 ; i < 2000 ; i++) {
+      for (int j = 0 ; j < 15 ; j++) seq[j] = "ACGT"[rand() % 4];
+      // Only the last 4 bases are random, so the spheres are large.
+      for (int j = 0 ; j < 11 ; j++) seq[j] = "ACGT"[j % 4];
+      int count = 1 + rand() % 5;
+      test_assert(starcode_add(sp[0], seq, count) == 0);
+      test_assert(starcode_add(sp[1], seq, count) == 0);
+   }
+   test_assert(starcode_run(sp[0]) == 0);
+   test_assert(starcode_run(sp[1]) == 0);
+   starcode_cluster_t c[2];
+   size_t nsorted = 0;
+   while (starcode_next_cluster(sp[0], c)) {
+      test_assert_critical(starcode_next_cluster(sp[1], c+1));
+      test_assert(c[0].count == c[1].count);
+      test_assert_critical(c[0].size == c[1].size);
+      for (size_t k = 0 ; k < c[0].size ; k++)
+         test_assert(strcmp(c[0].seqs[k], c[1].seqs[k]) == 0);
+      for (size_t k = 2 ; k < c[0].size ; k++, nsorted++)
+         test_assert(strcmp(c[0].seqs[k-1], c[0].seqs[k]) < 0);
+   }
+   test_assert(!starcode_next_cluster(sp[1], c+1));
+   test_assert(nsorted > 0);
+   destroy_starcode(sp[0]);
+   destroy_starcode(sp[1]);
+
+}
+
+
+void
+test_add_seqs
+(void)
+{
+
+   const char *seqs[] = {
+      "GATTACA", "CCCCCCC", "GATTACC", "GATTACA", "CCCCCCG",
+   };
+   const int counts[] = {6, 5, 1, 4, 1};
+   const int ids[] = {50, 40, 30, 20, 10};
+
+   // Nothing is added if one sequence is not valid.
+   const char *bad[] = {"GATTACA", "GATXACA"};
+   const int zero[] = {1, 0};
+   starcode_t *sc = new_starcode(1, 0, 1, MP_CLUSTER, 5.0);
+   test_assert_critical(sc != NULL);
+   test_assert(starcode_add_seqs(sc, 2, bad, NULL, NULL) == 1);
+   test_assert(starcode_add_seqs(sc, 2, seqs, zero, NULL) == 1);
+   test_assert(starcode_add_seqs(sc, 1, NULL, NULL, NULL) == 1);
+   test_assert(starcode_add_seqs(sc, 0, NULL, NULL, NULL) == 0);
+
+   // Nothing is added if the ids are not positive or unique.
+   const int dup[] = {5, 5};
+   const int neg[] = {1, -1};
+   test_assert(starcode_add_seqs(sc, 2, seqs, NULL, dup) == 1);
+   test_assert(starcode_add_seqs(sc, 2, seqs, NULL, neg) == 1);
+   test_assert(starcode_add_seqs(sc, 2, seqs, NULL, zero) == 1);
+
+   // Same clusters as with 'starcode_add()' (see 'test_context').
+   test_assert(starcode_add_seqs(sc, 5, seqs, counts, ids) == 0);
+   // Ids cannot be reused or mixed with automatic ids.
+   test_assert(starcode_add_seqs(sc, 1, seqs, NULL, ids + 4) == 1);
+   test_assert(starcode_add_seqs(sc, 1, seqs, NULL, NULL) == 1);
+   test_assert(starcode_add(sc, "GATTACA", 1) == 1);
+   test_assert(starcode_run(sc) == 0);
+   test_assert(starcode_add_seqs(sc, 5, seqs, counts, ids) == 1);
+   starcode_cluster_t cluster;
+   test_assert_critical(starcode_next_cluster(sc, &cluster));
+   test_assert(cluster.count == 11);
+   test_assert_critical(cluster.size == 2);
+   test_assert(strcmp(cluster.seqs[0], "GATTACA") == 0);
+   test_assert(strcmp(cluster.seqs[1], "GATTACC") == 0);
+   test_assert_critical(cluster.nids == 3);
+   test_assert(cluster.ids[0] == 20);
+   test_assert(cluster.ids[1] == 30);
+   test_assert(cluster.ids[2] == 50);
+   test_assert_critical(starcode_next_cluster(sc, &cluster));
+   test_assert(cluster.count == 6);
+   test_assert_critical(cluster.nids == 2);
+   test_assert(cluster.ids[0] == 10);
+   test_assert(cluster.ids[1] == 40);
+   test_assert(!starcode_next_cluster(sc, &cluster));
+   destroy_starcode(sc);
+
+   // Without counts, every sequence is one read.
+   sc = new_starcode(1, 0, 1, SPHERES_CLUSTER, 1.0);
+   test_assert_critical(sc != NULL);
+   test_assert(starcode_add_seqs(sc, 5, seqs, NULL, NULL) == 0);
+   test_assert(starcode_add_seqs(sc, 1, seqs, NULL, ids) == 1);
+   test_assert(starcode_run(sc) == 0);
+   test_assert_critical(starcode_next_cluster(sc, &cluster));
+   test_assert(strcmp(cluster.seqs[0], "GATTACA") == 0);
+   test_assert(cluster.count == 3);
+   test_assert_critical(cluster.nids == 3);
+   test_assert(cluster.ids[0] == 1);
+   test_assert(cluster.ids[1] == 3);
+   test_assert(cluster.ids[2] == 4);
+   destroy_starcode(sc);
+
+   // Duplicates are found among many ids.
+   const char *many[200];
+   int manyids[200];
+   for (int i = 0 ; i < 200 ; i++) {
+      many[i] = "GATTACA";
+      manyids[i] = 2*i + 1;
+   }
+   sc = new_starcode(1, 0, 1, MP_CLUSTER, 5.0);
+   test_assert_critical(sc != NULL);
+   test_assert(starcode_add_seqs(sc, 200, many, NULL, manyids) == 0);
+   test_assert(starcode_add_seqs(sc, 1, many, NULL, manyids + 150) == 1);
+   test_assert(starcode_add_seqs(sc, 1, many, counts, ids) == 0);
+   test_assert(starcode_run(sc) == 0);
+   test_assert_critical(starcode_next_cluster(sc, &cluster));
+   test_assert(cluster.count == 206);
+   test_assert_critical(cluster.nids == 201);
+   test_assert(cluster.ids[0] == 1);
+   test_assert(cluster.ids[25] == 50);
+   test_assert(cluster.ids[200] == 399);
+   destroy_starcode(sc);
 
 }
 
@@ -1207,7 +2432,23 @@ const test_case_t test_cases_starcode[] = {
    {"starcode/base/8",     test_starcode_8},
    {"starcode/base/9",     test_starcode_9},
    {"starcode/base/10",    test_starcode_10},
+   {"starcode/scan_rawseq", test_scan_rawseq},
+   {"starcode/scan_chunks", test_scan_chunks},
+   {"starcode/gunzip",     test_gunzip},
+   {"starcode/arena",      test_arena},
+   {"starcode/index",      test_index},
+   {"starcode/reference",  test_reference},
+   {"starcode/checkpoint", test_checkpoint},
    {"starcode/seqsort",    test_seqsort},
+   {"starcode/dedup",      test_dedup},
+   {"starcode/radix_sort", test_radix_sort},
+   {"starcode/steal_plan", test_steal_plan},
+   {"starcode/merge_edges", test_merge_edges},
+   {"starcode/union_find", test_union_find},
+   {"starcode/compute_clusters", test_compute_clusters},
+   {"starcode/sphere_clustering", test_sphere_clustering},
+   {"starcode/context",    test_context},
+   {"starcode/add_seqs",   test_add_seqs},
    {"starcode/tidy_ouput", test_tidy_output},
    {NULL, NULL}
 };
@@ -14,16 +14,29 @@ void reset_gstack(gstack_t **g) {
 char *
 render
 (
-   node_t * node,
-   char   * string
+   trie_t   * trie,
+   uint32_t   node,
+   int        depth,
+   char     * string
 )
 {
    for (int i = 0 ; i < 6 ; i++) {
-      void * child = node->child[i];
-      if (child == NULL) continue;
+      uint32_t child = trie->nodes[node].child[i];
+      if (child == 0) continue;
       *string++ = untranslate[i];
-      if (child == &LEAF_NODE) continue;
-      string = render(node->child[i], string);
+      if (child & TAIL) {
+         tail_t *tail = trie->tails + (child & ~TAIL);
+         for (uint32_t k = 0 ; k < tail->len ; k++) {
+            *string++ = untranslate[(int) trie->labels[tail->label+k]];
+         }
+         if (trie->data[tail->data] != &LEAF_NODE) abort();
+         continue;
+      }
+      if (depth == get_height(trie) - 1) {
+         if (trie->data[child] != &LEAF_NODE) abort();
+         continue;
+      }
+      string = render(trie, child, depth+1, string);
    }
    return string;
 }
@@ -112,7 +125,7 @@ setup
       fprintf(stderr, "unittest error: %s:%d\n", __FILE__, __LINE__);
       abort();
    }
-   render(trie->root, trie_buff);
+   render(trie, 0, 0, trie_buff);
    if (strcmp(trie_rendering, trie_buff) != 0) {
       fprintf(stderr, "unittest error: %s:%d\n", __FILE__, __LINE__);
       abort();
@@ -134,7 +147,7 @@ teardown
    trie_t * trie
 )
 {
-   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   destroy_trie(trie, NULL);
 }
 
 
@@ -146,47 +159,89 @@ test_base_1
 {
 
    const char cache[17] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
-   node_t *node = new_trienode();
+   trie_t *trie = new_trie(20);
    // Check that creation succeeded.
-   test_assert_critical(node != NULL);
-   // Check initialization.
+   test_assert_critical(trie != NULL);
+   test_assert_critical(trie->nodes != NULL);
+   test_assert(trie->nnodes == 1);
+   test_assert(trie->ndata == 1);
+   // Check that the arena is aligned on cache lines.
+   test_assert(sizeof(node_t) == 48);
+   test_assert(((uintptr_t) trie->nodes & 63) == 0);
+   // Check initialization of the root.
+   node_t *node = trie->nodes;
    test_assert(node->path == 0);
    for (int i = 0 ; i < 6 ; i++) {
-      test_assert(node->child[i] == NULL);
+      test_assert(node->child[i] == 0);
    }
    for (int i = 0 ; i < 2*TAU+1 ; i++) {
       test_assert(node->cache[i] == cache[i]);
    }
    
-   free(node);
+   destroy_trie(trie, NULL);
 
 }
 
 void
 test_base_2
 (void)
-// Test 'insert()'.
+// Test tails in 'insert_string()'.
 {
-   node_t *root = new_trienode();
-   test_assert_critical(root != NULL);
-
-   for (unsigned int i = 0 ; i < 6 ; i++) {
-      node_t *node = insert(root, i);
-      test_assert_critical(node != NULL);
-      for (int j = 0 ; j < 6 ; j++) {
-         test_assert(node->child[j] == NULL);
-      }
-      const char cache[17] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
+   trie_t *trie = new_trie(4);
+   test_assert_critical(trie != NULL);
+
+   // A single string is a tail below the root.
+   void **data = insert_string(trie, "AAAA");
+   test_assert_critical(data != NULL);
+   *data = data;
+   test_assert(trie->nnodes == 1);
+   test_assert(trie->nlazy == 3);
+   test_assert(trie->ntails == 1);
+   test_assert(trie->nodes->child[1] == (TAIL | 0));
+   test_assert(trie->tails[0].len == 3);
+   test_assert(memcmp(trie->labels + trie->tails[0].label,
+            "\1\1\1", 3) == 0);
+   test_assert(trie->data[trie->tails[0].data] == data);
+   test_assert(count_nodes(trie) == 5);
+
+   // A second string expands the tail down to where they differ.
+   void **other = insert_string(trie, "AACA");
+   test_assert_critical(other != NULL);
+   test_assert(*other == NULL);
+   *other = other;
+   test_assert(count_nodes(trie) == 7);
+
+   const char cache[17] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
+   const uint32_t paths[3] = {0, 0x1, 0x11};
+   node_t *node = trie->nodes;
+   for (int depth = 0 ; depth < 3 ; depth++) {
+      test_assert(node->path == paths[depth]);
       for (int i = 0 ; i < 2*TAU+1 ; i++) {
          test_assert(node->cache[i] == cache[i]);
       }
-      test_assert(node->path == i);
-      test_assert(root->child[i] == node);
+      if (depth < 2) node = trie->nodes + node->child[1];
    }
+   // Only the nodes "A" and "AA" were created.
+   test_assert(trie->nnodes == 3);
+   test_assert(trie->nlazy == 2);
+
+   test_assert(node->child[1] & TAIL);
+   tail_t *tail = trie->tails + (node->child[1] & ~TAIL);
+   test_assert(tail->len == 1);
+   test_assert(trie->data[tail->data] == data);
 
-   // Destroy manually.
-   for (int i = 0 ; i < 6 ; i++) free(root->child[i]);
-   free(root);
+   test_assert(node->child[2] & TAIL);
+   tail = trie->tails + (node->child[2] & ~TAIL);
+   test_assert(tail->len == 1);
+   test_assert(trie->data[tail->data] == other);
+
+   // Inserting a string again returns the same leaf.
+   test_assert(insert_string(trie, "AAAA") == data);
+   test_assert(trie->nnodes == 4);
+   test_assert(trie->nlazy == 1);
+   test_assert(count_nodes(trie) == 7);
+
+   destroy_trie(trie, NULL);
 
 }
 
@@ -194,40 +249,56 @@ test_base_2
 void
 test_base_3
 (void)
-// Test 'insert_wo_malloc()'.
+// Test expansion of tails in 'search()'.
 {
-   node_t *root = new_trienode();
-   test_assert_critical(root != NULL);
+   trie_t *trie = new_trie(20);
+   test_assert_critical(trie != NULL);
 
-   node_t *nodes = malloc(6 * sizeof(node_t));
-   if (nodes == NULL) {
-      fprintf(stderr, "unittest error: %s:%d\n", __FILE__, __LINE__);
-      exit(EXIT_FAILURE);
-   }
+   void **data = insert_string(trie, "AAAAAAAAAAAAAAAAAAAA");
+   test_assert_critical(data != NULL);
+   *data = data;
+   test_assert(trie->nnodes == 1);
+   test_assert(trie->nlazy == 19);
 
-   for (unsigned int i = 0 ; i < 6 ; i++) {
-      node_t *node = insert_wo_malloc(root, i, nodes+i);
-      test_assert_critical(node != NULL);
-      test_assert(node == nodes+i);
-      for (int j = 0 ; j < 6 ; j++) {
-         test_assert(node->child[j] == NULL);
-      }
-      const char cache[17] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
-      for (int i = 0 ; i < 2*TAU+1 ; i++) {
-         test_assert(node->cache[i] == cache[i]);
-      }
-      test_assert(node->path == i);
-      test_assert(root->child[i] == node);
-   }
+   gstack_t **hits = new_tower(4);
+   test_assert_critical(hits != NULL);
 
-   // Try to overwrite nodes (should not succeed);
-   for (int i = 0 ; i < 6 ; i++) {
-      node_t *node = insert_wo_malloc(root, i, 0x0);
-      test_assert(node == NULL);
+   // Pebbles are seeded down to depth 10, which needs nodes.
+   int err = search(trie, "AAAAAAAAAAAAAAAAAAAT", 3, hits, 0, 10,
+         BYTEWISE_KERNEL);
+   test_assert(err == 0);
+   test_assert(hits[1]->nitems == 1);
+   test_assert(hits[1]->items[0] == data);
+   test_assert(trie->nnodes == 11);
+   test_assert(trie->nlazy == 9);
+   test_assert(count_nodes(trie) == 21);
+   for (int i = 1 ; i <= 10 ; i++) {
+      test_assert(trie->info->pebbles[i]->nitems == 1);
+      test_assert((uintptr_t) trie->info->pebbles[i]->items[0] ==
+            (uintptr_t) i);
    }
 
-   free(root);
-   free(nodes);
+   // Restart from the pebbles, below which the tail is searched.
+   reset_gstack(hits);
+   err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 10, 10, BYTEWISE_KERNEL);
+   test_assert(err == 0);
+   test_assert(hits[0]->nitems == 1);
+   test_assert(hits[0]->items[0] == data);
+   test_assert(trie->nnodes == 11);
+
+   // Check the tail at once with 'dash()'.
+   reset_gstack(hits);
+   err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 0, hits, 10, 10, BYTEWISE_KERNEL);
+   test_assert(err == 0);
+   test_assert(hits[0]->nitems == 1);
+
+   reset_gstack(hits);
+   err = search(trie, "AAAAAAAAAAAAAAAAAAAC", 0, hits, 10, 10, BYTEWISE_KERNEL);
+   test_assert(err == 0);
+   test_assert(hits[0]->nitems == 0);
+
+   destroy_tower(hits);
+   destroy_trie(trie, NULL);
 
 }
 
@@ -243,14 +314,15 @@ test_base_4
    for (int height = 1 ; height < M ; height++) {
       trie_t *trie = new_trie(height);
       test_assert_critical(trie != NULL);
-      test_assert_critical(trie->root != NULL);
+      test_assert_critical(trie->nodes != NULL);
       test_assert_critical(trie->info != NULL);
 
       test_assert(get_height(trie) == height);
 
       // Make sure that 'info' is initialized properly.
       info_t *info = trie->info;
-      test_assert(((node_t*) *info->pebbles[0]->items) == trie->root);
+      test_assert(info->pebbles[0]->nitems == 1);
+      test_assert(*info->pebbles[0]->items == (void *) 0);
       for (int i = 1 ; i < M ; i++) {
          test_assert_critical(info->pebbles[i]->items != NULL);
       }
@@ -265,44 +337,39 @@ test_base_4
          test_assert(data != NULL);
          *data = data;
       }
-      destroy_trie(trie, DESTROY_NODES_YES, NULL);
+      destroy_trie(trie, NULL);
       trie = NULL;
    }
 
    for (int height = 1 ; height < M ; height++) {
       trie_t *trie = new_trie(height);
       test_assert_critical(trie != NULL);
-      test_assert_critical(trie->root != NULL);
+      test_assert_critical(trie->nodes != NULL);
       test_assert_critical(trie->info != NULL);
 
       test_assert(get_height(trie) == height);
 
       // Make sure that 'info' is initialized properly.
       info_t *info = trie->info;
-      test_assert(((node_t*) *info->pebbles[0]->items) == trie->root);
+      test_assert(info->pebbles[0]->nitems == 1);
+      test_assert(*info->pebbles[0]->items == (void *) 0);
       for (int i = 1 ; i < M ; i++) {
          test_assert_critical(info->pebbles[i]->items != NULL);
       }
 
       // Insert 20 random sequences without malloc.
-      node_t *nodes = malloc(20*height * sizeof(node_t));
-      if (nodes == NULL) {
-         fprintf(stderr, "unittest error: %s:%d", __FILE__, __LINE__);
-         exit(EXIT_FAILURE);
-      }
+      test_assert_critical(reserve_trie(trie, 20*height, 20) == 0);
 
-      node_t *pos = nodes;
       for (int i = 0 ; i < 20 ; i++) {
          char seq[M] = {0};
          for (int j = 0 ; j < height ; j++) {
             seq[j] = untranslate[(int)(5 * drand48())];
          }
-         void **data = insert_string_wo_malloc(trie, seq, &pos);
+         void **data = insert_string_wo_malloc(trie, seq);
          test_assert(data != NULL);
          *data = data;
       }
-      destroy_trie(trie, DESTROY_NODES_NO, NULL);
-      free(nodes);
+      destroy_trie(trie, NULL);
       trie = NULL;
    }
    
@@ -322,7 +389,7 @@ test_base_5
    *data = data;
    test_assert(21 == count_nodes(trie));
 
-   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   destroy_trie(trie, NULL);
 
 }
 
@@ -335,19 +402,24 @@ test_base_6
    trie_t *trie = new_trie(20);
    test_assert_critical(trie != NULL);
 
-   node_t *nodes = malloc(19 * sizeof(node_t));
-   if (nodes == NULL) {
-      fprintf(stderr, "unittest error (%s:%d)\n", __FILE__, __LINE__);
-      exit(EXIT_FAILURE);
-   }
-   node_t *pos = nodes;
+   test_assert_critical(reserve_trie(trie, 19, 1) == 0);
    void **data = 
-      insert_string_wo_malloc(trie, "AAAAAAAAAAAAAAAAAAAA", &pos);
+      insert_string_wo_malloc(trie, "AAAAAAAAAAAAAAAAAAAA");
    test_assert(data != NULL);
    *data = data;
    test_assert(21 == count_nodes(trie));
-   // Check that the pointer has been incremented by 19 positions.
-   test_assert(19 == (pos - nodes));
+   // Check that a tail of 19 nodes and 1 leaf have been used.
+   test_assert(1 == trie->nnodes);
+   test_assert(19 == trie->nlazy);
+   test_assert(2 == trie->ndata);
+   test_assert(data == trie->data + 1);
+
+   // Inserting the string again expands the tail into nodes.
+   test_assert(data ==
+         insert_string_wo_malloc(trie, "AAAAAAAAAAAAAAAAAAAA"));
+   test_assert(20 == trie->nnodes);
+   test_assert(0 == trie->nlazy);
+   test_assert(21 == count_nodes(trie));
 
    // Cache at initialization.
    const char cache[17] = {8,7,6,5,4,3,2,1,0,1,2,3,4,5,6,7,8};
@@ -358,24 +430,31 @@ test_base_6
       286331153 };
 
    // Check the integrity of the nodes.
-   node_t *node = trie->root;
+   node_t *node = trie->nodes;
    for (int i = 0 ; i < 20 ; i++) {
-      test_assert_critical(node != NULL);
       test_assert(node->cache != NULL);
       test_assert(node->path == paths[i]);
-      test_assert(node->child[0] == NULL);
-      test_assert(node->child[1] != NULL);
+      test_assert(node->child[0] == 0);
+      test_assert(node->child[1] != 0);
       for (int j = 2 ; j < 6 ; j++) {
-         test_assert(node->child[j] == NULL);
+         test_assert(node->child[j] == 0);
       }
       for (int j = 0 ; j < 2*TAU+1 ; j++) {
          test_assert(node->cache[j] == cache[j]);
       }
-      node = node->child[1];
+      if (i < 19) node = trie->nodes + node->child[1];
    }
+   test_assert(node->child[1] == 1);
 
-   destroy_trie(trie, DESTROY_NODES_NO, NULL);
-   free(nodes);
+   // The room is used up (should not succeed).
+   redirect_stderr();
+   data = insert_string_wo_malloc(trie, "TAAAAAAAAAAAAAAAAAAA");
+   unredirect_stderr();
+   test_assert(data == NULL);
+   test_assert(check_trie_error_and_reset() > 0);
+   test_assert_stderr("error: no room left in trie\n");
+
+   destroy_trie(trie, NULL);
 
 }
 
@@ -391,13 +470,12 @@ test_base_7
    test_assert(gstack->nslots == GSTACK_INIT_SIZE);
    test_assert(gstack->nitems == 0);
 
-   node_t *node = new_trienode();
-   push(node, &gstack);
-   test_assert(node == (node_t *) gstack->items[0]);
+   int item;
+   push(&item, &gstack);
+   test_assert(&item == gstack->items[0]);
    test_assert(gstack->nslots == GSTACK_INIT_SIZE);
    test_assert(gstack->nitems == 1);
 
-   free(node);
    free(gstack);
    
 }
@@ -455,9 +533,8 @@ test_errmsg
    test_assert_stderr(string);
 
    // Check error messages in 'insert_string_wo_malloc()'.
-   node_t * dummy;
    redirect_stderr();
-   not_inserted = insert_string_wo_malloc(trie, too_long_string, &dummy);
+   not_inserted = insert_string_wo_malloc(trie, too_long_string);
    unredirect_stderr();
    test_assert(not_inserted == NULL);
    test_assert_stderr(string);
@@ -467,7 +544,7 @@ test_errmsg
    test_assert_critical(hits != NULL);
 
    redirect_stderr();
-   err = search(trie, "AAAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 0);
+   err = search(trie, "AAAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 0, BYTEWISE_KERNEL);
    unredirect_stderr();
    test_assert(err > 0);
    test_assert_stderr("error: query longer than allowed max\n");
@@ -478,7 +555,7 @@ test_errmsg
 
    reset_gstack(hits);
    redirect_stderr();
-   err = search(trie, " TGCTAGGGTACTCGATAAC", 9, hits, 0, 0);
+   err = search(trie, " TGCTAGGGTACTCGATAAC", 9, hits, 0, 0, BYTEWISE_KERNEL);
    unredirect_stderr();
    test_assert(err > 0);
    test_assert_stderr("error: requested tau greater than 8\n");
@@ -497,14 +574,17 @@ test_errmsg
    test_assert(check_trie_error_and_reset() >  0);
    test_assert_stderr("error: could not create trie\n");
 
+   trie_t *trie_full = new_trie(20);
+   test_assert_critical(trie_full != NULL);
    redirect_stderr();
    set_alloc_failure_rate_to(1);
-   node_t *trienode_fail = new_trienode();
+   err = reserve_trie(trie_full, 0, 1000);
    reset_alloc();
    unredirect_stderr();
-   test_assert(trienode_fail == NULL);
+   test_assert(err > 0);
    test_assert(check_trie_error_and_reset() >  0);
-   test_assert_stderr("error: could not create trie node\n");
+   test_assert_stderr("error: could not allocate trie leaves\n");
+   destroy_trie(trie_full, NULL);
 
    redirect_stderr();
    set_alloc_failure_rate_to(1);
@@ -543,7 +623,7 @@ test_search
 
    // The first series of test has been worked out manually. //
    
-   err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 18);
+   err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 18, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -552,7 +632,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAAAAAAAAAATA", 3, hits, 18, 3);
+   search(trie, "AAAAAAAAAAAAAAAAAATA", 3, hits, 18, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -561,7 +641,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "AAAGAAAAAAAAAAAAAATA", 3, hits, 3, 15);
+   search(trie, "AAAGAAAAAAAAAAAAAATA", 3, hits, 3, 15, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -570,7 +650,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, "AAAGAAAAAAAAAAAGACTG", 3, hits, 15, 15);
+   search(trie, "AAAGAAAAAAAAAAAGACTG", 3, hits, 15, 15, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -579,7 +659,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "AAAGAAAAAAAAAAAAAAAA", 3, hits, 15, 0);
+   search(trie, "AAAGAAAAAAAAAAAAAAAA", 3, hits, 15, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -588,7 +668,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 19);
+   search(trie, "TAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 19, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -597,7 +677,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "TAAAAAAAAAAAAAAAAAAG", 3, hits, 19, 0);
+   search(trie, "TAAAAAAAAAAAAAAAAAAG", 3, hits, 19, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -606,7 +686,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAAAAAAAAAAAAAAAAAA", 3, hits, 0, 1);
+   search(trie, " AAAAAAAAAAAAAAAAAAA", 3, hits, 0, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -615,7 +695,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "   ATGCTAGGGTACTCGAT", 3, hits, 0, 1);
+   search(trie, "   ATGCTAGGGTACTCGAT", 3, hits, 0, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -624,7 +704,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAAAAAAAAAAAAAAAAAT", 3, hits, 1, 0);
+   search(trie, " AAAAAAAAAAAAAAAAAAT", 3, hits, 1, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -633,7 +713,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "ATGCTAGGGTACTCGATAAC", 0, hits, 0, 0);
+   search(trie, "ATGCTAGGGTACTCGATAAC", 0, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -642,7 +722,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " TGCTAGGGTACTCGATAAC", 1, hits, 0, 0);
+   search(trie, " TGCTAGGGTACTCGATAAC", 1, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -651,7 +731,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "NAAAAAAAAAAAAAAAAAAN", 2, hits, 0, 1);
+   search(trie, "NAAAAAAAAAAAAAAAAAAN", 2, hits, 0, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -660,7 +740,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "NNAAAAAAAAAAAAAAAANN", 3, hits, 1, 0);
+   search(trie, "NNAAAAAAAAAAAAAAAANN", 3, hits, 1, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -669,7 +749,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAANAAAAAAAAA", 0, hits, 0, 0);
+   search(trie, "AAAAAAAAAANAAAAAAAAA", 0, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -678,7 +758,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "NNNAGACTTTTCCAGGGTAT", 3, hits, 0, 0);
+   search(trie, "NNNAGACTTTTCCAGGGTAT", 3, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -687,7 +767,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "GGGAGACTTTTCCAGGGNNN", 3, hits, 0, 0);
+   search(trie, "GGGAGACTTTTCCAGGGNNN", 3, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -696,7 +776,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "   GGGAGACTTTTCCAGGG", 3, hits, 0, 3);
+   search(trie, "   GGGAGACTTTTCCAGGG", 3, hits, 0, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -705,7 +785,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "   AGACTTTTCCAGGGTAT", 3, hits, 3, 3);
+   search(trie, "   AGACTTTTCCAGGGTAT", 3, hits, 3, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -714,7 +794,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "                   N", 1, hits, 3, 19);
+   search(trie, "                   N", 1, hits, 3, 19, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -723,7 +803,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "                    ", 1, hits, 19, 0);
+   search(trie, "                    ", 1, hits, 19, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -734,7 +814,7 @@ test_search
    // Caution here: the hit is present but the initial
    // search conditions are wrong.
    reset_gstack(hits);
-   search(trie, "ATGCTAGGGTACTCGATAAC", 0, hits, 20, 1);
+   search(trie, "ATGCTAGGGTACTCGATAAC", 0, hits, 20, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -744,7 +824,7 @@ test_search
 
    // Repeat first test cases.
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 18);
+   search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 18, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -753,7 +833,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAAAAAAAAAATA", 3, hits, 18, 18);
+   search(trie, "AAAAAAAAAAAAAAAAAATA", 3, hits, 18, 18, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -762,7 +842,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "GGGAGAC----CCAGGGTAT", 3, hits, 0, 0);
+   search(trie, "GGGAGAC----CCAGGGTAT", 3, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 1);
@@ -771,7 +851,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "GGGATTT----GCAGGGTAT", 3, hits, 0, 0);
+   search(trie, "GGGATTT----GCAGGGTAT", 3, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -782,7 +862,7 @@ test_search
    // The tests below were randomly generated by a Python script. //
 
    reset_gstack(hits);
-   search(trie, "             CAAAAAT", 3, hits, 0, 12);
+   search(trie, "             CAAAAAT", 3, hits, 0, 12, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -791,7 +871,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "            AAAAGATA", 3, hits, 12, 14);
+   search(trie, "            AAAAGATA", 3, hits, 12, 14, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -800,7 +880,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "            AAGAAACC", 3, hits, 14, 13);
+   search(trie, "            AAGAAACC", 3, hits, 14, 13, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -809,7 +889,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "            ATAANTAA", 3, hits, 13, 12);
+   search(trie, "            ATAANTAA", 3, hits, 13, 12, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -818,7 +898,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "            TCAANAAA", 3, hits, 12, 3);
+   search(trie, "            TCAANAAA", 3, hits, 12, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -827,7 +907,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "   AAAAAAAAAAAAAAAGA", 3, hits, 3, 16);
+   search(trie, "   AAAAAAAAAAAAAAAGA", 3, hits, 3, 16, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -836,7 +916,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "   AAAAAAAAAAAAANAAA", 3, hits, 16, 3);
+   search(trie, "   AAAAAAAAAAAAANAAA", 3, hits, 16, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -845,7 +925,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "   GGATTCAAGGTTACTAG", 3, hits, 3, 2);
+   search(trie, "   GGATTCAAGGTTACTAG", 3, hits, 3, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -854,7 +934,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "  AAAAAAAAAAAAAAACAA", 3, hits, 2, 13);
+   search(trie, "  AAAAAAAAAAAAAAACAA", 3, hits, 2, 13, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -863,7 +943,7 @@ test_search
    test_assert(hits[3]->nitems == 5);
 
    reset_gstack(hits);
-   search(trie, "  AAAAAAAAAAANAAAAAT", 3, hits, 13, 5);
+   search(trie, "  AAAAAAAAAAANAAAAAT", 3, hits, 13, 5, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -872,7 +952,7 @@ test_search
    test_assert(hits[3]->nitems == 2);
 
    reset_gstack(hits);
-   search(trie, "  AAATAAAANAAAAAAAAA", 3, hits, 5, 2);
+   search(trie, "  AAATAAAANAAAAAAAAA", 3, hits, 5, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -881,7 +961,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "  GGANTCAAGGGTTACTAG", 3, hits, 2, 5);
+   search(trie, "  GGANTCAAGGGTTACTAG", 3, hits, 2, 5, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -890,7 +970,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "  GGATTAGATCCCGCTTTG", 3, hits, 5, 2);
+   search(trie, "  GGATTAGATCCCGCTTTG", 3, hits, 5, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -899,7 +979,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "  TGNGATGAGAAGAAGACC", 3, hits, 2, 3);
+   search(trie, "  TGNGATGAGAAGAAGACC", 3, hits, 2, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -908,7 +988,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "  TTCGGGCGACNATATAGG", 3, hits, 3, 1);
+   search(trie, "  TTCGGGCGACNATATAGG", 3, hits, 3, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -917,7 +997,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAAAANATAANAAAAAAAA", 3, hits, 1, 5);
+   search(trie, " AAAAANATAANAAAAAAAA", 3, hits, 1, 5, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -926,7 +1006,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAAATAAAAAAAAACAAAA", 3, hits, 5, 15);
+   search(trie, " AAAATAAAAAAAAACAAAA", 3, hits, 5, 15, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -935,7 +1015,7 @@ test_search
    test_assert(hits[3]->nitems == 4);
 
    reset_gstack(hits);
-   search(trie, " AAAATAAAAAAAAATAAAA", 3, hits, 15, 4);
+   search(trie, " AAAATAAAAAAAAATAAAA", 3, hits, 15, 4, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -944,7 +1024,7 @@ test_search
    test_assert(hits[3]->nitems == 4);
 
    reset_gstack(hits);
-   search(trie, " AAACAAAAANAAAAAAGAA", 3, hits, 4, 4);
+   search(trie, " AAACAAAAANAAAAAAGAA", 3, hits, 4, 4, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -953,7 +1033,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAATAAAAANAAAAAAANA", 3, hits, 4, 3);
+   search(trie, " AAATAAAAANAAAAAAANA", 3, hits, 4, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -962,7 +1042,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " AAGCTAGGGTACTCGATGC", 3, hits, 3, 2);
+   search(trie, " AAGCTAGGGTACTCGATGC", 3, hits, 3, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -971,7 +1051,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " ANAAAAAAAAAAAGAAANA", 3, hits, 2, 2);
+   search(trie, " ANAAAAAAAAAAAGAAANA", 3, hits, 2, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -980,7 +1060,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " ATGCTAGGGACTCTATAAC", 3, hits, 2, 1);
+   search(trie, " ATGCTAGGGACTCTATAAC", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -989,7 +1069,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " CAACAAAAAAAAAAAAAAN", 3, hits, 1, 6);
+   search(trie, " CAACAAAAAAAAAAAAAAN", 3, hits, 1, 6, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -998,7 +1078,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " CAACAGTCTTCGACTAANG", 3, hits, 6, 1);
+   search(trie, " CAACAGTCTTCGACTAANG", 3, hits, 6, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1007,7 +1087,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " GAAAAGAAAAAAAAAAAAA", 3, hits, 1, 2);
+   search(trie, " GAAAAGAAAAAAAAAAAAA", 3, hits, 1, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1016,7 +1096,7 @@ test_search
    test_assert(hits[3]->nitems == 5);
 
    reset_gstack(hits);
-   search(trie, " GGAGACTTCTCCAGGGTAG", 3, hits, 2, 3);
+   search(trie, " GGAGACTTCTCCAGGGTAG", 3, hits, 2, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1025,7 +1105,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " GGGGATCATGGGTTACTAG", 3, hits, 3, 2);
+   search(trie, " GGGGATCATGGGTTACTAG", 3, hits, 3, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1034,7 +1114,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " GTGCTAGGTACTCGATAAC", 3, hits, 2, 1);
+   search(trie, " GTGCTAGGTACTCGATAAC", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1043,7 +1123,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " NCATTGTATAGCCCGTAAC", 3, hits, 1, 1);
+   search(trie, " NCATTGTATAGCCCGTAAC", 3, hits, 1, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1052,7 +1132,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " TAAGAAAAAAAAAAAAAAT", 3, hits, 1, 2);
+   search(trie, " TAAGAAAAAAAAAAAAAAT", 3, hits, 1, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1061,7 +1141,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, " TCATTATTATAGCTCGTAC", 3, hits, 2, 6);
+   search(trie, " TCATTATTATAGCTCGTAC", 3, hits, 2, 6, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1070,7 +1150,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " TCATTGTGATGCTCGTATC", 3, hits, 6, 2);
+   search(trie, " TCATTGTGATGCTCGTATC", 3, hits, 6, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1079,7 +1159,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " TGATATAAAGGGTTTCTAG", 3, hits, 2, 2);
+   search(trie, " TGATATAAAGGGTTTCTAG", 3, hits, 2, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1088,7 +1168,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " TTGCTAGGGTACTCGATAC", 3, hits, 2, 9);
+   search(trie, " TTGCTAGGGTACTCGATAC", 3, hits, 2, 9, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1097,7 +1177,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " TTGCTAGGTANTCGATAAC", 3, hits, 9, 4);
+   search(trie, " TTGCTAGGTANTCGATAAC", 3, hits, 9, 4, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1106,7 +1186,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, " TTGTATATGTCNTAGAAAT", 3, hits, 4, 3);
+   search(trie, " TTGTATATGTCNTAGAAAT", 3, hits, 4, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1115,7 +1195,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, " TTTGTATGTGTCATAGAAA", 3, hits, 3, 0);
+   search(trie, " TTTGTATGTGTCATAGAAA", 3, hits, 3, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1124,7 +1204,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAAGGAAANAAAT", 3, hits, 0, 10);
+   search(trie, "AAAAAAAAAAGGAAANAAAT", 3, hits, 0, 10, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1133,7 +1213,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAANAAAATAAAA", 3, hits, 10, 9);
+   search(trie, "AAAAAAAAAANAAAATAAAA", 3, hits, 10, 9, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1142,7 +1222,7 @@ test_search
    test_assert(hits[3]->nitems == 2);
 
    reset_gstack(hits);
-   search(trie, "AAAAAAAAAGAACAAACAAA", 3, hits, 9, 5);
+   search(trie, "AAAAAAAAAGAACAAACAAA", 3, hits, 9, 5, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1151,7 +1231,7 @@ test_search
    test_assert(hits[3]->nitems == 2);
 
    reset_gstack(hits);
-   search(trie, "AAAAATANAAAAAAAAAAAT", 3, hits, 5, 4);
+   search(trie, "AAAAATANAAAAAAAAAAAT", 3, hits, 5, 4, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1160,7 +1240,7 @@ test_search
    test_assert(hits[3]->nitems == 2);
 
    reset_gstack(hits);
-   search(trie, "AAAACAAAAAACACAAAAAA", 3, hits, 4, 3);
+   search(trie, "AAAACAAAAAACACAAAAAA", 3, hits, 4, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1169,7 +1249,7 @@ test_search
    test_assert(hits[3]->nitems == 2);
 
    reset_gstack(hits);
-   search(trie, "AAAGNAAAAANAAAAAAAAA", 3, hits, 3, 3);
+   search(trie, "AAAGNAAAAANAAAAAAAAA", 3, hits, 3, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1178,7 +1258,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, "AAANAACAAAAAAAAAAAAA", 3, hits, 3, 3);
+   search(trie, "AAANAACAAAAAAAAAAAAA", 3, hits, 3, 3, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1187,7 +1267,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, "AAATAAAAAAAAGAAAAAAA", 3, hits, 3, 2);
+   search(trie, "AAATAAAAAAAAGAAAAAAA", 3, hits, 3, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1196,7 +1276,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, "AACCAAAAAAAAAAANAAAT", 3, hits, 2, 2);
+   search(trie, "AACCAAAAAAAAAAANAAAT", 3, hits, 2, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1205,7 +1285,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "AAGANAAAAANAAAAAAAAA", 3, hits, 2, 1);
+   search(trie, "AAGANAAAAANAAAAAAAAA", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1214,7 +1294,7 @@ test_search
    test_assert(hits[3]->nitems == 3);
 
    reset_gstack(hits);
-   search(trie, "ATGCTAGGGTACTCGATAAN", 3, hits, 1, 6);
+   search(trie, "ATGCTAGGGTACTCGATAAN", 3, hits, 1, 6, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1223,7 +1303,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "ATGCTANGATAGTCGATAAC", 3, hits, 6, 0);
+   search(trie, "ATGCTANGATAGTCGATAAC", 3, hits, 6, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1232,7 +1312,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "CANACAGTATACGACTANGG", 3, hits, 0, 2);
+   search(trie, "CANACAGTATACGACTANGG", 3, hits, 0, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1241,7 +1321,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "CATACAGTATACGCCTAAGA", 3, hits, 2, 1);
+   search(trie, "CATACAGTATACGCCTAAGA", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1250,7 +1330,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "CGAGGCGTAGAGTATTTCGA", 3, hits, 1, 8);
+   search(trie, "CGAGGCGTAGAGTATTTCGA", 3, hits, 1, 8, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1259,7 +1339,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "CGAGGCGTTCAGTGTTTGCA", 3, hits, 8, 0);
+   search(trie, "CGAGGCGTTCAGTGTTTGCA", 3, hits, 8, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1268,7 +1348,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "GGATTAGTTCACCGCTATCG", 3, hits, 0, 0);
+   search(trie, "GGATTAGTTCACCGCTATCG", 3, hits, 0, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1277,7 +1357,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "TAAAAAAANAAAAACACAAA", 3, hits, 0, 2);
+   search(trie, "TAAAAAAANAAAAACACAAA", 3, hits, 0, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1286,7 +1366,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TAGAAAAAAAANAAAAAAAG", 3, hits, 2, 2);
+   search(trie, "TAGAAAAAAAANAAAAAAAG", 3, hits, 2, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1295,7 +1375,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TANTTGCGATAGCTCGTAAC", 3, hits, 2, 2);
+   search(trie, "TANTTGCGATAGCTCGTAAC", 3, hits, 2, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1304,7 +1384,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TATAAAAAAAAAAAANCAAA", 3, hits, 2, 1);
+   search(trie, "TATAAAAAAAAAAAANCAAA", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1313,7 +1393,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TCATTGTGATAGCANGTAGC", 3, hits, 1, 1);
+   search(trie, "TCATTGTGATAGCANGTAGC", 3, hits, 1, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1322,7 +1402,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TNCGNAGCGACTAATATGGG", 3, hits, 1, 2);
+   search(trie, "TNCGNAGCGACTAATATGGG", 3, hits, 1, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1331,7 +1411,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TNGAGATGATGGAGAANACC", 3, hits, 2, 1);
+   search(trie, "TNGAGATGATGGAGAANACC", 3, hits, 2, 1, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1340,7 +1420,7 @@ test_search
    test_assert(hits[3]->nitems == 1);
 
    reset_gstack(hits);
-   search(trie, "TTCTGANCGACTAATATAGG", 3, hits, 1, 2);
+   search(trie, "TTCTGANCGACTAATATAGG", 3, hits, 1, 2, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1349,7 +1429,7 @@ test_search
    test_assert(hits[3]->nitems == 0);
 
    reset_gstack(hits);
-   search(trie, "TTGGTNTTTGTCATAGAAAT", 3, hits, 2, 0);
+   search(trie, "TTGGTNTTTGTCATAGAAAT", 3, hits, 2, 0, BYTEWISE_KERNEL);
    test_assert(err == 0);
    test_assert(check_trie_error_and_reset() == 0);
    test_assert(hits[0]->nitems == 0);
@@ -1365,6 +1445,523 @@ test_search
 }
 
 
+void
+test_kernel
+(void)
+{
+
+   // The bit-parallel and the SIMD kernels must give the same hits
+   // in the same order as the bytewise kernel, and leave the same
+   // values in the caches of the nodes. The same searches are run
+   // with each kernel on identical tries of padded random sequences.
+   const kernel_t kernels[3] =
+      {BYTEWISE_KERNEL, BITPARALLEL_KERNEL, SIMD_KERNEL};
+
+   srand48(123);
+   const char *alphabet = "AAACCCGGGTTTN";
+   char seqs[300][21];
+
+   for (int i = 0 ; i < 300 ; i++) {
+      int len = 12 + (int)(9 * drand48());
+      memset(seqs[i], ' ', 20);
+      for (int j = 20-len ; j < 20 ; j++) {
+         seqs[i][j] = alphabet[(int)(12 * drand48())];
+      }
+      seqs[i][20] = '\0';
+   }
+
+   for (int tau = 1 ; tau <= TAU ; tau++) {
+      trie_t *trie[3];
+      gstack_t **hits[3];
+      for (int k = 0 ; k < 3 ; k++) {
+         trie[k] = new_trie(20);
+         test_assert_critical(trie[k] != NULL);
+         hits[k] = new_tower(tau+1);
+         test_assert_critical(hits[k] != NULL);
+         for (int i = 0 ; i < 300 ; i++) {
+            void **data = insert_string(trie[k], seqs[i]);
+            test_assert_critical(data != NULL);
+            *data = (void *) (uintptr_t) (i+1);
+         }
+      }
+
+      // Queries are mutated sequences of the trie, searched
+      // from the prefix shared with the previous query.
+      char prev[21] = {0};
+      int seed = 0;
+      for (int q = 0 ; q < 200 ; q++) {
+         char query[21];
+         strcpy(query, seqs[(int)(300 * drand48())]);
+         for (int j = 0 ; j < tau ; j++) {
+            int pos = (int)(20 * drand48());
+            if (query[pos] != ' ') query[pos] = alphabet[(int)(13*drand48())];
+         }
+         int start = 0;
+         while (start < seed && query[start] == prev[start]) start++;
+         seed = (int)(21 * drand48());
+         strcpy(prev, query);
+
+         for (int k = 0 ; k < 3 ; k++) {
+            reset_gstack(hits[k]);
+            int err = search(trie[k], query, tau, hits[k], start, seed,
+                  kernels[k]);
+            test_assert(err == 0);
+         }
+
+         for (int k = 1 ; k < 3 ; k++) {
+            for (int d = 0 ; d <= tau ; d++) {
+               test_assert(hits[0][d]->nitems == hits[k][d]->nitems);
+               if (hits[0][d]->nitems != hits[k][d]->nitems) continue;
+               test_assert(memcmp(hits[0][d]->items, hits[k][d]->items,
+                        hits[0][d]->nitems * sizeof(void *)) == 0);
+            }
+            test_assert(trie[0]->nnodes == trie[k]->nnodes);
+            for (uint32_t i = 0 ; i < trie[0]->nnodes ; i++) {
+               node_t *node[2] = {trie[0]->nodes + i, trie[k]->nodes + i};
+               test_assert(memcmp(node[0]->child, node[1]->child,
+                        sizeof(node[0]->child)) == 0);
+               test_assert(memcmp(node[0]->cache, node[1]->cache,
+                        sizeof(node[0]->cache)) == 0);
+            }
+         }
+      }
+
+      for (int k = 0 ; k < 3 ; k++) {
+         destroy_trie(trie[k], NULL);
+         destroy_tower(hits[k]);
+      }
+   }
+
+}
+
+
+void
+test_simd
+(void)
+{
+
+   // All the versions of the SIMD kernel must compute the same arms
+   // as the portable version, whichever is chosen at run time. The
+   // caches and the query are random but with the values that the
+   // search can produce.
+
+   srand48(123);
+   arms_t versions[3] = {horizontal_arms, horizontal_arms, horizontal_arms};
+   int nversions = 1;
+#ifdef X86_SIMD
+   if (__builtin_cpu_supports("sse4.1")) {
+      versions[nversions++] = horizontal_arms_sse4;
+   }
+   if (__builtin_cpu_supports("avx2")) {
+      versions[nversions++] = horizontal_arms_avx2;
+   }
+#endif
+   test_assert(simd_arms() == versions[nversions-1]);
+
+   for (int iter = 0 ; iter < 10000 ; iter++) {
+      char parent[2*TAU+1];
+      char qbytes[2*TAU];
+      for (int j = 0 ; j < 2*TAU+1 ; j++) {
+         parent[j] = (char)(12 * drand48());
+      }
+      for (int j = 0 ; j < 2*TAU ; j++) {
+         qbytes[j] = (char)(8 * drand48()) - 1;
+      }
+      int maxa = 1 + (int)(TAU * drand48());
+      int pad = drand48() < .2;
+
+      uint64_t arms[3][8];
+      for (int v = 0 ; v < nversions ; v++) {
+         versions[v](parent + TAU, qbytes + TAU, maxa, pad, arms[v]);
+      }
+      for (int v = 1 ; v < nversions ; v++) {
+         test_assert(memcmp(arms[0], arms[v], 6 * sizeof(uint64_t)) == 0);
+      }
+   }
+
+}
+
+
+void
+test_hamming
+(void)
+{
+
+   // The hits of 'search_hamming()' must be the sequences of the
+   // same length as the query within the Hamming distance, which
+   // are found here by brute force. 'N' matches nothing.
+
+   srand48(123);
+   const char *alphabet = "AAACCCGGGTTTN";
+   char seqs[300][13];
+
+   for (int i = 0 ; i < 300 ; i++) {
+      int len = 10 + (int)(3 * drand48());
+      memset(seqs[i], ' ', 12);
+      for (int j = 12-len ; j < 12 ; j++) {
+         seqs[i][j] = alphabet[(int)(12 * drand48())];
+      }
+      seqs[i][12] = '\0';
+      // No duplicates.
+      for (int k = 0 ; k < i ; k++) {
+         if (strcmp(seqs[i], seqs[k]) == 0) i--;
+      }
+   }
+
+   for (int tau = 0 ; tau <= 4 ; tau++) {
+      trie_t *trie = new_trie(12);
+      test_assert_critical(trie != NULL);
+      gstack_t **hits = new_tower(tau+1);
+      test_assert_critical(hits != NULL);
+      for (int i = 0 ; i < 300 ; i++) {
+         void **data = insert_string(trie, seqs[i]);
+         test_assert_critical(data != NULL);
+         *data = (void *) (uintptr_t) (i+1);
+      }
+
+      char prev[13] = {0};
+      int seed = 0;
+      for (int q = 0 ; q < 300 ; q++) {
+         char query[13];
+         strcpy(query, seqs[(int)(300 * drand48())]);
+         for (int j = 0 ; j < tau ; j++) {
+            int pos = (int)(12 * drand48());
+            if (query[pos] != ' ') query[pos] = alphabet[(int)(13*drand48())];
+         }
+         int start = 0;
+         while (start < seed && query[start] == prev[start]) start++;
+         seed = (int)(12 * drand48());
+         strcpy(prev, query);
+
+         reset_gstack(hits);
+         int err = search_hamming(trie, query, tau, hits, start, seed);
+         test_assert(err == 0);
+
+         int found[300] = {0};
+         for (int d = 0 ; d <= tau ; d++) {
+            for (size_t j = 0 ; j < hits[d]->nitems ; j++) {
+               int i = (uintptr_t) hits[d]->items[j] - 1;
+               test_assert(found[i] == 0);
+               found[i] = d+1;
+            }
+         }
+
+         for (int i = 0 ; i < 300 ; i++) {
+            int dist = 0;
+            for (int j = 0 ; j < 12 ; j++) {
+               if ((query[j] == ' ') != (seqs[i][j] == ' ')) {
+                  dist = tau+1;
+                  break;
+               }
+               dist += query[j] != seqs[i][j] || query[j] == 'N';
+            }
+            test_assert(found[i] == (dist <= tau ? dist+1 : 0));
+         }
+      }
+
+      destroy_trie(trie, NULL);
+      destroy_tower(hits);
+   }
+
+}
+
+
+void
+test_verify
+(void)
+{
+
+   // The hits of 'search()' and 'search_hamming()' must be the
+   // sequences within the distance of 'band_distance()' and
+   // 'hamming_distance()', at the same distance and in the order
+   // of 'trie_order()'.
+
+   srand48(321);
+   const char *alphabet = "AAACCCGGGTTTN";
+   char seqs[300][13];
+
+   for (int i = 0 ; i < 300 ; i++) {
+      int len = 9 + (int)(4 * drand48());
+      memset(seqs[i], ' ', 12);
+      for (int j = 12-len ; j < 12 ; j++) {
+         seqs[i][j] = alphabet[(int)(12 * drand48())];
+      }
+      seqs[i][12] = '\0';
+      // No duplicates.
+      for (int k = 0 ; k < i ; k++) {
+         if (strcmp(seqs[i], seqs[k]) == 0) i--;
+      }
+   }
+
+   for (int hamming = 0 ; hamming < 2 ; hamming++)
+   for (int tau = 0 ; tau <= 4 ; tau++) {
+      trie_t *trie = new_trie(12);
+      test_assert_critical(trie != NULL);
+      gstack_t **hits = new_tower(tau+1);
+      test_assert_critical(hits != NULL);
+      for (int i = 0 ; i < 300 ; i++) {
+         void **data = insert_string(trie, seqs[i]);
+         test_assert_critical(data != NULL);
+         *data = (void *) (uintptr_t) (i+1);
+      }
+
+      char prev[13] = {0};
+      int seed = 0;
+      for (int q = 0 ; q < 300 ; q++) {
+         char query[13];
+         strcpy(query, seqs[(int)(300 * drand48())]);
+         for (int j = 0 ; j < tau ; j++) {
+            int pos = (int)(12 * drand48());
+            if (query[pos] != ' ') query[pos] = alphabet[(int)(13*drand48())];
+         }
+         int start = 0;
+         while (start < seed && query[start] == prev[start]) start++;
+         seed = (int)(12 * drand48());
+         strcpy(prev, query);
+
+         reset_gstack(hits);
+         int err = hamming ?
+            search_hamming(trie, query, tau, hits, start, seed) :
+            search(trie, query, tau, hits, start, seed, BYTEWISE_KERNEL);
+         test_assert(err == 0);
+
+         int found[300] = {0};
+         for (int d = 0 ; d <= tau ; d++) {
+            for (size_t j = 0 ; j < hits[d]->nitems ; j++) {
+               int i = (uintptr_t) hits[d]->items[j] - 1;
+               test_assert(found[i] == 0);
+               found[i] = d+1;
+               if (j == 0) continue;
+               int k = (uintptr_t) hits[d]->items[j-1] - 1;
+               test_assert(trie_order(seqs[k], seqs[i]) < 0);
+            }
+         }
+
+         for (int i = 0 ; i < 300 ; i++) {
+            int dist = hamming ?
+               hamming_distance(query, seqs[i], tau) :
+               band_distance(query, seqs[i], tau);
+            test_assert(found[i] == (dist <= tau ? dist+1 : 0));
+         }
+      }
+
+      destroy_trie(trie, NULL);
+      destroy_tower(hits);
+   }
+
+}
+
+void
+test_image
+(void)
+{
+
+   // A trie mapped from its image must give the same hits as
+   // the original, and expand its tails in the spare nodes.
+
+   srand48(123);
+   const char *alphabet = "ACGT";
+   char seqs[500][21];
+
+   trie_t *trie = new_trie(20);
+   test_assert_critical(trie != NULL);
+   for (int i = 0 ; i < 500 ; i++) {
+      for (int j = 0 ; j < 20 ; j++) {
+         seqs[i][j] = alphabet[(int)(4 * drand48())];
+      }
+      seqs[i][20] = '\0';
+      void **data = insert_string(trie, seqs[i]);
+      test_assert_critical(data != NULL);
+      *data = (void *) (uintptr_t) (i+1);
+   }
+
+   FILE *f = tmpfile();
+   test_assert_critical(f != NULL);
+   // Images must start at an aligned offset.
+   test_assert(fputc('x', f) != EOF);
+   redirect_stderr();
+   test_assert(write_trie(trie, f) == 1);
+   unredirect_stderr();
+   test_assert(check_trie_error_and_reset() > 0);
+   test_assert_stderr("error: trie image must start at an aligned offset\n");
+   rewind(f);
+   test_assert(write_trie(trie, f) == 0);
+   long size = ftell(f);
+   test_assert(size % 64 == 0);
+
+   void *image = NULL;
+   test_assert_critical(posix_memalign(&image, 64, size) == 0);
+   rewind(f);
+   test_assert_critical(fread(image, 1, size, f) == (size_t) size);
+   fclose(f);
+
+   // Truncated images are rejected.
+   redirect_stderr();
+   test_assert(map_trie(image, size-64) == NULL);
+   unredirect_stderr();
+   test_assert(check_trie_error_and_reset() > 0);
+   test_assert_stderr("error: invalid trie image\n");
+
+   trie_t *mapped = map_trie(image, size);
+   test_assert_critical(mapped != NULL);
+   test_assert(mapped->image == image);
+   test_assert(mapped->nnodes == trie->nnodes);
+   test_assert(mapped->ndata == trie->ndata);
+   // Mapped tries cannot grow.
+   redirect_stderr();
+   test_assert(insert_string(mapped, "AAAAAAAAAAAAAAAAAAAA") == NULL);
+   unredirect_stderr();
+   test_assert(check_trie_error_and_reset() > 0);
+   test_assert_stderr("error: cannot resize a mapped trie\n"
+         "error: could not insert string\n");
+
+   gstack_t **hits1 = new_tower(4);
+   gstack_t **hits2 = new_tower(4);
+   test_assert_critical(hits1 != NULL && hits2 != NULL);
+   for (int q = 0 ; q < 200 ; q++) {
+      char query[21];
+      strcpy(query, seqs[(int)(500 * drand48())]);
+      for (int j = 0 ; j < 3 ; j++) {
+         query[(int)(20 * drand48())] = alphabet[(int)(4 * drand48())];
+      }
+      reset_gstack(hits1);
+      reset_gstack(hits2);
+      test_assert(search(trie, query, 3, hits1, 0, 0, BYTEWISE_KERNEL) == 0);
+      test_assert(search(mapped, query, 3, hits2, 0, 0, BYTEWISE_KERNEL) == 0);
+      for (int d = 0 ; d < 4 ; d++) {
+         test_assert_critical(hits1[d]->nitems == hits2[d]->nitems);
+         for (size_t j = 0 ; j < hits1[d]->nitems ; j++) {
+            test_assert(hits1[d]->items[j] == hits2[d]->items[j]);
+         }
+      }
+   }
+
+   destroy_trie(mapped, NULL);
+   destroy_trie(trie, NULL);
+   destroy_tower(hits1);
+   destroy_tower(hits2);
+   free(image);
+
+}
+
+
+void
+test_share
+(void)
+{
+
+   // A view must give the same hits in the same order as the trie
+   // it shares, for the same restarts from the pebbles, and must
+   // never write in the trie. Two tries are built from the same
+   // sequences, one is searched directly, the other through views.
+
+   srand48(123);
+   const char *alphabet = "ACGT";
+   char seqs[300][21];
+
+   trie_t *trie[2];
+   for (int k = 0 ; k < 2 ; k++) {
+      trie[k] = new_trie(20);
+      test_assert_critical(trie[k] != NULL);
+   }
+   for (int i = 0 ; i < 300 ; i++) {
+      int len = 12 + (int)(9 * drand48());
+      memset(seqs[i], ' ', 20);
+      for (int j = 20-len ; j < 20 ; j++) {
+         seqs[i][j] = alphabet[(int)(4 * drand48())];
+      }
+      seqs[i][20] = '\0';
+      for (int k = 0 ; k < 2 ; k++) {
+         void **data = insert_string(trie[k], seqs[i]);
+         test_assert_critical(data != NULL);
+         *data = (void *) (uintptr_t) (i+1);
+      }
+   }
+
+   // Copy of the node arena of the shared trie.
+   const uint32_t nnodes = trie[1]->nnodes;
+   const uint32_t nlazy = trie[1]->nlazy;
+   node_t *nodes = malloc(nnodes * sizeof(node_t));
+   test_assert_critical(nodes != NULL);
+   memcpy(nodes, trie[1]->nodes, nnodes * sizeof(node_t));
+
+   trie_t *view[2] = {share_trie(trie[1]), share_trie(trie[1])};
+   test_assert_critical(view[0] != NULL && view[1] != NULL);
+   test_assert(view[0]->caches != NULL);
+   test_assert(view[0]->nodes == trie[1]->nodes);
+
+   // Views cannot grow.
+   redirect_stderr();
+   test_assert(insert_string(view[0], "AAAAAAAAAAAAAAAAAAAA") == NULL);
+   unredirect_stderr();
+   test_assert(check_trie_error_and_reset() > 0);
+   test_assert_stderr("error: cannot insert in a view of a trie\n");
+
+   gstack_t **hits[3] = {new_tower(4), new_tower(4), new_tower(4)};
+   test_assert_critical(hits[0] != NULL && hits[1] != NULL &&
+         hits[2] != NULL);
+
+   for (int h = 0 ; h < 2 ; h++) {
+      // Queries are mutated sequences of the trie, searched from
+      // the prefix shared with the previous query, in Levenshtein
+      // and then in Hamming distance. The second view is searched
+      // from the root.
+      char prev[21] = {0};
+      int seed = 0;
+      for (int q = 0 ; q < 300 ; q++) {
+         char query[21];
+         strcpy(query, seqs[(int)(300 * drand48())]);
+         for (int j = 0 ; j < 2 ; j++) {
+            int pos = (int)(20 * drand48());
+            if (query[pos] != ' ') query[pos] = alphabet[(int)(4*drand48())];
+         }
+         int start = 0;
+         while (start < seed && query[start] == prev[start]) start++;
+         seed = (int)(21 * drand48());
+         strcpy(prev, query);
+
+         trie_t *t[3] = {trie[0], view[0], view[1]};
+         for (int k = 0 ; k < 3 ; k++) {
+            int s = k < 2 ? start : 0;
+            reset_gstack(hits[k]);
+            int err = h ?
+               search_hamming(t[k], query, 3, hits[k], s, seed) :
+               search(t[k], query, 3, hits[k], s, seed, BYTEWISE_KERNEL);
+            test_assert(err == 0);
+         }
+         for (int k = 1 ; k < 3 ; k++) {
+            for (int d = 0 ; d < 4 ; d++) {
+               test_assert_critical(hits[0][d]->nitems ==
+                     hits[k][d]->nitems);
+               test_assert(memcmp(hits[0][d]->items, hits[k][d]->items,
+                        hits[0][d]->nitems * sizeof(void *)) == 0);
+            }
+         }
+      }
+   }
+
+   // Some pebbles were marks in the tails.
+   uint32_t nslots = 0;
+   for (int i = 0 ; i <= 20 ; i++) nslots += view[0]->info->markslots[i];
+   test_assert(nslots > 0);
+
+   // The shared trie is untouched.
+   test_assert(trie[1]->nnodes == nnodes);
+   test_assert(trie[1]->nlazy == nlazy);
+   test_assert(memcmp(nodes, trie[1]->nodes, nnodes * sizeof(node_t)) == 0);
+   // The trie searched directly has expanded tails.
+   test_assert(trie[0]->nnodes > nnodes);
+
+   destroy_trie(view[0], NULL);
+   destroy_trie(view[1], NULL);
+   destroy_trie(trie[0], NULL);
+   destroy_trie(trie[1], NULL);
+   for (int k = 0 ; k < 3 ; k++) destroy_tower(hits[k]);
+   free(nodes);
+
+}
+
+
 void
 test_mem_1
 (void)
@@ -1397,7 +1994,7 @@ test_mem_1
    // Search with failure in 'malloc()'.
    set_alloc_failure_rate_to(1);
    redirect_stderr();
-   err = search(trie, "NNNNNNNN", 8, hits, 0, 8);
+   err = search(trie, "NNNNNNNN", 8, hits, 0, 8, BYTEWISE_KERNEL);
    unredirect_stderr();
    reset_alloc();
 
@@ -1407,10 +2004,10 @@ test_mem_1
    reset_gstack(hits);
 
    // Do it again without failure.
-   err = search(trie, "NNNNNNNN", 8, hits, 0, 8);
+   err = search(trie, "NNNNNNNN", 8, hits, 0, 8, BYTEWISE_KERNEL);
    test_assert(err == 0);
 
-   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   destroy_trie(trie, NULL);
    destroy_tower(hits);
    
 }
@@ -1451,7 +2048,7 @@ test_mem_2
             *data = data;
          }
       }
-      destroy_trie(trie, DESTROY_NODES_YES, NULL);
+      destroy_trie(trie, NULL);
    }
 
    unredirect_stderr();
@@ -1467,12 +2064,6 @@ test_mem_3
 
    srand48(123);
 
-   node_t *nodes = malloc(2000 * sizeof(node_t));
-   if (nodes == NULL) {
-      fprintf(stderr, "unittest error: %s:%d\n", __FILE__, __LINE__);
-      exit(EXIT_FAILURE);
-   }
-
    char seq[21];
    seq[20] = '\0';
 
@@ -1488,21 +2079,25 @@ test_mem_3
          test_assert(check_trie_error_and_reset() > 0);
          continue;
       }
-      node_t *pos = nodes;
+      if (reserve_trie(trie, 2000, 100)) {
+         // Make sure errors are reported.
+         test_assert(check_trie_error_and_reset() > 0);
+         destroy_trie(trie, NULL);
+         continue;
+      }
       for (int j = 0 ; j < 100 ; j++) {
          for (int k = 0 ; k < 20 ; k++) {
             seq[k] = untranslate[(int)(5 * drand48())];
          }
-         void **data = insert_string_wo_malloc(trie, seq, &pos);
+         void **data = insert_string_wo_malloc(trie, seq);
          test_assert(*data == NULL);
          *data = data;
       }
-      destroy_trie(trie, DESTROY_NODES_NO, NULL);
+      destroy_trie(trie, NULL);
    }
 
    unredirect_stderr();
    reset_alloc();
-   free(nodes);
    
 }
 
@@ -1528,7 +2123,8 @@ test_mem_4
       // 'malloc()' and so should have an error code of 0
       // on every call.
       reset_gstack(hits);
-      err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 20);
+      err = search(trie, "AAAAAAAAAAAAAAAAAAAA", 3, hits, 0, 20,
+            BYTEWISE_KERNEL);
       test_assert(err ==  0);
       test_assert(check_trie_error_and_reset() == 0);
       test_assert(hits[0]->nitems == 1);
@@ -1583,13 +2179,13 @@ test_mem_5
          seq[j] = untranslate[(int)(5 * drand48())];
       }
       reset_gstack(hits);
-      search(trie, seq, 3, hits, 0, 20);
+      search(trie, seq, 3, hits, 0, 20, BYTEWISE_KERNEL);
    }
 
    unredirect_stderr();
    reset_alloc();
    destroy_tower(hits);
-   destroy_trie(trie, DESTROY_NODES_YES, NULL);
+   destroy_trie(trie, NULL);
    
 }
 
@@ -1600,7 +2196,6 @@ test_mem_6
 {
 
    trie_t *trie;
-   node_t *trienode;
    gstack_t *gstack;
    gstack_t **tower;
 
@@ -1615,21 +2210,23 @@ test_mem_6
          test_assert(check_trie_error_and_reset() >  0);
       }
       else {
-         destroy_trie(trie, DESTROY_NODES_YES, NULL);
+         destroy_trie(trie, NULL);
          trie = NULL;
       }
    }
 
-   // Test 'new_trienode()'.
+   // Test 'reserve_trie()'.
    for (int i = 0 ; i < 1000 ; i++) {
-      trienode = new_trienode();
-      if (trienode == NULL) {
+      trie = new_trie(20);
+      if (trie == NULL) {
          test_assert(check_trie_error_and_reset() >  0);
+         continue;
       }
-      else {
-         free(trienode);
-         trienode = NULL;
+      if (reserve_trie(trie, 1000, 1000)) {
+         test_assert(check_trie_error_and_reset() >  0);
       }
+      destroy_trie(trie, NULL);
+      trie = NULL;
    }
 
    // Test 'new_gstack()'.
@@ -1673,6 +2270,12 @@ const test_case_t test_cases_trie[] = {
       {"trie/base/8", test_base_8},
       {"errmsg",      test_errmsg},
       {"search",      test_search},
+      {"kernel",      test_kernel},
+      {"simd",        test_simd},
+      {"hamming",     test_hamming},
+      {"verify",      test_verify},
+      {"image",       test_image},
+      {"share",       test_share},
       {"mem/1",       test_mem_1},
       {"mem/2",       test_mem_2},
       {"mem/3",       test_mem_3},